@@ -0,0 +1,200 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// benchmarks of the table parsing and the luks token lookups that the daemon
+// does for every encryption job and status query. the luks header is formatted
+// into a plain file, so no root privilege or block device is required.
+
+#include "encrypt/tabfile.h"
+#include "encrypt/tokenindex.h"
+#include "encrypt/cryptdevicecache.h"
+
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+
+#include <libcryptsetup.h>
+
+#include <cstring>
+
+using namespace daemonplugin_file_encrypt;
+
+static constexpr int kTabEntries { 200 };
+static constexpr quint64 kHeaderSize { 16 * 1024 * 1024 };
+static constexpr char kPassphrase[] { "benchmark" };
+static constexpr char kTPMToken[] {
+    R"({"type":"usec-tpm2","keyslots":["0"],"pin":"1","kek-priv":"","kek-pub":"","iv":"","enc":""})"
+};
+static constexpr char kRecoveryToken[] { R"({"type":"usec-recoverykey","keyslots":["0"]})" };
+
+class DaemonBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void tabFileLoad();
+    void tabFileScan();
+    void tabFileRewrite();
+
+    void tokenIndexCached();
+    void tokenIndexCold();
+    void tokenKeyTypeOf();
+
+private:
+    bool writeTabFile();
+    bool formatHeader();
+
+    QTemporaryDir dir;
+    QString tabPath;
+    QString headerPath;
+    bool headerReady { false };
+};
+
+bool DaemonBenchmark::writeTabFile()
+{
+    tabPath = dir.filePath("fstab");
+    QFile file(tabPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    file.write("# /etc/fstab: static file system information.\n#\n");
+    for (int i = 0; i < kTabEntries; ++i) {
+        if (i % 10 == 0)
+            file.write(QString("\n# /dev/sdb%1\n").arg(i).toLatin1());
+        file.write(QString("UUID=%1-0000-4000-8000-000000000000\t/media/disk%2\text4\t"
+                           "rw,relatime,nofail\t0\t2\n")
+                           .arg(i, 8, 16, QChar('0'))
+                           .arg(i)
+                           .toLatin1());
+    }
+    return true;
+}
+
+bool DaemonBenchmark::formatHeader()
+{
+    headerPath = dir.filePath("header.bin");
+    QFile file(headerPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || !file.resize(kHeaderSize))
+        return false;
+    file.close();
+
+    struct crypt_device *cdev { nullptr };
+    if (crypt_init(&cdev, headerPath.toStdString().c_str()) < 0)
+        return false;
+
+    // the minimum cost, the benchmark measures lookups instead of kdf.
+    struct crypt_pbkdf_type pbkdf = {};
+    pbkdf.type = CRYPT_KDF_PBKDF2;
+    pbkdf.hash = "sha256";
+    pbkdf.iterations = 1000;
+    pbkdf.flags = CRYPT_PBKDF_NO_BENCHMARK;
+    struct crypt_params_luks2 params = {};
+    params.pbkdf = &pbkdf;
+    params.sector_size = 512;
+
+    bool ok = crypt_format(cdev, CRYPT_LUKS2, "aes", "xts-plain64", nullptr, nullptr, 64, &params) == 0
+            && crypt_keyslot_add_by_volume_key(cdev, 0, nullptr, 64, kPassphrase, strlen(kPassphrase)) == 0
+            && crypt_token_json_set(cdev, CRYPT_ANY_TOKEN, kTPMToken) >= 0
+            && crypt_token_json_set(cdev, CRYPT_ANY_TOKEN, kRecoveryToken) >= 0;
+    crypt_free(cdev);
+    return ok;
+}
+
+void DaemonBenchmark::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    QVERIFY(writeTabFile());
+
+    headerReady = formatHeader();
+    if (!headerReady)
+        qWarning() << "cannot format luks header in" << headerPath;
+}
+
+void DaemonBenchmark::tabFileLoad()
+{
+    TabFile tab(tabPath);
+    QBENCHMARK {
+        QVERIFY(tab.load());
+    }
+    QVERIFY(tab.lineCount() > kTabEntries);
+}
+
+void DaemonBenchmark::tabFileScan()
+{
+    TabFile tab(tabPath);
+    QVERIFY(tab.load());
+
+    // what fstab and crypttab updates do: find the entry of a device.
+    const QByteArray &target = QString("/media/disk%1").arg(kTabEntries - 1).toLatin1();
+    int found = -1;
+    QBENCHMARK {
+        found = -1;
+        for (int i = 0; i < tab.lineCount(); ++i) {
+            if (tab.isEntry(i) && tab.field(i, 1) == target) {
+                found = i;
+                break;
+            }
+        }
+    }
+    QVERIFY(found >= 0);
+}
+
+void DaemonBenchmark::tabFileRewrite()
+{
+    TabFile tab(tabPath);
+    QVERIFY(tab.load());
+
+    QByteArray contents;
+    QBENCHMARK {
+        for (int i = 0; i < tab.lineCount(); ++i) {
+            if (tab.isEntry(i))
+                tab.setField(i, 3, "rw,relatime,nofail,x-gvfs-show");
+        }
+        contents = tab.contents();
+    }
+    QVERIFY(contents.contains("x-gvfs-show"));
+}
+
+void DaemonBenchmark::tokenIndexCached()
+{
+    if (!headerReady)
+        QSKIP("luks header is not available");
+
+    QString tokenJson;
+    QCOMPARE(TokenIndex::instance()->tpmToken(headerPath, &tokenJson), 0);
+    QBENCHMARK {
+        TokenIndex::instance()->tpmToken(headerPath, &tokenJson);
+    }
+    QVERIFY(tokenJson.contains("usec-tpm2"));
+}
+
+void DaemonBenchmark::tokenIndexCold()
+{
+    if (!headerReady)
+        QSKIP("luks header is not available");
+
+    DeviceTokens tokens;
+    QBENCHMARK {
+        // drops both the crypt handle and tokens, as a device change does.
+        CryptDeviceCache::instance()->invalidate(headerPath);
+        QCOMPARE(TokenIndex::instance()->tokens(headerPath, &tokens), 0);
+    }
+    QVERIFY(tokens.tpmToken >= 0);
+}
+
+void DaemonBenchmark::tokenKeyTypeOf()
+{
+    const QJsonObject &token = QJsonDocument::fromJson(kTPMToken).object();
+    disk_encrypt::SecKeyType type { disk_encrypt::kPasswordOnly };
+    QBENCHMARK {
+        type = TokenIndex::keyTypeOf(token);
+    }
+    QCOMPARE(type, disk_encrypt::kTPMAndPIN);
+}
+
+QTEST_GUILESS_MAIN(DaemonBenchmark)
+
+#include "daemonbenchmark.moc"
@@ -0,0 +1,167 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// benchmarks of the lookups that file manager plugins do on every menu and
+// settings access. run with -iterations or -median to get stable numbers.
+
+#include "configs/settings/settings.h"
+#include "utils/devicestatecache.h"
+#include "utils/encryptutils.h"
+
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+using namespace dfmplugin_diskenc;
+
+static constexpr int kGroups { 16 };
+static constexpr int kKeysPerGroup { 64 };
+static constexpr int kDevices { 64 };
+
+class FileManagerBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void settingsValue();
+    void settingsSetValue();
+    void settingsSync();
+
+    void deviceStateLookup();
+    void deviceStateUpdate();
+
+    void formatRecoveryKey();
+
+private:
+    QString writeDefaultSettings();
+
+    QTemporaryDir dir;
+    Settings *settings { nullptr };
+};
+
+QString FileManagerBenchmark::writeDefaultSettings()
+{
+    QJsonObject root;
+    for (int g = 0; g < kGroups; ++g) {
+        QJsonObject group;
+        for (int k = 0; k < kKeysPerGroup; ++k)
+            group.insert(QString("key-%1").arg(k), QString("value-%1-%2").arg(g).arg(k));
+        root.insert(QString("group-%1").arg(g), group);
+    }
+
+    const QString &path = dir.filePath("default.json");
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return {};
+    file.write(QJsonDocument(root).toJson());
+    return path;
+}
+
+void FileManagerBenchmark::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    const QString &defaultFile = writeDefaultSettings();
+    QVERIFY(!defaultFile.isEmpty());
+
+    settings = new Settings(defaultFile, dir.filePath("fallback.json"), dir.filePath("setting.json"), this);
+    QCOMPARE(settings->value("group-0", "key-0").toString(), QString("value-0-0"));
+
+    auto cache = DeviceStateCache::instance();
+    for (int i = 0; i < kDevices; ++i) {
+        const QString &dev = QString("/dev/sdb%1").arg(i);
+        cache->setKeyType(dev, i % 3);
+        cache->setFresh(dev);
+    }
+}
+
+void FileManagerBenchmark::cleanupTestCase()
+{
+    delete settings;
+    settings = nullptr;
+}
+
+void FileManagerBenchmark::settingsValue()
+{
+    int hits = 0;
+    QBENCHMARK {
+        hits = 0;
+        for (int g = 0; g < kGroups; ++g) {
+            const QString &group = QString("group-%1").arg(g);
+            for (int k = 0; k < kKeysPerGroup; ++k)
+                hits += settings->value(group, QString("key-%1").arg(k)).isValid();
+        }
+    }
+    QCOMPARE(hits, kGroups * kKeysPerGroup);
+}
+
+void FileManagerBenchmark::settingsSetValue()
+{
+    int round = 0;
+    QBENCHMARK {
+        ++round;
+        for (int k = 0; k < kKeysPerGroup; ++k)
+            settings->setValue("group-0", QString("key-%1").arg(k), round);
+    }
+    QCOMPARE(settings->value("group-0", "key-0").toInt(), round);
+}
+
+void FileManagerBenchmark::settingsSync()
+{
+    QSignalSpy spy(settings, &Settings::syncFinished);
+    int round = 0;
+    QBENCHMARK {
+        settings->setValue("group-1", "key-0", ++round);
+        settings->sync();
+        QVERIFY(spy.wait(5000));
+    }
+    QVERIFY(QFile::exists(dir.filePath("setting.json")));
+}
+
+void FileManagerBenchmark::deviceStateLookup()
+{
+    auto cache = DeviceStateCache::instance();
+    QStringList devs;
+    for (int i = 0; i < kDevices; ++i)
+        devs << QString("/dev/sdb%1").arg(i);
+
+    int fresh = 0;
+    QBENCHMARK {
+        fresh = 0;
+        for (const auto &dev : qAsConst(devs)) {
+            fresh += cache->isFresh(dev);
+            cache->keyType(dev);
+        }
+    }
+    QCOMPARE(fresh, kDevices);
+}
+
+void FileManagerBenchmark::deviceStateUpdate()
+{
+    auto cache = DeviceStateCache::instance();
+    int round = 0;
+    QBENCHMARK {
+        ++round;
+        // alternate the type so keyTypeChanged is emitted every time.
+        for (int i = 0; i < kDevices; ++i)
+            cache->setKeyType(QString("/dev/sdb%1").arg(i), (i + round) % 3);
+    }
+}
+
+void FileManagerBenchmark::formatRecoveryKey()
+{
+    const QString raw("123456789012345678901234");
+    QString formatted;
+    QBENCHMARK {
+        formatted = recovery_key_utils::formatRecoveryKey(raw);
+    }
+    QVERIFY(!formatted.isEmpty());
+}
+
+QTEST_GUILESS_MAIN(FileManagerBenchmark)
+
+#include "filemanagerbenchmark.moc"
@@ -0,0 +1,233 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// runs the real encryption pipeline of the daemon on sparse loop devices:
+//     bcDoSetupHeader -> bcInitHeaderDevice -> bcResumeReencrypt
+// and prints one json object per case and phase, so results of different
+// builds can be compared. must be run as root.
+//
+// usage: daemonplugin-file-encrypt-benchmark --cipher sm4,aes --sector-size 512,4096
+//            --hotzone 64,256 --size 512,2048 --dir /var/tmp
+
+#include "encrypt/diskencrypt.h"
+#include "encrypt/encrypttuning.h"
+#include "encrypt/jobcontext.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QProcess>
+#include <QFile>
+#include <QDir>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <cstdio>
+
+using namespace daemonplugin_file_encrypt;
+
+static constexpr quint64 kMiB { 1024 * 1024 };
+static constexpr char kPassphrase[] { "benchmark" };
+
+struct BenchCase
+{
+    QString cipher;
+    int sectorSize { 0 };
+    quint64 hotzoneMiB { 0 };
+    quint64 sizeMiB { 0 };
+};
+
+struct Usage
+{
+    qint64 wallMs { 0 };
+    double cpuSecs { 0 };
+    qint64 maxRssKiB { 0 };
+};
+
+static double cpuSeconds()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+            + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static qint64 maxRss()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+template<typename Fn>
+static int measure(Usage *usage, Fn fn)
+{
+    QElapsedTimer timer;
+    timer.start();
+    double cpu = cpuSeconds();
+    int ret = fn();
+    usage->wallMs = timer.elapsed();
+    usage->cpuSecs = cpuSeconds() - cpu;
+    // ru_maxrss is the peak of process so far, not of the phase.
+    usage->maxRssKiB = maxRss();
+    return ret;
+}
+
+static bool run(const QString &program, const QStringList &args, QString *output = nullptr)
+{
+    QProcess proc;
+    proc.start(program, args);
+    if (!proc.waitForFinished(-1) || proc.exitCode() != 0) {
+        qWarning() << program << args << "failed:" << proc.readAllStandardError();
+        return false;
+    }
+    if (output)
+        *output = QString(proc.readAllStandardOutput()).trimmed();
+    return true;
+}
+
+static QString setupLoopDevice(const QString &imgPath, quint64 sizeMiB)
+{
+    QFile img(imgPath);
+    if (!img.open(QIODevice::WriteOnly | QIODevice::Truncate) || !img.resize(qint64(sizeMiB * kMiB))) {
+        qWarning() << "cannot create image" << imgPath;
+        return "";
+    }
+    img.close();
+
+    QString loopDev;
+    if (!run("losetup", { "--find", "--show", imgPath }, &loopDev))
+        return "";
+    if (!run("mkfs.ext4", { "-q", "-F", loopDev })) {
+        run("losetup", { "-d", loopDev });
+        return "";
+    }
+    return loopDev;
+}
+
+static void printResult(const BenchCase &bc, const QString &phase, const Usage &usage, int ret,
+                        const QJsonArray &stages = {})
+{
+    const double secs = usage.wallMs / 1000.0;
+    QJsonObject obj {
+        { "cipher", bc.cipher },
+        { "sector-size", bc.sectorSize },
+        { "hotzone-mib", qint64(bc.hotzoneMiB) },
+        { "size-mib", qint64(bc.sizeMiB) },
+        { "phase", phase },
+        { "result", ret },
+        { "wall-ms", usage.wallMs },
+        { "cpu-secs", usage.cpuSecs },
+        { "max-rss-kib", usage.maxRssKiB },
+        { "mib-per-sec", secs > 0 ? bc.sizeMiB / secs : 0 },
+    };
+    if (!stages.isEmpty())
+        obj.insert("stages", stages);
+    fprintf(stdout, "%s\n", QJsonDocument(obj).toJson(QJsonDocument::Compact).constData());
+    fflush(stdout);
+}
+
+static bool runCase(const BenchCase &bc, const QString &workDir)
+{
+    const QString &imgPath = QString("%1/dfm-encrypt-bench-%2.img").arg(workDir).arg(getpid());
+    const QString &device = setupLoopDevice(imgPath, bc.sizeMiB);
+    if (device.isEmpty())
+        return false;
+
+    TuningProfile profile = tuning_utils::bcProbeProfile(device);
+    if (bc.hotzoneMiB > 0)
+        profile.hotzoneSize = bc.hotzoneMiB * kMiB;
+    tuning_utils::bcSetProfile(device, profile);
+
+    JobContext ctx;
+    ctx.jobID = "benchmark";
+    ctx.device = device;
+
+    EncryptParams params;
+    params.device = device;
+    params.passphrase = kPassphrase;
+    params.cipher = bc.cipher;
+    params.sectorSize = bc.sectorSize;
+
+    QString headerPath;
+    int keyslotCipher = -1, keyslotRecKey = -1;
+    Usage usage;
+    int ret = measure(&usage, [&] {
+        return disk_encrypt_funcs::bcDoSetupHeader(params, &headerPath, &keyslotCipher, &keyslotRecKey, &ctx);
+    });
+    printResult(bc, "setup-header", usage, ret);
+
+    if (ret == kSuccess) {
+        ret = measure(&usage, [&] {
+            return disk_encrypt_funcs::bcInitHeaderDevice(device, headerPath);
+        });
+        printResult(bc, "init-header-device", usage, ret);
+    }
+
+    if (ret == kSuccess) {
+        ret = measure(&usage, [&] {
+            return disk_encrypt_funcs::bcResumeReencrypt(device, params.passphrase, "", true, &ctx);
+        });
+        printResult(bc, "reencrypt", usage, ret,
+                    QJsonArray::fromVariantList(ctx.timings.summary()));
+    }
+
+    run("losetup", { "-d", device });
+    QFile::remove(imgPath);
+    return ret == kSuccess;
+}
+
+template<typename T>
+static QList<T> parseList(const QString &value, T (*convert)(const QString &))
+{
+    QList<T> values;
+    for (const auto &item : value.split(',', QString::SkipEmptyParts))
+        values.append(convert(item.trimmed()));
+    return values;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the reencryption pipeline on loop devices.");
+    parser.addHelpOption();
+    parser.addOptions({
+            { "cipher", "Ciphers, comma separated.", "list", "sm4,aes" },
+            { "sector-size", "LUKS2 sector sizes, comma separated.", "list", "512,4096" },
+            { "hotzone", "Hotzone sizes in MiB, comma separated, 0 means default.", "list", "0,64,256" },
+            { "size", "Device sizes in MiB, comma separated.", "list", "512,2048" },
+            { "dir", "Directory of the image files.", "dir", "/var/tmp" },
+    });
+    parser.process(app);
+
+    if (geteuid() != 0) {
+        qCritical() << "must be run as root.";
+        return 1;
+    }
+
+    const auto &ciphers = parser.value("cipher").split(',', QString::SkipEmptyParts);
+    const auto &sectorSizes = parseList<int>(parser.value("sector-size"), [](const QString &v) { return v.toInt(); });
+    const auto &hotzones = parseList<quint64>(parser.value("hotzone"), [](const QString &v) { return v.toULongLong(); });
+    const auto &sizes = parseList<quint64>(parser.value("size"), [](const QString &v) { return v.toULongLong(); });
+    const QString &workDir = QDir(parser.value("dir")).absolutePath();
+
+    int failed = 0;
+    for (const auto &cipher : ciphers) {
+        for (int sectorSize : sectorSizes) {
+            for (quint64 hotzone : hotzones) {
+                for (quint64 size : sizes) {
+                    if (!runCase({ cipher, sectorSize, hotzone, size }, workDir))
+                        failed += 1;
+                }
+            }
+        }
+    }
+    return failed == 0 ? 0 : 2;
+}
@@ -11,6 +11,8 @@
 #include <QString>
 #include <QDebug>
 
+#include <memory>
+
 #if defined(DAEMONPLUGIN_FILE_ENCRYPT_LIBRARY)
 #    define DAEMONPLUGIN_FILE_ENCRYPT_EXPORT Q_DECL_EXPORT
 #else
@@ -24,13 +26,38 @@
 
 FILE_ENCRYPT_BEGIN_NS
 
+// holds key material in memory that is locked against swapping and is
+// wiped once the last copy is released. copies share the same memory, so
+// a job converts the passphrase once and passes it around freely.
+class SecretBuffer
+{
+public:
+    SecretBuffer() = default;
+    // keeps the byte length of passphrase as the keyslots were created.
+    explicit SecretBuffer(const QString &passphrase);
+    SecretBuffer(const char *data, size_t size);
+    static SecretBuffer random(size_t size);
+
+    const char *data() const;
+    size_t size() const;
+    inline bool isEmpty() const { return size() == 0; }
+
+private:
+    struct Data;
+    std::shared_ptr<Data> d;
+};
+
 struct EncryptParams
 {
     QString device;
-    QString passphrase;
+    SecretBuffer passphrase;
     QString cipher;
     QString recoveryPath;
     QString tpmToken;
+    int sectorSize { 0 };   // the luks2 sector size, 0 means decided by device.
+    bool discardData { false };   // the content of device can be dropped.
+    bool hwOpal { false };   // encrypt by the OPAL drive itself if it is able to.
+    bool detachedHeader { false };   // the header is kept in /boot, the device is encrypted in place.
 
     bool isValid() const
     {
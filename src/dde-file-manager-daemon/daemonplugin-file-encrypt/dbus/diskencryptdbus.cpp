@@ -6,16 +6,38 @@
 #include "diskencryptdbus_adaptor.h"
 #include "encrypt/encryptworker.h"
 #include "encrypt/diskencrypt.h"
+#include "encrypt/encrypttuning.h"
+#include "encrypt/pbkdfpolicy.h"
+#include "encrypt/cryptdevicecache.h"
+#include "encrypt/tokenindex.h"
+#include "encrypt/blockdevicestates.h"
+#include "encrypt/tabfile.h"
+#include "encrypt/jobscheduler.h"
+#include "encrypt/iothrottle.h"
+#include "encrypt/encryptbatch.h"
+#include "encrypt/jobjournal.h"
+#include "encrypt/resourcegovernor.h"
 #include "notification/notifications.h"
+#include "notification/progressaggregator.h"
 
 #include <dfm-framework/dpf.h>
 #include <dfm-mount/dmount.h>
+#include <dfm-base/utils/finallyutil.h>
 
 #include <QtConcurrent>
 #include <QDateTime>
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusMessage>
+#include <QDBusReply>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
 
 #include <libcryptsetup.h>
+#include <systemd/sd-login.h>
 
 FILE_ENCRYPT_USE_NS
 using namespace disk_encrypt;
@@ -26,30 +48,67 @@ static constexpr char kActionDecrypt[] { "com.deepin.filemanager.daemon.DiskEncr
 static constexpr char kActionChgPwd[] { "com.deepin.filemanager.daemon.DiskEncrypt.ChangePassphrase" };
 static constexpr char kObjPath[] { "/com/deepin/filemanager/daemon/DiskEncrypt" };
 
+static constexpr char kCrypttabPath[] { "/etc/crypttab" };
+static constexpr int kDeferredCheckDelay { 60 * 1000 };
+static constexpr int kResumeRequestInterval { 5000 };
+static constexpr int kMaxResumeRequestInterval { 60000 };
+
 ReencryptWorkerV2 *gFstabEncWorker { nullptr };
 
 DiskEncryptDBus::DiskEncryptDBus(QObject *parent)
     : QObject(parent),
       QDBusContext()
 {
+    scheduler = new JobScheduler(this);
     QDBusConnection::systemBus().registerObject(kObjPath, this);
     new DiskEncryptDBusAdaptor(this);
 
-    dfmmount::DDeviceManager::instance();
-
     connect(SignalEmitter::instance(), &SignalEmitter::updateEncryptProgress,
-            this, [this](const QString &dev, double progress) {
-                Q_EMIT this->EncryptProgress(dev, deviceName, progress);
-            },
-            Qt::QueuedConnection);
+            this, &DiskEncryptDBus::EncryptProgress, Qt::QueuedConnection);
     connect(SignalEmitter::instance(), &SignalEmitter::updateDecryptProgress,
-            this, [this](const QString &dev, double progress) {
-                Q_EMIT this->DecryptProgress(dev, deviceName, progress);
-            },
-            Qt::QueuedConnection);
+            this, &DiskEncryptDBus::DecryptProgress, Qt::QueuedConnection);
+    connect(SignalEmitter::instance(), &SignalEmitter::updateEncryptProgressInfo,
+            this, &DiskEncryptDBus::EncryptProgressDetail, Qt::QueuedConnection);
+    connect(SignalEmitter::instance(), &SignalEmitter::updateDecryptProgressInfo,
+            this, &DiskEncryptDBus::DecryptProgressDetail, Qt::QueuedConnection);
 
-    QtConcurrent::run([this] { diskCheck(); });
-    triggerReencrypt();
+    // the partitions of a batch report into one combined progress.
+    connect(this, &DiskEncryptDBus::EncryptProgressDetail,
+            this, [this](const QString &dev, const QString &, const QVariantMap &info) {
+                journalPhase(dev, info);
+                auto batch = batchOf(dev);
+                if (!batch)
+                    return;
+                batch->setProgress(dev, info);
+                Q_EMIT EncryptDisksProgress(batch->id(), batch->progress());
+            });
+    connect(this, &DiskEncryptDBus::DecryptProgressDetail,
+            this, [this](const QString &dev, const QString &, const QVariantMap &info) {
+                journalPhase(dev, info);
+            });
+    connect(this, &DiskEncryptDBus::PrepareEncryptDiskResult,
+            this, [this](const QString &dev, const QString &, const QString &, int code) {
+                if (auto batch = batchOf(dev))
+                    batch->setResult(dev, code);
+            });
+    connect(this, &DiskEncryptDBus::EncryptDiskResult,
+            this, [this](const QString &dev, const QString &, int code) {
+                if (auto batch = batchOf(dev))
+                    batch->setResult(dev, code);
+            });
+
+    // most users have no encrypted disks, the device watchers and the
+    // crypttab check are started by the first request which needs them.
+    if (QFile::exists(kEncConfigPath)) {
+        activate();
+        triggerReencrypt();
+    } else if (QFileInfo(kCrypttabPath).size() > 0) {
+        // the stale items are left by decryption at boot, clear them once
+        // the startup is done.
+        QTimer::singleShot(kDeferredCheckDelay, this, &DiskEncryptDBus::activate);
+    }
+
+    recoverJobs();
 }
 
 DiskEncryptDBus::~DiskEncryptDBus()
@@ -58,39 +117,95 @@ DiskEncryptDBus::~DiskEncryptDBus()
 
 QString DiskEncryptDBus::PrepareEncryptDisk(const QVariantMap &params)
 {
-    deviceName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
+    activate();
+    QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+    QString devName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
     if (!checkAuth(kActionEncrypt)) {
-        Q_EMIT PrepareEncryptDiskResult(params.value(encrypt_param_keys::kKeyDevice).toString(),
-                                        deviceName,
+        Q_EMIT PrepareEncryptDiskResult(dev,
+                                        devName,
                                         "",
                                         -kUserCancelled);
         return "";
     }
 
     auto jobID = JOB_ID.arg(QDateTime::currentMSecsSinceEpoch());
+    startPrepareEncrypt(jobID, params);
+    return jobID;
+}
+
+QString DiskEncryptDBus::EncryptDisks(const QVariantList &paramsList)
+{
+    activate();
+    auto batchID = QString("batch_%1").arg(QDateTime::currentMSecsSinceEpoch());
+    auto batch = QSharedPointer<EncryptBatch>::create(batchID, paramsList);
+    if (!checkAuth(kActionEncrypt)) {
+        QVariantMap results = batch->results();
+        results.insert("code", -kUserCancelled);
+        Q_EMIT EncryptDisksResult(batchID, results);
+        return "";
+    }
+
+    for (const auto &other : batches) {
+        for (const auto &p : paramsList) {
+            if (other->contains(p.toMap().value(encrypt_param_keys::kKeyDevice).toString())) {
+                qWarning() << "partitions are in batch" << other->id() << "already";
+                QVariantMap results = batch->results();
+                results.insert("code", -kErrorEncryptBusy);
+                Q_EMIT EncryptDisksResult(batchID, results);
+                return batchID;
+            }
+        }
+    }
+
+    qInfo() << "start encrypting" << paramsList.count() << "partitions in batch" << batchID;
+    batches.insert(batchID, batch);
+    Q_EMIT EncryptDisksProgress(batchID, batch->progress());
+    advanceBatch(batchID);
+    return batchID;
+}
+
+bool DiskEncryptDBus::startPrepareEncrypt(const QString &jobID, const QVariantMap &params)
+{
+    QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+    QString devName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
     PrencryptWorker *worker = new PrencryptWorker(jobID,
                                                   params,
                                                   this);
+    if (!addJob(worker->context())) {
+        delete worker;
+        Q_EMIT PrepareEncryptDiskResult(dev, devName, jobID, -kErrorEncryptBusy);
+        return false;
+    }
+
     connect(worker, &QThread::finished, this, [=] {
         int ret = worker->exitError();
-        QString device = params.value(encrypt_param_keys::kKeyDevice).toString();
 
         qDebug() << "pre encrypt finished"
-                 << device
+                 << dev
                  << ret;
 
         if (params.value(encrypt_param_keys::kKeyInitParamsOnly).toBool()
             || ret != kSuccess) {
-            Q_EMIT this->PrepareEncryptDiskResult(device,
-                                                  deviceName,
+            removeJob(dev);
+            Q_EMIT this->PrepareEncryptDiskResult(dev,
+                                                  devName,
                                                   jobID,
                                                   static_cast<int>(ret));
+        } else if (worker->isFormatted()) {
+            qInfo() << "device is encrypted by formatting" << dev;
+            QStringList tokens { params.value(encrypt_param_keys::kKeyTPMToken).toString() };
+            if (worker->recKeyPos() >= 0)
+                tokens << QString("{ 'type': 'usec-recoverykey', 'keyslots': ['%1'] }").arg(worker->recKeyPos());
+            setTokens(dev, tokens);
+            removeJob(dev);
+            Q_EMIT EncryptDiskResult(dev, devName, kSuccess);
         } else {
-            qInfo() << "start reencrypt device" << device;
+            qInfo() << "start reencrypt device" << dev;
             int ksCipher = worker->cipherPos();
             int ksRec = worker->recKeyPos();
-            startReencrypt(device,
-                           params.value(encrypt_param_keys::kKeyPassphrase).toString(),
+            recordJob(worker->context(), params, ksRec);
+            startReencrypt(worker->context(),
+                           SecretBuffer(params.value(encrypt_param_keys::kKeyPassphrase).toString()),
                            params.value(encrypt_param_keys::kKeyTPMToken).toString(),
                            ksCipher,
                            ksRec);
@@ -99,17 +214,54 @@ QString DiskEncryptDBus::PrepareEncryptDisk(const QVariantMap &params)
         worker->deleteLater();
     });
 
-    worker->start();
+    scheduler->submit(worker, JobScheduler::kPrioritySetup, dev);
+    return true;
+}
+
+EncryptBatch *DiskEncryptDBus::batchOf(const QString &dev)
+{
+    for (const auto &batch : batches) {
+        if (batch->contains(dev))
+            return batch.data();
+    }
+    return nullptr;
+}
 
-    return jobID;
+void DiskEncryptDBus::advanceBatch(const QString &batchID)
+{
+    auto batch = batches.value(batchID);
+    if (!batch)
+        return;
+
+    // the next partition of disk may be refused if the disk is busy with
+    // other jobs, it ends at once as failed and the next one is tried.
+    QList<QVariantMap> startable = batch->takeStartable();
+    while (!startable.isEmpty()) {
+        for (const auto &params : startable) {
+            const QString &dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+            // the ids of one batch are started at the same millisecond.
+            auto jobID = QString("%1_%2").arg(batchID).arg(dev.mid(5));
+            if (!startPrepareEncrypt(jobID, params))
+                batch->setEnded(dev, false);
+        }
+        startable = batch->takeStartable();
+    }
+
+    Q_EMIT EncryptDisksProgress(batchID, batch->progress());
+    if (batch->isFinished()) {
+        qInfo() << "batch" << batchID << "finished";
+        Q_EMIT EncryptDisksResult(batchID, batch->results());
+        batches.remove(batchID);
+    }
 }
 
 QString DiskEncryptDBus::DecryptDisk(const QVariantMap &params)
 {
-    deviceName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
+    activate();
+    QString devName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
     QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
     if (!checkAuth(kActionDecrypt)) {
-        Q_EMIT DecryptDiskResult(dev, deviceName, "", -kUserCancelled);
+        Q_EMIT DecryptDiskResult(dev, devName, "", -kUserCancelled);
         return "";
     }
 
@@ -123,25 +275,28 @@ QString DiskEncryptDBus::DecryptDisk(const QVariantMap &params)
     }
 
     DecryptWorker *worker = new DecryptWorker(jobID, params, this);
-    connect(worker, &QThread::finished, this, [=] {
-        int ret = worker->exitError();
-        qDebug() << "decrypt device finished:"
-                 << dev
-                 << ret;
-        Q_EMIT DecryptDiskResult(dev, deviceName, jobID, ret);
-        worker->deleteLater();
-    });
-    worker->start();
+    if (!addJob(worker->context())) {
+        delete worker;
+        Q_EMIT DecryptDiskResult(dev, devName, jobID, -kErrorEncryptBusy);
+        return jobID;
+    }
+
+    // only the jobs which decrypt now have progress to continue.
+    if (!params.value(encrypt_param_keys::kKeyInitParamsOnly).toBool()
+        || params.value(encrypt_param_keys::kKeyOnlineDecrypt).toBool())
+        recordJob(worker->context(), params, -1);
+    startDecrypt(worker);
     return jobID;
 }
 
 QString DiskEncryptDBus::ChangeEncryptPassphress(const QVariantMap &params)
 {
-    deviceName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
+    activate();
+    QString devName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
     QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
     if (!checkAuth(kActionChgPwd)) {
         Q_EMIT ChangePassphressResult(dev,
-                                      deviceName,
+                                      devName,
                                       "",
                                       -kUserCancelled);
         return "";
@@ -151,26 +306,44 @@ QString DiskEncryptDBus::ChangeEncryptPassphress(const QVariantMap &params)
     ChgPassWorker *worker = new ChgPassWorker(jobID, params, this);
     connect(worker, &QThread::finished, this, [=] {
         int ret = worker->exitError();
-        QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
         qDebug() << "change password finished:"
                  << dev
                  << ret;
-        Q_EMIT ChangePassphressResult(dev, deviceName, jobID, ret);
+        Q_EMIT ChangePassphressResult(dev, devName, jobID, ret);
         worker->deleteLater();
     });
-    worker->start();
+    scheduler->submit(worker, JobScheduler::kPriorityHeader, dev);
     return jobID;
 }
 
 QString DiskEncryptDBus::QueryTPMToken(const QString &device)
 {
+    activate();
     QString token;
     disk_encrypt_funcs::bcGetToken(device, &token);
     return token;
 }
 
+int DiskEncryptDBus::QueryTokenSummary(const QString &device)
+{
+    activate();
+    SecKeyType type { kPasswordOnly };
+    int ret = TokenIndex::instance()->keyType(device, &type);
+    return ret < 0 ? ret : int(type);
+}
+
+QVariantMap DiskEncryptDBus::QueryTokenSummaries(const QStringList &devices)
+{
+    activate();
+    QVariantMap summaries;
+    for (const auto &device : devices)
+        summaries.insert(device, QueryTokenSummary(device));
+    return summaries;
+}
+
 void DiskEncryptDBus::SetEncryptParams(const QVariantMap &params)
 {
+    activate();
     if (!checkAuth(kActionEncrypt)) {
         Q_EMIT PrepareEncryptDiskResult(params.value(encrypt_param_keys::kKeyDevice).toString(),
                                         deviceName,
@@ -179,10 +352,275 @@ void DiskEncryptDBus::SetEncryptParams(const QVariantMap &params)
         return;
     }
 
+    // kept for resuming after the job is paused.
+    fstabEncParams = params;
     if (!gFstabEncWorker)
         return;
 
     gFstabEncWorker->setEncryptParams(params);
+    submitFstabEncWorker();
+}
+
+QVariantMap DiskEncryptDBus::QueryCipherBenchmark()
+{
+    // benchmark takes seconds at first time, reply it in thread to keep the bus responsive.
+    setDelayedReply(true);
+    QDBusMessage msg = message();
+    QtConcurrent::run([msg] {
+        QVariantMap results = disk_encrypt_utils::bcBenchmarkCiphers();
+        QDBusConnection::systemBus().send(msg.createReply(QVariant::fromValue(results)));
+    });
+    return {};
+}
+
+bool DiskEncryptDBus::IsHwOpalSupported(const QString &device)
+{
+    activate();
+    if (!device.startsWith("/dev/"))
+        return false;
+    return block_device_utils::bcIsOpalSupported(device);
+}
+
+void DiskEncryptDBus::SetProgressInterval(int msecs)
+{
+    // shared by all the clients of the jobs.
+    if (!checkAuth(kActionEncrypt))
+        return;
+
+    ProgressAggregator::setInterval(msecs);
+    qInfo() << "progress report interval is set to" << ProgressAggregator::interval() << "ms";
+}
+
+void DiskEncryptDBus::SetBandwidthLimit(int mibPerSec)
+{
+    if (!checkAuth(kActionEncrypt))
+        return;
+
+    // takes effect on running jobs at the next hotzone.
+    IOThrottle::setLimit(quint64(qMax(0, mibPerSec)));
+    qInfo() << "reencryption bandwidth limit is set to" << IOThrottle::limit() << "MiB/s";
+}
+
+int DiskEncryptDBus::BandwidthLimit()
+{
+    return int(IOThrottle::limit());
+}
+
+// the caller runs in the active session of the seat, or it's a user service
+// of the owner of that session.
+static bool isActiveSessionOwner(const QDBusConnection &conn, const QString &service)
+{
+    const QDBusReply<uint> &pid = conn.interface()->servicePid(service);
+    const QDBusReply<uint> &uid = conn.interface()->serviceUid(service);
+    if (!pid.isValid() || !uid.isValid())
+        return false;
+
+    char *session { nullptr };
+    if (sd_pid_get_session(pid_t(pid.value()), &session) < 0
+        && sd_uid_get_display(uid_t(uid.value()), &session) < 0)
+        return false;
+    dfmbase::FinallyUtil release([session] { free(session); });
+
+    uid_t owner { 0 };
+    return sd_session_is_active(session) > 0
+            && sd_session_get_uid(session, &owner) >= 0
+            && owner == uid_t(uid.value());
+}
+
+void DiskEncryptDBus::SetSessionIdle(bool idle)
+{
+    // only the user in front of the seat reports whether it's there.
+    if (!isActiveSessionOwner(connection(), message().service())) {
+        qWarning() << "session idle state is not reported by the active session, ignored" << message().service();
+        return;
+    }
+
+    if (!sessionWatcher) {
+        sessionWatcher = new QDBusServiceWatcher(this);
+        sessionWatcher->setConnection(QDBusConnection::systemBus());
+        sessionWatcher->setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+        connect(sessionWatcher, &QDBusServiceWatcher::serviceUnregistered,
+                this, [this](const QString &service) {
+                    sessionWatcher->removeWatchedService(service);
+                    qInfo() << "session reporter is gone, take session as active" << service;
+                    IOThrottle::setSessionIdle(false);
+                });
+    }
+    sessionWatcher->setWatchedServices({ message().service() });
+
+    if (IOThrottle::isSessionIdle() != idle)
+        qInfo() << "session is" << (idle ? "idle" : "active") << ", reencryption is"
+                << (idle ? "at full speed" : "throttled");
+    IOThrottle::setSessionIdle(idle);
+}
+
+void DiskEncryptDBus::SetPauseWhenActive(bool pause)
+{
+    // holding jobs stalls them for as long as the session is active.
+    if (!checkAuth(kActionEncrypt))
+        return;
+
+    IOThrottle::setPauseWhenActive(pause);
+    qInfo() << "hold reencryption while user is active:" << pause;
+}
+
+void DiskEncryptDBus::SetPbkdfPolicy(int unlockMs, int maxMemoryMiB)
+{
+    if (!checkAuth(kActionEncrypt))
+        return;
+
+    // applies to the keyslots created afterwards, existing ones are kept.
+    pbkdf_utils::bcSetPolicy(quint32(qMax(0, unlockMs)), quint32(qMax(0, maxMemoryMiB)) * 1024);
+    qInfo() << "pbkdf policy is set to" << pbkdf_utils::bcUnlockMs() << "ms,"
+            << pbkdf_utils::bcMaxMemoryKb() << "KiB";
+}
+
+QVariantMap DiskEncryptDBus::QueryPbkdfProfile()
+{
+    // calibrating takes the unlock target time, reply it in thread.
+    setDelayedReply(true);
+    QDBusMessage msg = message();
+    QtConcurrent::run([msg] {
+        QVariantMap profile = pbkdf_utils::bcProfileToJson(pbkdf_utils::bcGetProfile()).toVariantMap();
+        QDBusConnection::systemBus().send(msg.createReply(QVariant::fromValue(profile)));
+    });
+    return {};
+}
+
+int DiskEncryptDBus::PauseJob(const QString &device)
+{
+    auto ctx = runningJobs.value(device);
+    if (!ctx) {
+        qWarning() << "no running job to pause for" << device;
+        return -kErrorParamsInvalid;
+    }
+
+    if (!checkAuth(ctx->type == kJobDecrypt ? kActionDecrypt : kActionEncrypt))
+        return -kUserCancelled;
+
+    // takes effect at the next hotzone boundary.
+    qInfo() << "pause job" << ctx->jobID << "of" << device;
+    ctx->interrupted = true;
+
+    // the fstab job waiting for params ends at once, through the same exit
+    // of worker. it does nothing, so it needs no slot of scheduler.
+    if (gFstabEncWorker && !fstabEncSubmitted && gFstabEncWorker->context() == ctx) {
+        if (paramsRequestTimer)
+            paramsRequestTimer->stop();
+        fstabEncSubmitted = true;
+        gFstabEncWorker->start();
+    }
+    return kSuccess;
+}
+
+int DiskEncryptDBus::ResumeJob(const QString &device)
+{
+    if (!pausedJobs.contains(device)) {
+        qWarning() << "no paused job to resume for" << device;
+        return -kErrorParamsInvalid;
+    }
+
+    const JobType type = pausedJobs.value(device).ctx->type;
+    if (!checkAuth(type == kJobDecrypt ? kActionDecrypt : kActionEncrypt))
+        return -kUserCancelled;
+
+    // the passphrase of an interrupted job is asked from the session first.
+    if (interruptedJobs.contains(device)) {
+        Q_EMIT RequestResumeJob(resumeRequestOf(interruptedJobs.value(device)));
+        return kSuccess;
+    }
+    return resumeJob(device);
+}
+
+int DiskEncryptDBus::ResumeInterruptedJob(const QVariantMap &params)
+{
+    const QString &device = params.value(encrypt_param_keys::kKeyDevice).toString();
+    const QString &passphrase = params.value(encrypt_param_keys::kKeyPassphrase).toString();
+    if (!interruptedJobs.contains(device)) {
+        qWarning() << "no interrupted job to resume for" << device;
+        return -kErrorParamsInvalid;
+    }
+
+    const JobType type = interruptedJobs.value(device).type;
+    if (!checkAuth(type == kJobDecrypt ? kActionDecrypt : kActionEncrypt))
+        return -kUserCancelled;
+
+    int ret = disk_encrypt_funcs::bcCheckPassphrase(device, passphrase);
+    if (ret != kSuccess)
+        return ret;
+
+    interruptedJobs.remove(device);
+    if (interruptedJobs.isEmpty() && resumeRequestTimer)
+        resumeRequestTimer->stop();
+    pausedJobs[device].passphrase = SecretBuffer(passphrase);
+    return resumeJob(device);
+}
+
+int DiskEncryptDBus::resumeJob(const QString &device)
+{
+    PausedJob job = pausedJobs.take(device);
+    if (!addJob(job.ctx)) {
+        pausedJobs.insert(device, job);
+        return -kErrorEncryptBusy;
+    }
+
+    qInfo() << "resume job" << job.ctx->jobID << "of" << device;
+    job.ctx->interrupted = false;
+    switch (job.ctx->type) {
+    case kJobEncrypt:
+        startReencrypt(job.ctx, job.passphrase, job.token, -1, job.recPos);
+        break;
+    case kJobDecrypt:
+        startDecrypt(new DecryptWorker(job.ctx, job.params, job.passphrase, this));
+        break;
+    case kJobFstabEncrypt:
+        // the fstab job reloads its config and is registered again by itself.
+        removeJob(device);
+        triggerReencrypt();
+        break;
+    }
+    return kSuccess;
+}
+
+QVariantList DiskEncryptDBus::ListJobs()
+{
+    QVariantList jobs;
+    for (const auto &ctx : runningJobs)
+        jobs.append(jobInfo(ctx, false));
+    for (const auto &job : pausedJobs)
+        jobs.append(jobInfo(job.ctx, true));
+    return jobs;
+}
+
+QVariantMap DiskEncryptDBus::GetJob(const QString &jobID)
+{
+    for (const auto &ctx : runningJobs) {
+        if (ctx->jobID == jobID || ctx->device == jobID)
+            return jobInfo(ctx, false);
+    }
+    for (const auto &job : pausedJobs) {
+        if (job.ctx->jobID == jobID || job.ctx->device == jobID)
+            return jobInfo(job.ctx, true);
+    }
+    return {};
+}
+
+QVariantList DiskEncryptDBus::JobTimings()
+{
+    QVariantList timings;
+    for (const auto &t : finishedTimings)
+        timings.append(t);
+    for (const auto &ctx : runningJobs)
+        timings.append(jobTimings(ctx));
+    return timings;
+}
+
+QVariantMap DiskEncryptDBus::QueryResourceUsage()
+{
+    QVariantMap usage = ResourceGovernor::instance()->utilization();
+    usage.insert("workersRunning", scheduler->runningCount());
+    usage.insert("workersQueued", scheduler->pendingCount());
+    return usage;
 }
 
 void DiskEncryptDBus::onFstabDiskEncProgressUpdated(const QString &dev, qint64 offset, qint64 total)
@@ -200,6 +638,24 @@ void DiskEncryptDBus::onFstabDiskEncFinished(const QString &dev, int result, con
     }
 }
 
+void DiskEncryptDBus::activate()
+{
+    if (activated)
+        return;
+    activated = true;
+
+    QElapsedTimer timer;
+    timer.start();
+    // start watching device changes in main thread, the workers use them.
+    dfmmount::DDeviceManager::instance();
+    CryptDeviceCache::instance();
+    BlockDeviceStates::instance();
+    qInfo() << "disk encrypt is activated, takes" << timer.elapsed() << "ms";
+
+    if (QFileInfo(kCrypttabPath).size() > 0)
+        QtConcurrent::run([this] { diskCheck(); });
+}
+
 bool DiskEncryptDBus::checkAuth(const QString &actID)
 {
     return dpfSlotChannel->push("daemonplugin_core", "slot_Polkit_CheckAuth",
@@ -207,58 +663,382 @@ bool DiskEncryptDBus::checkAuth(const QString &actID)
             .toBool();
 }
 
-void DiskEncryptDBus::startReencrypt(const QString &dev, const QString &passphrase, const QString &token, int /*cipherPos*/, int recPos)
+void DiskEncryptDBus::startReencrypt(const JobContextPtr &ctx, const SecretBuffer &passphrase, const QString &token, int /*cipherPos*/, int recPos)
 {
-    ReencryptWorker *worker = new ReencryptWorker(dev, passphrase, this);
+    ReencryptWorker *worker = new ReencryptWorker(ctx, passphrase, this);
+    QString devName = ctx->deviceName;
     connect(worker, &ReencryptWorker::deviceReencryptResult,
-            this, [this](const QString &dev, int result) {
-                Q_EMIT this->EncryptDiskResult(dev, deviceName, result);
+            this, [this, devName](const QString &dev, int result) {
+                Q_EMIT this->EncryptDiskResult(dev, devName, result);
             });
     connect(worker, &QThread::finished, this, [=] {
         int ret = worker->exitError();
+        QString dev = ctx->device;
         qDebug() << "reencrypt finished"
+                 << dev
                  << ret;
         worker->deleteLater();
-        setToken(dev, token);
 
-        if (recPos >= 0) {
-            QString tokenJson = QString("{ 'type': 'usec-recoverykey', 'keyslots': ['%1'] }").arg(recPos);
-            setToken(dev, tokenJson);
+        if (ret == -kErrorJobPaused) {
+            pausedJobs.insert(dev, { ctx, {}, passphrase, token, recPos });
+            removeJob(dev);
+            return;
+        }
+
+        // the journal is kept only for an unfinished job.
+        journalPhases.remove(dev);
+        job_journal::bcRemove(dev);
+
+        QStringList tokens { token };
+        if (recPos >= 0)
+            tokens << QString("{ 'type': 'usec-recoverykey', 'keyslots': ['%1'] }").arg(recPos);
+        setTokens(dev, tokens);
+        removeJob(dev);
+    });
+    scheduler->submit(worker, JobScheduler::kPriorityReencrypt, ctx->device);
+}
+
+// journaled only when the phase changes.
+void DiskEncryptDBus::journalPhase(const QString &device, const QVariantMap &info)
+{
+    const QString &phase = info.value("phase").toString();
+    auto iter = journalPhases.find(device);
+    if (iter != journalPhases.end() && !phase.isEmpty() && iter.value() != phase) {
+        iter.value() = phase;
+        job_journal::bcSetPhase(device, phase);
+    }
+}
+
+void DiskEncryptDBus::recordJob(const JobContextPtr &ctx, const QVariantMap &params, int recPos)
+{
+    JournalEntry entry = job_journal::bcEntryOf(*ctx);
+    entry.phase = "setup";
+    entry.encMode = params.value(encrypt_param_keys::kKeyEncMode).toInt();
+    entry.token = params.value(encrypt_param_keys::kKeyTPMToken).toString();
+    entry.recPos = recPos;
+    if (params.value(encrypt_param_keys::kKeyDetachedHeader).toBool())
+        entry.headerPath = disk_encrypt_utils::bcDetachedHeaderPath(ctx->device);
+    if (job_journal::bcRecord(entry))
+        journalPhases.insert(ctx->device, entry.phase);
+}
+
+// the reencryption of a job is interrupted if the daemon crashed or was
+// restarted, its progress is kept in the header, or in the header backup of
+// a decryption. the job is taken as paused and the session is asked for the
+// passphrase to continue it.
+void DiskEncryptDBus::recoverJobs()
+{
+    const QList<JournalEntry> &entries = job_journal::bcLoad();
+    if (entries.isEmpty())
+        return;
+
+    activate();
+    for (auto entry : entries) {
+        // the header is named by the partition uuid, which keeps the device
+        // if the disks are enumerated in another order after a reboot.
+        if (!entry.headerPath.isEmpty()) {
+            const QString &partUUID = QFileInfo(entry.headerPath).completeBaseName();
+            const QString &device = QFileInfo("/dev/disk/by-partuuid/" + partUUID).canonicalFilePath();
+            if (!device.isEmpty() && device != entry.device) {
+                qInfo() << "device of the detached header" << entry.headerPath << "is renamed" << entry.device << "->" << device;
+                job_journal::bcRemove(entry.device);
+                entry.device = device;
+                job_journal::bcRecord(entry);
+            }
+        }
+
+        EncryptStatus status { kStatusUnknown };
+        bool resumable = false;
+        if (entry.type == kJobEncrypt)
+            resumable = block_device_utils::bcDevEncryptStatus(entry.device, &status) == kSuccess
+                    && status == kStatusOnlineUnfinished;
+        else if (entry.type == kJobDecrypt)
+            resumable = QFile::exists(disk_encrypt_utils::bcDecryptHeaderPath(entry.device));
+        if (!resumable) {
+            qInfo() << "drop the journal of" << entry.device << ", no reencryption to resume" << status;
+            job_journal::bcRemove(entry.device);
+            continue;
+        }
+        if (runningJobs.contains(entry.device) || pausedJobs.contains(entry.device))
+            continue;
+
+        auto ctx = JobContextPtr::create();
+        ctx->type = entry.type;
+        ctx->jobID = entry.jobID;
+        ctx->traceID = entry.traceID;
+        ctx->device = entry.device;
+        ctx->deviceName = entry.deviceName;
+        ctx->startTime = entry.startTime;
+        // the cleartext device is gone with a reboot, the job is resumed offline then.
+        if (!entry.activeName.isEmpty() && QFile::exists("/dev/mapper/" + entry.activeName))
+            ctx->activeName = entry.activeName;
+
+        // the cleartext device might be opened again by crypttab at boot, a
+        // decryption is resumed online, which closes it first if so.
+        QVariantMap params;
+        if (entry.type == kJobDecrypt) {
+            ctx->headerPath = disk_encrypt_utils::bcDecryptHeaderPath(entry.device);
+            params.insert(encrypt_param_keys::kKeyDevice, entry.device);
+            params.insert(encrypt_param_keys::kKeyDeviceName, entry.deviceName);
+            params.insert(encrypt_param_keys::kKeyInitParamsOnly, true);
+            params.insert(encrypt_param_keys::kKeyOnlineDecrypt, true);
+        }
+
+        qInfo() << "found interrupted job" << entry.jobID << "of" << entry.device << "at phase" << entry.phase;
+        pausedJobs.insert(entry.device, { ctx, params, {}, entry.token, entry.recPos });
+        interruptedJobs.insert(entry.device, entry);
+        journalPhases.insert(entry.device, entry.phase);
+    }
+    if (interruptedJobs.isEmpty())
+        return;
+
+    // the request is broadcasted, a client started later doesn't know it,
+    // so request again with growing interval until the jobs are resumed.
+    resumeRequestTimer = new QTimer(this);
+    resumeRequestTimer->setInterval(kResumeRequestInterval);
+    connect(resumeRequestTimer, &QTimer::timeout, this, [this] {
+        requestInterruptedJobs();
+        resumeRequestTimer->setInterval(qMin(resumeRequestTimer->interval() * 2, kMaxResumeRequestInterval));
+    });
+    resumeRequestTimer->start();
+    QTimer::singleShot(0, this, &DiskEncryptDBus::requestInterruptedJobs);
+}
+
+void DiskEncryptDBus::requestInterruptedJobs()
+{
+    if (interruptedJobs.isEmpty()) {
+        if (resumeRequestTimer)
+            resumeRequestTimer->stop();
+        return;
+    }
+    for (const auto &entry : interruptedJobs)
+        Q_EMIT RequestResumeJob(resumeRequestOf(entry));
+}
+
+QVariantMap DiskEncryptDBus::resumeRequestOf(const JournalEntry &entry)
+{
+    return QVariantMap {
+        { "device-path", entry.device },
+        { "device-name", entry.deviceName },
+        { "job", entry.jobID },
+        { "phase", entry.phase },
+        { "mode", entry.encMode },
+        { "trace-id", entry.traceID },
+    };
+}
+
+void DiskEncryptDBus::startDecrypt(DecryptWorker *worker)
+{
+    auto ctx = worker->context();
+    connect(worker, &QThread::finished, this, [=] {
+        int ret = worker->exitError();
+        QString dev = ctx->device;
+        qDebug() << "decrypt device finished:"
+                 << dev
+                 << ret;
+        if (ret == -kErrorJobPaused)
+            pausedJobs.insert(dev, { ctx, worker->jobParams(), worker->jobPassphrase() });
+        // the journal is kept only for an unfinished job, which has its
+        // header backup left.
+        if (ret != -kErrorJobPaused && !QFile::exists(disk_encrypt_utils::bcDecryptHeaderPath(dev))) {
+            journalPhases.remove(dev);
+            job_journal::bcRemove(dev);
         }
+        removeJob(dev);
+        Q_EMIT DecryptDiskResult(dev, ctx->deviceName, ctx->jobID, ret);
+        worker->deleteLater();
     });
-    worker->start();
+    scheduler->submit(worker, JobScheduler::kPriorityReencrypt, ctx->device);
+}
+
+// reencryption is IO bound, jobs on partitions of one disk only compete for
+// the same disk, so only one job is allowed per physical disk.
+bool DiskEncryptDBus::addJob(const JobContextPtr &ctx)
+{
+    const QString &disk = tuning_utils::bcSysDiskDir(ctx->device);
+    for (auto iter = runningJobs.cbegin(); iter != runningJobs.cend(); ++iter) {
+        if (iter.key() == ctx->device
+            || (!disk.isEmpty() && tuning_utils::bcSysDiskDir(iter.key()) == disk)) {
+            qWarning() << "cannot start job for" << ctx->device
+                       << ", device is busy with job" << iter.value()->jobID << "of" << iter.key();
+            return false;
+        }
+    }
+    if (pausedJobs.contains(ctx->device)) {
+        qWarning() << "cannot start job for" << ctx->device << ", it has a paused job";
+        return false;
+    }
+    runningJobs.insert(ctx->device, ctx);
+    qInfo() << "job" << ctx->jobID << "started for" << ctx->device
+            << ", running jobs:" << runningJobs.keys();
+    return true;
+}
+
+QVariantMap DiskEncryptDBus::jobInfo(const JobContextPtr &ctx, bool paused)
+{
+    static const QMap<JobType, QString> kTypeNames {
+        { kJobEncrypt, "encrypt" },
+        { kJobDecrypt, "decrypt" },
+        { kJobFstabEncrypt, "fstab-encrypt" },
+    };
+
+    QVariantMap info = ctx->progress.snapshot().toVariantMap();
+    // no progress is reported before the reencryption starts.
+    if (info.value("phase").toString().isEmpty())
+        info.insert("phase", "prepare");
+    info.insert("jobID", ctx->jobID);
+    info.insert("device", ctx->device);
+    info.insert("deviceName", ctx->deviceName);
+    info.insert("type", kTypeNames.value(ctx->type));
+    info.insert("state", paused ? "paused" : (ctx->interrupted ? "pausing" : "running"));
+    info.insert("startTime", ctx->startTime);
+    return info;
 }
 
-void DiskEncryptDBus::setToken(const QString &dev, const QString &token)
+void DiskEncryptDBus::removeJob(const QString &dev)
 {
-    if (token.isEmpty())
+    static constexpr int kMaxFinishedTimings { 16 };
+    auto ctx = runningJobs.take(dev);
+    if (!ctx)
         return;
 
-    int ret = disk_encrypt_funcs::bcSetToken(dev, token.toStdString().c_str());
-    if (ret != 0)
-        qWarning() << "set token failed for device" << dev;
+    if (auto batch = batchOf(dev)) {
+        // the result is emitted after the job is removed by some callers,
+        // so the batch goes on after the current event.
+        const QString batchID = batch->id();
+        QMetaObject::invokeMethod(this, [this, dev, batchID] {
+            auto batch = batches.value(batchID);
+            if (!batch)
+                return;
+            batch->setEnded(dev, pausedJobs.contains(dev));
+            advanceBatch(batchID);
+        }, Qt::QueuedConnection);
+    }
+
+    trace_log::span(ctx->traceID, "daemon_job", ctx->startTime * 1000, trace_log::now(),
+                    { { "job", ctx->jobID }, { "device", ctx->device }, { "type", int(ctx->type) } });
+
+    QVariantMap timings = jobTimings(ctx);
+    if (!ctx->verification.isEmpty())
+        timings.insert("verification", ctx->verification);
+    finishedTimings.append(timings);
+    while (finishedTimings.count() > kMaxFinishedTimings)
+        finishedTimings.removeFirst();
+}
+
+QVariantMap DiskEncryptDBus::jobTimings(const JobContextPtr &ctx)
+{
+    return QVariantMap {
+        { "jobID", ctx->jobID },
+        { "device", ctx->device },
+        { "startTime", ctx->startTime },
+        { "totalMsecs", ctx->timings.totalMsecs() },
+        { "phases", ctx->timings.summary() },
+    };
+}
+
+void DiskEncryptDBus::setTokens(const QString &dev, const QStringList &tokens)
+{
+    QStringList validTokens = tokens;
+    validTokens.removeAll("");
+    if (validTokens.isEmpty())
+        return;
+
+    HeaderTransaction trans(dev);
+    int ret = trans.begin();
+    for (int i = 0; i < validTokens.count() && ret == kSuccess; ++i)
+        ret = trans.setToken(validTokens.at(i));
+    if (ret == kSuccess)
+        ret = trans.commit();
+    if (ret != kSuccess)
+        qWarning() << "set token failed for device" << dev << ret;
 }
 
 bool DiskEncryptDBus::triggerReencrypt()
 {
-    gFstabEncWorker = new ReencryptWorkerV2(this);
+    // the config only exists while an online encryption of fstab device is unfinished.
+    if (!QFile::exists(kEncConfigPath)) {
+        qInfo() << "no online encryption config, skip the fstab encrypt worker";
+        return false;
+    }
+
+    gFstabEncWorker = new ReencryptWorkerV2(JOB_ID.arg(QDateTime::currentMSecsSinceEpoch()), this);
     gFstabEncWorker->loadReencryptConfig();
-    connect(gFstabEncWorker, &ReencryptWorkerV2::requestEncryptParams,
-            this, &DiskEncryptDBus::RequestEncryptParams);
+    if (!gFstabEncWorker->hasUnfinishedOnlineEncryption()) {
+        qInfo() << "no unfinished fstab encryption, skip the fstab encrypt worker";
+        delete gFstabEncWorker;
+        gFstabEncWorker = nullptr;
+        return false;
+    }
+
+    fstabEncSubmitted = false;
+    if (!fstabEncParams.isEmpty())
+        gFstabEncWorker->setEncryptParams(fstabEncParams);
     connect(gFstabEncWorker, &ReencryptWorkerV2::deviceReencryptResult,
             this, [this](const QString &dev, int code) {
                 Q_EMIT EncryptDiskResult(dev, deviceName, code);
             });
     connect(gFstabEncWorker, &ReencryptWorkerV2::finished,
-            this, [] { gFstabEncWorker->deleteLater(); gFstabEncWorker = nullptr; });
+            this, [this] {
+                if (gFstabEncWorker->exitError() == -kErrorJobPaused)
+                    pausedJobs.insert(currentEncryptingDevice, { gFstabEncWorker->context() });
+                removeJob(currentEncryptingDevice);
+                gFstabEncWorker->deleteLater();
+                gFstabEncWorker = nullptr;
+            });
 
     currentEncryptingDevice = gFstabEncWorker->encryptConfig().devicePath;
     deviceName = gFstabEncWorker->encryptConfig().deviceName;
-    qInfo() << "about to start encrypting" << currentEncryptingDevice;
-    gFstabEncWorker->start();
+    if (!currentEncryptingDevice.isEmpty())
+        addJob(gFstabEncWorker->context());
+    submitFstabEncWorker();
     return true;
 }
 
+void DiskEncryptDBus::submitFstabEncWorker()
+{
+    if (!gFstabEncWorker || fstabEncSubmitted)
+        return;
+
+    // the worker holds a long slot and its disk while running, it's not
+    // submitted until the user gives the params.
+    if (!gFstabEncWorker->hasValidParams()) {
+        requestEncryptParams();
+        return;
+    }
+
+    if (paramsRequestTimer)
+        paramsRequestTimer->stop();
+    fstabEncSubmitted = true;
+    qInfo() << "about to start encrypting" << currentEncryptingDevice;
+    scheduler->submit(gFstabEncWorker, JobScheduler::kPriorityReencrypt, currentEncryptingDevice);
+}
+
+void DiskEncryptDBus::requestEncryptParams()
+{
+    if (!gFstabEncWorker)
+        return;
+    Q_EMIT RequestEncryptParams(gFstabEncWorker->encryptConfig().keyConfig());
+
+    // the request is broadcasted, a client started later doesn't know it,
+    // so request again with growing interval until params are set.
+    if (!paramsRequestTimer) {
+        paramsRequestTimer = new QTimer(this);
+        connect(paramsRequestTimer, &QTimer::timeout, this, [this] {
+            if (!gFstabEncWorker || fstabEncSubmitted) {
+                paramsRequestTimer->stop();
+                return;
+            }
+            Q_EMIT RequestEncryptParams(gFstabEncWorker->encryptConfig().keyConfig());
+            paramsRequestTimer->setInterval(qMin(paramsRequestTimer->interval() * 2, kMaxResumeRequestInterval));
+        });
+    }
+    if (!paramsRequestTimer->isActive()) {
+        paramsRequestTimer->setInterval(kResumeRequestInterval);
+        paramsRequestTimer->start();
+    }
+}
+
 // this function should be running in thread.
 // it may take times.
 void DiskEncryptDBus::diskCheck()
@@ -269,81 +1049,68 @@ void DiskEncryptDBus::diskCheck()
 void DiskEncryptDBus::getDeviceMapper(QMap<QString, QString> *dev2uuid, QMap<QString, QString> *uuid2dev)
 {
     Q_ASSERT(dev2uuid && uuid2dev);
-    using namespace dfmmount;
-    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
-    Q_ASSERT(monitor);
-
-    const QStringList &objPaths = monitor->getDevices();
-    for (const auto &objPath : objPaths) {
-        auto blkPtr = monitor->createDeviceById(objPath).objectCast<DBlockDevice>();
-        if (!blkPtr) continue;
+    const auto &states = BlockDeviceStates::instance()->states();
+    for (const auto &st : states) {
+        if (st.uuid.isEmpty()) continue;
 
-        QString uuid = blkPtr->getProperty(dfmmount::Property::kBlockIDUUID).toString();
-        if (uuid.isEmpty()) continue;
-
-        QString dev = blkPtr->device();
-        uuid = QString("UUID=") + uuid;
-        dev2uuid->insert(dev, uuid);
-        uuid2dev->insert(uuid, dev);
+        QString uuid = QString("UUID=") + st.uuid;
+        dev2uuid->insert(st.device, uuid);
+        uuid2dev->insert(uuid, st.device);
     }
 }
 
 bool DiskEncryptDBus::updateCrypttab()
 {
     qInfo() << "==== start checking crypttab...";
-    QFile crypttab("/etc/crypttab");
-    if (!crypttab.open(QIODevice::ReadWrite)) {
+    QElapsedTimer timer;
+    timer.start();
+
+    TabFile crypttab("/etc/crypttab");
+    if (!crypttab.load()) {
         qWarning() << "cannot open crypttab for rw";
         return false;
     }
-    auto content = crypttab.readAll();
-    crypttab.close();
 
-    bool cryptUpdated = false;
-    QByteArrayList lines = content.split('\n');
-    for (int i = lines.count() - 1; i >= 0; --i) {
-        QString line = lines.at(i);
-        if (line.startsWith("#")) {
-            qInfo() << "==== [ignore] comment:" << line;
+    // resolve all devices once for the whole file.
+    QMap<QString, QString> dev2uuid, uuid2dev;
+    getDeviceMapper(&dev2uuid, &uuid2dev);
+
+    for (int i = crypttab.lineCount() - 1; i >= 0; --i) {
+        if (!crypttab.isEntry(i))
             continue;
-        }
 
-        auto items = line.split(QRegularExpression(R"( |\t)"), QString::SkipEmptyParts);
-        if (items.count() < 2) {
-            lines.removeAt(i);
-            qInfo() << "==== [remove] invalid line:" << line;
+        const QString &target = crypttab.field(i, 0);
+        const QString &source = crypttab.field(i, 1);
+        if (crypttab.fieldCount(i) < 2) {
+            crypttab.removeLine(i);
+            qInfo() << "==== [remove] invalid line:" << target;
             continue;
         }
 
-        if (isEncrypted(items.at(0), items.at(1)) == 0) {
-            lines.removeAt(i);
-            cryptUpdated = true;
-            qInfo() << "==== [remove] this item is not encrypted:" << line;
+        if (isEncrypted(target, source, uuid2dev) == 0) {
+            crypttab.removeLine(i);
+            qInfo() << "==== [remove] this item is not encrypted:" << target << source;
             continue;
         }
 
-        qInfo() << "==== [ keep ] device is still encrypted:" << line;
+        qInfo() << "==== [ keep ] device is still encrypted:" << target << source;
     }
 
-    qInfo() << "==== end checking crypttab, crypttab is updated:" << cryptUpdated;
-    if (cryptUpdated) {
-        content = lines.join('\n');
-        content.append("\n");
-        if (!crypttab.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-            qWarning() << "cannot open cryppttab for update";
-            return false;
-        }
-        crypttab.write(content);
-        crypttab.close();
+    bool cryptUpdated = crypttab.isModified();
+    qInfo() << "==== end checking crypttab, crypttab is updated:" << cryptUpdated
+            << ", lines:" << crypttab.lineCount()
+            << ", devices:" << uuid2dev.count()
+            << ", takes:" << timer.elapsed() << "ms";
+    if (cryptUpdated && !crypttab.save()) {
+        qWarning() << "cannot open cryppttab for update";
+        return false;
     }
     return cryptUpdated;
 }
 
-int DiskEncryptDBus::isEncrypted(const QString &target, const QString &source)
+int DiskEncryptDBus::isEncrypted(const QString &target, const QString &source,
+                                 const QMap<QString, QString> &uuid2dev)
 {
-    QMap<QString, QString> dev2uuid, uuid2dev;
-    getDeviceMapper(&dev2uuid, &uuid2dev);
-
     QString dev = source;
     if (dev.startsWith("UUID")) {
         dev = uuid2dev.value(dev);
@@ -358,11 +1125,11 @@ int DiskEncryptDBus::isEncrypted(const QString &target, const QString &source)
         return -1;
     }
 
-    auto devPtr = block_device_utils::bcCreateBlkDev(dev);
-    if (!devPtr) {
-        qDebug() << "cannot construct device pointer by " << dev;
+    BlockDeviceState st;
+    if (!BlockDeviceStates::instance()->state(dev, &st)) {
+        qDebug() << "cannot get device state by " << dev;
         return -2;
     }
 
-    return devPtr->isEncrypted() ? 1 : 0;
+    return st.isEncrypted ? 1 : 0;
 }
@@ -6,12 +6,19 @@
 #define DISKENCRYPTDBUS_H
 
 #include "daemonplugin_file_encrypt_global.h"
+#include "encrypt/jobcontext.h"
+#include "encrypt/jobjournal.h"
 
 #include <QObject>
 #include <QDBusContext>
 #include <QDBusServiceWatcher>
 
+class QTimer;
+
 FILE_ENCRYPT_BEGIN_NS
+class DecryptWorker;
+class EncryptBatch;
+class JobScheduler;
 class DiskEncryptDBus : public QObject, public QDBusContext
 {
     Q_OBJECT
@@ -23,10 +30,29 @@ public:
 
 public Q_SLOTS:
     QString PrepareEncryptDisk(const QVariantMap &params);
+    QString EncryptDisks(const QVariantList &paramsList);
     QString DecryptDisk(const QVariantMap &params);
     QString ChangeEncryptPassphress(const QVariantMap &params);
     QString QueryTPMToken(const QString &device);
+    int QueryTokenSummary(const QString &device);
+    QVariantMap QueryTokenSummaries(const QStringList &devices);
     void SetEncryptParams(const QVariantMap &params);
+    QVariantMap QueryCipherBenchmark();
+    bool IsHwOpalSupported(const QString &device);
+    void SetProgressInterval(int msecs);
+    void SetBandwidthLimit(int mibPerSec);
+    int BandwidthLimit();
+    void SetSessionIdle(bool idle);
+    void SetPauseWhenActive(bool pause);
+    void SetPbkdfPolicy(int unlockMs, int maxMemoryMiB);
+    QVariantMap QueryPbkdfProfile();
+    int PauseJob(const QString &device);
+    int ResumeJob(const QString &device);
+    int ResumeInterruptedJob(const QVariantMap &params);
+    QVariantList ListJobs();
+    QVariantMap GetJob(const QString &jobID);
+    QVariantList JobTimings();
+    QVariantMap QueryResourceUsage();
 
 Q_SIGNALS:
     void PrepareEncryptDiskResult(const QString &device, const QString &devName, const QString &jobID, int errCode);
@@ -35,25 +61,86 @@ Q_SIGNALS:
     void ChangePassphressResult(const QString &device, const QString &devName, const QString &jobID, int errCode);
     void EncryptProgress(const QString &device, const QString &devName, double progress);
     void DecryptProgress(const QString &device, const QString &devName, double progress);
+    void EncryptProgressDetail(const QString &device, const QString &devName, const QVariantMap &info);
+    void DecryptProgressDetail(const QString &device, const QString &devName, const QVariantMap &info);
     void RequestEncryptParams(const QVariantMap &encConfig);
+    void EncryptDisksProgress(const QString &batchID, const QVariantMap &info);
+    void EncryptDisksResult(const QString &batchID, const QVariantMap &results);
+    void RequestResumeJob(const QVariantMap &job);
 
 private Q_SLOTS:
     void onFstabDiskEncProgressUpdated(const QString &dev, qint64 offset, qint64 total);
     void onFstabDiskEncFinished(const QString &dev, int result, const QString &errstr);
 
 private:
+    void activate();
     bool checkAuth(const QString &actID);
-    void startReencrypt(const QString &dev, const QString &passphrase, const QString &token, int cipherPos, int recPos);
-    void setToken(const QString &dev, const QString &token);
+    bool startPrepareEncrypt(const QString &jobID, const QVariantMap &params);
+    EncryptBatch *batchOf(const QString &dev);
+    void advanceBatch(const QString &batchID);
+    void startReencrypt(const JobContextPtr &ctx, const SecretBuffer &passphrase, const QString &token, int cipherPos, int recPos);
+    void startDecrypt(DecryptWorker *worker);
+    int resumeJob(const QString &device);
+    void recordJob(const JobContextPtr &ctx, const QVariantMap &params, int recPos);
+    void journalPhase(const QString &device, const QVariantMap &info);
+    void recoverJobs();
+    void requestInterruptedJobs();
+    static QVariantMap resumeRequestOf(const JournalEntry &entry);
+    bool addJob(const JobContextPtr &ctx);
+    static QVariantMap jobInfo(const JobContextPtr &ctx, bool paused);
+    static QVariantMap jobTimings(const JobContextPtr &ctx);
+    void removeJob(const QString &dev);
+    void setTokens(const QString &dev, const QStringList &tokens);
     bool triggerReencrypt();
+    void submitFstabEncWorker();
+    void requestEncryptParams();
     void diskCheck();
     static void getDeviceMapper(QMap<QString, QString> *dev2uuid, QMap<QString, QString> *uuid2dev);
     static bool updateCrypttab();
-    static int isEncrypted(const QString &target, const QString &source);
+    static int isEncrypted(const QString &target, const QString &source,
+                           const QMap<QString, QString> &uuid2dev);
 
 private:
+    // device of the fstab encryption which is resumed at startup.
     QString currentEncryptingDevice;
     QString deviceName;
+
+    JobScheduler *scheduler { nullptr };
+    // the device watchers are created and crypttab is checked at first use.
+    bool activated { false };
+    // the session that reports idle state, it's taken as active once gone.
+    QDBusServiceWatcher *sessionWatcher { nullptr };
+
+    // running en/decrypt jobs, keyed by device.
+    QMap<QString, JobContextPtr> runningJobs;
+
+    // what's needed to continue an interrupted job.
+    struct PausedJob
+    {
+        JobContextPtr ctx;
+        QVariantMap params;
+        SecretBuffer passphrase;
+        QString token;
+        int recPos { -1 };
+    };
+    QMap<QString, PausedJob> pausedJobs;
+
+    // multi partitions encryptions requested by EncryptDisks, keyed by batch id.
+    QMap<QString, QSharedPointer<EncryptBatch>> batches;
+
+    QVariantMap fstabEncParams;
+    // requests the params of fstab encryption until they are set.
+    QTimer *paramsRequestTimer { nullptr };
+    bool fstabEncSubmitted { false };
+
+    // the journaled jobs and their last recorded phase.
+    QMap<QString, QString> journalPhases;
+    // the jobs found in journal at startup, which wait for the passphrase.
+    QMap<QString, JournalEntry> interruptedJobs;
+    QTimer *resumeRequestTimer { nullptr };
+
+    // phase timings of the recently finished jobs.
+    QList<QVariantMap> finishedTimings;
 };
 
 FILE_ENCRYPT_END_NS
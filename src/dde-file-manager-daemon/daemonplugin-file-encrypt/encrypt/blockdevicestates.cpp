@@ -0,0 +1,173 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "blockdevicestates.h"
+
+#include <QFileInfo>
+#include <QDebug>
+
+#include <dfm-mount/dmount.h>
+
+FILE_ENCRYPT_USE_NS
+using namespace dfmmount;
+
+static constexpr char kBlockObjPrefix[] { "/org/freedesktop/UDisks2/block_devices/" };
+
+static QSharedPointer<DBlockMonitor> blockMonitor()
+{
+    auto mng = DDeviceManager::instance();
+    Q_ASSERT_X(mng, "cannot create device manager", "");
+    return mng->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+}
+
+BlockDeviceStates *BlockDeviceStates::instance()
+{
+    static BlockDeviceStates ins;
+    return &ins;
+}
+
+bool BlockDeviceStates::state(const QString &device, BlockDeviceState *state)
+{
+    Q_ASSERT(state);
+    const QString &key = stateKey(device);
+    {
+        QReadLocker locker(&lock);
+        auto iter = devStates.constFind(key);
+        if (iter != devStates.constEnd()) {
+            *state = iter.value();
+            return true;
+        }
+        // the table is complete when the monitor works, the device just
+        // doesn't exist.
+        if (watching)
+            return false;
+    }
+
+    // fallback to a live query.
+    auto monitor = blockMonitor();
+    if (!monitor)
+        return false;
+    const QStringList &objPaths = monitor->resolveDeviceNode(device, {});
+    if (objPaths.isEmpty()) {
+        qWarning() << "cannot resolve device from" << device;
+        return false;
+    }
+    return loadState(objPaths.constFirst(), state);
+}
+
+QList<BlockDeviceState> BlockDeviceStates::states()
+{
+    QReadLocker locker(&lock);
+    return devStates.values();
+}
+
+BlockDeviceStates::BlockDeviceStates()
+{
+    watchDevices();
+}
+
+QString BlockDeviceStates::stateKey(const QString &device)
+{
+    // /dev/disk/by-uuid/xx, /dev/mapper/xx are all symlinks.
+    const QString &path = QFileInfo(device).canonicalFilePath();
+    return path.isEmpty() ? device : path;
+}
+
+bool BlockDeviceStates::loadState(const QString &objPath, BlockDeviceState *state)
+{
+    auto monitor = blockMonitor();
+    if (!monitor)
+        return false;
+
+    auto blkDev = monitor->createDeviceById(objPath).objectCast<DBlockDevice>();
+    if (!blkDev) {
+        qWarning() << "cannot create device by" << objPath;
+        return false;
+    }
+
+    state->objPath = objPath;
+    state->device = blkDev->device();
+    state->idType = blkDev->getProperty(Property::kBlockIDType).toString();
+    state->idVersion = blkDev->getProperty(Property::kBlockIDVersion).toString();
+    state->uuid = blkDev->getProperty(Property::kBlockIDUUID).toString();
+    state->mountPoints = blkDev->mountPoints();
+    state->isEncrypted = blkDev->isEncrypted();
+    return true;
+}
+
+void BlockDeviceStates::watchDevices()
+{
+    auto monitor = blockMonitor();
+    if (!monitor) {
+        qWarning() << "cannot watch block devices, device states are queried on demand.";
+        return;
+    }
+
+    QObject::connect(monitor.data(), &DBlockMonitor::deviceAdded,
+                     monitor.data(), [this](const QString &objPath) { refresh(objPath); });
+    QObject::connect(monitor.data(), &DBlockMonitor::deviceRemoved,
+                     monitor.data(), [this](const QString &objPath) { remove(objPath); });
+    QObject::connect(monitor.data(), &DBlockMonitor::propertyChanged,
+                     monitor.data(), [this](const QString &objPath, const QMap<Property, QVariant> &) {
+                         refresh(objPath);
+                     });
+    QObject::connect(monitor.data(), &DBlockMonitor::mountAdded,
+                     monitor.data(), [this](const QString &objPath, const QString &mpt) {
+                         updateMountPoint(objPath, mpt, true);
+                     });
+    QObject::connect(monitor.data(), &DBlockMonitor::mountRemoved,
+                     monitor.data(), [this](const QString &objPath, const QString &mpt) {
+                         updateMountPoint(objPath, mpt, false);
+                     });
+    monitor->startMonitor();
+
+    const QStringList &objPaths = monitor->getDevices();
+    for (const auto &objPath : objPaths) {
+        BlockDeviceState st;
+        if (loadState(objPath, &st))
+            insert(st);
+    }
+
+    QWriteLocker locker(&lock);
+    watching = true;
+    qInfo() << "block device states seeded:" << devStates.count();
+}
+
+void BlockDeviceStates::insert(const BlockDeviceState &state)
+{
+    const QString &key = stateKey(state.device);
+    QWriteLocker locker(&lock);
+    devStates.insert(key, state);
+    objPathKeys.insert(state.objPath, key);
+}
+
+void BlockDeviceStates::refresh(const QString &objPath)
+{
+    if (!objPath.startsWith(kBlockObjPrefix))
+        return;
+
+    BlockDeviceState st;
+    if (loadState(objPath, &st))
+        insert(st);
+}
+
+void BlockDeviceStates::remove(const QString &objPath)
+{
+    // the device node is gone already, cannot be resolved.
+    QWriteLocker locker(&lock);
+    devStates.remove(objPathKeys.take(objPath));
+}
+
+void BlockDeviceStates::updateMountPoint(const QString &objPath, const QString &mountPoint, bool mounted)
+{
+    QWriteLocker locker(&lock);
+    auto iter = devStates.find(objPathKeys.value(objPath));
+    if (iter == devStates.end())
+        return;
+
+    QStringList &mpts = iter.value().mountPoints;
+    if (mounted && !mpts.contains(mountPoint))
+        mpts.append(mountPoint);
+    if (!mounted)
+        mpts.removeAll(mountPoint);
+}
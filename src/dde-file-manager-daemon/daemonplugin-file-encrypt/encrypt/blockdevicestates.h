@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef BLOCKDEVICESTATES_H
+#define BLOCKDEVICESTATES_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QReadWriteLock>
+#include <QHash>
+#include <QStringList>
+
+FILE_ENCRYPT_BEGIN_NS
+
+struct BlockDeviceState
+{
+    QString objPath;
+    QString device;
+    QString idType;
+    QString idVersion;
+    QString uuid;
+    QStringList mountPoints;
+    bool isEncrypted { false };
+};
+
+// the udisks properties of all block devices, seeded once and kept up to
+// date by the block monitor, so that querying a device doesn't need a
+// round-trip to udisks.
+class BlockDeviceStates
+{
+public:
+    static BlockDeviceStates *instance();
+
+    bool state(const QString &device, BlockDeviceState *state);
+    QList<BlockDeviceState> states();
+
+private:
+    BlockDeviceStates();
+    Q_DISABLE_COPY(BlockDeviceStates)
+
+    static QString stateKey(const QString &device);
+    static bool loadState(const QString &objPath, BlockDeviceState *state);
+    void watchDevices();
+    void insert(const BlockDeviceState &state);
+    void refresh(const QString &objPath);
+    void remove(const QString &objPath);
+    void updateMountPoint(const QString &objPath, const QString &mountPoint, bool mounted);
+
+private:
+    QReadWriteLock lock;
+    QHash<QString, BlockDeviceState> devStates;
+    QHash<QString, QString> objPathKeys;   // udisks object path -> key of devStates
+    bool watching { false };
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // BLOCKDEVICESTATES_H
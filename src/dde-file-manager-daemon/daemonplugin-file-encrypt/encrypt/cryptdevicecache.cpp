@@ -0,0 +1,172 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "cryptdevicecache.h"
+#include "diskencrypt.h"
+#include "encrypttuning.h"
+
+#include <QFileInfo>
+
+#include <dfm-mount/dmount.h>
+
+#include <libcryptsetup.h>
+
+FILE_ENCRYPT_USE_NS
+using namespace disk_encrypt;
+
+static constexpr char kBlockObjPrefix[] { "/org/freedesktop/UDisks2/block_devices/" };
+
+CryptDeviceCache *CryptDeviceCache::instance()
+{
+    static CryptDeviceCache ins;
+    return &ins;
+}
+
+int CryptDeviceCache::take(const QString &device, crypt_device **cdev, quint64 *generation)
+{
+    Q_ASSERT(cdev && generation);
+    const QString &key = cacheKey(device);
+    {
+        QMutexLocker locker(&mtx);
+        *generation = generations.value(key, 0);
+        *cdev = handles.take(key);
+        if (*cdev)
+            return kSuccess;
+    }
+
+    // the header of device may live in a detached file.
+    const QString &header = disk_encrypt_utils::bcHeaderDevice(device);
+    int ret = crypt_init_data_device(cdev, header.toStdString().c_str(), device.toStdString().c_str());
+    if (ret < 0) {
+        qWarning() << "init device failed" << device << ret;
+        *cdev = nullptr;
+        return -kErrorInitCrypt;
+    }
+
+    ret = crypt_load(*cdev, CRYPT_LUKS, nullptr);
+    if (ret < 0) {
+        qWarning() << "load device failed" << device << ret;
+        crypt_free(*cdev);
+        *cdev = nullptr;
+        return -kErrorLoadCrypt;
+    }
+    return kSuccess;
+}
+
+void CryptDeviceCache::giveBack(const QString &device, crypt_device *cdev, quint64 generation)
+{
+    if (!cdev)
+        return;
+
+    const QString &key = cacheKey(device);
+    {
+        QMutexLocker locker(&mtx);
+        // the device changed while handle is leased, or another lease of
+        // the same device has been returned already. nothing drops the
+        // handles of changed devices when they are not watched.
+        if (watching && generations.value(key, 0) == generation && !handles.contains(key)) {
+            handles.insert(key, cdev);
+            return;
+        }
+    }
+    crypt_free(cdev);
+}
+
+void CryptDeviceCache::invalidate(const QString &device)
+{
+    const QString &key = cacheKey(device);
+    crypt_device *cdev { nullptr };
+    {
+        QMutexLocker locker(&mtx);
+        generations[key] += 1;
+        cdev = handles.take(key);
+    }
+    if (cdev) {
+        qDebug() << "cached crypt device dropped:" << key;
+        crypt_free(cdev);
+    }
+}
+
+quint64 CryptDeviceCache::generation(const QString &device)
+{
+    QMutexLocker locker(&mtx);
+    return generations.value(cacheKey(device), 0);
+}
+
+void CryptDeviceCache::clear()
+{
+    QHash<QString, crypt_device *> dropped;
+    {
+        QMutexLocker locker(&mtx);
+        dropped.swap(handles);
+        for (auto iter = generations.begin(); iter != generations.end(); ++iter)
+            iter.value() += 1;
+    }
+    for (auto cdev : dropped)
+        crypt_free(cdev);
+}
+
+CryptDeviceCache::CryptDeviceCache()
+{
+    watchDevices();
+}
+
+CryptDeviceCache::~CryptDeviceCache()
+{
+    clear();
+}
+
+QString CryptDeviceCache::cacheKey(const QString &device)
+{
+    // /dev/disk/by-uuid/xx, /dev/mapper/xx are all symlinks.
+    const QString &path = QFileInfo(device).canonicalFilePath();
+    return path.isEmpty() ? device : path;
+}
+
+void CryptDeviceCache::watchDevices()
+{
+    using namespace dfmmount;
+    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+    if (!monitor) {
+        qWarning() << "cannot watch block devices, crypt device handles are not cached.";
+        return;
+    }
+
+    // udisks refreshes the block properties on udev change events, which are
+    // emitted after the header is written by any process.
+    auto onChanged = [this](const QString &objPath) {
+        if (objPath.startsWith(kBlockObjPrefix))
+            invalidate("/dev/" + objPath.mid(int(strlen(kBlockObjPrefix))));
+    };
+    QObject::connect(monitor.data(), &DBlockMonitor::propertyChanged,
+                     monitor.data(), [onChanged](const QString &objPath, const QMap<Property, QVariant> &) {
+                         onChanged(objPath);
+                     });
+    QObject::connect(monitor.data(), &DBlockMonitor::deviceRemoved,
+                     monitor.data(), [onChanged](const QString &objPath) {
+                         onChanged(objPath);
+                         if (objPath.startsWith(kBlockObjPrefix))
+                             tuning_utils::bcDropProfile("/dev/" + objPath.mid(int(strlen(kBlockObjPrefix))));
+                     });
+    monitor->startMonitor();
+
+    QMutexLocker locker(&mtx);
+    watching = true;
+}
+
+CryptDeviceLease::CryptDeviceLease(const QString &device)
+    : device(device)
+{
+    err = CryptDeviceCache::instance()->take(device, &cdev, &gen);
+}
+
+CryptDeviceLease::~CryptDeviceLease()
+{
+    if (!cdev)
+        return;
+
+    if (discarded)
+        crypt_free(cdev);
+    else
+        CryptDeviceCache::instance()->giveBack(device, cdev, gen);
+}
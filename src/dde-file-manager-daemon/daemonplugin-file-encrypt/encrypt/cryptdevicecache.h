@@ -0,0 +1,76 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef CRYPTDEVICECACHE_H
+#define CRYPTDEVICECACHE_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QMutex>
+#include <QHash>
+
+struct crypt_device;
+
+FILE_ENCRYPT_BEGIN_NS
+
+// keeps loaded LUKS contexts so that back-to-back header queries and
+// mutations on one device don't re-read and re-validate the metadata.
+// a handle is owned by one lease at a time, handles are dropped when udev
+// reports a change of the device.
+class CryptDeviceCache
+{
+public:
+    static CryptDeviceCache *instance();
+
+    int take(const QString &device, struct crypt_device **cdev, quint64 *generation);
+    void giveBack(const QString &device, struct crypt_device *cdev, quint64 generation);
+    void invalidate(const QString &device);
+    void clear();
+    // bumped every time the device is invalidated.
+    quint64 generation(const QString &device);
+
+    static QString cacheKey(const QString &device);
+
+private:
+    CryptDeviceCache();
+    ~CryptDeviceCache();
+    Q_DISABLE_COPY(CryptDeviceCache)
+
+    void watchDevices();
+
+private:
+    QMutex mtx;
+    QHash<QString, struct crypt_device *> handles;
+    QHash<QString, quint64> generations;
+    // handles are cached only while the device changes are watched.
+    bool watching { false };
+};
+
+// a loaded crypt_device borrowed from the cache, in scope.
+class CryptDeviceLease
+{
+public:
+    explicit CryptDeviceLease(const QString &device);
+    ~CryptDeviceLease();
+    Q_DISABLE_COPY(CryptDeviceLease)
+
+    inline struct crypt_device *get() const { return cdev; }
+    inline int error() const { return err; }
+    inline quint64 generation() const { return gen; }
+    inline explicit operator bool() const { return cdev != nullptr; }
+
+    // the handle is not returned to cache, used when an operation failed
+    // and the in-memory state of the handle is uncertain.
+    inline void discard() { discarded = true; }
+
+private:
+    QString device;
+    struct crypt_device *cdev { nullptr };
+    quint64 gen { 0 };
+    int err { 0 };
+    bool discarded { false };
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // CRYPTDEVICECACHE_H
@@ -2,25 +2,44 @@
 //
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "diskencrypt.h"
+#include "encrypttuning.h"
+#include "pbkdfpolicy.h"
+#include "jobcontext.h"
+#include "cryptdevicecache.h"
+#include "tokenindex.h"
+#include "blockdevicestates.h"
+#include "iothrottle.h"
+#include "resourcegovernor.h"
 #include "fsresize/fsresize.h"
 #include "notification/notifications.h"
+#include "notification/progressaggregator.h"
 
 #include <QDebug>
 #include <QFile>
 #include <QTextStream>
 #include <QDir>
+#include <QFileInfo>
 #include <QFile>
 #include <QLibrary>
 #include <QJsonDocument>
+#include <QJsonArray>
 #include <QJsonObject>
+#include <QMutex>
 
 #include <dfm-base/utils/finallyutil.h>
 #include <dfm-mount/dmount.h>
 
 #include <libcryptsetup.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/sed-opal.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
+#include <algorithm>
 #include <functional>
 
 FILE_ENCRYPT_USE_NS
@@ -37,20 +56,10 @@ using namespace disk_encrypt;
         return retVal;                    \
     }
 
-// used to record current reencrypting device.
-QString gCurrReencryptingDevice;
-QString gCurrDecryptintDevice;
-bool gInterruptEncFlag { false };
 
-struct crypt_params_reencrypt *encryptParams()
+struct crypt_params_reencrypt encryptParams(const struct crypt_params_luks2 *luks2)
 {
-    static struct crypt_params_luks2 reencLuks2
-    {
-        .sector_size = 512
-    };
-
-    static struct crypt_params_reencrypt reencParams
-    {
+    return {
         .mode = CRYPT_REENCRYPT_ENCRYPT,
         .direction = CRYPT_REENCRYPT_BACKWARD,
         .resilience = "datashift",
@@ -58,39 +67,171 @@ struct crypt_params_reencrypt *encryptParams()
         .data_shift = 32 * 1024,
         .max_hotzone_size = 0,
         .device_size = 0,
-        .luks2 = &reencLuks2,
+        .luks2 = luks2,
         .flags = CRYPT_REENCRYPT_INITIALIZE_ONLY | CRYPT_REENCRYPT_MOVE_FIRST_SEGMENT
     };
-    return &reencParams;
 }
-struct crypt_params_reencrypt *decryptParams()
+// with a bandwidth limit, one hotzone holds about a second of io so that
+// the pacing between hotzones stays smooth.
+quint64 hotzoneSectors(const TuningProfile &profile)
 {
-    static struct crypt_params_reencrypt params
-    {
+    quint64 size = profile.hotzoneSize;
+    quint64 limit = IOThrottle::limit() * 1024 * 1024;
+    if (limit > 0)
+        size = size > 0 ? qMin(size, limit) : limit;
+    return size / 512;
+}
+
+struct crypt_params_reencrypt decryptParams(const TuningProfile &profile)
+{
+    return {
         .mode = CRYPT_REENCRYPT_DECRYPT,
         .direction = CRYPT_REENCRYPT_BACKWARD,
-        .resilience = "checksum",
+        .resilience = tuning_utils::bcResilienceName(profile.resilience),
         .hash = "sha256",
         .data_shift = 0,
-        .max_hotzone_size = 0,
+        .max_hotzone_size = hotzoneSectors(profile),   // in 512B sectors
         .device_size = 0
     };
-    return &params;
 }
-struct crypt_params_reencrypt *resumeParams()
+struct crypt_params_reencrypt resumeParams(const TuningProfile &profile)
 {
-    static struct crypt_params_reencrypt params
-    {
+    // the hotzone of a datashift reencryption is always the data shift,
+    // the max size only takes effect on checksum/journal resilience.
+    return {
         .mode = CRYPT_REENCRYPT_REENCRYPT,
         .direction = CRYPT_REENCRYPT_FORWARD,
-        .resilience = "checksum",
+        .resilience = tuning_utils::bcResilienceName(profile.resilience),
         .hash = "sha256",
-        .max_hotzone_size = 0,
+        .max_hotzone_size = hotzoneSectors(profile),   // in 512B sectors
         .device_size = 0,
         .flags = CRYPT_REENCRYPT_RESUME_ONLY
     };
-    return &params;
 }
+// reports the progress of fs resizing into the channel of reencryption.
+fs_resize::ProgressCallback resizeProgress(JobContext *ctx, bool encrypting)
+{
+    Q_ASSERT(ctx);
+    return [ctx, encrypting](const QString &phase, double progress) {
+        ProgressInfo info;
+        if (!ctx->progress.update(phase, progress, &info))
+            return;
+        if (encrypting)
+            Q_EMIT SignalEmitter::instance()->updateEncryptProgressInfo(ctx->device, ctx->deviceName, info.toVariantMap());
+        else
+            Q_EMIT SignalEmitter::instance()->updateDecryptProgressInfo(ctx->device, ctx->deviceName, info.toVariantMap());
+    };
+}
+
+static constexpr char kDecryptHeaderDir[] { "/boot/usec-crypt/decrypt" };
+
+static constexpr char kJobKeyslotToken[] { "dfm-job-keyslot" };
+static constexpr int kMaxTokens { 32 };   // LUKS2_TOKENS_MAX
+
+// the key has full entropy, a fast pbkdf doesn't weaken the keyslot.
+static int addJobKeyslot(struct crypt_device *cdev, JobContext *ctx)
+{
+    const SecretBuffer &key = SecretBuffer::random(32);
+    if (key.isEmpty())
+        return -1;
+
+    struct crypt_pbkdf_type fastPbkdf = {
+        .type = CRYPT_KDF_PBKDF2,
+        .hash = "sha256",
+        .time_ms = 0,
+        .iterations = 1000,
+        .max_memory_kb = 0,
+        .parallel_threads = 0,
+        .flags = CRYPT_PBKDF_NO_BENCHMARK,
+    };
+    crypt_set_pbkdf_type(cdev, &fastPbkdf);
+    int ret = crypt_keyslot_add_by_volume_key(cdev, CRYPT_ANY_SLOT, nullptr, 0,
+                                              key.data(), key.size());
+    crypt_set_pbkdf_type(cdev, nullptr);
+    CHECK_INT(ret, "add job keyslot failed " + ctx->device, ret);
+    const int keyslot = ret;
+
+    // a job keyslot must never stay untagged, or nothing removes it after
+    // the job is gone.
+    const QByteArray &json = QJsonDocument(QJsonObject {
+                                                   { "type", kJobKeyslotToken },
+                                                   { "keyslots", QJsonArray { QString::number(keyslot) } },
+                                                   { "job", ctx->jobID } })
+                                     .toJson(QJsonDocument::Compact);
+    ret = crypt_token_json_set(cdev, CRYPT_ANY_TOKEN, json.constData());
+    if (ret < 0) {
+        qWarning() << "tag job keyslot failed" << ctx->device << keyslot << ret;
+        crypt_keyslot_destroy(cdev, keyslot);
+        return ret;
+    }
+
+    ctx->unlockKey = key;
+    ctx->unlockKeyslot = keyslot;
+    ctx->unlockToken = ret;
+    return keyslot;
+}
+
+static void removeJobKeyslot(struct crypt_device *cdev, JobContext *ctx)
+{
+    if (ctx->unlockKeyslot < 0)
+        return;
+
+    int ret = crypt_keyslot_destroy(cdev, ctx->unlockKeyslot);
+    if (ret < 0)
+        qWarning() << "remove job keyslot failed" << ctx->device << ctx->unlockKeyslot << ret;
+    if (ctx->unlockToken >= 0) {
+        ret = crypt_token_json_set(cdev, ctx->unlockToken, nullptr);
+        if (ret < 0)
+            qWarning() << "remove job keyslot token failed" << ctx->device << ctx->unlockToken << ret;
+    }
+    ctx->unlockKey = {};
+    ctx->unlockKeyslot = -1;
+    ctx->unlockToken = -1;
+}
+
+// the keys of job keyslots are lost with the daemon when a job is killed by
+// a crash or a reboot, their keyslots are found by the tags and removed.
+static void removeStaleJobKeyslots(struct crypt_device *cdev, JobContext *ctx)
+{
+    for (int token = 0; token < kMaxTokens; ++token) {
+        if (token == ctx->unlockToken)
+            continue;
+
+        const char *type { nullptr };
+        crypt_token_info status = crypt_token_status(cdev, token, &type);
+        if (status == CRYPT_TOKEN_INACTIVE || status == CRYPT_TOKEN_INVALID
+            || !type || qstrcmp(type, kJobKeyslotToken) != 0)
+            continue;
+
+        const char *json { nullptr };
+        if (crypt_token_json_get(cdev, token, &json) < 0 || !json)
+            continue;
+        // the json is owned by cdev and invalid once the header changes.
+        const QJsonArray &keyslots = QJsonDocument::fromJson(json).object().value("keyslots").toArray();
+
+        for (const auto &slot : keyslots) {
+            bool ok = false;
+            int keyslot = slot.toString().toInt(&ok);
+            if (!ok || keyslot == ctx->unlockKeyslot)
+                continue;
+            int ret = crypt_keyslot_destroy(cdev, keyslot);
+            qInfo() << "remove stale job keyslot" << ctx->device << keyslot << ret;
+        }
+        int ret = crypt_token_json_set(cdev, token, nullptr);
+        if (ret < 0)
+            qWarning() << "remove stale job keyslot token failed" << ctx->device << token << ret;
+    }
+}
+
+// the secret to unlock the device within job, keeps the byte length of
+// passphrase as the keyslots were created.
+static SecretBuffer unlockSecret(JobContext *ctx, const SecretBuffer &passphrase)
+{
+    if (ctx->unlockKeyslot >= 0)
+        return ctx->unlockKey;
+    return passphrase;
+}
+
 void parseCipher(const QString &fullCipher, QString *cipher, QString *mode, int *len)
 {
     Q_ASSERT(cipher && mode && len);
@@ -104,10 +245,14 @@ EncryptParams disk_encrypt_utils::bcConvertParams(const QVariantMap &params)
     auto toString = [&params](const QString &key) { return params.value(key).toString(); };
     return {
         .device = toString(encrypt_param_keys::kKeyDevice),
-        .passphrase = toString(encrypt_param_keys::kKeyPassphrase),   // decode()
+        .passphrase = SecretBuffer(toString(encrypt_param_keys::kKeyPassphrase)),   // decode()
         .cipher = toString(encrypt_param_keys::kKeyCipher),
         .recoveryPath = toString(encrypt_param_keys::kKeyRecoveryExportPath),
         .tpmToken = toString(encrypt_param_keys::kKeyTPMToken),
+        .sectorSize = 0,
+        .discardData = params.value(encrypt_param_keys::kKeyDiscardData).toBool(),
+        .hwOpal = params.value(encrypt_param_keys::kKeyHwOpal).toBool(),
+        .detachedHeader = params.value(encrypt_param_keys::kKeyDetachedHeader).toBool(),
     };
 }
 
@@ -182,23 +327,162 @@ QString disk_encrypt_utils::bcExpRecFile(const EncryptParams &params)
     return "";
 }
 
-QString disk_encrypt_utils::bcGenRecKey()
+QString disk_encrypt_utils::bcCreateMemFile(const QString &name, qint64 size)
 {
-    QString recKey;
-    QLibrary lib("usec-recoverykey");
-    dfmbase::FinallyUtil finalClear([&] { if (lib.isLoaded()) lib.unload(); });
+    int fd = memfd_create(name.toStdString().c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    CHECK_INT(fd, "cannot create memfd " + name + strerror(errno), "");
+
+    // header files never change in size, seal it so no one can grow it.
+    if (ftruncate(fd, size) != 0
+        || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        qWarning() << "cannot setup memfd" << name << strerror(errno);
+        close(fd);
+        return "";
+    }
+    return QString("/proc/self/fd/%1").arg(fd);
+}
 
-    if (!lib.load()) {
-        qWarning() << "libusec-recoverykey load failed. use uuid as recovery key";
-        return recKey;
+QString disk_encrypt_utils::bcCopyToMemFile(const QString &name, const QString &src)
+{
+    int srcFd = open(src.toStdString().c_str(), O_RDONLY | O_CLOEXEC);
+    CHECK_INT(srcFd, "cannot open file " + src + strerror(errno), "");
+    dfmbase::FinallyUtil finalClear([&] { close(srcFd); });
+
+    struct stat st;
+    CHECK_INT(fstat(srcFd, &st), "cannot stat file " + src, "");
+
+    QString memPath = bcCreateMemFile(name, st.st_size);
+    if (memPath.isEmpty())
+        return "";
+
+    int memFd = memPath.mid(int(strlen("/proc/self/fd/"))).toInt();
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        ssize_t bytes = sendfile(memFd, srcFd, &offset, size_t(st.st_size - offset));
+        if (bytes <= 0) {
+            qWarning() << "cannot copy file into memory" << src << strerror(errno);
+            bcCloseMemFile(memPath);
+            return "";
+        }
+    }
+    return memPath;
+}
+
+void disk_encrypt_utils::bcCloseMemFile(const QString &path)
+{
+    static const QString kFdPrefix { "/proc/self/fd/" };
+    if (!path.startsWith(kFdPrefix))
+        return;
+
+    bool ok = false;
+    int fd = path.mid(kFdPrefix.length()).toInt(&ok);
+    if (ok && fd > 2)
+        close(fd);
+}
+
+static QString partUUIDOf(const QString &device)
+{
+    const QString &target = QFileInfo(device).canonicalFilePath();
+    const QFileInfoList &links = QDir("/dev/disk/by-partuuid").entryInfoList(QDir::System | QDir::NoDotAndDotDot);
+    for (const auto &link : links) {
+        if (link.canonicalFilePath() == target)
+            return link.fileName();
     }
+    return "";
+}
 
+QString disk_encrypt_utils::bcDetachedHeaderPath(const QString &device)
+{
+    static constexpr char kHeaderDir[] { "/boot/usec-crypt/headers" };
+    const QString &partUUID = partUUIDOf(device);
+    return partUUID.isEmpty() ? "" : QString("%1/%2.luks2").arg(kHeaderDir, partUUID);
+}
+
+QString disk_encrypt_utils::bcDecryptHeaderPath(const QString &device)
+{
+    // the device name might change with a reboot, the partition uuid won't.
+    const QString &partUUID = partUUIDOf(device);
+    return QString("%1/%2.luks2").arg(kDecryptHeaderDir, partUUID.isEmpty() ? device.mid(5) : partUUID);
+}
+
+int disk_encrypt_utils::bcChooseSectorSize(const EncryptParams &params)
+{
+    return params.sectorSize > 0
+            ? params.sectorSize
+            : block_device_utils::bcGetSectorSize(params.device);
+}
+
+QString disk_encrypt_utils::bcHeaderDevice(const QString &device)
+{
+    const QString &decryptHeader = bcDecryptHeaderPath(device);
+    if (QFile::exists(decryptHeader))
+        return decryptHeader;
+    const QString &header = bcDetachedHeaderPath(device);
+    return (!header.isEmpty() && QFile::exists(header)) ? header : device;
+}
+
+QVariantMap disk_encrypt_utils::bcBenchmarkCiphers()
+{
+    static QMutex mtx;
+    static QVariantMap results;
+
+    // the cpu won't change during runtime, benchmark only once.
+    QMutexLocker locker(&mtx);
+    if (!results.isEmpty())
+        return results;
+
+    static const QStringList kCandidates { "aes", "sm4" };
+    static constexpr size_t kBufferSize { 1024 * 1024 };
+    static constexpr size_t kIVSize { 16 };
+    for (const auto &candidate : kCandidates) {
+        QString cipher, mode;
+        int keyLen;
+        parseCipher(candidate, &cipher, &mode, &keyLen);
+
+        // the benchmark takes the cipher mode without iv generator.
+        std::string cMode = mode.section('-', 0, 0).toStdString();
+        double encMbs = 0, decMbs = 0;
+        int ret = crypt_benchmark(nullptr,
+                                  cipher.toStdString().c_str(),
+                                  cMode.c_str(),
+                                  size_t(keyLen / 8),
+                                  kIVSize,
+                                  kBufferSize,
+                                  &encMbs,
+                                  &decMbs);
+        if (ret < 0) {
+            qWarning() << "benchmark cipher failed:" << cipher << mode << ret;
+            continue;
+        }
+        qInfo() << "benchmark cipher" << cipher << mode << keyLen
+                << "encryption:" << encMbs << "MiB/s"
+                << "decryption:" << decMbs << "MiB/s";
+        results.insert(candidate, encMbs);
+    }
+    return results;
+}
+
+QString disk_encrypt_utils::bcGenRecKey()
+{
     typedef int (*FnGenKey)(char *, const size_t, const size_t);
-    FnGenKey fn = (FnGenKey)(lib.resolve("usec_get_recovery_key"));
-    if (!fn) {
-        qWarning() << "libusec-recoverykey resolve failed. use uuid as recovery key";
+    // resolved once, the library stays loaded for the life of daemon.
+    static const FnGenKey fn = [] {
+        QLibrary lib("usec-recoverykey");
+        if (!lib.load()) {
+            qWarning() << "libusec-recoverykey load failed. use uuid as recovery key";
+            return FnGenKey(nullptr);
+        }
+        FnGenKey genKey = (FnGenKey)(lib.resolve("usec_get_recovery_key"));
+        if (!genKey) {
+            qWarning() << "libusec-recoverykey resolve failed. use uuid as recovery key";
+            lib.unload();
+        }
+        return genKey;
+    }();
+
+    QString recKey;
+    if (!fn)
         return recKey;
-    }
 
     static const size_t kRecoveryKeySize = 24;
     char genKey[kRecoveryKeySize + 1];
@@ -213,7 +497,8 @@ QString disk_encrypt_utils::bcGenRecKey()
 }
 
 int disk_encrypt_funcs::bcInitHeaderFile(const EncryptParams &params,
-                                         QString &headerPath, int *keyslotCipher, int *keyslotRecKey)
+                                         QString &headerPath, int *keyslotCipher, int *keyslotRecKey,
+                                         JobContext *ctx)
 {
     if (!disk_encrypt_utils::bcValidateParams(params))
         return -kErrorParamsInvalid;
@@ -226,18 +511,29 @@ int disk_encrypt_funcs::bcInitHeaderFile(const EncryptParams &params,
         return -kErrorDeviceEncrypted;
     }
 
+    if (disk_encrypt_utils::bcHeaderDevice(params.device) != params.device) {
+        qWarning() << "device is encrypted with detached header:" << params.device;
+        return -kErrorDeviceEncrypted;
+    }
+
     if (block_device_utils::bcIsMounted(params.device)) {
         qWarning() << "device is already mounted, cannot encrypt";
         return -kErrorDeviceMounted;
     }
 
-    int err = bcDoSetupHeader(params, &headerPath, keyslotCipher, keyslotRecKey);
+    int err = bcDoSetupHeader(params, &headerPath, keyslotCipher, keyslotRecKey, ctx);
     return err;
 }
 
-int disk_encrypt_funcs::bcDoSetupHeader(const EncryptParams &params, QString *headerPath, int *keyslotCipher, int *keyslotRecKey)
+int disk_encrypt_funcs::bcDoSetupHeader(const EncryptParams &params, QString *headerPath, int *keyslotCipher, int *keyslotRecKey,
+                                        JobContext *ctx)
 {
     Q_ASSERT(headerPath && keyslotCipher && keyslotRecKey);
+    JobContext localCtx;
+    if (!ctx) {
+        localCtx.device = params.device;
+        ctx = &localCtx;
+    }
 
     QString localPath;
     int ret = 0;
@@ -245,18 +541,26 @@ int disk_encrypt_funcs::bcDoSetupHeader(const EncryptParams &params, QString *he
     if (localPath.isEmpty())
         return -kErrorCreateHeader;
 
-    fs_resize::shrinkFileSystem_ext(params.device);
+    // probe the device before it's been touched, the profile is reused when resuming.
+    JobPhase phase(ctx, "probe");
+    const quint32 activateFlags = tuning_utils::bcActivateFlags(tuning_utils::bcGetProfile(params.device));
+    int sectorSize = disk_encrypt_utils::bcChooseSectorSize(params);
+
+    phase.next("shrink_fs");
+    ctx->progress.reset(params.device, "fsck");
+    fs_resize::shrinkFileSystem_ext(params.device, resizeProgress(ctx, true));
 
     struct crypt_device *cdev { nullptr };
 
     dfmbase::FinallyUtil finalClear([&] {
         if (cdev) crypt_free(cdev);
         if (ret < 0) {
-            ::remove(localPath.toStdString().c_str());
-            fs_resize::expandFileSystem_ext(params.device);
+            disk_encrypt_utils::bcCloseMemFile(localPath);
+            fs_resize::expandFileSystem_ext(params.device, resizeProgress(ctx, true));
         }
     });
 
+    phase.next("format");
     ret = crypt_init(&cdev, localPath.toStdString().c_str());
     CHECK_INT(ret, "init crypt failed " + params.device, -kErrorInitCrypt);
 
@@ -268,13 +572,13 @@ int disk_encrypt_funcs::bcDoSetupHeader(const EncryptParams &params, QString *he
     QString cipher, mode;
     int keyLen;
     parseCipher(params.cipher, &cipher, &mode, &keyLen);
-    qDebug() << "encrypt with cipher:" << cipher << mode << keyLen;
+    qDebug() << "encrypt with cipher:" << cipher << mode << keyLen << "sector size:" << sectorSize;
 
     std::string cDevice = params.device.toStdString();
     struct crypt_params_luks2 luks2Params = {
         .data_alignment = 0,
         .data_device = cDevice.c_str(),
-        .sector_size = 512,
+        .sector_size = uint32_t(sectorSize),
         .label = nullptr,
         .subsystem = nullptr
     };
@@ -288,62 +592,405 @@ int disk_encrypt_funcs::bcDoSetupHeader(const EncryptParams &params, QString *he
                        &luks2Params);
     CHECK_INT(ret, "format failed " + params.device, -kErrorFormatLuks);
 
-    ret = crypt_keyslot_add_by_volume_key(cdev,
-                                          CRYPT_ANY_SLOT,
-                                          nullptr,
-                                          0,
-                                          params.passphrase.toStdString().c_str(),
-                                          params.passphrase.length());
+    // every later activation gets the flags from header.
+    if (activateFlags != 0) {
+        ret = crypt_persistent_flags_set(cdev, CRYPT_FLAGS_ACTIVATION, activateFlags);
+        if (ret < 0)
+            qWarning() << "cannot persist activation flags" << params.device << activateFlags << ret;
+    }
+
+    // the pbkdf of keyslots.
+    phase.next("add_keyslots");
+    const PbkdfProfile &pbkdf = pbkdf_utils::bcApply(cdev, params.device);
+    ret = governed(ResourceCost::ofNewKeyslot(cdev), ResourceGovernor::kPbkdf, "add_keyslot", [&] {
+        return crypt_keyslot_add_by_volume_key(cdev,
+                                               CRYPT_ANY_SLOT,
+                                               nullptr,
+                                               0,
+                                               params.passphrase.data(),
+                                               params.passphrase.size());
+    });
     CHECK_INT(ret, "add key failed " + params.device, -kErrorAddKeyslot);
     *keyslotCipher = ret;
+    pbkdf_utils::bcRecord(params.device, ret, "encrypt", pbkdf);
 
     QString recKey = disk_encrypt_utils::bcExpRecFile(params);
     if (!recKey.isEmpty()) {
-        ret = crypt_keyslot_add_by_volume_key(cdev,
-                                              CRYPT_ANY_SLOT,
-                                              nullptr,
-                                              0,
-                                              recKey.toStdString().c_str(),
-                                              recKey.length());
+        const SecretBuffer recKeySecret(recKey);
+        ret = governed(ResourceCost::ofNewKeyslot(cdev), ResourceGovernor::kPbkdf, "add_keyslot", [&] {
+            return crypt_keyslot_add_by_volume_key(cdev,
+                                                   CRYPT_ANY_SLOT,
+                                                   nullptr,
+                                                   0,
+                                                   recKeySecret.data(),
+                                                   recKeySecret.size());
+        });
         if (ret < 0) {
             qWarning() << "add recovery key failed:"
                        << params.device
                        << ret;
+        } else {
+            pbkdf_utils::bcRecord(params.device, ret, "recovery_key", pbkdf);
         }
         *keyslotRecKey = ret;
     }
 
-    ret = crypt_reencrypt_init_by_passphrase(cdev,
-                                             nullptr,
-                                             params.passphrase.toStdString().c_str(),
-                                             params.passphrase.length(),
-                                             CRYPT_ANY_SLOT,
-                                             0,
-                                             cipher.toStdString().c_str(),
-                                             mode.toStdString().c_str(),
-                                             encryptParams());
+    // the volume key is still in memory after format, the job keyslot saves
+    // the pbkdf of user passphrase in the following unlocks.
+    int unlockSlot = 0;
+    if (addJobKeyslot(cdev, ctx) >= 0)
+        unlockSlot = ctx->unlockKeyslot;
+    const SecretBuffer &secret = unlockSecret(ctx, params.passphrase);
+
+    phase.next("init_reencrypt");
+    struct crypt_params_luks2 reencLuks2 = { .sector_size = uint32_t(sectorSize) };
+    auto reencParams = encryptParams(&reencLuks2);
+    ret = governed(ResourceCost::ofKeyslot(cdev, unlockSlot), ResourceGovernor::kPbkdf, "init_reencrypt", [&] {
+        return crypt_reencrypt_init_by_passphrase(cdev,
+                                                  nullptr,
+                                                  secret.data(),
+                                                  secret.size(),
+                                                  CRYPT_ANY_SLOT,
+                                                  unlockSlot,
+                                                  cipher.toStdString().c_str(),
+                                                  mode.toStdString().c_str(),
+                                                  &reencParams);
+    });
     CHECK_INT(ret, "init reencryption failed " + params.device, -kErrorInitReencrypt);
 
     // active device for expanding fs.
+    phase.next("expand_fs");
     QString activeDev = QString("dm-%1").arg(params.device.mid(5));
-    ret = crypt_activate_by_passphrase(cdev,
-                                       activeDev.toStdString().c_str(),
-                                       CRYPT_ANY_SLOT,
-                                       params.passphrase.toStdString().c_str(),
-                                       params.passphrase.length(),
-                                       CRYPT_ACTIVATE_NO_JOURNAL);
+    ret = governed(ResourceCost::ofKeyslot(cdev, unlockSlot), ResourceGovernor::kPbkdf, "activate", [&] {
+        return crypt_activate_by_passphrase(cdev,
+                                            activeDev.toStdString().c_str(),
+                                            unlockSlot,
+                                            secret.data(),
+                                            secret.size(),
+                                            CRYPT_ACTIVATE_NO_JOURNAL | activateFlags);
+    });
     CHECK_INT(ret, "acitve device failed " + params.device + activeDev, -kErrorActive);
 
-    fs_resize::expandFileSystem_ext(QString("/dev/mapper/%1").arg(activeDev));
+    fs_resize::expandFileSystem_ext(QString("/dev/mapper/%1").arg(activeDev),
+                                    resizeProgress(ctx, true));
     ret = crypt_deactivate(nullptr, activeDev.toStdString().c_str());
     CHECK_INT(ret, "deacitvi device failed " + params.device, -kErrorDeactive);
 
+    // no one would resume with the key.
+    if (ctx == &localCtx)
+        removeJobKeyslot(cdev, ctx);
+
     *headerPath = localPath;
     return kSuccess;
 }
 
+// the locking range of drive protects the data, opal needs an admin pin
+// to take the range, the passphrase of user is the pin here.
+static int formatOpal(struct crypt_device *cdev, const EncryptParams &params,
+                      struct crypt_params_luks2 *luks2Params)
+{
+#ifdef CRYPT_OPAL_HW_ONLY
+    struct crypt_params_hw_opal opalParams = {
+        .admin_key = params.passphrase.data(),
+        .admin_key_size = params.passphrase.size(),
+        .user_key_size = 32,
+    };
+    // no cipher means the drive encrypts the data alone.
+    int ret = crypt_format_luks2_opal(cdev,
+                                      nullptr,
+                                      nullptr,
+                                      nullptr,
+                                      nullptr,
+                                      0,
+                                      luks2Params,
+                                      &opalParams);
+    if (ret == 0)
+        qInfo() << "device is formatted as hardware opal segment" << params.device;
+    return ret;
+#else
+    Q_UNUSED(cdev)
+    Q_UNUSED(params)
+    Q_UNUSED(luks2Params)
+    return -ENOTSUP;
+#endif
+}
+
+int disk_encrypt_funcs::bcFormatEncryptDevice(const EncryptParams &params, int *keyslotCipher, int *keyslotRecKey,
+                                              JobContext *ctx)
+{
+    Q_ASSERT(keyslotCipher && keyslotRecKey);
+    JobContext localCtx;
+    if (!ctx) {
+        localCtx.device = params.device;
+        ctx = &localCtx;
+    }
+
+    if (!disk_encrypt_utils::bcValidateParams(params))
+        return -kErrorParamsInvalid;
+    if (block_device_utils::bcDevEncryptVersion(params.device) != kNotEncrypted)
+        return -kErrorDeviceEncrypted;
+    if (block_device_utils::bcIsMounted(params.device))
+        return -kErrorDeviceMounted;
+
+    // the recreated fs keeps the identity, so fstab and users see no change.
+    QString fsUUID, fsLabel;
+    if (!fs_resize::isEmptyFileSystem_ext(params.device, &fsUUID, &fsLabel) && !params.discardData) {
+        qWarning() << "device is not empty, cannot format it" << params.device;
+        return -kErrorParamsInvalid;
+    }
+
+    JobPhase phase(ctx, "format");
+    const quint32 activateFlags = tuning_utils::bcActivateFlags(tuning_utils::bcGetProfile(params.device));
+    int sectorSize = disk_encrypt_utils::bcChooseSectorSize(params);
+
+    struct crypt_device *cdev { nullptr };
+    dfmbase::FinallyUtil finalClear([&] {
+        if (cdev) crypt_free(cdev);
+        CryptDeviceCache::instance()->invalidate(params.device);
+    });
+
+    int ret = crypt_init(&cdev, params.device.toStdString().c_str());
+    CHECK_INT(ret, "init crypt failed " + params.device, -kErrorInitCrypt);
+    crypt_set_rng_type(cdev, CRYPT_RNG_RANDOM);
+
+    QString cipher, mode;
+    int keyLen;
+    parseCipher(params.cipher, &cipher, &mode, &keyLen);
+    struct crypt_params_luks2 luks2Params = { .sector_size = uint32_t(sectorSize) };
+
+    bool hwOpal = params.hwOpal && block_device_utils::bcIsOpalSupported(params.device);
+    if (hwOpal) {
+        ret = formatOpal(cdev, params, &luks2Params);
+        if (ret < 0) {
+            qWarning() << "opal format failed, fall back to dm-crypt" << params.device << ret;
+            crypt_free(cdev);
+            cdev = nullptr;
+            ret = crypt_init(&cdev, params.device.toStdString().c_str());
+            CHECK_INT(ret, "init crypt failed " + params.device, -kErrorInitCrypt);
+            crypt_set_rng_type(cdev, CRYPT_RNG_RANDOM);
+            hwOpal = false;
+        }
+    }
+
+    if (!hwOpal) {
+        ret = crypt_format(cdev,
+                           CRYPT_LUKS2,
+                           cipher.toStdString().c_str(),
+                           mode.toStdString().c_str(),
+                           nullptr,
+                           nullptr,
+                           keyLen / 8,
+                           &luks2Params);
+        CHECK_INT(ret, "format failed " + params.device, -kErrorFormatLuks);
+    }
+
+    // the drive does the crypto of opal segment, dm-crypt flags make no sense.
+    if (activateFlags != 0 && !hwOpal) {
+        ret = crypt_persistent_flags_set(cdev, CRYPT_FLAGS_ACTIVATION, activateFlags);
+        if (ret < 0)
+            qWarning() << "cannot persist activation flags" << params.device << activateFlags << ret;
+    }
+
+    phase.next("add_keyslots");
+    const PbkdfProfile &pbkdf = pbkdf_utils::bcApply(cdev, params.device);
+    ret = governed(ResourceCost::ofNewKeyslot(cdev), ResourceGovernor::kPbkdf, "add_keyslot", [&] {
+        return crypt_keyslot_add_by_volume_key(cdev,
+                                               CRYPT_ANY_SLOT,
+                                               nullptr,
+                                               0,
+                                               params.passphrase.data(),
+                                               params.passphrase.size());
+    });
+    CHECK_INT(ret, "add key failed " + params.device, -kErrorAddKeyslot);
+    *keyslotCipher = ret;
+    pbkdf_utils::bcRecord(params.device, ret, "format", pbkdf);
+
+    QString recKey = disk_encrypt_utils::bcExpRecFile(params);
+    if (!recKey.isEmpty()) {
+        const SecretBuffer recKeySecret(recKey);
+        ret = governed(ResourceCost::ofNewKeyslot(cdev), ResourceGovernor::kPbkdf, "add_keyslot", [&] {
+            return crypt_keyslot_add_by_volume_key(cdev,
+                                                   CRYPT_ANY_SLOT,
+                                                   nullptr,
+                                                   0,
+                                                   recKeySecret.data(),
+                                                   recKeySecret.size());
+        });
+        if (ret < 0)
+            qWarning() << "add recovery key failed:" << params.device << ret;
+        else
+            pbkdf_utils::bcRecord(params.device, ret, "recovery_key", pbkdf);
+        *keyslotRecKey = ret;
+    }
+
+    phase.next("mkfs");
+    QString activeDev = QString("dm-%1").arg(params.device.mid(5));
+    ret = crypt_activate_by_volume_key(cdev,
+                                       activeDev.toStdString().c_str(),
+                                       nullptr,
+                                       0,
+                                       hwOpal ? 0 : activateFlags);
+    CHECK_INT(ret, "acitve device failed " + params.device + activeDev, -kErrorActive);
+
+    bool formatted = fs_resize::formatFileSystem_ext(QString("/dev/mapper/%1").arg(activeDev), fsUUID, fsLabel);
+    ret = crypt_deactivate(nullptr, activeDev.toStdString().c_str());
+    CHECK_BOOL(formatted, "cannot create filesystem on " + activeDev, -kErrorResizeFs);
+    CHECK_INT(ret, "deacitvi device failed " + params.device, -kErrorDeactive);
+    return kSuccess;
+}
+
+int disk_encrypt_funcs::bcSetupDetachedHeader(const EncryptParams &params, const QString &activeName,
+                                              int *keyslotCipher, int *keyslotRecKey, JobContext *ctx)
+{
+    Q_ASSERT(keyslotCipher && keyslotRecKey);
+    JobContext localCtx;
+    if (!ctx) {
+        localCtx.device = params.device;
+        ctx = &localCtx;
+    }
+
+    if (!disk_encrypt_utils::bcValidateParams(params))
+        return -kErrorParamsInvalid;
+    if (block_device_utils::bcDevEncryptVersion(params.device) != kNotEncrypted)
+        return -kErrorDeviceEncrypted;
+
+    const QString &headerPath = disk_encrypt_utils::bcDetachedHeaderPath(params.device);
+    CHECK_BOOL(!headerPath.isEmpty(), "no partition uuid to name the header of " + params.device, -kErrorParamsInvalid);
+    CHECK_BOOL(!QFile::exists(headerPath), "detached header exists already " + headerPath, -kErrorDeviceEncrypted);
+
+    QDir().mkpath(QFileInfo(headerPath).absolutePath());
+    {
+        QFile header(headerPath);
+        CHECK_BOOL(header.open(QIODevice::WriteOnly), "cannot create header " + headerPath, -kErrorCreateHeader);
+        header.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+    }
+
+    JobPhase phase(ctx, "format");
+    const auto &profile = tuning_utils::bcGetProfile(params.device);
+    const quint32 activateFlags = tuning_utils::bcActivateFlags(profile);
+    int sectorSize = disk_encrypt_utils::bcChooseSectorSize(params);
+
+    int ret = 0;
+    struct crypt_device *cdev { nullptr };
+    dfmbase::FinallyUtil finalClear([&] {
+        if (cdev) crypt_free(cdev);
+        // nothing is written to the device before it's activated.
+        if (ret < 0)
+            QFile::remove(headerPath);
+        CryptDeviceCache::instance()->invalidate(params.device);
+    });
+
+    ret = crypt_init_data_device(&cdev,
+                                 headerPath.toStdString().c_str(),
+                                 params.device.toStdString().c_str());
+    CHECK_INT(ret, "init crypt failed " + params.device, -kErrorInitCrypt);
+    crypt_set_rng_type(cdev, CRYPT_RNG_RANDOM);
+
+    QString cipher, mode;
+    int keyLen;
+    parseCipher(params.cipher, &cipher, &mode, &keyLen);
+    qDebug() << "encrypt with detached header:" << headerPath << cipher << mode << keyLen << "sector size:" << sectorSize;
+
+    // the data offset is 0 with a detached header.
+    struct crypt_params_luks2 luks2Params = { .sector_size = uint32_t(sectorSize) };
+    ret = crypt_format(cdev,
+                       CRYPT_LUKS2,
+                       cipher.toStdString().c_str(),
+                       mode.toStdString().c_str(),
+                       nullptr,
+                       nullptr,
+                       keyLen / 8,
+                       &luks2Params);
+    CHECK_INT(ret, "format failed " + params.device, -kErrorFormatLuks);
+
+    if (activateFlags != 0) {
+        ret = crypt_persistent_flags_set(cdev, CRYPT_FLAGS_ACTIVATION, activateFlags);
+        if (ret < 0)
+            qWarning() << "cannot persist activation flags" << params.device << activateFlags << ret;
+    }
+
+    phase.next("add_keyslots");
+    const PbkdfProfile &pbkdf = pbkdf_utils::bcApply(cdev, params.device);
+    ret = governed(ResourceCost::ofNewKeyslot(cdev), ResourceGovernor::kPbkdf, "add_keyslot", [&] {
+        return crypt_keyslot_add_by_volume_key(cdev,
+                                               CRYPT_ANY_SLOT,
+                                               nullptr,
+                                               0,
+                                               params.passphrase.data(),
+                                               params.passphrase.size());
+    });
+    CHECK_INT(ret, "add key failed " + params.device, -kErrorAddKeyslot);
+    *keyslotCipher = ret;
+    pbkdf_utils::bcRecord(params.device, ret, "encrypt_detached", pbkdf);
+
+    QString recKey = disk_encrypt_utils::bcExpRecFile(params);
+    if (!recKey.isEmpty()) {
+        const SecretBuffer recKeySecret(recKey);
+        ret = governed(ResourceCost::ofNewKeyslot(cdev), ResourceGovernor::kPbkdf, "add_keyslot", [&] {
+            return crypt_keyslot_add_by_volume_key(cdev,
+                                                   CRYPT_ANY_SLOT,
+                                                   nullptr,
+                                                   0,
+                                                   recKeySecret.data(),
+                                                   recKeySecret.size());
+        });
+        if (ret < 0)
+            qWarning() << "add recovery key failed:" << params.device << ret;
+        else
+            pbkdf_utils::bcRecord(params.device, ret, "recovery_key", pbkdf);
+        *keyslotRecKey = ret;
+    }
+
+    int unlockSlot = CRYPT_ANY_SLOT;
+    if (addJobKeyslot(cdev, ctx) >= 0)
+        unlockSlot = ctx->unlockKeyslot;
+    const SecretBuffer &secret = unlockSecret(ctx, params.passphrase);
+
+    // no data shift, the hotzone is protected by checksums or a journal.
+    phase.next("init_reencrypt");
+    struct crypt_params_luks2 reencLuks2 = { .sector_size = uint32_t(sectorSize) };
+    struct crypt_params_reencrypt reencParams = {
+        .mode = CRYPT_REENCRYPT_ENCRYPT,
+        .direction = CRYPT_REENCRYPT_FORWARD,
+        .resilience = tuning_utils::bcResilienceName(profile.resilience),
+        .hash = "sha256",
+        .data_shift = 0,
+        .max_hotzone_size = hotzoneSectors(profile),
+        .device_size = 0,
+        .luks2 = &reencLuks2,
+        .flags = CRYPT_REENCRYPT_INITIALIZE_ONLY
+    };
+    ret = governed(ResourceCost::ofKeyslot(cdev, unlockSlot), ResourceGovernor::kPbkdf, "init_reencrypt", [&] {
+        return crypt_reencrypt_init_by_passphrase(cdev,
+                                                  nullptr,
+                                                  secret.data(),
+                                                  secret.size(),
+                                                  CRYPT_ANY_SLOT,
+                                                  unlockSlot,
+                                                  cipher.toStdString().c_str(),
+                                                  mode.toStdString().c_str(),
+                                                  &reencParams);
+    });
+    CHECK_INT(ret, "init reencryption failed " + params.device, -kErrorInitReencrypt);
+
+    // the file systems are mounted on the cleartext device during the job.
+    phase.next("activate");
+    ret = governed(ResourceCost::ofKeyslot(cdev, unlockSlot), ResourceGovernor::kPbkdf, "activate", [&] {
+        return crypt_activate_by_passphrase(cdev,
+                                            activeName.toStdString().c_str(),
+                                            unlockSlot,
+                                            secret.data(),
+                                            secret.size(),
+                                            activateFlags);
+    });
+    CHECK_INT(ret, "acitve device failed " + params.device + activeName, -kErrorActive);
+
+    if (ctx == &localCtx)
+        removeJobKeyslot(cdev, ctx);
+    return kSuccess;
+}
+
 int disk_encrypt_funcs::bcInitHeaderDevice(const QString &device,
-                                           const QString &passphrase,
                                            const QString &headerPath)
 {
     Q_ASSERT_X(!headerPath.isEmpty() && !device.isEmpty(),
@@ -352,7 +999,8 @@ int disk_encrypt_funcs::bcInitHeaderDevice(const QString &device,
     struct crypt_device *cdev { nullptr };
     dfmbase::FinallyUtil finalClear([&] {
         if (cdev) crypt_free(cdev);
-        if (!headerPath.isEmpty()) ::remove(headerPath.toStdString().c_str());
+        disk_encrypt_utils::bcCloseMemFile(headerPath);
+        CryptDeviceCache::instance()->invalidate(device);
     });
 
     int ret = crypt_init(&cdev, device.toStdString().c_str());
@@ -368,36 +1016,46 @@ int disk_encrypt_funcs::bcInitHeaderDevice(const QString &device,
 int disk_encrypt_funcs::bcPrepareHeaderFile(const QString &device, QString *headerPath)
 {
     Q_ASSERT(headerPath);
-    QString localPath = QString("/tmp/%1_luks2_pre_enc").arg(device.mid(5));
-    int fd = open(localPath.toStdString().c_str(),
-                  O_CREAT | O_EXCL | O_WRONLY,
-                  S_IRUSR | S_IWUSR);
-    CHECK_INT(fd, "create tmp file failed " + device + strerror(errno), -kErrorOpenFileFailed);
-
-    int ret = posix_fallocate(fd, 0, 32 * 1024 * 1024);
-    close(fd);
-    CHECK_BOOL(ret == 0, "allocate file failed " + localPath, -kErrorCreateHeader);
+    QString localPath = disk_encrypt_utils::bcCreateMemFile(device.mid(5) + "_luks2_pre_enc", 32 * 1024 * 1024);
+    CHECK_BOOL(!localPath.isEmpty(), "create header file failed " + device, -kErrorCreateHeader);
     *headerPath = localPath;
     return kSuccess;
 }
 
 int disk_encrypt_funcs::bcDecryptDevice(const QString &device,
-                                        const QString &passphrase)
+                                        const SecretBuffer &passphrase,
+                                        JobContext *ctx)
 {
-    // backup header first
-    QString headerPath;
+    JobContext localCtx;
+    if (!ctx) {
+        localCtx.device = device;
+        ctx = &localCtx;
+    }
+    ctx->progress.reset(device, "decrypt");
+
+    // a paused or interrupted decryption continues on its header backup.
+    QString headerPath = disk_encrypt_utils::bcDecryptHeaderPath(device);
+    const bool resuming = QFile::exists(headerPath);
+    ctx->headerPath.clear();
+    const QString &detachedHeader = disk_encrypt_utils::bcDetachedHeaderPath(device);
+    const bool detached = !detachedHeader.isEmpty() && QFile::exists(detachedHeader);
+
     uint32_t flags;
     struct crypt_device *cdev = nullptr;
     dfmbase::FinallyUtil finalClear([&] {
         if (cdev) crypt_free(cdev);
-        if (!headerPath.isEmpty()) ::remove(headerPath.toStdString().c_str());
-        gCurrDecryptintDevice.clear();
+        CryptDeviceCache::instance()->invalidate(device);
     });
-    gCurrDecryptintDevice = device;
 
-    int ret = bcBackupCryptHeader(device, headerPath);
-    CHECK_INT(ret, "backup header failed " + device, -kErrorBackupHeader);
+    int ret = 0;
+    JobPhase phase(ctx, "backup_header");
+    if (!resuming) {
+        // backup header first
+        ret = bcBackupCryptHeader(device, headerPath);
+        CHECK_INT(ret, "backup header failed " + device, -kErrorBackupHeader);
+    }
 
+    phase.next("load_header");
     ret = crypt_init_data_device(&cdev,
                                  headerPath.toStdString().c_str(),
                                  device.toStdString().c_str());
@@ -406,66 +1064,131 @@ int disk_encrypt_funcs::bcDecryptDevice(const QString &device,
     ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
     CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
 
+#ifdef CRYPT_OPAL_HW_ONLY
+    // the data of a hardware segment is never visible in plain, it cannot be
+    // reencrypted.
+    CHECK_BOOL(crypt_get_hw_encryption_type(cdev) != CRYPT_OPAL_HW_ONLY,
+               "cannot decrypt hardware encrypted device " + device,
+               -kErrorParamsInvalid);
+#endif
+
     ret = crypt_persistent_flags_get(cdev,
                                      CRYPT_FLAGS_REQUIREMENTS,
                                      &flags);
     CHECK_INT(ret, "get device flag failed " + device, -kErrorGetReencryptFlag);
     bool underEncrypting = (flags & CRYPT_REQUIREMENT_OFFLINE_REENCRYPT) || (flags & CRYPT_REQUIREMENT_ONLINE_REENCRYPT);
-    CHECK_BOOL(!underEncrypting,
+    CHECK_BOOL(underEncrypting == resuming,
                "device is under encrypting... " + device + " the flags are: " + QString::number(flags),
                -kErrorWrongFlags);
 
-    ret = crypt_reencrypt_init_by_passphrase(cdev,
-                                             nullptr,
-                                             passphrase.toStdString().c_str(),
-                                             passphrase.length(),
-                                             CRYPT_ANY_SLOT,
-                                             CRYPT_ANY_SLOT,
-                                             nullptr,
-                                             nullptr,
-                                             decryptParams());
+    phase.next("init_reencrypt");
+    const auto &profile = tuning_utils::bcGetProfile(device);
+    auto reencParams = resuming ? resumeParams(profile) : decryptParams(profile);
+    ret = governed(ResourceCost::ofKeyslot(cdev, CRYPT_ANY_SLOT), ResourceGovernor::kPbkdf, "init_reencrypt", [&] {
+        return crypt_reencrypt_init_by_passphrase(cdev,
+                                                  nullptr,
+                                                  passphrase.data(),
+                                                  passphrase.size(),
+                                                  CRYPT_ANY_SLOT,
+                                                  CRYPT_ANY_SLOT,
+                                                  nullptr,
+                                                  nullptr,
+                                                  &reencParams);
+    });
     CHECK_INT(ret, "init reencrypt failed " + device, -kErrorWrongPassphrase);
 
-    ret = crypt_reencrypt(cdev, bcDecryptProgress);
+    phase.next("decrypt");
+    ret = governed(ResourceCost::ofReencrypt(reencParams.max_hotzone_size * 512), ResourceGovernor::kReencrypt, "reencrypt", [&] {
+        return crypt_reencrypt_run(cdev, bcDecryptProgress, ctx);
+    });
     CHECK_INT(ret, "decrypt failed" + device, -kErrorReencryptFailed);
+    if (ctx->interrupted) {
+        qInfo() << "decryption is paused" << device;
+        ctx->headerPath = headerPath;
+        return -kErrorJobPaused;
+    }
 
-    bool res = fs_resize::recoverySuperblock_ext(device, headerPath);
-    CHECK_BOOL(res, "recovery fs failed " + device, -kErrorResizeFs);
+    // the data of a detached header device is not shifted.
+    if (detached) {
+        if (!QFile::remove(detachedHeader))
+            qWarning() << "cannot remove detached header" << detachedHeader;
+    } else {
+        phase.next("recover_fs");
+        bool res = fs_resize::recoverySuperblock_ext(device, headerPath, resizeProgress(ctx, false));
+        // the backup is kept, it's the only header left of the device.
+        CHECK_BOOL(res, "recovery fs failed " + device, -kErrorResizeFs);
+    }
+
+    if (!QFile::remove(headerPath))
+        qWarning() << "cannot remove decrypt header" << headerPath;
     return 0;
 }
 
+// the backup drives the whole decryption and is the only header once the
+// data is decrypted in place, it must survive a crash or a reboot.
 int disk_encrypt_funcs::bcBackupCryptHeader(const QString &device, QString &headerPath)
 {
-    headerPath = "/tmp/dm_header_" + device.mid(5);
-    struct crypt_device *cdev = nullptr;
-    dfmbase::FinallyUtil finalClear([&] { if (cdev) crypt_free(cdev); });
+    CryptDeviceLease cdev(device);
+    if (!cdev)
+        return cdev.error();
 
-    int ret = crypt_init(&cdev, device.toStdString().c_str());
-    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
+    headerPath = disk_encrypt_utils::bcDecryptHeaderPath(device);
+    CHECK_BOOL(QDir().mkpath(kDecryptHeaderDir), "cannot create " + QString(kDecryptHeaderDir), -kErrorBackupHeader);
+    if (!QFile::setPermissions(kDecryptHeaderDir, QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ExeOwner))
+        qWarning() << "cannot restrict permissions of" << kDecryptHeaderDir;
+
+    // written aside and renamed, a crash never leaves a partial header.
+    const QString &tmpPath = headerPath + ".tmp";
+    ::remove(tmpPath.toStdString().c_str());
+    dfmbase::FinallyUtil finalClear([&] { ::remove(tmpPath.toStdString().c_str()); });
 
-    ret = crypt_header_backup(cdev,
-                              nullptr,
-                              headerPath.toStdString().c_str());
+    int ret = crypt_header_backup(cdev.get(), nullptr, tmpPath.toStdString().c_str());
     CHECK_INT(ret, "backup header failed " + device, -kErrorBackupHeader);
+
+    int fd = open(tmpPath.toStdString().c_str(), O_RDWR | O_CLOEXEC);
+    CHECK_INT(fd, "cannot open header backup " + tmpPath + strerror(errno), -kErrorBackupHeader);
+    ret = fchmod(fd, S_IRUSR | S_IWUSR);
+    if (ret == 0)
+        ret = fsync(fd);
+    close(fd);
+    CHECK_INT(ret, "cannot sync header backup " + tmpPath + strerror(errno), -kErrorBackupHeader);
+
+    ret = rename(tmpPath.toStdString().c_str(), headerPath.toStdString().c_str());
+    CHECK_INT(ret, "cannot save header backup " + headerPath + strerror(errno), -kErrorBackupHeader);
     return 0;
 }
 
 int disk_encrypt_funcs::bcResumeReencrypt(const QString &device,
-                                          const QString &passphrase,
+                                          const SecretBuffer &passphrase,
                                           const QString &clearDev,
-                                          bool expandFs)
+                                          bool expandFs,
+                                          JobContext *ctx)
 {
     qDebug() << "start resume encryption for device"
              << device;
-    gCurrReencryptingDevice = device;
+    JobContext localCtx;
+    if (!ctx) {
+        localCtx.device = device;
+        ctx = &localCtx;
+    }
+    ctx->progress.reset(device);
+
     struct crypt_device *cdev { nullptr };
     dfmbase::FinallyUtil finalClear([&] {
-        if (cdev) crypt_free(cdev);
-        gCurrDecryptintDevice.clear();
+        if (cdev) {
+            // a paused job resumes with the job key later.
+            if (!ctx->interrupted) {
+                removeJobKeyslot(cdev, ctx);
+                removeStaleJobKeyslots(cdev, ctx);
+            }
+            crypt_free(cdev);
+        }
+        CryptDeviceCache::instance()->invalidate(device);
     });
 
+    JobPhase phase(ctx, "load_header");
     int ret = crypt_init_data_device(&cdev,
-                                     device.toStdString().c_str(),
+                                     disk_encrypt_utils::bcHeaderDevice(device).toStdString().c_str(),
                                      device.toStdString().c_str());
     CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
 
@@ -480,37 +1203,63 @@ int disk_encrypt_funcs::bcResumeReencrypt(const QString &device,
     CHECK_BOOL(flags & CRYPT_REQUIREMENT_ONLINE_REENCRYPT,
                "wrong flags " + device + " flags " + QString::number(flags),
                -kErrorWrongFlags);
+    // the jobs interrupted before this one left their keyslots.
+    removeStaleJobKeyslots(cdev, ctx);
 
+    phase.next("init_reencrypt");
     std::string _clearDev = clearDev.toStdString();
     const char *__clearDev = clearDev.isEmpty() ? nullptr : _clearDev.c_str();
-    ret = crypt_reencrypt_init_by_passphrase(cdev,
-                                             __clearDev,
-                                             passphrase.toStdString().c_str(),
-                                             passphrase.length(),
-                                             CRYPT_ANY_SLOT,
-                                             CRYPT_ANY_SLOT,
-                                             nullptr,
-                                             nullptr,
-                                             resumeParams());
+    auto reencParams = resumeParams(tuning_utils::bcGetProfile(device));
+    const SecretBuffer &secret = unlockSecret(ctx, passphrase);
+    int unlockSlot = ctx->unlockKeyslot >= 0 ? ctx->unlockKeyslot : CRYPT_ANY_SLOT;
+    ret = governed(ResourceCost::ofKeyslot(cdev, unlockSlot), ResourceGovernor::kPbkdf, "init_reencrypt", [&] {
+        return crypt_reencrypt_init_by_passphrase(cdev,
+                                                  __clearDev,
+                                                  secret.data(),
+                                                  secret.size(),
+                                                  CRYPT_ANY_SLOT,
+                                                  unlockSlot,
+                                                  nullptr,
+                                                  nullptr,
+                                                  &reencParams);
+    });
     CHECK_INT(ret, "init reencrypt failed " + device, -kErrorInitReencrypt);
 
-    ret = crypt_reencrypt(cdev, bcEncryptProgress);
+    phase.next("reencrypt");
+    ret = governed(ResourceCost::ofReencrypt(reencParams.max_hotzone_size * 512), ResourceGovernor::kReencrypt, "reencrypt", [&] {
+        return crypt_reencrypt_run(cdev, bcEncryptProgress, ctx);
+    });
     CHECK_INT(ret, "start resume failed " + device, -kErrorReencryptFailed);
+    if (ctx->interrupted) {
+        qInfo() << "encryption is paused" << device;
+        return -kErrorJobPaused;
+    }
 
     if (!expandFs)
         return kSuccess;
 
-    // active device for expanding fs.
+    // active device for expanding fs, the persistent flags of header are
+    // merged by libcryptsetup.
+    phase.next("expand_fs");
     QString activeDev = QString("dm-%1").arg(device.mid(5));
-    ret = crypt_activate_by_passphrase(cdev,
-                                       activeDev.toStdString().c_str(),
-                                       CRYPT_ANY_SLOT,
-                                       passphrase.toStdString().c_str(),
-                                       passphrase.length(),
-                                       CRYPT_ACTIVATE_NO_JOURNAL);
+    ret = governed(ResourceCost::ofKeyslot(cdev, unlockSlot), ResourceGovernor::kPbkdf, "activate", [&] {
+        return crypt_activate_by_passphrase(cdev,
+                                            activeDev.toStdString().c_str(),
+                                            unlockSlot,
+                                            secret.data(),
+                                            secret.size(),
+                                            CRYPT_ACTIVATE_NO_JOURNAL);
+    });
     CHECK_INT(ret, "acitve device failed " + device + activeDev, -kErrorActive);
 
-    fs_resize::expandFileSystem_ext(QString("/dev/mapper/%1").arg(activeDev));
+    const QString &mapper = QString("/dev/mapper/%1").arg(activeDev);
+    fs_resize::expandFileSystem_ext(mapper, resizeProgress(ctx, true));
+
+    phase.next("verify");
+    fs_resize::SampleResult sample;
+    if (!fs_resize::sampleFileSystem_ext(mapper, &sample))
+        qCritical() << "sampling the encrypted device found errors" << device << sample.errors;
+    ctx->verification = sample.toVariantMap();
 
     ret = crypt_deactivate(nullptr,
                            activeDev.toStdString().c_str());
@@ -518,100 +1267,100 @@ int disk_encrypt_funcs::bcResumeReencrypt(const QString &device,
     return kSuccess;
 }
 
-int disk_encrypt_funcs::bcEncryptProgress(uint64_t size, uint64_t offset, void *)
+int disk_encrypt_funcs::bcEncryptProgress(uint64_t size, uint64_t offset, void *usrptr)
 {
-    Q_EMIT SignalEmitter::instance()->updateEncryptProgress(gCurrReencryptingDevice,
-                                                            double(offset) / size);
-    return 0;
+    auto ctx = static_cast<JobContext *>(usrptr);
+    Q_ASSERT(ctx);
+    ctx->throttle.pace(offset, ctx->interrupted);
+
+    ProgressInfo info;
+    // a non-zero return stops reencryption at the hotzone boundary.
+    if (!ctx->progress.update(size, offset, &info))
+        return ctx->interrupted ? 1 : 0;
+
+    Q_EMIT SignalEmitter::instance()->updateEncryptProgress(ctx->device, ctx->deviceName,
+                                                            info.progress);
+    Q_EMIT SignalEmitter::instance()->updateEncryptProgressInfo(ctx->device, ctx->deviceName,
+                                                                info.toVariantMap());
+    return ctx->interrupted ? 1 : 0;
 }
 
-int disk_encrypt_funcs::bcDecryptProgress(uint64_t size, uint64_t offset, void *)
+int disk_encrypt_funcs::bcDecryptProgress(uint64_t size, uint64_t offset, void *usrptr)
 {
-    Q_EMIT SignalEmitter::instance()->updateDecryptProgress(gCurrDecryptintDevice,
-                                                            double(offset) / size);
-    return 0;
+    auto ctx = static_cast<JobContext *>(usrptr);
+    Q_ASSERT(ctx);
+    ctx->throttle.pace(offset, ctx->interrupted);
+
+    ProgressInfo info;
+    // a non-zero return stops reencryption at the hotzone boundary.
+    if (!ctx->progress.update(size, offset, &info))
+        return ctx->interrupted ? 1 : 0;
+
+    Q_EMIT SignalEmitter::instance()->updateDecryptProgress(ctx->device, ctx->deviceName,
+                                                            info.progress);
+    Q_EMIT SignalEmitter::instance()->updateDecryptProgressInfo(ctx->device, ctx->deviceName,
+                                                                info.toVariantMap());
+    return ctx->interrupted ? 1 : 0;
 }
 
 int disk_encrypt_funcs::bcChangePassphrase(const QString &device, const QString &oldPassphrase, const QString &newPassphrase, int *keyslot)
 {
-    struct crypt_device *cdev { nullptr };
-    dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
-
-    int ret = crypt_init_data_device(&cdev, device.toStdString().c_str(), nullptr);
-    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
-
-    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
-    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
-
-    ret = crypt_keyslot_change_by_passphrase(cdev,
-                                             CRYPT_ANY_SLOT,
-                                             CRYPT_ANY_SLOT,
-                                             oldPassphrase.toStdString().c_str(),
-                                             oldPassphrase.length(),
-                                             newPassphrase.toStdString().c_str(),
-                                             newPassphrase.length());
+    CryptDeviceLease cdev(device);
+    if (!cdev)
+        return cdev.error();
+
+    const SecretBuffer oldPassphraseSecret(oldPassphrase);
+    const SecretBuffer newPassphraseSecret(newPassphrase);
+    const PbkdfProfile &pbkdf = pbkdf_utils::bcApply(cdev.get(), device);
+    int ret = governed(ResourceCost::ofChange(cdev.get()), ResourceGovernor::kPbkdf, "change_keyslot", [&] {
+        return crypt_keyslot_change_by_passphrase(cdev.get(),
+                                                  CRYPT_ANY_SLOT,
+                                                  CRYPT_ANY_SLOT,
+                                                  oldPassphraseSecret.data(),
+                                                  oldPassphraseSecret.size(),
+                                                  newPassphraseSecret.data(),
+                                                  newPassphraseSecret.size());
+    });
+    if (ret < 0) cdev.discard();
     CHECK_INT(ret, "change passphrase failed " + device, -kErrorChangePassphraseFailed);
     Q_ASSERT(keyslot);
     *keyslot = ret;
+    pbkdf_utils::bcRecord(device, ret, "change_passphrase", pbkdf);
     return kSuccess;
 }
 
 int disk_encrypt_funcs::bcChangePassphraseByRecKey(const QString &device, const QString &recoveryKey, const QString &newPassphrase, int *keyslot)
 {
-    struct crypt_device *cdev { nullptr };
-    dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
-
-    int ret = crypt_init_data_device(&cdev,
-                                     device.toStdString().c_str(),
-                                     /*device.toStdString().c_str()*/ nullptr);
-    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
-
-    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
-    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
-
-    ret = crypt_keyslot_add_by_passphrase(cdev,
-                                          CRYPT_ANY_SLOT,
-                                          recoveryKey.toStdString().c_str(),
-                                          recoveryKey.length(),
-                                          newPassphrase.toStdString().c_str(),
-                                          newPassphrase.length());
+    CryptDeviceLease cdev(device);
+    if (!cdev)
+        return cdev.error();
+
+    const SecretBuffer recoveryKeySecret(recoveryKey);
+    const SecretBuffer newPassphraseSecret(newPassphrase);
+    const PbkdfProfile &pbkdf = pbkdf_utils::bcApply(cdev.get(), device);
+    int ret = governed(ResourceCost::ofChange(cdev.get()), ResourceGovernor::kPbkdf, "change_keyslot", [&] {
+        return crypt_keyslot_add_by_passphrase(cdev.get(),
+                                               CRYPT_ANY_SLOT,
+                                               recoveryKeySecret.data(),
+                                               recoveryKeySecret.size(),
+                                               newPassphraseSecret.data(),
+                                               newPassphraseSecret.size());
+    });
+    if (ret < 0) cdev.discard();
     CHECK_INT(ret, "change passphrase by rec key failed " + device, -kErrorAddKeyslot);
     Q_ASSERT(keyslot);
     *keyslot = ret;
+    pbkdf_utils::bcRecord(device, ret, "change_passphrase_by_reckey", pbkdf);
     return kSuccess;
 }
 
 int disk_encrypt_funcs::bcGetToken(const QString &device, QString *tokenJson)
 {
     Q_ASSERT(tokenJson);
-    struct crypt_device *cdev { nullptr };
-    dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
-
-    int ret = crypt_init(&cdev,
-                         device.toStdString().c_str());
-    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
-
-    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
-    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
-
-    for (int i = 0; i < 32 /* LUKS2_TOKENS_MAX */; ++i) {
-        const char *token { nullptr };
-        if ((ret = crypt_token_json_get(cdev, i, &token)) < 0)
-            continue;
-        QString json(token);
-        if (json.contains("usec-tpm2")) {
-            // qInfo() << "found token:" << json;
-            QJsonDocument doc = QJsonDocument::fromJson(token);
-            QJsonObject obj = doc.object();
-            obj.insert("token_index", i);
-            doc.setObject(obj);
-            *tokenJson = doc.toJson();
-            return kSuccess;
-        }
-    }
-
-    qInfo() << "token not found." << device;
-    return kSuccess;
+    int ret = TokenIndex::instance()->tpmToken(device, tokenJson);
+    if (ret == kSuccess && tokenJson->isEmpty())
+        qInfo() << "token not found." << device;
+    return ret;
 }
 
 int disk_encrypt_funcs::bcSetToken(const QString &device, const QString &token)
@@ -623,44 +1372,37 @@ int disk_encrypt_funcs::bcSetToken(const QString &device, const QString &token)
     QJsonObject obj = doc.object();
     int tokenIndex = obj.value("token_index").toInt(CRYPT_ANY_TOKEN);
 
-    struct crypt_device *cdev { nullptr };
-    dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
+    CryptDeviceLease cdev(device);
+    if (!cdev)
+        return cdev.error();
 
-    int ret = crypt_init(&cdev,
-                         device.toStdString().c_str());
-    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
-
-    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
-    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
-
-    ret = crypt_token_json_set(cdev,
-                               tokenIndex,
-                               token.toStdString().c_str());
+    int ret = crypt_token_json_set(cdev.get(),
+                                   tokenIndex,
+                                   token.toStdString().c_str());
+    TokenIndex::instance()->invalidate(device);
+    if (ret < 0) cdev.discard();
     CHECK_INT(ret, "set token failed " + device, -kErrorSetTokenFailed);
     return 0;
 }
 
 EncryptVersion block_device_utils::bcDevEncryptVersion(const QString &device)
 {
-    auto blkDev = block_device_utils::bcCreateBlkDev(device);
-    if (!blkDev) {
-        qWarning() << "cannot create block device handler:"
+    BlockDeviceState st;
+    if (!BlockDeviceStates::instance()->state(device, &st)) {
+        qWarning() << "cannot get state of block device:"
                    << device;
         return kVersionUnknown;
     }
 
-    const QString &idType = blkDev->getProperty(dfmmount::Property::kBlockIDType).toString();
-    const QString &idVersion = blkDev->getProperty(dfmmount::Property::kBlockIDVersion).toString();
-
-    if (idType == "crypto_LUKS") {
-        if (idVersion == "1")
+    if (st.idType == "crypto_LUKS") {
+        if (st.idVersion == "1")
             return kVersionLUKS1;
-        if (idVersion == "2")
+        if (st.idVersion == "2")
             return kVersionLUKS2;
         return kVersionLUKSUnknown;
     }
 
-    if (blkDev->isEncrypted())
+    if (st.isEncrypted)
         return kVersionUnknown;
 
     // TODO: this should be completed, not only LUKS encrypt.
@@ -690,35 +1432,107 @@ DevPtr block_device_utils::bcCreateBlkDev(const QString &device)
     return blkDev.objectCast<dfmmount::DBlockDevice>();
 }
 
+// returns the block size of ext2/3/4, -1 if not an ext filesystem.
+static int extBlockSize(int fd)
+{
+    static constexpr off_t kSuperBlockOffset { 1024 };
+    static constexpr uint16_t kExtMagic { 0xEF53 };
+
+    unsigned char sb[1024];
+    if (pread(fd, sb, sizeof(sb), kSuperBlockOffset) != sizeof(sb))
+        return -1;
+
+    // s_magic at 0x38, s_log_block_size at 0x18, all little endian.
+    uint16_t magic = uint16_t(sb[0x38] | (sb[0x39] << 8));
+    if (magic != kExtMagic)
+        return -1;
+    uint32_t logBlockSize = uint32_t(sb[0x18] | (sb[0x19] << 8) | (sb[0x1A] << 16) | (uint32_t(sb[0x1B]) << 24));
+    return logBlockSize <= 6 ? (1024 << logBlockSize) : -1;
+}
+
+bool block_device_utils::bcIsOpalSupported(const QString &device)
+{
+#if defined(CRYPT_OPAL_HW_ONLY) && defined(IOC_OPAL_GET_STATUS)
+    int fd = open(device.toStdString().c_str(), O_RDONLY);
+    CHECK_INT(fd, "cannot open device to query opal status " + device, false);
+    dfmbase::FinallyUtil finalClear([&] { close(fd); });
+
+    struct opal_status status {};
+    if (ioctl(fd, IOC_OPAL_GET_STATUS, &status) != 0) {
+        qDebug() << "opal is not supported by" << device << strerror(errno);
+        return false;
+    }
+    return (status.flags & OPAL_FL_SUPPORTED) && (status.flags & OPAL_FL_LOCKING_SUPPORTED);
+#else
+    Q_UNUSED(device)
+    return false;
+#endif
+}
+
+int block_device_utils::bcGetSectorSize(const QString &device)
+{
+    static constexpr int kDefaultSectorSize { 512 };
+    static constexpr int kMaxSectorSize { 4096 };
+
+    int fd = open(device.toStdString().c_str(), O_RDONLY);
+    CHECK_INT(fd, "cannot open device to query block size " + device, kDefaultSectorSize);
+    dfmbase::FinallyUtil finalClear([&] { close(fd); });
+
+    int logicalSize = 0;
+    unsigned int physicalSize = 0;
+    uint64_t devSize = 0;
+    if (ioctl(fd, BLKSSZGET, &logicalSize) != 0
+        || ioctl(fd, BLKPBSZGET, &physicalSize) != 0
+        || ioctl(fd, BLKGETSIZE64, &devSize) != 0) {
+        qWarning() << "cannot query block size of" << device << strerror(errno);
+        return kDefaultSectorSize;
+    }
+
+    // the crypt sector must not be larger than the fs block, otherwise the
+    // fs writes will be rejected by dm-crypt.
+    int fsBlockSize = extBlockSize(fd);
+    if (fsBlockSize <= 0) {
+        qInfo() << "unknown filesystem block size, use default sector size" << device;
+        return kDefaultSectorSize;
+    }
+
+    int sectorSize = qMin(qMax(logicalSize, int(physicalSize)), kMaxSectorSize);
+    sectorSize = qMin(sectorSize, fsBlockSize);
+    // the data segment (and the datashift layout) must be aligned to the sector.
+    while (sectorSize > qMax(logicalSize, kDefaultSectorSize) && devSize % uint64_t(sectorSize) != 0)
+        sectorSize /= 2;
+
+    qInfo() << "block size of" << device
+            << "logical:" << logicalSize
+            << "physical:" << physicalSize
+            << "fs:" << fsBlockSize
+            << "chosen sector size:" << sectorSize;
+    return sectorSize;
+}
+
 bool block_device_utils::bcIsMounted(const QString &device)
 {
-    auto blkDev = block_device_utils::bcCreateBlkDev(device);
-    if (!blkDev) {
-        qWarning() << "cannot create block device handler:"
+    BlockDeviceState st;
+    if (!BlockDeviceStates::instance()->state(device, &st)) {
+        qWarning() << "cannot get state of block device:"
                    << device;
         return false;
     }
-    return !blkDev->mountPoints().isEmpty();
+    return !st.mountPoints.isEmpty();
 }
 
 int block_device_utils::bcDevEncryptStatus(const QString &device, EncryptStatus *status)
 {
     Q_ASSERT(status);
 
-    struct crypt_device *cdev { nullptr };
-    dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
-
-    int ret = crypt_init(&cdev,
-                         device.toStdString().c_str());
-    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
-
-    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
-    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
+    CryptDeviceLease cdev(device);
+    if (!cdev)
+        return cdev.error();
 
     uint32_t flags;
-    ret = crypt_persistent_flags_get(cdev,
-                                     CRYPT_FLAGS_REQUIREMENTS,
-                                     &flags);
+    int ret = crypt_persistent_flags_get(cdev.get(),
+                                         CRYPT_FLAGS_REQUIREMENTS,
+                                         &flags);
     CHECK_INT(ret, "get device flag failed " + device, -kErrorGetReencryptFlag);
 
     *status = kStatusFinished;
@@ -731,25 +1545,290 @@ int block_device_utils::bcDevEncryptStatus(const QString &device, EncryptStatus
     return kSuccess;
 }
 
+int disk_encrypt_funcs::bcCheckPassphrase(const QString &device, const QString &passphrase)
+{
+    CryptDeviceLease cdev(device);
+    if (!cdev)
+        return cdev.error();
+
+    // the keyslot is only unlocked without a name, nothing is activated.
+    const SecretBuffer secret(passphrase);
+    int ret = governed(ResourceCost::ofKeyslot(cdev.get(), CRYPT_ANY_SLOT), ResourceGovernor::kPbkdf, "activate", [&] {
+        return crypt_activate_by_passphrase(cdev.get(), nullptr, CRYPT_ANY_SLOT,
+                                            secret.data(), secret.size(), 0);
+    });
+    CHECK_INT(ret, "wrong passphrase for " + device, -kErrorWrongPassphrase);
+    return kSuccess;
+}
+
 int disk_encrypt_funcs::bcSetLabel(const QString &device, const QString &label)
 {
+    CryptDeviceLease cdev(device);
+    if (!cdev)
+        return cdev.error();
 
-    struct crypt_device *cdev { nullptr };
-    dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
+    int ret = crypt_set_label(cdev.get(), label.toStdString().c_str(), nullptr);
+    if (ret < 0) cdev.discard();
+    CHECK_INT(ret, "set label failed " + device, -kErrorSetLabel);
 
-    int ret = crypt_init(&cdev,
-                         device.toStdString().c_str());
-    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
+    return kSuccess;
+}
 
-    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
-    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
+HeaderTransaction::HeaderTransaction(const QString &device)
+    : device(device)
+{
+}
 
-    ret = crypt_set_label(cdev, label.toStdString().c_str(), nullptr);
-    CHECK_INT(ret, "set label failed " + device, -kErrorSetLabel);
+HeaderTransaction::~HeaderTransaction()
+{
+    rollback();
+}
+
+int HeaderTransaction::begin()
+{
+    Q_ASSERT(!lease);
+    lease.reset(new CryptDeviceLease(device));
+    if (!*lease) {
+        int err = lease->error();
+        lease.reset();
+        return err;
+    }
+    return kSuccess;
+}
+
+static bool sameSecret(const SecretBuffer &a, const SecretBuffer &b)
+{
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// gets the volume key once, so that new keyslots need no more unlocking.
+int HeaderTransaction::unlock(const SecretBuffer &passphrase, int *keyslot)
+{
+    Q_ASSERT(lease && keyslot);
+    // a passphrase staged before is not on device yet, but unlocks the same key.
+    for (const auto &change : qAsConst(changes)) {
+        if (change.type == Change::kAddKeyslot && sameSecret(change.passphrase, passphrase)) {
+            *keyslot = change.index;
+            return kSuccess;
+        }
+    }
+
+    struct crypt_device *cdev = lease->get();
+    char key[512];
+    size_t keySize = sizeof(key);
+    dfmbase::FinallyUtil finalClear([&] { explicit_bzero(key, sizeof(key)); });
+    int ret = governed(ResourceCost::ofKeyslot(cdev, CRYPT_ANY_SLOT), ResourceGovernor::kPbkdf, "unlock_keyslot", [&] {
+        return crypt_volume_key_get(cdev, CRYPT_ANY_SLOT, key, &keySize,
+                                    passphrase.data(), passphrase.size());
+    });
+    CHECK_INT(ret, "wrong passphrase for " + device, -kErrorWrongPassphrase);
+
+    if (volumeKey.isEmpty())
+        volumeKey = SecretBuffer(key, keySize);
+    *keyslot = ret;
+    return kSuccess;
+}
+
+int HeaderTransaction::freeKeyslot() const
+{
+    Q_ASSERT(lease);
+    const int max = crypt_keyslot_max(CRYPT_LUKS2);
+    for (int i = 0; i < max; ++i) {
+        if (crypt_keyslot_status(lease->get(), i) != CRYPT_SLOT_INACTIVE)
+            continue;
+        bool staged = std::any_of(changes.cbegin(), changes.cend(), [i](const Change &change) {
+            return change.type == Change::kAddKeyslot && change.index == i;
+        });
+        if (!staged)
+            return i;
+    }
+    return -1;
+}
+
+int HeaderTransaction::changePassphrase(const SecretBuffer &oldPassphrase, const SecretBuffer &newPassphrase, int *keyslot)
+{
+    Q_ASSERT(keyslot);
+    CHECK_BOOL(lease, "transaction is not began " + device, -kErrorParamsInvalid);
+    int oldKeyslot = -1;
+    int ret = unlock(oldPassphrase, &oldKeyslot);
+    if (ret != kSuccess)
+        return ret;
+
+    int newKeyslot = freeKeyslot();
+    CHECK_BOOL(newKeyslot >= 0, "no free keyslot for " + device, -kErrorChangePassphraseFailed);
+
+    Change add;
+    add.type = Change::kAddKeyslot;
+    add.index = newKeyslot;
+    add.passphrase = newPassphrase;
+    add.error = -kErrorChangePassphraseFailed;
+    changes.append(add);
+
+    // a keyslot staged in this transaction is just not added.
+    auto staged = std::find_if(changes.begin(), changes.end(), [oldKeyslot](const Change &change) {
+        return change.type == Change::kAddKeyslot && change.index == oldKeyslot;
+    });
+    if (staged != changes.end()) {
+        changes.erase(staged);
+    } else {
+        Change destroy;
+        destroy.type = Change::kDestroyKeyslot;
+        destroy.index = oldKeyslot;
+        destroy.error = -kErrorChangePassphraseFailed;
+        changes.append(destroy);
+    }
+
+    *keyslot = newKeyslot;
+    return kSuccess;
+}
+
+int HeaderTransaction::addPassphrase(const SecretBuffer &existPassphrase, const SecretBuffer &newPassphrase, int *keyslot)
+{
+    Q_ASSERT(keyslot);
+    CHECK_BOOL(lease, "transaction is not began " + device, -kErrorParamsInvalid);
+    int existKeyslot = -1;
+    int ret = unlock(existPassphrase, &existKeyslot);
+    if (ret != kSuccess)
+        return ret;
+
+    int newKeyslot = freeKeyslot();
+    CHECK_BOOL(newKeyslot >= 0, "no free keyslot for " + device, -kErrorAddKeyslot);
+
+    Change add;
+    add.type = Change::kAddKeyslot;
+    add.index = newKeyslot;
+    add.passphrase = newPassphrase;
+    add.error = -kErrorAddKeyslot;
+    changes.append(add);
+
+    *keyslot = newKeyslot;
+    return kSuccess;
+}
+
+int HeaderTransaction::setToken(const QString &token)
+{
+    CHECK_BOOL(lease, "transaction is not began " + device, -kErrorParamsInvalid);
+    if (token.isEmpty())
+        return kSuccess;
 
+    // some tokens are single quoted, which libcryptsetup accepts but Qt not.
+    QJsonObject obj = QJsonDocument::fromJson(token.toLocal8Bit()).object();
+    Change change;
+    change.type = Change::kSetToken;
+    change.index = obj.value("token_index").toInt(CRYPT_ANY_TOKEN);
+    change.value = token;
+    change.error = -kErrorSetTokenFailed;
+    changes.append(change);
     return kSuccess;
 }
 
+int HeaderTransaction::setLabel(const QString &label)
+{
+    CHECK_BOOL(lease, "transaction is not began " + device, -kErrorParamsInvalid);
+    Change change;
+    change.type = Change::kSetLabel;
+    change.value = label;
+    change.error = -kErrorSetLabel;
+    changes.append(change);
+    return kSuccess;
+}
+
+int HeaderTransaction::apply(Change *change)
+{
+    struct crypt_device *cdev = lease->get();
+    switch (change->type) {
+    case Change::kAddKeyslot: {
+        const PbkdfProfile &pbkdf = pbkdf_utils::bcApply(cdev, device);
+        int ret = governed(ResourceCost::ofNewKeyslot(cdev), ResourceGovernor::kPbkdf, "add_keyslot", [&] {
+            return crypt_keyslot_add_by_volume_key(cdev, change->index,
+                                                   volumeKey.data(), volumeKey.size(),
+                                                   change->passphrase.data(), change->passphrase.size());
+        });
+        if (ret >= 0)
+            pbkdf_utils::bcRecord(device, ret, "add_keyslot", pbkdf);
+        return ret;
+    }
+    case Change::kDestroyKeyslot:
+        return crypt_keyslot_destroy(cdev, change->index);
+    case Change::kSetToken: {
+        const char *json { nullptr };
+        change->existed = change->index != CRYPT_ANY_TOKEN
+                && crypt_token_json_get(cdev, change->index, &json) >= 0 && json;
+        if (change->existed)
+            change->previous = json;
+        int ret = crypt_token_json_set(cdev, change->index, change->value.toStdString().c_str());
+        if (ret >= 0)
+            change->index = ret;
+        return ret;
+    }
+    case Change::kSetLabel: {
+        const char *label = crypt_get_label(cdev);
+        change->previous = label ? label : "";
+        return crypt_set_label(cdev, change->value.toStdString().c_str(), nullptr);
+    }
+    }
+    return -EINVAL;
+}
+
+void HeaderTransaction::revert(const Change &change)
+{
+    struct crypt_device *cdev = lease->get();
+    int ret = 0;
+    switch (change.type) {
+    case Change::kAddKeyslot:
+        ret = crypt_keyslot_destroy(cdev, change.index);
+        break;
+    case Change::kSetToken:
+        ret = crypt_token_json_set(cdev, change.index,
+                                   change.existed ? change.previous.toStdString().c_str() : nullptr);
+        break;
+    case Change::kSetLabel:
+        ret = crypt_set_label(cdev, change.previous.toStdString().c_str(), nullptr);
+        break;
+    case Change::kDestroyKeyslot:
+        // applied at last, never reverted.
+        break;
+    }
+    if (ret < 0)
+        qWarning() << "cannot revert header change of" << device << change.type << change.index << ret;
+}
+
+int HeaderTransaction::commit()
+{
+    CHECK_BOOL(lease, "transaction is not began " + device, -kErrorParamsInvalid);
+    dfmbase::FinallyUtil finalClear([&] {
+        rollback();
+        CryptDeviceCache::instance()->invalidate(device);
+    });
+
+    // the replaced keyslots are destroyed after all others succeed, the old
+    // passphrase keeps working if anything fails.
+    std::stable_partition(changes.begin(), changes.end(), [](const Change &change) {
+        return change.type != Change::kDestroyKeyslot;
+    });
+
+    for (int i = 0; i < changes.count(); ++i) {
+        int ret = apply(&changes[i]);
+        if (ret >= 0)
+            continue;
+
+        qCritical() << "commit header change failed" << device << changes.at(i).type << ret;
+        for (int j = i - 1; j >= 0; --j)
+            revert(changes.at(j));
+        lease->discard();
+        return changes.at(i).error;
+    }
+    qInfo() << "header changes committed to" << device;
+    return kSuccess;
+}
+
+void HeaderTransaction::rollback()
+{
+    changes.clear();
+    volumeKey = {};
+    lease.reset();
+}
+
 bool disk_encrypt_utils::bcReadEncryptConfig(disk_encrypt::EncryptConfig *config)
 {
     Q_ASSERT(config);
@@ -774,11 +1853,14 @@ bool disk_encrypt_utils::bcReadEncryptConfig(disk_encrypt::EncryptConfig *config
     config->mountPoint = obj.value("device-mountpoint").toString();
     config->deviceName = obj.value("device-name").toString();
     config->devicePath = obj.value("device-path").toString();
+    config->traceID = obj.value("trace-id").toString();
     config->keySize = obj.value("key-size").toString();
     config->mode = obj.value("mode").toString();
     config->recoveryPath = obj.value("recoverykey-path").toString();
     // config->tpmConfig = obj.value("tpm-config");// no tpmconfig will be set in pre-encrypt phase
     config->clearDev = obj.value("volume").toString();
+    config->sectorSize = obj.value("sector-size").toInt(512);
+    config->hwOpal = obj.value("hw-opal").toBool();
 
     return true;
 }
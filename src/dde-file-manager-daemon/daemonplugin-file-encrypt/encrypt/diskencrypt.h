@@ -7,12 +7,18 @@
 #include "daemonplugin_file_encrypt_global.h"
 
 #include <QVariantMap>
+#include <QList>
+
+#include <memory>
 
 namespace dfmmount {
 class DBlockDevice;
 }   // namespace dfmmount
+struct crypt_device;
 
 FILE_ENCRYPT_BEGIN_NS
+struct JobContext;
+class CryptDeviceLease;
 
 enum EncryptVersion {
     kNotEncrypted,
@@ -31,19 +37,81 @@ enum EncryptStatus {
     kStatusUnknown = 10000
 };
 
+// stages keyslot, token and label changes and applies them to device in
+// commit(), where the device is unlocked only once. each change is written by
+// the normal libcryptsetup calls, which keep a valid header copy when crashed,
+// and the applied changes are reverted if a later one fails.
+// if the transaction is not committed, the device is untouched.
+class HeaderTransaction
+{
+public:
+    explicit HeaderTransaction(const QString &device);
+    ~HeaderTransaction();
+    Q_DISABLE_COPY(HeaderTransaction)
+
+    int begin();
+    int changePassphrase(const SecretBuffer &oldPassphrase, const SecretBuffer &newPassphrase, int *keyslot);
+    int addPassphrase(const SecretBuffer &existPassphrase, const SecretBuffer &newPassphrase, int *keyslot);
+    int setToken(const QString &token);
+    int setLabel(const QString &label);
+    int commit();
+    void rollback();
+
+private:
+    struct Change
+    {
+        enum Type {
+            kAddKeyslot,
+            kDestroyKeyslot,
+            kSetToken,
+            kSetLabel,
+        };
+
+        Type type { kSetLabel };
+        int index { -1 };   // the keyslot or token.
+        SecretBuffer passphrase;
+        QString value;
+        QString previous;   // the token or label before applied, for reverting.
+        bool existed { false };
+        int error { 0 };
+    };
+
+    int unlock(const SecretBuffer &passphrase, int *keyslot);
+    int freeKeyslot() const;
+    int apply(Change *change);
+    void revert(const Change &change);
+
+    QString device;
+    std::unique_ptr<CryptDeviceLease> lease;
+    SecretBuffer volumeKey;
+    QList<Change> changes;
+};
+
 namespace disk_encrypt_funcs {
-int bcInitHeaderFile(const EncryptParams &params, QString &headerPath, int *keyslotCipher, int *keyslotRecKey);
+int bcInitHeaderFile(const EncryptParams &params, QString &headerPath, int *keyslotCipher, int *keyslotRecKey,
+                     JobContext *ctx = nullptr);
 int bcGetToken(const QString &device, QString *tokenJson);
-int bcInitHeaderDevice(const QString &device, const QString &passphrase, const QString &headerPath);
+int bcInitHeaderDevice(const QString &device, const QString &headerPath);
 int bcSetToken(const QString &device, const QString &token);
-int bcResumeReencrypt(const QString &device, const QString &passphrase, const QString &clearDev, bool expandFs = true);
+int bcResumeReencrypt(const QString &device, const SecretBuffer &passphrase, const QString &clearDev, bool expandFs = true,
+                      JobContext *ctx = nullptr);
 int bcChangePassphrase(const QString &device, const QString &oldPassphrase, const QString &newPassphrase, int *keyslot);
 int bcChangePassphraseByRecKey(const QString &device, const QString &oldPassphrase, const QString &newPassphrase, int *keyslot);
-int bcDecryptDevice(const QString &device, const QString &passphrase);
+int bcDecryptDevice(const QString &device, const SecretBuffer &passphrase, JobContext *ctx = nullptr);
 int bcBackupCryptHeader(const QString &device, QString &headerPath);
-int bcDoSetupHeader(const EncryptParams &params, QString *headerPath, int *keyslotCipher, int *keyslotRecKey);
+int bcDoSetupHeader(const EncryptParams &params, QString *headerPath, int *keyslotCipher, int *keyslotRecKey,
+                    JobContext *ctx = nullptr);
 int bcPrepareHeaderFile(const QString &device, QString *headerPath);
+// encrypts an empty device by formatting it, no data is reencrypted.
+int bcFormatEncryptDevice(const EncryptParams &params, int *keyslotCipher, int *keyslotRecKey,
+                          JobContext *ctx = nullptr);
 int bcSetLabel(const QString &device, const QString &label);
+int bcCheckPassphrase(const QString &device, const QString &passphrase);
+// writes the header to bcDetachedHeaderPath and opens the device as
+// activeName, the data is encrypted online in place by bcResumeReencrypt,
+// no file system resize or data shift is needed.
+int bcSetupDetachedHeader(const EncryptParams &params, const QString &activeName, int *keyslotCipher, int *keyslotRecKey,
+                          JobContext *ctx = nullptr);
 
 int bcEncryptProgress(uint64_t size, uint64_t offset, void *usrptr);
 int bcDecryptProgress(uint64_t size, uint64_t offset, void *usrptr);
@@ -54,15 +122,38 @@ namespace disk_encrypt_utils {
 EncryptParams bcConvertParams(const QVariantMap &params);
 bool bcValidateParams(const EncryptParams &params);
 bool bcReadEncryptConfig(disk_encrypt::EncryptConfig *config);
+// the luks2 sector size that the device is formatted with.
+int bcChooseSectorSize(const EncryptParams &params);
 
 QString bcExpRecFile(const EncryptParams &params);
 QString bcGenRecKey();
+QVariantMap bcBenchmarkCiphers();
+
+// the header staging files live in memory only and are referred by the
+// /proc/self/fd path, they are released by bcCloseMemFile.
+QString bcCreateMemFile(const QString &name, qint64 size);
+QString bcCopyToMemFile(const QString &name, const QString &src);
+void bcCloseMemFile(const QString &path);
+
+// the header file of a device encrypted with detached header, named by the
+// partition uuid which is kept by the encryption. empty if device has no
+// partition uuid, the file might not exist.
+QString bcDetachedHeaderPath(const QString &device);
+// the header backup which holds the progress of a decryption until it's
+// finished, kept on disk to continue the decryption after a reboot.
+QString bcDecryptHeaderPath(const QString &device);
+// the header of an unfinished decryption, or the detached header of device,
+// or the device itself.
+QString bcHeaderDevice(const QString &device);
 }   // namespace disk_encrypt_utils
 
 typedef QSharedPointer<dfmmount::DBlockDevice> DevPtr;
 namespace block_device_utils {
 DevPtr bcCreateBlkDev(const QString &device);
 EncryptVersion bcDevEncryptVersion(const QString &device);
+int bcGetSectorSize(const QString &device);
+// the drive is a self-encrypting drive which libcryptsetup can take.
+bool bcIsOpalSupported(const QString &device);
 int bcDevEncryptStatus(const QString &device, EncryptStatus *status);
 bool bcIsMounted(const QString &device);
 }   // namespace block_device_utils
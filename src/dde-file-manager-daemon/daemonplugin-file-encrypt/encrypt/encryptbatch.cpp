@@ -0,0 +1,180 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "encryptbatch.h"
+#include "encrypttuning.h"
+
+#include <QSet>
+#include <QDebug>
+
+#include <algorithm>
+
+FILE_ENCRYPT_USE_NS
+using namespace disk_encrypt;
+
+EncryptBatch::EncryptBatch(const QString &batchID, const QVariantList &paramsList)
+    : batchID(batchID)
+{
+    QSet<QString> devices;
+    for (const auto &p : paramsList) {
+        Item item;
+        item.params = p.toMap();
+        item.device = item.params.value(encrypt_param_keys::kKeyDevice).toString();
+        item.deviceName = item.params.value(encrypt_param_keys::kKeyDeviceName).toString();
+        item.disk = tuning_utils::bcSysDiskDir(item.device);
+        if (item.disk.isEmpty())
+            item.disk = item.device;
+
+        // partitions in fstab are encrypted after reboot, they cannot be batched.
+        if (!item.device.startsWith("/dev/") || devices.contains(item.device)
+            || item.params.value(encrypt_param_keys::kKeyInitParamsOnly).toBool()) {
+            qWarning() << "batch" << batchID << "skips invalid partition" << item.device;
+            item.state = kDone;
+            item.code = -kErrorParamsInvalid;
+        }
+        devices.insert(item.device);
+        items.append(item);
+    }
+}
+
+bool EncryptBatch::contains(const QString &device) const
+{
+    return std::any_of(items.cbegin(), items.cend(), [&device](const Item &item) {
+        return item.device == device;
+    });
+}
+
+bool EncryptBatch::isFinished() const
+{
+    return std::all_of(items.cbegin(), items.cend(), [](const Item &item) {
+        return item.state == kDone;
+    });
+}
+
+QList<QVariantMap> EncryptBatch::takeStartable()
+{
+    QSet<QString> busyDisks;
+    for (const auto &item : items) {
+        if (item.state == kRunning || item.state == kPaused)
+            busyDisks.insert(item.disk);
+    }
+
+    QList<QVariantMap> startable;
+    for (auto &item : items) {
+        if (item.state != kQueued || busyDisks.contains(item.disk))
+            continue;
+        item.state = kRunning;
+        busyDisks.insert(item.disk);
+        startable.append(item.params);
+    }
+    return startable;
+}
+
+void EncryptBatch::setProgress(const QString &device, const QVariantMap &info)
+{
+    auto item = find(device);
+    if (!item || item->state == kQueued || item->state == kDone)
+        return;
+    // reports come again once a paused job is resumed.
+    item->state = kRunning;
+
+    // only the reencryption counts, the fs resizing restarts from 0.
+    const QString &phase = info.value("phase").toString();
+    if (phase.isEmpty() || phase == "reencrypt")
+        item->progress = info.value("progress").toDouble();
+    item->bytesPerSec = info.value("bytesPerSec").toDouble();
+    item->eta = info.value("eta", -1).toLongLong();
+}
+
+void EncryptBatch::setResult(const QString &device, int code)
+{
+    auto item = find(device);
+    if (item && (item->state == kRunning || item->state == kPaused))
+        item->code = code;
+}
+
+void EncryptBatch::setEnded(const QString &device, bool paused)
+{
+    auto item = find(device);
+    if (!item || item->state == kDone)
+        return;
+
+    if (paused) {
+        // the disk is kept for the paused job until it's resumed.
+        item->state = kPaused;
+        item->bytesPerSec = 0;
+        return;
+    }
+    item->state = kDone;
+    item->bytesPerSec = 0;
+    item->eta = 0;
+    if (item->code == kSuccess)
+        item->progress = 1;
+    qInfo() << "batch" << batchID << "partition" << device << "finished:" << item->code;
+}
+
+QVariantMap EncryptBatch::progress() const
+{
+    double progress = 0;
+    double bytesPerSec = 0;
+    qint64 eta = 0;
+    QVariantList devices;
+    for (const auto &item : items) {
+        // the failed ones are not going to move anymore, take them as done.
+        progress += item.state == kDone ? 1 : item.progress;
+        bytesPerSec += item.bytesPerSec;
+        // disks run in parallel, the slowest one decides. the queued ones
+        // have no throughput yet, so the eta is unknown until they start.
+        if (item.state == kQueued || item.state == kPaused || (item.state == kRunning && item.eta < 0))
+            eta = -1;
+        else if (eta >= 0)
+            eta = qMax(eta, item.eta);
+        devices.append(itemInfo(item));
+    }
+
+    return QVariantMap {
+        { "batchID", batchID },
+        { "phase", "reencrypt" },
+        { "progress", items.isEmpty() ? 1 : progress / items.count() },
+        { "bytesPerSec", bytesPerSec },
+        { "eta", eta },
+        { "devices", devices },
+    };
+}
+
+QVariantMap EncryptBatch::results() const
+{
+    QVariantList devices;
+    for (const auto &item : items)
+        devices.append(itemInfo(item));
+    return QVariantMap {
+        { "batchID", batchID },
+        { "devices", devices },
+    };
+}
+
+EncryptBatch::Item *EncryptBatch::find(const QString &device)
+{
+    for (auto &item : items) {
+        if (item.device == device)
+            return &item;
+    }
+    return nullptr;
+}
+
+QVariantMap EncryptBatch::itemInfo(const Item &item)
+{
+    static const QMap<State, QString> kStateNames {
+        { kQueued, "queued" },
+        { kRunning, "running" },
+        { kPaused, "paused" },
+        { kDone, "done" },
+    };
+    return QVariantMap {
+        { "device", item.device },
+        { "deviceName", item.deviceName },
+        { "state", kStateNames.value(item.state) },
+        { "progress", item.progress },
+        { "code", item.code },
+    };
+}
@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef ENCRYPTBATCH_H
+#define ENCRYPTBATCH_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QVariantMap>
+#include <QList>
+
+FILE_ENCRYPT_BEGIN_NS
+
+// the plan of encrypting several partitions at once. partitions on
+// different physical disks run in parallel, the ones on the same disk run
+// one by one in the order they are requested.
+class EncryptBatch
+{
+public:
+    EncryptBatch(const QString &batchID, const QVariantList &paramsList);
+
+    inline QString id() const { return batchID; }
+    bool contains(const QString &device) const;
+    bool isFinished() const;
+
+    // marks the next partition of each idle disk as running and returns their params.
+    QList<QVariantMap> takeStartable();
+
+    void setProgress(const QString &device, const QVariantMap &info);
+    void setResult(const QString &device, int code);
+    // the job of device ended, it's done unless paused.
+    void setEnded(const QString &device, bool paused);
+
+    // the combined progress, in the same format as the per device details,
+    // with the state of each partition in "devices".
+    QVariantMap progress() const;
+    QVariantMap results() const;
+
+private:
+    enum State {
+        kQueued,
+        kRunning,
+        kPaused,
+        kDone,
+    };   // enum State
+
+    struct Item
+    {
+        QVariantMap params;
+        QString device;
+        QString deviceName;
+        QString disk;
+        State state { kQueued };
+        int code { 0 };
+        double progress { 0 };
+        double bytesPerSec { 0 };
+        qint64 eta { -1 };
+    };
+    Item *find(const QString &device);
+    static QVariantMap itemInfo(const Item &item);
+
+private:
+    QString batchID;
+    QList<Item> items;
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // ENCRYPTBATCH_H
@@ -0,0 +1,286 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "encrypttuning.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QMap>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QVersionNumber>
+
+#include <dfm-base/utils/finallyutil.h>
+
+#include <libcryptsetup.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+FILE_ENCRYPT_USE_NS
+using namespace disk_encrypt;
+
+static constexpr quint64 kMiB { 1024 * 1024 };
+static constexpr quint64 kSlowFlashThroughput { 100 };   // MiB/s
+
+static const QMap<DeviceClass, QString> kClassNames {
+    { kClassUnknown, "unknown" },
+    { kClassHDD, "hdd" },
+    { kClassSataSSD, "ssd" },
+    { kClassNVMe, "nvme" },
+};
+
+// the upper bound of a hotzone. larger hotzones mean fewer metadata commits
+// during reencryption, smaller ones keep one step short on slow media.
+// with journal resilience libcryptsetup caps the hotzone to the journal
+// area of the metadata anyway, so hdds are left to libcryptsetup.
+static const QMap<DeviceClass, quint64> kHotzoneSizes {
+    { kClassUnknown, 0 },
+    { kClassHDD, 0 },
+    { kClassSataSSD, 256 * kMiB },
+    { kClassNVMe, 1024 * kMiB },
+};
+
+// how an interrupted hotzone is recovered. checksum recovery rereads the
+// hotzone and relies on the sectors being written atomically, which ssds
+// guarantee. hdds and slow flash sticks are the media mostly unplugged or
+// powered off in the middle of a write, the journal copies the hotzone
+// into the metadata first, so a torn write is always replayed.
+static const QMap<DeviceClass, QString> kResiliences {
+    { kClassUnknown, "journal" },
+    { kClassHDD, "journal" },
+    { kClassSataSSD, "checksum" },
+    { kClassNVMe, "checksum" },
+};
+
+// returns the sysfs dir of the physical disk which holds the device.
+QString tuning_utils::bcSysDiskDir(const QString &device)
+{
+    QString name = QFileInfo(device).canonicalFilePath().mid(5);   // /dev/mapper/xx -> dm-x
+    QString sysPath = QFileInfo("/sys/class/block/" + name).canonicalFilePath();
+    if (sysPath.isEmpty())
+        return "";
+
+    if (QFile::exists(sysPath + "/partition"))
+        return QFileInfo(sysPath).absolutePath();
+
+    // dm/md devices: use the first backing device.
+    const QStringList &slaves = QDir(sysPath + "/slaves").entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    if (!slaves.isEmpty())
+        return bcSysDiskDir("/dev/" + slaves.first());
+
+    return sysPath;
+}
+
+// the device paths are reused by other disks after unplugging, the cached
+// profiles are keyed by the disk sequence number which is never reused
+// until reboot, or by the wwid of disk on kernels before 5.15.
+static QString profileKey(const QString &device)
+{
+    const QString &canonical = QFileInfo(device).canonicalFilePath();
+    const QString &path = canonical.isEmpty() ? device : canonical;
+    const QString &diskDir = tuning_utils::bcSysDiskDir(device);
+    for (const char *attr : { "/diskseq", "/device/wwid", "/wwid" }) {
+        QFile f(diskDir + attr);
+        if (!diskDir.isEmpty() && f.open(QIODevice::ReadOnly))
+            return QString("%1@%2").arg(path, QString::fromUtf8(f.readAll().trimmed()));
+    }
+    return path;
+}
+
+static QMutex gProfilesMtx;
+static QMap<QString, TuningProfile> gProfiles;
+
+TuningProfile tuning_utils::bcGetProfile(const QString &device)
+{
+    const QString &key = profileKey(device);
+    QMutexLocker locker(&gProfilesMtx);
+    if (gProfiles.contains(key))
+        return gProfiles.value(key);
+
+    TuningProfile profile;
+    bool loaded = false;
+    QFile encConfig(kEncConfigPath);
+    if (encConfig.open(QIODevice::ReadOnly)) {
+        auto obj = QJsonDocument::fromJson(encConfig.readAll()).object();
+        encConfig.close();
+        if (obj.value("device-path").toString() == device && obj.contains("tuning")) {
+            profile = bcProfileFromJson(obj.value("tuning").toObject());
+            loaded = true;
+        }
+    }
+
+    if (!loaded)
+        profile = bcProbeProfile(device);
+
+    qInfo() << "tuning profile of" << device
+            << (loaded ? "(loaded)" : "(probed)")
+            << bcProfileToJson(profile);
+    gProfiles.insert(key, profile);
+    return profile;
+}
+
+// overrides the probed or saved profile of device, used by benchmarks.
+void tuning_utils::bcSetProfile(const QString &device, const TuningProfile &profile)
+{
+    const QString &key = profileKey(device);
+    QMutexLocker locker(&gProfilesMtx);
+    gProfiles.insert(key, profile);
+}
+
+// the sysfs node is gone once the device is removed, so the entries are
+// matched by the device path instead of the key. a replugged disk may get
+// the same diskseq back, e.g. loop devices, and must be probed again.
+void tuning_utils::bcDropProfile(const QString &device)
+{
+    QMutexLocker locker(&gProfilesMtx);
+    for (auto iter = gProfiles.begin(); iter != gProfiles.end();) {
+        if (iter.key() == device || iter.key().startsWith(device + "@"))
+            iter = gProfiles.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+TuningProfile tuning_utils::bcProbeProfile(const QString &device)
+{
+    TuningProfile profile;
+    profile.throughput = bcProbeThroughput(device);
+    profile.devClass = bcDeviceClass(device, profile.throughput);
+    profile.hotzoneSize = kHotzoneSizes.value(profile.devClass, 0);
+    profile.resilience = kResiliences.value(profile.devClass, profile.resilience);
+    return profile;
+}
+
+DeviceClass tuning_utils::bcDeviceClass(const QString &device, quint64 throughput)
+{
+    const QString &diskDir = bcSysDiskDir(device);
+    if (diskDir.isEmpty()) {
+        qWarning() << "cannot find sysfs node of" << device;
+        return kClassUnknown;
+    }
+
+    if (QFileInfo(diskDir).fileName().startsWith("nvme"))
+        return kClassNVMe;
+
+    QFile rotational(diskDir + "/queue/rotational");
+    if (!rotational.open(QIODevice::ReadOnly))
+        return kClassUnknown;
+    bool isRotational = rotational.readAll().trimmed() == "1";
+    rotational.close();
+
+    if (isRotational)
+        return kClassHDD;
+
+    // usb sticks and sd cards are reported as non-rotational but perform like a hdd.
+    if (throughput > 0 && throughput < kSlowFlashThroughput)
+        return kClassHDD;
+    return kClassSataSSD;
+}
+
+quint64 tuning_utils::bcProbeThroughput(const QString &device)
+{
+    static constexpr size_t kProbeBlockSize { 4 * kMiB };
+    static constexpr int kProbeBlocks { 16 };
+
+    int fd = open(device.toStdString().c_str(), O_RDONLY | O_DIRECT);
+    if (fd < 0) {
+        qWarning() << "cannot open device for probing" << device << strerror(errno);
+        return 0;
+    }
+
+    void *buf { nullptr };
+    dfmbase::FinallyUtil finalClear([&] {
+        close(fd);
+        if (buf) free(buf);
+    });
+    if (posix_memalign(&buf, 4096, kProbeBlockSize) != 0)
+        return 0;
+
+    QElapsedTimer timer;
+    timer.start();
+    quint64 total = 0;
+    for (int i = 0; i < kProbeBlocks; ++i) {
+        ssize_t bytes = pread(fd, buf, kProbeBlockSize, off_t(total));
+        if (bytes <= 0)
+            break;
+        total += quint64(bytes);
+    }
+    qint64 nsecs = timer.nsecsElapsed();
+    if (total == 0 || nsecs <= 0)
+        return 0;
+
+    return quint64(double(total) / kMiB / (double(nsecs) / 1e9));
+}
+
+QJsonObject tuning_utils::bcProfileToJson(const TuningProfile &profile)
+{
+    return QJsonObject {
+        { "device-class", kClassNames.value(profile.devClass) },
+        { "throughput", qint64(profile.throughput) },
+        { "hotzone-size", qint64(profile.hotzoneSize) },
+        { "resilience", profile.resilience },
+    };
+}
+
+TuningProfile tuning_utils::bcProfileFromJson(const QJsonObject &obj)
+{
+    TuningProfile profile;
+    profile.devClass = kClassNames.key(obj.value("device-class").toString(), kClassUnknown);
+    profile.throughput = quint64(obj.value("throughput").toVariant().toLongLong());
+    profile.hotzoneSize = quint64(obj.value("hotzone-size").toVariant().toLongLong());
+    profile.resilience = obj.value("resilience").toString(profile.resilience);
+    return profile;
+}
+
+const char *tuning_utils::bcResilienceName(const QString &resilience)
+{
+    // libcryptsetup keeps the pointer, so return a static string.
+    static const char *kResiliences[] { "checksum", "journal", "none" };
+    for (auto name : kResiliences) {
+        if (resilience == name)
+            return name;
+    }
+    return kResiliences[0];
+}
+
+quint32 tuning_utils::bcActivateFlags(const TuningProfile &profile)
+{
+    // the workqueue bypass flags are supported since linux 5.9.
+    static const bool kSupportNoWorkqueue = [] {
+        struct utsname name;
+        if (uname(&name) != 0)
+            return false;
+        return QVersionNumber::fromString(name.release) >= QVersionNumber(5, 9);
+    }();
+
+    switch (profile.devClass) {
+    case kClassNVMe:
+        // the queues of nvme are deep enough, the extra workqueue round trip
+        // only adds latency.
+        if (kSupportNoWorkqueue)
+            return CRYPT_ACTIVATE_NO_READ_WORKQUEUE | CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE;
+        return CRYPT_ACTIVATE_SAME_CPU_CRYPT;
+    case kClassSataSSD:
+        return CRYPT_ACTIVATE_SAME_CPU_CRYPT;
+    default:
+        // the default workqueues merge and sort the requests for hdd.
+        return 0;
+    }
+}
+
+QStringList tuning_utils::bcCrypttabOptions(quint32 flags)
+{
+    // see crypttab(5).
+    QStringList options;
+    if (flags & CRYPT_ACTIVATE_SAME_CPU_CRYPT)
+        options << "same-cpu-crypt";
+    if (flags & CRYPT_ACTIVATE_NO_READ_WORKQUEUE)
+        options << "no-read-workqueue";
+    if (flags & CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE)
+        options << "no-write-workqueue";
+    return options;
+}
@@ -0,0 +1,49 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef ENCRYPT_TUNING_H
+#define ENCRYPT_TUNING_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QJsonObject>
+
+FILE_ENCRYPT_BEGIN_NS
+
+enum DeviceClass {
+    kClassUnknown,
+    kClassHDD,
+    kClassSataSSD,
+    kClassNVMe,
+};   // enum DeviceClass
+
+struct TuningProfile
+{
+    DeviceClass devClass { kClassUnknown };
+    quint64 throughput { 0 };   // MiB/s, 0 means not probed.
+    quint64 hotzoneSize { 0 };   // bytes, 0 means decided by libcryptsetup.
+    QString resilience { "checksum" };
+};
+
+namespace tuning_utils {
+TuningProfile bcGetProfile(const QString &device);
+void bcSetProfile(const QString &device, const TuningProfile &profile);
+void bcDropProfile(const QString &device);
+TuningProfile bcProbeProfile(const QString &device);
+DeviceClass bcDeviceClass(const QString &device, quint64 throughput);
+quint64 bcProbeThroughput(const QString &device);
+QString bcSysDiskDir(const QString &device);
+
+QJsonObject bcProfileToJson(const TuningProfile &profile);
+TuningProfile bcProfileFromJson(const QJsonObject &obj);
+const char *bcResilienceName(const QString &resilience);
+
+// the dm-crypt flags (CRYPT_ACTIVATE_*) which suit the device, they are
+// persisted in the LUKS2 header and mirrored in crypttab options.
+quint32 bcActivateFlags(const TuningProfile &profile);
+QStringList bcCrypttabOptions(quint32 flags);
+}   // namespace tuning_utils
+
+FILE_ENCRYPT_END_NS
+
+#endif   // ENCRYPT_TUNING_H
@@ -3,15 +3,27 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "encryptworker.h"
 #include "diskencrypt.h"
+#include "encrypttuning.h"
+#include "iothrottle.h"
+#include "resourcegovernor.h"
+#include "tabfile.h"
+#include "fsresize/fsresize.h"
 
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QFile>
 #include <QDir>
-#include <QRegularExpression>
 #include <QSettings>
 #include <QReadWriteLock>
+#include <QFileInfo>
+#include <QProcess>
+
+#include <libcryptsetup.h>
+#include <mntent.h>
+#include <sys/mount.h>
+#include <cerrno>
+#include <cstring>
 
 FILE_ENCRYPT_USE_NS
 using namespace disk_encrypt;
@@ -27,12 +39,89 @@ void createUsecPathIfNotExist()
     }
 }
 
+// the name of the dm-crypt device which is opened on device.
+static QString activeMapperOf(const QString &device)
+{
+    const QString &name = QFileInfo(device).canonicalFilePath().mid(5);
+    const QStringList &holders = QDir("/sys/class/block/" + name + "/holders").entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const auto &holder : holders) {
+        QFile dmUUID(QString("/sys/class/block/%1/dm/uuid").arg(holder));
+        if (!dmUUID.open(QIODevice::ReadOnly) || !dmUUID.readAll().startsWith("CRYPT-"))
+            continue;
+        QFile dmName(QString("/sys/class/block/%1/dm/name").arg(holder));
+        if (dmName.open(QIODevice::ReadOnly))
+            return QString::fromLocal8Bit(dmName.readAll().trimmed());
+    }
+    return "";
+}
+
+// the mount points of device, in the order they were mounted.
+static QStringList mountPointsOf(const QString &device)
+{
+    QStringList mpts;
+    const QString &target = QFileInfo(device).canonicalFilePath();
+    FILE *mtab = setmntent("/proc/self/mounts", "r");
+    if (!mtab)
+        return mpts;
+    while (struct mntent *ent = getmntent(mtab)) {
+        if (QFileInfo(ent->mnt_fsname).canonicalFilePath() == target)
+            mpts.append(QString::fromLocal8Bit(ent->mnt_dir));
+    }
+    endmntent(mtab);
+    return mpts;
+}
+
+static QString fsUUIDOf(const QString &device)
+{
+    const QString &target = QFileInfo(device).canonicalFilePath();
+    const QFileInfoList &links = QDir("/dev/disk/by-uuid").entryInfoList(QDir::System | QDir::NoDotAndDotDot);
+    for (const auto &link : links) {
+        if (link.canonicalFilePath() == target)
+            return link.fileName();
+    }
+    return "";
+}
+
+// the mount points are in fstab, mount(8) finds the rest from there.
+static void remount(const QStringList &mpts)
+{
+    for (const auto &mpt : mpts) {
+        int ret = QProcess::execute("mount", { mpt });
+        if (ret != 0)
+            qWarning() << "cannot mount" << mpt << "again:" << ret;
+    }
+}
+
+static int reactivate(const QString &device, const QString &name, const SecretBuffer &passphrase)
+{
+    struct crypt_device *cdev { nullptr };
+    int ret = crypt_init_data_device(&cdev,
+                                     disk_encrypt_utils::bcHeaderDevice(device).toStdString().c_str(),
+                                     device.toStdString().c_str());
+    if (ret == 0)
+        ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
+    if (ret == 0) {
+        ret = governed(ResourceCost::ofKeyslot(cdev, CRYPT_ANY_SLOT), ResourceGovernor::kPbkdf, "activate", [&] {
+            return crypt_activate_by_passphrase(cdev, name.toStdString().c_str(), CRYPT_ANY_SLOT,
+                                                passphrase.data(), passphrase.size(), 0);
+        });
+    }
+    if (cdev)
+        crypt_free(cdev);
+    if (ret < 0)
+        qWarning() << "cannot open" << device << "as" << name << "again:" << ret;
+    return ret;
+}
+
 PrencryptWorker::PrencryptWorker(const QString &jobID,
                                  const QVariantMap &params,
                                  QObject *parent)
     : Worker(jobID, parent),
       params(params)
 {
+    ctx->device = params.value(encrypt_param_keys::kKeyDevice).toString();
+    ctx->deviceName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
+    ctx->traceID = params.value(encrypt_param_keys::kKeyTraceID).toString();
 }
 
 void PrencryptWorker::run()
@@ -57,11 +146,29 @@ void PrencryptWorker::run()
         return;
     }
 
+    if (encParams.detachedHeader) {
+        int ret = encryptDetached(encParams);
+        setExitCode(ret);
+        if (ret == kSuccess)
+            writeTokenFile(encParams);
+        return;
+    }
+
+    // nothing to keep on device, format it instead of reencrypting it.
+    if (encParams.discardData || fs_resize::isEmptyFileSystem_ext(encParams.device)) {
+        qInfo() << "format and encrypt device" << encParams.device;
+        int ret = disk_encrypt_funcs::bcFormatEncryptDevice(encParams, &keyslotCipher, &keyslotRecKey, ctx.data());
+        setExitCode(ret);
+        formatted = (ret == kSuccess);
+        return;
+    }
+
     QString localHeaderFile;
     int err = disk_encrypt_funcs::bcInitHeaderFile(encParams,
                                                    localHeaderFile,
                                                    &keyslotCipher,
-                                                   &keyslotRecKey);
+                                                   &keyslotRecKey,
+                                                   ctx.data());
     if (err != kSuccess || localHeaderFile.isEmpty()) {
         setExitCode(-kErrorCreateHeader);
         qDebug() << "cannot generate local header"
@@ -70,7 +177,6 @@ void PrencryptWorker::run()
     }
 
     int ret = disk_encrypt_funcs::bcInitHeaderDevice(encParams.device,
-                                                     encParams.passphrase,
                                                      localHeaderFile);
     if (ret != 0) {
         setExitCode(-kErrorApplyHeader);
@@ -79,16 +185,104 @@ void PrencryptWorker::run()
         return;
     }
 
-    if (!encParams.tpmToken.isEmpty()) {
-        QFile f(QString(TOKEN_FILE_PATH).arg(encParams.device.mid(5)));
-        if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-            qWarning() << "cannot open file to cache token";
-            return;
-        }
-        f.write(encParams.tpmToken.toLocal8Bit());
-        f.flush();
-        f.close();
+    writeTokenFile(encParams);
+}
+
+void PrencryptWorker::writeTokenFile(const EncryptParams &encParams)
+{
+    if (encParams.tpmToken.isEmpty())
+        return;
+
+    QFile f(QString(TOKEN_FILE_PATH).arg(encParams.device.mid(5)));
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "cannot open file to cache token";
+        return;
+    }
+    f.write(encParams.tpmToken.toLocal8Bit());
+    f.flush();
+    f.close();
+}
+
+// the partition stays in use: the header is kept in a file of /boot, the
+// file systems are moved onto the cleartext device after a short unmount
+// and the data is encrypted in place under them.
+// busy mounts are not supported: the unmount is never lazy or forced, a
+// file system held by open files fails the job with kErrorDeviceMounted
+// and the mounts are restored, the partition is left untouched.
+// after a reboot the job is resumed from its journal, crypttab opens the
+// cleartext device by the detached header and the file systems are mounted
+// on it again, see DiskEncryptDBus::recoverJobs.
+int PrencryptWorker::encryptDetached(const EncryptParams &encParams)
+{
+    const QString &device = encParams.device;
+    const QString &mapperName = QString("dm-%1").arg(device.mid(5));
+    const QString &fsUUID = fsUUIDOf(device);
+
+    JobPhase phase(ctx.data(), "unmount");
+    const QStringList &mpts = mountPointsOf(device);
+    for (int i = mpts.count() - 1; i >= 0; --i) {
+        if (umount2(mpts.at(i).toLocal8Bit().constData(), 0) == 0)
+            continue;
+        qWarning() << "cannot unmount" << mpts.at(i) << "for online encryption, busy mounts are not supported:" << strerror(errno);
+        remount(mpts.mid(i + 1));
+        return -kErrorDeviceMounted;
+    }
+
+    createUsecPathIfNotExist();
+    int ret = disk_encrypt_funcs::bcSetupDetachedHeader(encParams, mapperName,
+                                                        &keyslotCipher, &keyslotRecKey,
+                                                        ctx.data());
+    if (ret != kSuccess) {
+        qWarning() << "cannot setup detached header" << device << ret;
+        remount(mpts);
+        return ret;
+    }
+    ctx->activeName = mapperName;
+
+    phase.next("remount");
+    updateTabs(encParams, mapperName, fsUUID);
+    QProcess::execute("systemctl", { "daemon-reload" });
+    remount(mpts);
+    return kSuccess;
+}
+
+// the raw device and the mapper share the file system uuid during the job,
+// fstab takes the mapper path, crypttab opens it with the detached header.
+void PrencryptWorker::updateTabs(const EncryptParams &encParams, const QString &mapperName, const QString &fsUUID)
+{
+    const QString &header = disk_encrypt_utils::bcDetachedHeaderPath(encParams.device);
+    QStringList options { "header=" + header };
+    options << tuning_utils::bcCrypttabOptions(
+            tuning_utils::bcActivateFlags(tuning_utils::bcGetProfile(encParams.device)));
+    if (!encParams.tpmToken.isEmpty())
+        options << "tpm2-device=auto";
+
+    TabFile crypttab("/etc/crypttab");
+    if (crypttab.load() || !QFile::exists("/etc/crypttab")) {
+        const QString &partUUID = QFileInfo(header).completeBaseName();
+        crypttab.appendLine({ mapperName.toLocal8Bit(),
+                              ("PARTUUID=" + partUUID).toLocal8Bit(),
+                              "none",
+                              options.join(',').toLocal8Bit() });
+        if (!crypttab.save())
+            qWarning() << "cannot write crypttab";
+    }
+
+    TabFile fstab("/etc/fstab");
+    if (!fstab.load())
+        return;
+    const QByteArray &mapper = ("/dev/mapper/" + mapperName).toLocal8Bit();
+    const QByteArray &devDesc = encParams.device.toLocal8Bit();
+    const QByteArray &devUUID = ("UUID=" + fsUUID).toLocal8Bit();
+    for (int i = 0; i < fstab.lineCount(); ++i) {
+        if (!fstab.isEntry(i))
+            continue;
+        const QByteArray &src = fstab.field(i, 0);
+        if (src == devDesc || (!fsUUID.isEmpty() && src == devUUID))
+            fstab.setField(i, 0, mapper);
     }
+    if (fstab.isModified() && !fstab.save())
+        qWarning() << "cannot write fstab";
 }
 
 int PrencryptWorker::writeEncryptParams()
@@ -111,7 +305,13 @@ int PrencryptWorker::writeEncryptParams()
     obj.insert("device-mountpoint", params.value(encrypt_param_keys::kKeyMountPoint).toString());   // the mountpoint of the device
     obj.insert("cipher", params.value(encrypt_param_keys::kKeyCipher).toString() + "-xts-plain64");
     obj.insert("key-size", "256");
+    // the same size as the daemon formats with, so both stages agree on it.
+    EncryptParams encParams;
+    encParams.device = dev;
+    obj.insert("sector-size", disk_encrypt_utils::bcChooseSectorSize(encParams));
+    obj.insert("hw-opal", params.value(encrypt_param_keys::kKeyHwOpal).toBool());   // encrypted by the drive if it's able to.
     obj.insert("mode", encMode.value(params.value(encrypt_param_keys::kKeyEncMode).toInt()));
+    obj.insert("trace-id", params.value(encrypt_param_keys::kKeyTraceID).toString());   // continues the trace after reboot.
 
     QString expPath = params.value(encrypt_param_keys::kKeyRecoveryExportPath).toString();
     if (!expPath.isEmpty()) {
@@ -122,6 +322,7 @@ int PrencryptWorker::writeEncryptParams()
 
     QJsonDocument tpmConfig = QJsonDocument::fromJson(params.value(encrypt_param_keys::kKeyTPMConfig).toString().toLocal8Bit());
     obj.insert("tpm-config", tpmConfig.object());   // the tpm info used to decrypt passphrase from tpm.
+    obj.insert("tuning", tuning_utils::bcProfileToJson(tuning_utils::bcProbeProfile(dev)));   // hotzone and resilience of reencryption.
     QJsonDocument doc(obj);
 
     createUsecPathIfNotExist();
@@ -144,70 +345,61 @@ int PrencryptWorker::writeEncryptParams()
 int PrencryptWorker::setFstabTimeout()
 {
     static const QString kFstabPath { "/etc/fstab" };
-    QFile fstab(kFstabPath);
-    if (!fstab.open(QIODevice::ReadOnly))
+    TabFile fstab(kFstabPath);
+    if (!fstab.load())
         return kErrorOpenFstabFailed;
 
-    QByteArray fstabContents = fstab.readAll();
-    fstab.close();
-
     static const QByteArray kTimeoutParam = "x-systemd.device-timeout=0";
-    QString devDesc = params.value(encrypt_param_keys::kKeyDevice).toString();
-    QString devUUID = QString("UUID=%1").arg(params.value(encrypt_param_keys::kKeyUUID).toString());
-    QByteArrayList fstabLines = fstabContents.split('\n');
-    QList<QStringList> fstabItems;
-    bool foundItem = false;
-    for (const QString &line : fstabLines) {
-        QStringList items = line.split(QRegularExpression(R"(\t| )"), QString::SkipEmptyParts);
-        if (items.count() == 6
-            && (items[0] == devDesc || items[0] == devUUID)
-            && !foundItem) {
-
-            if (!items[3].contains(kTimeoutParam)) {
-                items[3] += ("," + kTimeoutParam);
-                foundItem = true;
-            }
-        }
-        fstabItems.append(items);
+    QByteArray devDesc = params.value(encrypt_param_keys::kKeyDevice).toString().toLocal8Bit();
+    QByteArray devUUID = QString("UUID=%1").arg(params.value(encrypt_param_keys::kKeyUUID).toString()).toLocal8Bit();
+    for (int i = 0; i < fstab.lineCount(); ++i) {
+        if (fstab.fieldCount(i) != 6)
+            continue;
+
+        const QByteArray &src = fstab.field(i, 0);
+        if (src != devDesc && src != devUUID)
+            continue;
+
+        const QByteArray &options = fstab.field(i, 3);
+        if (!options.contains(kTimeoutParam))
+            fstab.setField(i, 3, options + "," + kTimeoutParam);
+        break;
     }
 
-    if (foundItem) {
-        QByteArray newContents;
-        for (const auto &items : fstabItems) {
-            newContents += items.join('\t');
-            newContents.append('\n');
-        }
-
-        if (!fstab.open(QIODevice::Truncate | QIODevice::ReadWrite))
+    if (fstab.isModified()) {
+        if (!fstab.save())
             return kErrorOpenFstabFailed;
 
-        fstab.write(newContents);
-        fstab.flush();
-        fstab.close();
-
-        qDebug() << "old fstab contents:"
-                 << fstabContents;
         qDebug() << "new fstab contents"
-                 << newContents;
+                 << fstab.contents();
     }
 
     return kSuccess;
 }
 
-ReencryptWorker::ReencryptWorker(const QString &dev,
-                                 const QString &passphrase,
+ReencryptWorker::ReencryptWorker(const JobContextPtr &ctx,
+                                 const SecretBuffer &passphrase,
                                  QObject *parent)
-    : Worker("", parent),
+    : Worker(ctx, parent),
       passphrase(passphrase),
-      device(dev)
+      device(ctx->device)
 {
 }
 
 void ReencryptWorker::run()
 {
+    IOThrottle::lowerPriority();
+    // the file systems of an online job are mounted on the cleartext device.
+    // resuming a detached header job offline, the data is not shifted and
+    // the file system is never shrunk.
+    const QString &header = disk_encrypt_utils::bcDetachedHeaderPath(device);
+    const bool detached = !header.isEmpty() && QFile::exists(header);
     int ret = disk_encrypt_funcs::bcResumeReencrypt(device,
                                                     passphrase,
-                                                    "");
+                                                    ctx->activeName,
+                                                    ctx->activeName.isEmpty() && !detached,
+                                                    ctx.data());
+    setExitCode(ret);
 
     Q_EMIT deviceReencryptResult(device, ret);
 }
@@ -216,21 +408,47 @@ DecryptWorker::DecryptWorker(const QString &jobID,
                              const QVariantMap &params,
                              QObject *parent)
     : Worker(jobID, parent),
-      params(params)
+      params(params),
+      passphrase(params.value(encrypt_param_keys::kKeyPassphrase).toString())
+{
+    // the passphrase lives in the locked buffer only during the job.
+    this->params.remove(encrypt_param_keys::kKeyPassphrase);
+    ctx->type = kJobDecrypt;
+    ctx->device = params.value(encrypt_param_keys::kKeyDevice).toString();
+    ctx->deviceName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
+    ctx->traceID = params.value(encrypt_param_keys::kKeyTraceID).toString();
+}
+
+DecryptWorker::DecryptWorker(const JobContextPtr &ctx,
+                             const QVariantMap &params,
+                             const SecretBuffer &passphrase,
+                             QObject *parent)
+    : Worker(ctx, parent),
+      params(params),
+      passphrase(passphrase)
 {
 }
 
 void DecryptWorker::run()
 {
     bool initOnly = params.value(encrypt_param_keys::kKeyInitParamsOnly).toBool();
+    if (initOnly && params.value(encrypt_param_keys::kKeyOnlineDecrypt).toBool()) {
+        IOThrottle::lowerPriority();
+        int ret = decryptOnline();
+        // the device is in use, it's decrypted in the boot stage then.
+        if (ret == -kRebootRequired)
+            ret = writeDecryptParams();
+        setExitCode(ret);
+        return;
+    }
     if (initOnly) {
         setExitCode(writeDecryptParams());
         return;
     }
 
+    IOThrottle::lowerPriority();
     const QString &device = params.value(encrypt_param_keys::kKeyDevice).toString();
-    const QString &passphrase = params.value(encrypt_param_keys::kKeyPassphrase).toString();
-    int ret = disk_encrypt_funcs::bcDecryptDevice(device, passphrase);
+    int ret = disk_encrypt_funcs::bcDecryptDevice(device, passphrase, ctx.data());
     if (ret < 0) {
         setExitCode(ret);
         qDebug() << "decrypt devcei failed"
@@ -264,6 +482,90 @@ int DecryptWorker::writeDecryptParams()
     return -kRebootRequired;
 }
 
+// the partition is taken offline only while the job runs: its file systems
+// are unmounted and the cleartext device is closed, then it's decrypted
+// like a removable disk and mounted again from fstab.
+int DecryptWorker::decryptOnline()
+{
+    const QString &device = params.value(encrypt_param_keys::kKeyDevice).toString();
+    if (passphrase.isEmpty())
+        return -kRebootRequired;
+
+    // a resumed job finds the device closed already.
+    const QString &mapperName = activeMapperOf(device);
+    QStringList mpts;
+    QString fsUUID;
+    if (!mapperName.isEmpty()) {
+        JobPhase phase(ctx.data(), "unmount");
+        const QString &mapper = "/dev/mapper/" + mapperName;
+        fsUUID = fsUUIDOf(mapper);
+        mpts = mountPointsOf(mapper);
+        for (int i = mpts.count() - 1; i >= 0; --i) {
+            if (umount2(mpts.at(i).toLocal8Bit().constData(), 0) == 0)
+                continue;
+            qInfo() << "cannot unmount" << mpts.at(i) << "for online decryption:" << strerror(errno);
+            remount(mpts.mid(i + 1));
+            return -kRebootRequired;
+        }
+
+        int ret = crypt_deactivate(nullptr, mapperName.toStdString().c_str());
+        if (ret < 0) {
+            qInfo() << "cannot close" << mapperName << "for online decryption:" << ret;
+            remount(mpts);
+            return -kRebootRequired;
+        }
+    }
+    if (mpts.isEmpty() && !params.value(encrypt_param_keys::kKeyMountPoint).toString().isEmpty())
+        mpts.append(params.value(encrypt_param_keys::kKeyMountPoint).toString());
+
+    int ret = disk_encrypt_funcs::bcDecryptDevice(device, passphrase, ctx.data());
+    if (ret == -kErrorJobPaused)
+        return ret;
+    if (ret < 0) {
+        qWarning() << "online decryption failed" << device << ret;
+        if (!mapperName.isEmpty() && reactivate(device, mapperName, passphrase) >= 0)
+            remount(mpts);
+        return ret;
+    }
+
+    JobPhase phase(ctx.data(), "remount");
+    updateTabs(mapperName, fsUUID.isEmpty() ? fsUUIDOf(device) : fsUUID);
+    QProcess::execute("systemctl", { "daemon-reload" });
+    remount(mpts);
+    return kSuccess;
+}
+
+// the mapper is gone with the encryption, the fstab entries which refer to
+// it take the file system uuid, which is kept by the decryption.
+void DecryptWorker::updateTabs(const QString &mapperName, const QString &fsUUID)
+{
+    if (mapperName.isEmpty())
+        return;
+
+    TabFile crypttab("/etc/crypttab");
+    if (crypttab.load()) {
+        for (int i = crypttab.lineCount() - 1; i >= 0; --i) {
+            if (crypttab.isEntry(i) && crypttab.field(i, 0) == mapperName.toLocal8Bit())
+                crypttab.removeLine(i);
+        }
+        if (crypttab.isModified() && !crypttab.save())
+            qWarning() << "cannot write crypttab";
+    }
+
+    if (fsUUID.isEmpty())
+        return;
+    TabFile fstab("/etc/fstab");
+    if (!fstab.load())
+        return;
+    const QByteArray &mapper = ("/dev/mapper/" + mapperName).toLocal8Bit();
+    for (int i = 0; i < fstab.lineCount(); ++i) {
+        if (fstab.isEntry(i) && fstab.field(i, 0) == mapper)
+            fstab.setField(i, 0, ("UUID=" + fsUUID).toLocal8Bit());
+    }
+    if (fstab.isModified() && !fstab.save())
+        qWarning() << "cannot write fstab";
+}
+
 ChgPassWorker::ChgPassWorker(const QString &jobID, const QVariantMap &params, QObject *parent)
     : Worker(jobID, parent),
       params(params)
@@ -300,20 +602,33 @@ void ChgPassWorker::run()
     setExitCode(ret);
 }
 
-ReencryptWorkerV2::ReencryptWorkerV2(QObject *parent)
-    : Worker("", parent)
+ReencryptWorkerV2::ReencryptWorkerV2(const QString &jobID, QObject *parent)
+    : Worker(jobID, parent)
 {
+    ctx->type = kJobFstabEncrypt;
 }
 
 void ReencryptWorkerV2::setEncryptParams(const QVariantMap &params)
 {
     QWriteLocker lk(&lock);
     this->params = params;
+    // the passphrase lives in the locked buffer only during the job.
+    passphrase = SecretBuffer(params.value(encrypt_param_keys::kKeyPassphrase).toString());
+    this->params.remove(encrypt_param_keys::kKeyPassphrase);
+}
+
+bool ReencryptWorkerV2::hasValidParams()
+{
+    QReadLocker lk(&lock);
+    return validateParams();
 }
 
 void ReencryptWorkerV2::loadReencryptConfig()
 {
     disk_encrypt_utils::bcReadEncryptConfig(&config);
+    ctx->device = config.devicePath;
+    ctx->deviceName = config.deviceName;
+    ctx->traceID = config.traceID;
 }
 
 EncryptConfig ReencryptWorkerV2::encryptConfig() const
@@ -328,21 +643,22 @@ void ReencryptWorkerV2::run()
         return;
     }
 
-    while (true) {
-        QReadLocker lk(&lock);
-        if (validateParams())
-            break;
-
-        Q_EMIT requestEncryptParams(config.keyConfig());
-        QThread::sleep(3);   // don't request frequently.
+    // the params are requested before the worker is submitted, it's only
+    // started without them to end a job paused before they are set.
+    if (!hasValidParams()) {
+        int ret = ctx->interrupted ? -kErrorJobPaused : -kErrorParamsInvalid;
+        qInfo() << "job ends before params are set." << config.devicePath << ret;
+        setExitCode(ret);
+        Q_EMIT deviceReencryptResult(config.devicePath, ret);
+        return;
     }
 
-    int ret = disk_encrypt_funcs::bcResumeReencrypt(config.devicePath, "", config.clearDev, false);
+    IOThrottle::lowerPriority();
+    int ret = disk_encrypt_funcs::bcResumeReencrypt(config.devicePath, {}, config.clearDev, false, ctx.data());
+    if (ret == kSuccess)
+        ret = updateHeader();
+
     if (ret == kSuccess) {
-        // sets the passphrase, token, recovery-key
-        setPassphrase();
-        setRecoveryKey();
-        setBakcingDevLabel();
         updateCrypttab();
         removeEncryptFile();
     } else {
@@ -376,38 +692,61 @@ bool ReencryptWorkerV2::hasUnfinishedOnlineEncryption()
     return false;
 }
 
-void ReencryptWorkerV2::setPassphrase()
+// sets the passphrase, token, recovery key and label in one header write.
+int ReencryptWorkerV2::updateHeader()
+{
+    HeaderTransaction trans(config.devicePath);
+    int ret = trans.begin();
+    if (ret != kSuccess) {
+        qCritical() << "cannot stage header changes for device!" << config.devicePath << ret;
+        return ret;
+    }
+
+    ret = setPassphrase(&trans);
+    if (ret != kSuccess)
+        return ret;
+
+    ret = setRecoveryKey(&trans);
+    if (ret != kSuccess)
+        return ret;
+
+    setBakcingDevLabel(&trans);
+
+    ret = trans.commit();
+    if (ret != kSuccess)
+        qCritical() << "cannot write header changes to device!" << config.devicePath << ret;
+    return ret;
+}
+
+int ReencryptWorkerV2::setPassphrase(HeaderTransaction *trans)
 {
-    const QString &pass = params.value(encrypt_param_keys::kKeyPassphrase).toString();
     const QString &token = params.value(encrypt_param_keys::kKeyTPMToken).toString();
     int passKeyslot = -1;
-    int ret = disk_encrypt_funcs::bcChangePassphrase(config.devicePath, "", pass, &passKeyslot);
+    int ret = trans->changePassphrase({}, passphrase, &passKeyslot);
     if (ret != kSuccess) {
         qCritical() << "cannot set passphrase for device!" << config.devicePath << ret;
-        setExitCode(ret);
-        return;
+        return ret;
     }
 
     if (!token.isEmpty()) {
         // update token keyslot.
         auto _token = updateTokenKeyslots(token, passKeyslot);
-        ret = disk_encrypt_funcs::bcSetToken(config.devicePath, _token);
+        ret = trans->setToken(_token);
         if (ret != kSuccess) {
             qCritical() << "cannot set token for device!" << config.devicePath << ret;
-            setExitCode(ret);
-            return;
+            return ret;
         }
     }
 
     qInfo() << "passphrase has been setted at keyslot:" << passKeyslot;
+    return kSuccess;
 }
 
-void ReencryptWorkerV2::setRecoveryKey()
+int ReencryptWorkerV2::setRecoveryKey(HeaderTransaction *trans)
 {
-    const QString &pass = params.value(encrypt_param_keys::kKeyPassphrase).toString();
     const QString &recPath = params.value(encrypt_param_keys::kKeyRecoveryExportPath).toString();
     if (recPath.isEmpty())
-        return;
+        return kSuccess;
 
     EncryptParams param;
     param.device = config.devicePath;
@@ -415,30 +754,29 @@ void ReencryptWorkerV2::setRecoveryKey()
     QString recPass = disk_encrypt_utils::bcExpRecFile(param);
     if (recPass.isEmpty()) {
         qWarning() << "generate recovery key failed!";
-        return;
+        return kSuccess;
     }
 
     int recKeySlot = -1;
-    int ret = disk_encrypt_funcs::bcChangePassphraseByRecKey(config.devicePath, pass, recPass, &recKeySlot);
+    int ret = trans->addPassphrase(passphrase, SecretBuffer(recPass), &recKeySlot);
     if (ret != kSuccess) {
         qCritical() << "cannot set recovery key for device!" << config.devicePath << ret;
-        setExitCode(ret);
-        return;
+        return ret;
     }
 
     QString recToken = QString("{ 'type': 'usec-recoverykey', 'keyslots': ['%1'] }").arg(recKeySlot);
-    ret = disk_encrypt_funcs::bcSetToken(config.devicePath, recToken);
+    ret = trans->setToken(recToken);
     if (ret != kSuccess) {
         qCritical() << "cannot set recovery token for device!" << config.devicePath << ret;
-        setExitCode(ret);
-        return;
+        return ret;
     }
     qInfo() << "recovery key has been setted at keyslot:" << recKeySlot;
+    return kSuccess;
 }
 
-void ReencryptWorkerV2::setBakcingDevLabel()
+void ReencryptWorkerV2::setBakcingDevLabel(HeaderTransaction *trans)
 {
-    int ret = disk_encrypt_funcs::bcSetLabel(config.devicePath, config.deviceName);
+    int ret = trans->setLabel(config.deviceName);
     if (ret != kSuccess)
         qWarning() << "set label to device failed:" << config.devicePath << config.deviceName << ret;
     qInfo() << "device name setted." << config.devicePath << config.deviceName;
@@ -448,48 +786,49 @@ void ReencryptWorkerV2::updateCrypttab()
 {
     qInfo() << "start updating crypttab...";
 
+    // tpm info: tpm2-device=auto, and the dm-crypt flags persisted in header.
+    QStringList expectedOptions = tuning_utils::bcCrypttabOptions(
+            tuning_utils::bcActivateFlags(tuning_utils::bcGetProfile(config.devicePath)));
     QString tpmToken = params.value(encrypt_param_keys::kKeyTPMToken).toString();
-    if (tpmToken.isEmpty())
+    if (!tpmToken.isEmpty())
+        expectedOptions.append("tpm2-device=auto");
+    if (expectedOptions.isEmpty())
         return;
 
-    // do update crypttab item, append tpm info: tpm2-device=auto
-    QFile crypttab("/etc/crypttab");
-    if (!crypttab.open(QIODevice::ReadOnly)) {
+    TabFile crypttab("/etc/crypttab");
+    if (!crypttab.load()) {
         qWarning() << "cannot open crypttab for reading";
         return;
     }
-    auto contents = crypttab.readAll();
-    crypttab.close();
-
-    bool crypttabUpdated = false;
-    QString srcDev = QString("UUID=") + params.value(encrypt_param_keys::kKeyBackingDevUUID).toString();
-    QByteArrayList lines = contents.split('\n');
-    for (auto &line : lines) {
-        QString _line = line;
-        if (_line.contains(srcDev)) {
-            if (!_line.contains("tpm2-device=auto")) {
-                _line.append(",tpm2-device=auto");
-                line = _line.toLocal8Bit();
-                crypttabUpdated = true;
-            }
-            break;
+
+    QByteArray srcDev = (QString("UUID=") + params.value(encrypt_param_keys::kKeyBackingDevUUID).toString()).toLocal8Bit();
+    for (int i = 0; i < crypttab.lineCount(); ++i) {
+        if (crypttab.field(i, 1) != srcDev)
+            continue;
+
+        // target, source, key file, options.
+        if (crypttab.fieldCount(i) < 3)
+            crypttab.setField(i, 2, "none");
+        QByteArrayList options = crypttab.field(i, 3).split(',');
+        options.removeAll("");
+        for (const auto &opt : expectedOptions) {
+            if (!options.contains(opt.toLocal8Bit()))
+                options.append(opt.toLocal8Bit());
         }
+        crypttab.setField(i, 3, options.join(','));
+        break;
     }
-    if (!crypttabUpdated) {
+    if (!crypttab.isModified()) {
         qInfo() << "no need to update crypttab.";
         return;
     }
 
-    contents = lines.join('\n');
-
-    if (!crypttab.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-        qWarning() << "cannot open crypttab for writing";
+    if (!crypttab.save()) {
+        qWarning() << "cannot write crypttab";
         return;
     }
-    crypttab.write(contents.data());
-    crypttab.close();
     qInfo() << "crypttab has been updated:\n"
-            << contents;
+            << crypttab.contents();
 }
 
 void ReencryptWorkerV2::removeEncryptFile()
@@ -515,7 +854,7 @@ bool ReencryptWorkerV2::validateParams()
     if (params.value(encrypt_param_keys::kKeyDevice).toString() != config.devicePath)
         return false;
 
-    if (params.value(encrypt_param_keys::kKeyPassphrase).toString().isEmpty())
+    if (passphrase.isEmpty())
         return false;
 
     return true;
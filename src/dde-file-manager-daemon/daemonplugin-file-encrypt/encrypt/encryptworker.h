@@ -5,12 +5,15 @@
 #define ENCRYPTWORKER_H
 
 #include "daemonplugin_file_encrypt_global.h"
+#include "jobcontext.h"
 
 #include <QThread>
 #include <QMutex>
 #include <QReadWriteLock>
 
 FILE_ENCRYPT_BEGIN_NS
+class HeaderTransaction;
+
 #define TOKEN_FILE_PATH QString("/tmp/%1_tpm_token.json")
 
 class Worker : public QThread
@@ -18,7 +21,14 @@ class Worker : public QThread
     Q_OBJECT
 public:
     explicit Worker(const QString &jobID, QObject *parent = nullptr)
-        : QThread(parent), jobID(jobID) {}
+        : QThread(parent), jobID(jobID), ctx(new JobContext)
+    {
+        ctx->jobID = jobID;
+    }
+    explicit Worker(const JobContextPtr &ctx, QObject *parent = nullptr)
+        : QThread(parent), jobID(ctx->jobID), ctx(ctx) {}
+
+    inline JobContextPtr context() const { return ctx; }
 
     inline int exitError()
     {
@@ -37,6 +47,7 @@ protected:
     int exitCode { disk_encrypt::kSuccess };
     QString jobID;
     QMutex mtx;
+    JobContextPtr ctx;
 };
 
 class PrencryptWorker : public Worker
@@ -48,24 +59,30 @@ public:
                              QObject *parent);
     int cipherPos() const { return keyslotCipher; }
     int recKeyPos() const { return keyslotRecKey; }
+    // the device is encrypted already, no reencryption is needed.
+    bool isFormatted() const { return formatted; }
 
 protected:
     void run() override;
     int writeEncryptParams();
     int setFstabTimeout();
+    void writeTokenFile(const EncryptParams &encParams);
+    int encryptDetached(const EncryptParams &encParams);
+    void updateTabs(const EncryptParams &encParams, const QString &mapperName, const QString &fsUUID);
 
 private:
     QVariantMap params;
     int keyslotCipher { -1 };
     int keyslotRecKey { -1 };
+    bool formatted { false };
 };
 
 class ReencryptWorker : public Worker
 {
     Q_OBJECT
 public:
-    explicit ReencryptWorker(const QString &dev,
-                             const QString &passphrase,
+    explicit ReencryptWorker(const JobContextPtr &ctx,
+                             const SecretBuffer &passphrase,
                              QObject *parent = nullptr);
 
 Q_SIGNALS:
@@ -76,7 +93,7 @@ protected:
     void run() override;
 
 protected:
-    QString passphrase;
+    SecretBuffer passphrase;
     QString device;
 };
 
@@ -85,22 +102,24 @@ class ReencryptWorkerV2 : public Worker
     Q_OBJECT
 
 public:
-    explicit ReencryptWorkerV2(QObject *parent = nullptr);
+    explicit ReencryptWorkerV2(const QString &jobID, QObject *parent = nullptr);
     void setEncryptParams(const QVariantMap &params);
+    // the worker is only started with valid params, it never waits for them.
+    bool hasValidParams();
     void loadReencryptConfig();
     disk_encrypt::EncryptConfig encryptConfig() const;
+    bool hasUnfinishedOnlineEncryption();
 
 Q_SIGNALS:
-    void requestEncryptParams(const QVariantMap &encConf);
     void deviceReencryptResult(const QString &device,
                                int result);
 
 protected:
     void run() override;
-    bool hasUnfinishedOnlineEncryption();
-    void setPassphrase();
-    void setRecoveryKey();
-    void setBakcingDevLabel();
+    int updateHeader();
+    int setPassphrase(HeaderTransaction *trans);
+    int setRecoveryKey(HeaderTransaction *trans);
+    void setBakcingDevLabel(HeaderTransaction *trans);
     void updateCrypttab();
     void removeEncryptFile();
     QString updateTokenKeyslots(const QString &token, int keyslot);
@@ -108,6 +127,7 @@ protected:
 
 private:
     QVariantMap params;
+    SecretBuffer passphrase;
     QReadWriteLock lock;
 
     disk_encrypt::EncryptConfig config;
@@ -120,13 +140,23 @@ public:
     explicit DecryptWorker(const QString &jobID,
                            const QVariantMap &params,
                            QObject *parent = nullptr);
+    explicit DecryptWorker(const JobContextPtr &ctx,
+                           const QVariantMap &params,
+                           const SecretBuffer &passphrase,
+                           QObject *parent = nullptr);
+    // the params without the passphrase, which is kept apart.
+    QVariantMap jobParams() const { return params; }
+    SecretBuffer jobPassphrase() const { return passphrase; }
 
 protected:
     void run() override;
     int writeDecryptParams();
+    int decryptOnline();
+    void updateTabs(const QString &mapperName, const QString &fsUUID);
 
 private:
     QVariantMap params;
+    SecretBuffer passphrase;
 };
 
 class ChgPassWorker : public Worker
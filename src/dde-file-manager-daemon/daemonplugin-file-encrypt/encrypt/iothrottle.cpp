@@ -0,0 +1,91 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "iothrottle.h"
+
+#include <QThread>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+FILE_ENCRYPT_USE_NS
+
+// from linux/ioprio.h, which is not shipped by every distribution.
+static constexpr int kIOPrioWhoProcess { 1 };
+static constexpr int kIOPrioClassBE { 2 };
+static constexpr int kIOPrioClassShift { 13 };
+static constexpr int kIOPrioLowestLevel { 7 };
+
+static constexpr quint64 kMiB { 1024 * 1024 };
+static constexpr qint64 kSleepSlice { 100 };   // ms
+
+static std::atomic<quint64> gBandwidthLimit { 0 };   // MiB/s
+static std::atomic_bool gSessionIdle { false };
+static std::atomic_bool gPauseWhenActive { false };
+
+void IOThrottle::pace(quint64 offset, const std::atomic_bool &cancelled)
+{
+    bool held = false;
+    while (gPauseWhenActive && !gSessionIdle && !cancelled) {
+        held = true;
+        QThread::msleep(kSleepSlice);
+    }
+
+    quint64 mibps = effectiveLimit();
+    // restart the window when limit changed, the job restarted or was held.
+    if (mibps == 0 || mibps != baseLimit || held || !timer.isValid() || offset < baseOffset) {
+        baseLimit = mibps;
+        baseOffset = offset;
+        timer.start();
+        return;
+    }
+
+    qint64 expected = qint64((offset - baseOffset) * 1000 / (mibps * kMiB));
+    while (expected > timer.elapsed()) {
+        QThread::msleep(quint64(qMin(kSleepSlice, expected - timer.elapsed())));
+        if (effectiveLimit() != mibps || cancelled)
+            break;
+    }
+}
+
+void IOThrottle::setLimit(quint64 mibPerSec)
+{
+    gBandwidthLimit.store(mibPerSec);
+}
+
+quint64 IOThrottle::limit()
+{
+    return gBandwidthLimit.load();
+}
+
+void IOThrottle::lowerPriority()
+{
+    int prio = (kIOPrioClassBE << kIOPrioClassShift) | kIOPrioLowestLevel;
+    if (syscall(SYS_ioprio_set, kIOPrioWhoProcess, int(syscall(SYS_gettid)), prio) != 0)
+        qWarning() << "cannot lower io priority of reencrypt thread" << strerror(errno);
+}
+
+void IOThrottle::setSessionIdle(bool idle)
+{
+    gSessionIdle.store(idle);
+}
+
+bool IOThrottle::isSessionIdle()
+{
+    return gSessionIdle.load();
+}
+
+void IOThrottle::setPauseWhenActive(bool pause)
+{
+    gPauseWhenActive.store(pause);
+}
+
+bool IOThrottle::pauseWhenActive()
+{
+    return gPauseWhenActive.load();
+}
+
+quint64 IOThrottle::effectiveLimit()
+{
+    return gSessionIdle ? 0 : gBandwidthLimit.load();
+}
@@ -0,0 +1,48 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef IOTHROTTLE_H
+#define IOTHROTTLE_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QElapsedTimer>
+
+#include <atomic>
+
+FILE_ENCRYPT_BEGIN_NS
+
+// paces the reencryption in progress callbacks so that the average
+// throughput of a job stays under the bandwidth limit. the limit only
+// applies while the user is active, jobs run at full speed when the
+// session is idle or locked.
+class IOThrottle
+{
+public:
+    void pace(quint64 offset, const std::atomic_bool &cancelled);
+
+    // 0 means unlimited.
+    static void setLimit(quint64 mibPerSec);
+    static quint64 limit();
+
+    // the calling thread yields the disk to the desktop.
+    static void lowerPriority();
+
+    static void setSessionIdle(bool idle);
+    static bool isSessionIdle();
+    // jobs hold at the hotzone boundary while user is active.
+    static void setPauseWhenActive(bool pause);
+    static bool pauseWhenActive();
+
+private:
+    static quint64 effectiveLimit();
+
+private:
+    QElapsedTimer timer;
+    quint64 baseOffset { 0 };
+    quint64 baseLimit { 0 };
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // IOTHROTTLE_H
@@ -0,0 +1,103 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef JOBCONTEXT_H
+#define JOBCONTEXT_H
+
+#include "daemonplugin_file_encrypt_global.h"
+#include "notification/progressaggregator.h"
+#include "notification/phasetimings.h"
+#include "notification/tracelog.h"
+#include "iothrottle.h"
+
+#include <QSharedPointer>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QVariantMap>
+
+#include <atomic>
+
+FILE_ENCRYPT_BEGIN_NS
+
+enum JobType {
+    kJobEncrypt,
+    kJobDecrypt,
+    kJobFstabEncrypt,
+};   // enum JobType
+
+// the state of one en/decrypt job, passed to libcryptsetup as the usrptr
+// of progress callbacks, so jobs on different devices don't share globals.
+struct JobContext
+{
+    JobType type { kJobEncrypt };
+    QString jobID;
+    QString traceID;   // set by the client to correlate its spans with the job
+    QString device;
+    QString deviceName;
+    qint64 startTime { QDateTime::currentMSecsSinceEpoch() };
+    std::atomic_bool interrupted { false };
+    ProgressAggregator progress;
+    PhaseTimings timings;
+    IOThrottle throttle;
+
+    // a random key of a keyslot with cheap pbkdf, unlocks the device inside
+    // the job instead of deriving the user passphrase for every step.
+    SecretBuffer unlockKey;
+    int unlockKeyslot { -1 };
+    int unlockToken { -1 };   // tags the keyslot, see removeStaleJobKeyslots
+
+    // the detached header of a paused decryption, which holds the progress.
+    QString headerPath;
+    // the opened cleartext device of an online encryption, whose file
+    // systems stay mounted during the job.
+    QString activeName;
+
+    // the result of sampling the encrypted device, set by the job thread
+    // before it ends.
+    QVariantMap verification;
+};
+typedef QSharedPointer<JobContext> JobContextPtr;
+
+// times the stages of a job in scope, next() ends the current stage and
+// starts another one. the stages are traced too if tracing is enabled.
+class JobPhase
+{
+public:
+    JobPhase(JobContext *ctx, const char *phase)
+        : ctx(ctx), phase(phase) { start(); }
+    ~JobPhase() { end(); }
+    Q_DISABLE_COPY(JobPhase)
+
+    void next(const char *nextPhase)
+    {
+        end();
+        phase = nextPhase;
+        start();
+    }
+
+    void end()
+    {
+        if (!phase)
+            return;
+        ctx->timings.record(ctx->jobID, ctx->device, phase, timer.elapsed());
+        trace_log::span(ctx->traceID, phase, beginUs, trace_log::now(),
+                        { { "job", ctx->jobID }, { "device", ctx->device } });
+        phase = nullptr;
+    }
+
+private:
+    void start()
+    {
+        timer.start();
+        beginUs = trace_log::now();
+    }
+
+    JobContext *ctx { nullptr };
+    const char *phase { nullptr };
+    QElapsedTimer timer;
+    qint64 beginUs { 0 };
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // JOBCONTEXT_H
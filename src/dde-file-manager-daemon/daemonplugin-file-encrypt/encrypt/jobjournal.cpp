@@ -0,0 +1,155 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "jobjournal.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QMutex>
+#include <QDateTime>
+#include <QJsonDocument>
+
+FILE_ENCRYPT_USE_NS
+
+// the record of a device is read and rewritten by the job thread and the
+// main thread.
+static QMutex gJournalMtx;
+
+static QString journalPath(const QString &device)
+{
+    return QString("%1/%2.json").arg(job_journal::kJournalDir, device.mid(5));
+}
+
+static bool writeEntry(const JournalEntry &entry)
+{
+    if (!QDir().mkpath(job_journal::kJournalDir)) {
+        qWarning() << "cannot create journal dir" << job_journal::kJournalDir;
+        return false;
+    }
+
+    QSaveFile f(journalPath(entry.device));
+    if (!f.open(QIODevice::WriteOnly)) {
+        qWarning() << "cannot open journal of" << entry.device << f.errorString();
+        return false;
+    }
+    f.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+    f.write(QJsonDocument(job_journal::bcEntryToJson(entry)).toJson(QJsonDocument::Compact));
+    if (!f.commit()) {
+        qWarning() << "cannot write journal of" << entry.device << f.errorString();
+        return false;
+    }
+    return true;
+}
+
+static bool readEntry(const QString &path, JournalEntry *entry)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+
+    QJsonParseError err;
+    const QJsonDocument &doc = QJsonDocument::fromJson(f.readAll(), &err);
+    if (err.error != QJsonParseError::NoError || !doc.isObject()) {
+        qWarning() << "broken journal" << path << err.errorString();
+        return false;
+    }
+    *entry = job_journal::bcEntryFromJson(doc.object());
+    return !entry->device.isEmpty();
+}
+
+JournalEntry job_journal::bcEntryOf(const JobContext &ctx)
+{
+    JournalEntry entry;
+    entry.type = ctx.type;
+    entry.jobID = ctx.jobID;
+    entry.traceID = ctx.traceID;
+    entry.device = ctx.device;
+    entry.deviceName = ctx.deviceName;
+    entry.startTime = ctx.startTime;
+    entry.activeName = ctx.activeName;
+    return entry;
+}
+
+bool job_journal::bcRecord(const JournalEntry &entry)
+{
+    if (entry.device.isEmpty())
+        return false;
+
+    JournalEntry e = entry;
+    e.updatedAt = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker locker(&gJournalMtx);
+    return writeEntry(e);
+}
+
+void job_journal::bcSetPhase(const QString &device, const QString &phase)
+{
+    QMutexLocker locker(&gJournalMtx);
+    JournalEntry entry;
+    if (!readEntry(journalPath(device), &entry) || entry.phase == phase)
+        return;
+
+    entry.phase = phase;
+    entry.updatedAt = QDateTime::currentMSecsSinceEpoch();
+    writeEntry(entry);
+}
+
+void job_journal::bcRemove(const QString &device)
+{
+    QMutexLocker locker(&gJournalMtx);
+    const QString &path = journalPath(device);
+    if (QFile::exists(path) && !QFile::remove(path))
+        qWarning() << "cannot remove journal" << path;
+}
+
+QList<JournalEntry> job_journal::bcLoad()
+{
+    QMutexLocker locker(&gJournalMtx);
+    QList<JournalEntry> entries;
+    const QFileInfoList &files = QDir(kJournalDir).entryInfoList({ "*.json" }, QDir::Files);
+    for (const auto &file : files) {
+        JournalEntry entry;
+        if (readEntry(file.absoluteFilePath(), &entry))
+            entries.append(entry);
+    }
+    return entries;
+}
+
+QJsonObject job_journal::bcEntryToJson(const JournalEntry &entry)
+{
+    return QJsonObject {
+        { "type", int(entry.type) },
+        { "job", entry.jobID },
+        { "trace-id", entry.traceID },
+        { "device", entry.device },
+        { "device-name", entry.deviceName },
+        { "start-time", entry.startTime },
+        { "phase", entry.phase },
+        { "active-name", entry.activeName },
+        { "mode", entry.encMode },
+        { "token", entry.token },
+        { "rec-keyslot", entry.recPos },
+        { "header", entry.headerPath },
+        { "updated", entry.updatedAt },
+    };
+}
+
+JournalEntry job_journal::bcEntryFromJson(const QJsonObject &obj)
+{
+    JournalEntry entry;
+    entry.type = static_cast<JobType>(obj.value("type").toInt(kJobEncrypt));
+    entry.jobID = obj.value("job").toString();
+    entry.traceID = obj.value("trace-id").toString();
+    entry.device = obj.value("device").toString();
+    entry.deviceName = obj.value("device-name").toString();
+    entry.startTime = qint64(obj.value("start-time").toDouble());
+    entry.phase = obj.value("phase").toString();
+    entry.activeName = obj.value("active-name").toString();
+    entry.encMode = obj.value("mode").toInt(disk_encrypt::kPasswordOnly);
+    entry.token = obj.value("token").toString();
+    entry.recPos = obj.value("rec-keyslot").toInt(-1);
+    entry.headerPath = obj.value("header").toString();
+    entry.updatedAt = qint64(obj.value("updated").toDouble());
+    return entry;
+}
@@ -0,0 +1,54 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef JOBJOURNAL_H
+#define JOBJOURNAL_H
+
+#include "daemonplugin_file_encrypt_global.h"
+#include "jobcontext.h"
+
+#include <QJsonObject>
+#include <QList>
+
+FILE_ENCRYPT_BEGIN_NS
+
+// what's needed to continue a job after the daemon is restarted. nothing
+// secret is recorded, the passphrase is asked from the session again.
+struct JournalEntry
+{
+    JobType type { kJobEncrypt };
+    QString jobID;
+    QString traceID;
+    QString device;
+    QString deviceName;
+    qint64 startTime { 0 };
+    QString phase;
+    QString activeName;   // the cleartext device of an online job.
+    int encMode { disk_encrypt::kPasswordOnly };
+    QString token;   // the tpm token which is set after the job.
+    int recPos { -1 };
+    // the detached header of an online job, which finds the partition by
+    // its uuid if the device is named differently after a reboot.
+    QString headerPath;
+    qint64 updatedAt { 0 };   // msecs since epoch.
+};
+
+// one file per device in kJournalDir, replaced atomically on every change,
+// so a crash leaves either the old or the new record.
+namespace job_journal {
+inline constexpr char kJournalDir[] { "/var/lib/dde-file-manager/encrypt-jobs" };
+
+JournalEntry bcEntryOf(const JobContext &ctx);
+bool bcRecord(const JournalEntry &entry);
+// keeps the last phase reported by the job, no-op if the device has no record.
+void bcSetPhase(const QString &device, const QString &phase);
+void bcRemove(const QString &device);
+QList<JournalEntry> bcLoad();
+
+QJsonObject bcEntryToJson(const JournalEntry &entry);
+JournalEntry bcEntryFromJson(const QJsonObject &obj);
+}   // namespace job_journal
+
+FILE_ENCRYPT_END_NS
+
+#endif   // JOBJOURNAL_H
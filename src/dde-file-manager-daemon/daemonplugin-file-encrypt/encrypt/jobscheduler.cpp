@@ -0,0 +1,77 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "jobscheduler.h"
+#include "encrypttuning.h"
+
+#include <QThread>
+#include <QDebug>
+
+#include <algorithm>
+
+FILE_ENCRYPT_USE_NS
+
+static constexpr int kMinWorkers { 2 };
+static constexpr int kMaxWorkers { 4 };
+
+JobScheduler::JobScheduler(QObject *parent)
+    : QObject(parent),
+      maxWorkers(qBound(kMinWorkers, QThread::idealThreadCount(), kMaxWorkers))
+{
+}
+
+void JobScheduler::submit(QThread *worker, Priority priority, const QString &device)
+{
+    Q_ASSERT(worker);
+    Task task;
+    task.worker = worker;
+    task.priority = priority;
+    task.disk = tuning_utils::bcSysDiskDir(device);
+    if (task.disk.isEmpty())
+        task.disk = device;
+
+    // keep the queue sorted by priority, FIFO within one priority.
+    auto iter = std::find_if(queue.begin(), queue.end(), [priority](const Task &t) {
+        return t.priority > priority;
+    });
+    queue.insert(iter, task);
+    schedule();
+}
+
+void JobScheduler::schedule()
+{
+    for (int i = 0; i < queue.count() && running < maxWorkers;) {
+        const Task &task = queue.at(i);
+        // one slot is always left for header operations.
+        bool isLong = task.priority != kPriorityHeader;
+        if (busyDisks.contains(task.disk) || (isLong && runningLong >= maxWorkers - 1)) {
+            ++i;
+            continue;
+        }
+        start(queue.takeAt(i));
+    }
+
+    if (!queue.isEmpty())
+        qDebug() << "jobs running:" << running << ", queued:" << queue.count();
+}
+
+void JobScheduler::start(const Task &task)
+{
+    bool isLong = task.priority != kPriorityHeader;
+    busyDisks.insert(task.disk);
+    running += 1;
+    if (isLong)
+        runningLong += 1;
+
+    // the worker may be deleted later by the caller's handler, only the
+    // copied task data is used here.
+    const QString disk = task.disk;
+    connect(task.worker, &QThread::finished, this, [this, disk, isLong] {
+        busyDisks.remove(disk);
+        running -= 1;
+        if (isLong)
+            runningLong -= 1;
+        schedule();
+    });
+    task.worker->start();
+}
@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef JOBSCHEDULER_H
+#define JOBSCHEDULER_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QObject>
+#include <QList>
+#include <QSet>
+
+class QThread;
+
+FILE_ENCRYPT_BEGIN_NS
+
+// starts the workers with a bounded concurrency. queued workers are started
+// by priority then by order of submission, workers on the same physical
+// disk never run at the same time.
+class JobScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Priority {
+        kPriorityHeader,   // passphrase changes, done in seconds.
+        kPrioritySetup,   // fs check, resize and header init.
+        kPriorityReencrypt,   // the data reencryption, takes hours.
+    };   // enum Priority
+
+    explicit JobScheduler(QObject *parent = nullptr);
+
+    // the worker is started by scheduler, it's still owned by the caller.
+    void submit(QThread *worker, Priority priority, const QString &device);
+    inline int pendingCount() const { return queue.count(); }
+    inline int runningCount() const { return running; }
+
+private:
+    struct Task
+    {
+        QThread *worker { nullptr };
+        Priority priority { kPriorityHeader };
+        QString disk;
+    };
+    void schedule();
+    void start(const Task &task);
+
+private:
+    QList<Task> queue;
+    QSet<QString> busyDisks;
+    int running { 0 };
+    int runningLong { 0 };
+    int maxWorkers { 0 };
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // JOBSCHEDULER_H
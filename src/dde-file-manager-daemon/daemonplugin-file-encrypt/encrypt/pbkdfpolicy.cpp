@@ -0,0 +1,205 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "pbkdfpolicy.h"
+#include "resourcegovernor.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QMutex>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QThread>
+
+#include <libcryptsetup.h>
+#include <unistd.h>
+#include <cstring>
+
+FILE_ENCRYPT_USE_NS
+
+static constexpr quint32 kMaxThreads { 4 };
+static constexpr quint32 kMinMemoryKb { 32 * 1024 };
+static constexpr quint32 kMaxMemoryKb { 1024 * 1024 };   // the hard limit of libcryptsetup.
+static constexpr size_t kVolumeKeySize { 64 };
+
+static QMutex gProfileMtx;
+static QMutex gCalibrateMtx;   // never taken inside gProfileMtx.
+static PbkdfProfile gProfile;
+static quint32 gUnlockMs { 0 };
+static quint32 gMaxMemoryKb { 0 };
+
+// an eighth of the ram, so that unlocking never swaps.
+static quint32 defaultMaxMemoryKb()
+{
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || pageSize <= 0)
+        return kMaxMemoryKb;
+
+    quint64 ramKb = quint64(pages) * quint64(pageSize) / 1024;
+    return quint32(qBound(quint64(kMinMemoryKb), ramKb / 8, quint64(kMaxMemoryKb)));
+}
+
+void pbkdf_utils::bcSetPolicy(quint32 unlockMs, quint32 maxMemoryKb)
+{
+    QMutexLocker locker(&gProfileMtx);
+    gUnlockMs = unlockMs;
+    gMaxMemoryKb = maxMemoryKb == 0 ? 0 : qBound(kMinMemoryKb, maxMemoryKb, kMaxMemoryKb);
+    gProfile = {};
+}
+
+quint32 pbkdf_utils::bcUnlockMs()
+{
+    QMutexLocker locker(&gProfileMtx);
+    return gUnlockMs > 0 ? gUnlockMs : kDefaultUnlockMs;
+}
+
+quint32 pbkdf_utils::bcMaxMemoryKb()
+{
+    QMutexLocker locker(&gProfileMtx);
+    return gMaxMemoryKb > 0 ? gMaxMemoryKb : defaultMaxMemoryKb();
+}
+
+PbkdfProfile pbkdf_utils::bcGetProfile()
+{
+    const quint32 unlockMs = bcUnlockMs();
+    const quint32 maxMemoryKb = bcMaxMemoryKb();
+
+    auto cachedProfile = [&](PbkdfProfile *profile) {
+        QMutexLocker locker(&gProfileMtx);
+        if (!gProfile.isValid() || gProfile.unlockMs != unlockMs || gProfile.maxMemoryKb != maxMemoryKb)
+            return false;
+        *profile = gProfile;
+        return true;
+    };
+
+    // the cpu won't change during runtime, benchmark only once. concurrent
+    // jobs wait for the same result on the calibrating lock, the policy and
+    // profile stay readable by others meanwhile.
+    PbkdfProfile profile;
+    if (cachedProfile(&profile))
+        return profile;
+
+    QMutexLocker calibrating(&gCalibrateMtx);
+    if (cachedProfile(&profile))
+        return profile;
+
+    profile = bcCalibrate(unlockMs, maxMemoryKb);
+    QMutexLocker locker(&gProfileMtx);
+    gProfile = profile;
+    return profile;
+}
+
+PbkdfProfile pbkdf_utils::bcCalibrate(quint32 unlockMs, quint32 maxMemoryKb)
+{
+    static const QStringList kTypes { CRYPT_KDF_ARGON2ID, CRYPT_KDF_PBKDF2 };
+    static constexpr char kPassword[] { "dde-file-manager" };
+    static constexpr char kSalt[] { "0123456789abcdef0123456789abcdef" };
+
+    const quint32 threads = qBound(1u, quint32(QThread::idealThreadCount()), kMaxThreads);
+    for (const auto &type : kTypes) {
+        const std::string cType = type.toStdString();
+        bool isArgon = type != CRYPT_KDF_PBKDF2;
+        struct crypt_pbkdf_type pbkdf = {
+            .type = cType.c_str(),
+            .hash = "sha256",
+            .time_ms = unlockMs,
+            .iterations = 0,
+            .max_memory_kb = isArgon ? maxMemoryKb : 0,
+            .parallel_threads = isArgon ? threads : 0,
+            .flags = 0,
+        };
+        // the benchmark takes the memory it's calibrating for.
+        const ResourceCost cost { pbkdf.max_memory_kb, qMax(1u, pbkdf.parallel_threads) };
+        int ret = governed(cost, ResourceGovernor::kPbkdf, "benchmark_pbkdf", [&] {
+            return crypt_benchmark_pbkdf(nullptr, &pbkdf,
+                                         kPassword, strlen(kPassword),
+                                         kSalt, strlen(kSalt),
+                                         kVolumeKeySize, nullptr, nullptr);
+        });
+        if (ret < 0) {
+            qWarning() << "benchmark pbkdf failed:" << type << ret;
+            continue;
+        }
+
+        PbkdfProfile profile;
+        profile.type = type;
+        profile.iterations = pbkdf.iterations;
+        profile.memoryKb = pbkdf.max_memory_kb;
+        profile.threads = pbkdf.parallel_threads;
+        profile.unlockMs = unlockMs;
+        profile.maxMemoryKb = maxMemoryKb;
+        profile.calibratedAt = QDateTime::currentSecsSinceEpoch();
+        qInfo() << "pbkdf calibrated:" << bcProfileToJson(profile);
+        return profile;
+    }
+    return {};
+}
+
+QJsonObject pbkdf_utils::bcProfileToJson(const PbkdfProfile &profile)
+{
+    return QJsonObject {
+        { "type", profile.type },
+        { "hash", profile.hash },
+        { "iterations", qint64(profile.iterations) },
+        { "memory-kb", qint64(profile.memoryKb) },
+        { "threads", qint64(profile.threads) },
+        { "unlock-ms", qint64(profile.unlockMs) },
+        { "max-memory-kb", qint64(profile.maxMemoryKb) },
+        { "calibrated-at", profile.calibratedAt },
+    };
+}
+
+PbkdfProfile pbkdf_utils::bcApply(struct crypt_device *cdev, const QString &device)
+{
+    const PbkdfProfile &profile = bcGetProfile();
+    if (!profile.isValid()) {
+        qWarning() << "no pbkdf profile, use the defaults of libcryptsetup for" << device;
+        crypt_set_pbkdf_type(cdev, nullptr);
+        return profile;
+    }
+
+    const std::string cType = profile.type.toStdString();
+    const std::string cHash = profile.hash.toStdString();
+    struct crypt_pbkdf_type pbkdf = {
+        .type = cType.c_str(),
+        .hash = cHash.c_str(),
+        .time_ms = 0,
+        .iterations = profile.iterations,
+        .max_memory_kb = profile.memoryKb,
+        .parallel_threads = profile.threads,
+        .flags = CRYPT_PBKDF_NO_BENCHMARK,
+    };
+    int ret = crypt_set_pbkdf_type(cdev, &pbkdf);
+    if (ret < 0) {
+        qWarning() << "cannot set pbkdf for" << device << ret << ", use the defaults";
+        crypt_set_pbkdf_type(cdev, nullptr);
+        return {};
+    }
+    return profile;
+}
+
+void pbkdf_utils::bcRecord(const QString &device, int keyslot, const QString &operation, const PbkdfProfile &profile)
+{
+    QJsonObject record = bcProfileToJson(profile);
+    record.insert("time", QDateTime::currentDateTime().toString(Qt::ISODate));
+    record.insert("device", device);
+    record.insert("keyslot", keyslot);
+    record.insert("operation", operation);
+    if (!profile.isValid())
+        record.insert("type", "default");
+
+    const QByteArray &line = QJsonDocument(record).toJson(QJsonDocument::Compact);
+    qInfo() << "keyslot created:" << line;
+
+    QDir().mkpath(QFileInfo(kAuditLogPath).absolutePath());
+    QFile audit(kAuditLogPath);
+    if (!audit.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "cannot open pbkdf audit log" << audit.errorString();
+        return;
+    }
+    audit.write(line + "\n");
+    audit.close();
+}
@@ -0,0 +1,56 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PBKDF_POLICY_H
+#define PBKDF_POLICY_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QJsonObject>
+
+struct crypt_device;
+
+FILE_ENCRYPT_BEGIN_NS
+
+// the parameters of keyslots which are unlocked by users. libcryptsetup
+// benchmarks for 2s and up to 1GiB of argon2 memory for every keyslot by
+// default, which is slow to unlock and swaps on low-end machines. the
+// machine is benchmarked once against the unlock latency target and the
+// memory ceiling here, the result is used for all keyslots afterwards.
+struct PbkdfProfile
+{
+    QString type;
+    QString hash { "sha256" };
+    quint32 iterations { 0 };
+    quint32 memoryKb { 0 };   // argon2 only.
+    quint32 threads { 0 };   // argon2 only.
+    quint32 unlockMs { 0 };   // the target it's calibrated for.
+    quint32 maxMemoryKb { 0 };   // the ceiling it's calibrated for.
+    qint64 calibratedAt { 0 };   // secs since epoch.
+
+    inline bool isValid() const { return iterations > 0; }
+};
+
+namespace pbkdf_utils {
+inline constexpr char kAuditLogPath[] { "/var/log/dde-file-manager/pbkdf.log" };
+inline constexpr quint32 kDefaultUnlockMs { 1000 };
+
+// 0 restores the default, the profile is recalibrated at next use.
+void bcSetPolicy(quint32 unlockMs, quint32 maxMemoryKb);
+quint32 bcUnlockMs();
+quint32 bcMaxMemoryKb();
+
+PbkdfProfile bcGetProfile();
+PbkdfProfile bcCalibrate(quint32 unlockMs, quint32 maxMemoryKb);
+QJsonObject bcProfileToJson(const PbkdfProfile &profile);
+
+// sets the profile on cdev for the next keyslot operations on it, the
+// defaults of libcryptsetup are used if the benchmark failed.
+PbkdfProfile bcApply(struct crypt_device *cdev, const QString &device);
+// appends the parameters a keyslot was created with to kAuditLogPath.
+void bcRecord(const QString &device, int keyslot, const QString &operation, const PbkdfProfile &profile);
+}   // namespace pbkdf_utils
+
+FILE_ENCRYPT_END_NS
+
+#endif   // PBKDF_POLICY_H
@@ -0,0 +1,165 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "resourcegovernor.h"
+
+#include <QDebug>
+#include <QThread>
+#include <QElapsedTimer>
+
+#include <libcryptsetup.h>
+#include <unistd.h>
+#include <cstring>
+
+FILE_ENCRYPT_USE_NS
+
+// the size libcryptsetup takes when the hotzone isn't limited.
+static constexpr quint64 kDefaultHotzoneBytes { 64 * 1024 * 1024 };
+static constexpr quint64 kMinMemoryBudgetKb { 512 * 1024 };
+
+// half of the ram, the rest is left to the desktop and the page cache
+// which the reencryption goes through.
+static quint64 memoryBudgetOfRam()
+{
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || pageSize <= 0)
+        return kMinMemoryBudgetKb;
+    return qMax(kMinMemoryBudgetKb, quint64(pages) * quint64(pageSize) / 1024 / 2);
+}
+
+static ResourceCost costOf(const struct crypt_pbkdf_type &pbkdf)
+{
+    ResourceCost cost;
+    // pbkdf2 takes no memory and one thread.
+    if (pbkdf.type && strcmp(pbkdf.type, CRYPT_KDF_PBKDF2) != 0) {
+        cost.memoryKb = pbkdf.max_memory_kb;
+        cost.threads = qMax(1u, pbkdf.parallel_threads);
+    }
+    return cost;
+}
+
+ResourceCost ResourceCost::ofKeyslot(struct crypt_device *cdev, int keyslot)
+{
+    ResourceCost cost;
+    if (!cdev)
+        return cost;
+
+    struct crypt_pbkdf_type pbkdf {};
+    if (keyslot >= 0) {
+        if (crypt_keyslot_get_pbkdf(cdev, keyslot, &pbkdf) == 0)
+            cost = costOf(pbkdf);
+        return cost;
+    }
+
+    const int count = crypt_keyslot_max(CRYPT_LUKS2);
+    for (int i = 0; i < count; ++i) {
+        crypt_keyslot_info info = crypt_keyslot_status(cdev, i);
+        if (info != CRYPT_SLOT_ACTIVE && info != CRYPT_SLOT_ACTIVE_LAST)
+            continue;
+        if (crypt_keyslot_get_pbkdf(cdev, i, &pbkdf) != 0)
+            continue;
+        const ResourceCost &slotCost = costOf(pbkdf);
+        cost.memoryKb = qMax(cost.memoryKb, slotCost.memoryKb);
+        cost.threads = qMax(cost.threads, slotCost.threads);
+    }
+    return cost;
+}
+
+ResourceCost ResourceCost::ofNewKeyslot(struct crypt_device *cdev)
+{
+    const struct crypt_pbkdf_type *pbkdf = cdev ? crypt_get_pbkdf_type(cdev) : nullptr;
+    return pbkdf ? costOf(*pbkdf) : ResourceCost();
+}
+
+ResourceCost ResourceCost::ofChange(struct crypt_device *cdev)
+{
+    // the derivations run one after another.
+    ResourceCost cost = ofKeyslot(cdev, CRYPT_ANY_SLOT);
+    const ResourceCost &newCost = ofNewKeyslot(cdev);
+    cost.memoryKb = qMax(cost.memoryKb, newCost.memoryKb);
+    cost.threads = qMax(cost.threads, newCost.threads);
+    return cost;
+}
+
+ResourceCost ResourceCost::ofReencrypt(quint64 hotzoneBytes)
+{
+    // the hotzone is read into a buffer and written back from it.
+    ResourceCost cost;
+    cost.memoryKb = (hotzoneBytes > 0 ? hotzoneBytes : kDefaultHotzoneBytes) / 1024;
+    return cost;
+}
+
+ResourceGovernor *ResourceGovernor::instance()
+{
+    static ResourceGovernor ins;
+    return &ins;
+}
+
+ResourceGovernor::ResourceGovernor()
+    : memoryBudgetKb(memoryBudgetOfRam()),
+      threadBudget(quint32(qMax(1, QThread::idealThreadCount())))
+{
+    qInfo() << "resource budget of jobs:" << memoryBudgetKb << "KiB," << threadBudget << "threads";
+}
+
+bool ResourceGovernor::fits(const ResourceCost &cost) const
+{
+    if (pbkdfRunning == 0)
+        return true;
+    return memoryUsedKb + cost.memoryKb <= memoryBudgetKb
+            && threadsUsed + cost.threads <= threadBudget;
+}
+
+void ResourceGovernor::acquire(const ResourceCost &cost, Kind kind, const char *step)
+{
+    QMutexLocker locker(&mtx);
+    if (kind == kPbkdf && !fits(cost)) {
+        qInfo() << "queue" << step << "for" << cost.memoryKb << "KiB," << cost.threads << "threads, used:"
+                << memoryUsedKb << "KiB," << threadsUsed << "threads";
+        QElapsedTimer timer;
+        timer.start();
+        waiting += 1;
+        queuedTimes += 1;
+        while (!fits(cost))
+            released.wait(&mtx);
+        waiting -= 1;
+        maxWaitMsecs = qMax(maxWaitMsecs, timer.elapsed());
+        qInfo() << step << "waited for" << timer.elapsed() << "ms";
+    }
+
+    memoryUsedKb += cost.memoryKb;
+    threadsUsed += cost.threads;
+    if (kind == kPbkdf)
+        pbkdfRunning += 1;
+    else
+        reencryptRunning += 1;
+}
+
+void ResourceGovernor::release(const ResourceCost &cost, Kind kind)
+{
+    QMutexLocker locker(&mtx);
+    memoryUsedKb -= qMin(memoryUsedKb, cost.memoryKb);
+    threadsUsed -= qMin(threadsUsed, cost.threads);
+    if (kind == kPbkdf)
+        pbkdfRunning -= 1;
+    else
+        reencryptRunning -= 1;
+    released.wakeAll();
+}
+
+QVariantMap ResourceGovernor::utilization()
+{
+    QMutexLocker locker(&mtx);
+    return QVariantMap {
+        { "memoryBudgetKb", memoryBudgetKb },
+        { "memoryUsedKb", memoryUsedKb },
+        { "threadBudget", threadBudget },
+        { "threadsUsed", threadsUsed },
+        { "pbkdfRunning", pbkdfRunning },
+        { "reencryptRunning", reencryptRunning },
+        { "pbkdfWaiting", waiting },
+        { "queuedTimes", queuedTimes },
+        { "maxWaitMsecs", maxWaitMsecs },
+    };
+}
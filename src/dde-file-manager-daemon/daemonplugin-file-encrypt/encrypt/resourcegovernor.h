@@ -0,0 +1,102 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef RESOURCEGOVERNOR_H
+#define RESOURCEGOVERNOR_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVariantMap>
+
+struct crypt_device;
+
+FILE_ENCRYPT_BEGIN_NS
+
+struct ResourceCost
+{
+    quint64 memoryKb { 0 };
+    quint32 threads { 1 };
+
+    // the pbkdf of unlocking keyslot, the most expensive one of the active
+    // keyslots for CRYPT_ANY_SLOT.
+    static ResourceCost ofKeyslot(struct crypt_device *cdev, int keyslot);
+    // the pbkdf which is set on cdev for the next new keyslot.
+    static ResourceCost ofNewKeyslot(struct crypt_device *cdev);
+    // unlocking any keyslot then deriving the new one.
+    static ResourceCost ofChange(struct crypt_device *cdev);
+    // the buffers and the crypto thread of a running reencryption.
+    static ResourceCost ofReencrypt(quint64 hotzoneBytes);
+};
+
+// a memory and cpu budget shared by the jobs. one argon2 derivation takes
+// up to 1GiB, the derivations of concurrent jobs are queued once the
+// budget is used up. a step which exceeds the budget alone still runs
+// when no other derivation is running, so nothing waits forever.
+// reencryptions are counted but never queued, they don't wait for hours
+// of other reencryptions.
+class ResourceGovernor
+{
+public:
+    enum Kind {
+        kPbkdf,
+        kReencrypt,
+    };   // enum Kind
+
+    static ResourceGovernor *instance();
+
+    void acquire(const ResourceCost &cost, Kind kind, const char *step);
+    void release(const ResourceCost &cost, Kind kind);
+
+    QVariantMap utilization();
+
+private:
+    ResourceGovernor();
+    Q_DISABLE_COPY(ResourceGovernor)
+
+    bool fits(const ResourceCost &cost) const;
+
+private:
+    QMutex mtx;
+    QWaitCondition released;
+
+    quint64 memoryBudgetKb { 0 };
+    quint32 threadBudget { 0 };
+    quint64 memoryUsedKb { 0 };
+    quint32 threadsUsed { 0 };
+    int pbkdfRunning { 0 };
+    int reencryptRunning { 0 };
+    int waiting { 0 };
+    quint64 queuedTimes { 0 };
+    qint64 maxWaitMsecs { 0 };
+};
+
+// holds the cost in scope.
+class ResourceLease
+{
+public:
+    ResourceLease(const ResourceCost &cost, ResourceGovernor::Kind kind, const char *step)
+        : cost(cost), kind(kind)
+    {
+        ResourceGovernor::instance()->acquire(cost, kind, step);
+    }
+    ~ResourceLease() { ResourceGovernor::instance()->release(cost, kind); }
+    Q_DISABLE_COPY(ResourceLease)
+
+private:
+    ResourceCost cost;
+    ResourceGovernor::Kind kind;
+};
+
+// runs the call of libcryptsetup with its cost held.
+template<typename Func>
+inline int governed(const ResourceCost &cost, ResourceGovernor::Kind kind, const char *step, Func &&func)
+{
+    ResourceLease lease(cost, kind, step);
+    return func();
+}
+
+FILE_ENCRYPT_END_NS
+
+#endif   // RESOURCEGOVERNOR_H
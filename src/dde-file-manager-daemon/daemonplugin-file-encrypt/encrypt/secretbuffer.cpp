@@ -0,0 +1,95 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <unistd.h>
+#include <string.h>
+
+FILE_ENCRYPT_USE_NS
+
+struct SecretBuffer::Data
+{
+    char *data { nullptr };
+    size_t size { 0 };
+    size_t capacity { 0 };
+
+    explicit Data(size_t size)
+        : size(size)
+    {
+        static const size_t kPageSize = size_t(sysconf(_SC_PAGESIZE));
+        capacity = qMax(kPageSize, (size + kPageSize - 1) / kPageSize * kPageSize);
+        void *mem = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            qCritical() << "cannot allocate secret buffer" << strerror(errno);
+            this->size = 0;
+            capacity = 0;
+            return;
+        }
+        data = static_cast<char *>(mem);
+        // keeps working if the limit of locked memory is reached, only warns.
+        if (mlock(data, capacity) != 0)
+            qWarning() << "cannot lock secret buffer in memory" << strerror(errno);
+        madvise(data, capacity, MADV_DONTDUMP);
+    }
+
+    ~Data()
+    {
+        if (!data)
+            return;
+        explicit_bzero(data, capacity);
+        munlock(data, capacity);
+        munmap(data, capacity);
+    }
+
+    Q_DISABLE_COPY(Data)
+};
+
+SecretBuffer::SecretBuffer(const QString &passphrase)
+{
+    if (passphrase.isEmpty())
+        return;
+
+    QByteArray utf8 = passphrase.toUtf8();
+    // the keyslots were created with the utf-8 bytes cut at the count of
+    // characters, keep the same bytes or the existing keys cannot unlock.
+    size_t len = size_t(qMin(utf8.size(), passphrase.length()));
+    d = std::make_shared<Data>(len);
+    if (d->data)
+        memcpy(d->data, utf8.constData(), len);
+    explicit_bzero(utf8.data(), size_t(utf8.size()));
+}
+
+SecretBuffer::SecretBuffer(const char *data, size_t size)
+{
+    if (!data || size == 0)
+        return;
+    d = std::make_shared<Data>(size);
+    if (d->data)
+        memcpy(d->data, data, size);
+}
+
+SecretBuffer SecretBuffer::random(size_t size)
+{
+    SecretBuffer buf;
+    buf.d = std::make_shared<Data>(size);
+    if (!buf.d->data || getrandom(buf.d->data, size, 0) != ssize_t(size)) {
+        qWarning() << "cannot generate random secret" << strerror(errno);
+        return {};
+    }
+    return buf;
+}
+
+const char *SecretBuffer::data() const
+{
+    // libcryptsetup rejects a null passphrase, but an empty one is valid and
+    // used by the keyslot of boot stage encryption.
+    return d && d->data ? d->data : "";
+}
+
+size_t SecretBuffer::size() const
+{
+    return d && d->data ? d->size : 0;
+}
@@ -0,0 +1,205 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "tabfile.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDebug>
+
+#include <dfm-base/utils/finallyutil.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+FILE_ENCRYPT_USE_NS
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool writeAll(int fd, const QByteArray &data)
+{
+    const char *buf = data.constData();
+    qint64 left = data.size();
+    while (left > 0) {
+        ssize_t bytes = write(fd, buf, size_t(left));
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return false;
+        buf += bytes;
+        left -= bytes;
+    }
+    return true;
+}
+
+TabFile::TabFile(const QString &path)
+    : path(path)
+{
+}
+
+bool TabFile::load()
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) {
+        qWarning() << "cannot open file for reading" << path;
+        return false;
+    }
+    const QByteArray &contents = f.readAll();
+    f.close();
+
+    lines.clear();
+    modified = false;
+    // the last item is empty when file ends with '\n', keeps it so that the
+    // file ending is restored by join.
+    const QByteArrayList &rawLines = contents.split('\n');
+    lines.reserve(rawLines.count());
+    for (const auto &raw : rawLines)
+        lines.append(parseLine(raw));
+    return true;
+}
+
+bool TabFile::save()
+{
+    if (!modified)
+        return true;
+
+    // write a sibling file and rename it over, the file is either the old or
+    // the new one after a crash.
+    QByteArray tmpPath = (path + ".XXXXXX").toLocal8Bit();
+    int fd = mkstemp(tmpPath.data());
+    if (fd < 0) {
+        qWarning() << "cannot create temp file for" << path << strerror(errno);
+        return false;
+    }
+
+    bool committed = false;
+    dfmbase::FinallyUtil finalClear([&] {
+        if (fd >= 0) close(fd);
+        if (!committed) ::unlink(tmpPath.constData());
+    });
+
+    struct stat st;
+    if (stat(path.toLocal8Bit().constData(), &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);
+        if (fchown(fd, st.st_uid, st.st_gid) != 0)
+            qWarning() << "cannot keep owner of" << path << strerror(errno);
+    }
+
+    if (!writeAll(fd, contents()) || fsync(fd) != 0) {
+        qWarning() << "cannot write temp file for" << path << strerror(errno);
+        return false;
+    }
+    close(fd);
+    fd = -1;
+
+    if (::rename(tmpPath.constData(), path.toLocal8Bit().constData()) != 0) {
+        qWarning() << "cannot replace" << path << strerror(errno);
+        return false;
+    }
+    committed = true;
+
+    // persist the rename.
+    int dirFd = open(QFileInfo(path).absolutePath().toLocal8Bit().constData(), O_RDONLY | O_DIRECTORY);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+
+    modified = false;
+    return true;
+}
+
+QByteArray TabFile::contents() const
+{
+    QByteArray contents;
+    for (int i = 0; i < lines.count(); ++i) {
+        if (i > 0)
+            contents.append('\n');
+        contents.append(lines.at(i).raw);
+    }
+    return contents;
+}
+
+bool TabFile::isEntry(int line) const
+{
+    const Line &l = lines.at(line);
+    return !l.comment && !l.fields.isEmpty();
+}
+
+int TabFile::fieldCount(int line) const
+{
+    const Line &l = lines.at(line);
+    return l.comment ? 0 : l.fields.count();
+}
+
+QByteArray TabFile::field(int line, int index) const
+{
+    const Line &l = lines.at(line);
+    if (l.comment || index < 0 || index >= l.fields.count())
+        return QByteArray();
+    return l.raw.mid(l.fields.at(index).first, l.fields.at(index).second);
+}
+
+void TabFile::setField(int line, int index, const QByteArray &value)
+{
+    Line &l = lines[line];
+    if (l.comment || index < 0 || index > l.fields.count())
+        return;
+
+    if (index == l.fields.count()) {
+        int end = l.fields.isEmpty() ? 0 : l.fields.last().first + l.fields.last().second;
+        l.raw.insert(end, (l.fields.isEmpty() ? QByteArray() : QByteArray("\t")) + value);
+    } else {
+        if (field(line, index) == value)
+            return;
+        l.raw.replace(l.fields.at(index).first, l.fields.at(index).second, value);
+    }
+    l = parseLine(l.raw);
+    modified = true;
+}
+
+void TabFile::removeLine(int line)
+{
+    lines.remove(line);
+    modified = true;
+}
+
+void TabFile::appendLine(const QByteArrayList &fields)
+{
+    int pos = lines.count();
+    if (pos > 0 && lines.last().raw.isEmpty())
+        --pos;
+    lines.insert(pos, parseLine(fields.join('\t')));
+    if (lines.count() == 1)
+        lines.append(parseLine(QByteArray()));
+    modified = true;
+}
+
+TabFile::Line TabFile::parseLine(const QByteArray &raw)
+{
+    Line l;
+    l.raw = raw;
+
+    const int len = raw.size();
+    int pos = 0;
+    while (pos < len && isBlank(raw.at(pos)))
+        ++pos;
+    if (pos < len && raw.at(pos) == '#') {
+        l.comment = true;
+        return l;
+    }
+
+    while (pos < len) {
+        int start = pos;
+        while (pos < len && !isBlank(raw.at(pos)))
+            ++pos;
+        l.fields.append({ start, pos - start });
+        while (pos < len && isBlank(raw.at(pos)))
+            ++pos;
+    }
+    return l;
+}
@@ -0,0 +1,54 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef TABFILE_H
+#define TABFILE_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QByteArrayList>
+#include <QVector>
+
+FILE_ENCRYPT_BEGIN_NS
+
+// a fstab(5)/crypttab(5) style file, whitespace separated fields per line.
+// only edited fields are rewritten, comments, blank lines and separators are
+// kept as they are.
+class TabFile
+{
+public:
+    explicit TabFile(const QString &path);
+
+    bool load();
+    bool save();
+    inline bool isModified() const { return modified; }
+    QByteArray contents() const;
+
+    inline int lineCount() const { return lines.count(); }
+    bool isEntry(int line) const;
+    int fieldCount(int line) const;
+    QByteArray field(int line, int index) const;
+    // index == fieldCount appends a field.
+    void setField(int line, int index, const QByteArray &value);
+    void removeLine(int line);
+    // appends an entry before the trailing blank line.
+    void appendLine(const QByteArrayList &fields);
+
+private:
+    struct Line
+    {
+        QByteArray raw;
+        QVector<QPair<int, int>> fields;   // offset and length in raw
+        bool comment { false };
+    };
+    static Line parseLine(const QByteArray &raw);
+
+private:
+    QString path;
+    QVector<Line> lines;
+    bool modified { false };
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // TABFILE_H
@@ -0,0 +1,122 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "tokenindex.h"
+#include "cryptdevicecache.h"
+
+#include <QDebug>
+#include <QJsonDocument>
+
+#include <libcryptsetup.h>
+
+FILE_ENCRYPT_USE_NS
+using namespace disk_encrypt;
+
+static constexpr int kMaxTokens { 32 };   // LUKS2_TOKENS_MAX
+
+TokenIndex *TokenIndex::instance()
+{
+    static TokenIndex ins;
+    return &ins;
+}
+
+int TokenIndex::tokens(const QString &device, DeviceTokens *tokens)
+{
+    Q_ASSERT(tokens);
+    const QString &key = CryptDeviceCache::cacheKey(device);
+    const quint64 generation = CryptDeviceCache::instance()->generation(device);
+    {
+        QMutexLocker locker(&mtx);
+        auto iter = indexes.constFind(key);
+        if (iter != indexes.cend() && iter->generation == generation) {
+            *tokens = iter.value();
+            return kSuccess;
+        }
+    }
+
+    DeviceTokens loaded;
+    int ret = load(device, &loaded);
+    if (ret < 0)
+        return ret;
+
+    QMutexLocker locker(&mtx);
+    indexes.insert(key, loaded);
+    *tokens = loaded;
+    return kSuccess;
+}
+
+int TokenIndex::tpmToken(const QString &device, QString *tokenJson)
+{
+    Q_ASSERT(tokenJson);
+    DeviceTokens devTokens;
+    int ret = tokens(device, &devTokens);
+    if (ret < 0)
+        return ret;
+    *tokenJson = devTokens.tpmTokenJson;
+    return kSuccess;
+}
+
+int TokenIndex::keyType(const QString &device, SecKeyType *type)
+{
+    Q_ASSERT(type);
+    DeviceTokens devTokens;
+    int ret = tokens(device, &devTokens);
+    if (ret < 0)
+        return ret;
+    *type = devTokens.keyType;
+    return kSuccess;
+}
+
+void TokenIndex::invalidate(const QString &device)
+{
+    QMutexLocker locker(&mtx);
+    indexes.remove(CryptDeviceCache::cacheKey(device));
+}
+
+SecKeyType TokenIndex::keyTypeOf(const QJsonObject &tpmToken)
+{
+    const QString &usePin = tpmToken.value("pin").toString();
+    if (usePin == "1")
+        return kTPMAndPIN;
+    if (usePin == "0")
+        return kTPMOnly;
+    return kPasswordOnly;
+}
+
+int TokenIndex::load(const QString &device, DeviceTokens *tokens)
+{
+    CryptDeviceLease cdev(device);
+    if (!cdev)
+        return cdev.error();
+    // the handle of lease has been loaded at this generation.
+    tokens->generation = cdev.generation();
+
+    for (int i = 0; i < kMaxTokens; ++i) {
+        const char *type { nullptr };
+        crypt_token_info status = crypt_token_status(cdev.get(), i, &type);
+        if (status == CRYPT_TOKEN_INACTIVE || status == CRYPT_TOKEN_INVALID)
+            continue;
+
+        const char *json { nullptr };
+        if (crypt_token_json_get(cdev.get(), i, &json) < 0 || !json)
+            continue;
+
+        LuksToken token;
+        token.index = i;
+        token.type = QString::fromUtf8(type);
+        token.json = QJsonDocument::fromJson(json).object();
+        if (token.type == kTPMTokenType && tokens->tpmToken < 0) {
+            tokens->tpmToken = tokens->tokens.size();
+            tokens->keyType = keyTypeOf(token.json);
+
+            QJsonObject obj = token.json;
+            obj.insert("token_index", i);
+            tokens->tpmTokenJson = QJsonDocument(obj).toJson();
+        }
+        tokens->tokens.append(token);
+    }
+
+    qDebug() << "tokens of" << device << "indexed:" << tokens->tokens.size()
+             << "tpm token at" << tokens->tpmToken;
+    return kSuccess;
+}
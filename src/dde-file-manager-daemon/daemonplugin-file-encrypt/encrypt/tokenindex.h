@@ -0,0 +1,65 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef TOKENINDEX_H
+#define TOKENINDEX_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QMutex>
+#include <QHash>
+#include <QVector>
+#include <QJsonObject>
+
+FILE_ENCRYPT_BEGIN_NS
+
+inline constexpr char kTPMTokenType[] { "usec-tpm2" };
+
+struct LuksToken
+{
+    int index { -1 };
+    QString type;
+    QJsonObject json;
+};
+
+// the parsed tokens of a LUKS2 header.
+struct DeviceTokens
+{
+    QVector<LuksToken> tokens;
+    int tpmToken { -1 };   // the position in tokens.
+    disk_encrypt::SecKeyType keyType { disk_encrypt::kPasswordOnly };
+    QString tpmTokenJson;   // with token_index, as QueryTPMToken replies.
+    quint64 generation { 0 };
+};
+
+// the tokens of devices, parsed once from the header and kept until the
+// header is changed, so that the queries on every menu open don't walk and
+// parse the token slots again.
+class TokenIndex
+{
+public:
+    static TokenIndex *instance();
+
+    int tokens(const QString &device, DeviceTokens *tokens);
+    int tpmToken(const QString &device, QString *tokenJson);
+    int keyType(const QString &device, disk_encrypt::SecKeyType *type);
+    // called after the tokens are written by daemon, other writers are
+    // found by the generation of CryptDeviceCache.
+    void invalidate(const QString &device);
+
+    static disk_encrypt::SecKeyType keyTypeOf(const QJsonObject &tpmToken);
+
+private:
+    TokenIndex() = default;
+    Q_DISABLE_COPY(TokenIndex)
+
+    static int load(const QString &device, DeviceTokens *tokens);
+
+private:
+    QMutex mtx;
+    QHash<QString, DeviceTokens> indexes;
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // TOKENINDEX_H
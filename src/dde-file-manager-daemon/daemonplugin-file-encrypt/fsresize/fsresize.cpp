@@ -3,56 +3,260 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "fsresize.h"
 
+#include <QProcess>
+#include <QRegularExpression>
+#include <QSharedPointer>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMap>
+#include <QUuid>
+#include <QRandomGenerator>
+#include <QtConcurrent/QtConcurrent>
+
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <array>
+#include <atomic>
 
 using namespace daemonplugin_file_encrypt;
 
-bool fs_resize::shrinkFileSystem_ext(const QString &device)
+// runs the e2fsprogs tool directly (no shell) and feeds its output as it comes.
+static int runTool(const QString &program, const QStringList &args,
+                   const std::function<void(const QByteArray &)> &onOutput)
 {
-    // TODO(xust): not find the API of resize2fs, use BIN program temp
-    QString cmd = QString("e2fsck -f -y %1").arg(device);
-    int ret = ::system(cmd.toStdString().c_str());
-    if (ret != 0) {
-        qWarning() << "e2fsck failed!"
-                   << ret;
-        return false;
+    QProcess proc;
+    proc.setProcessChannelMode(QProcess::MergedChannels);
+    // the output is parsed, keep it untranslated.
+    auto env = QProcessEnvironment::systemEnvironment();
+    env.insert("LC_ALL", "C");
+    proc.setProcessEnvironment(env);
+    proc.start(program, args, QIODevice::ReadOnly);
+    if (!proc.waitForStarted()) {
+        qWarning() << "cannot start" << program << proc.errorString();
+        return -1;
     }
 
-    cmd = QString("resize2fs -M %1").arg(device);
-    ret = ::system(cmd.toStdString().c_str());
-    if (ret != 0) {
-        qWarning() << "resize2fs failed"
-                   << ret;
-        return false;
+    while (proc.state() != QProcess::NotRunning) {
+        if (proc.waitForReadyRead(-1) && onOutput)
+            onOutput(proc.readAll());
     }
+    const QByteArray &rest = proc.readAll();
+    if (!rest.isEmpty() && onOutput)
+        onOutput(rest);
+
+    if (proc.exitStatus() != QProcess::NormalExit)
+        return -1;
+    return proc.exitCode();
+}
+
+// splits the output into lines, '\r' is taken as line end too since the tools
+// redraw their progress with it.
+static std::function<void(const QByteArray &)> lineReader(const std::function<void(const QString &)> &onLine)
+{
+    QSharedPointer<QByteArray> buffer(new QByteArray);
+    return [=](const QByteArray &data) {
+        buffer->append(data);
+        int start = 0;
+        for (int i = 0; i < buffer->size(); ++i) {
+            if (buffer->at(i) == '\n' || buffer->at(i) == '\r') {
+                if (i > start)
+                    onLine(QString::fromLocal8Bit(buffer->mid(start, i - start)));
+                start = i + 1;
+            }
+        }
+        buffer->remove(0, start);
+    };
+}
+
+// the identity of an ext filesystem and its mount history, a filesystem
+// verified by us stays verified until it's mounted again.
+struct FsState
+{
+    QByteArray uuid;
+    quint32 mountTime { 0 };
+    quint16 mountCount { 0 };
+    bool clean { false };
+    quint16 fsState { 0 };
+    bool needsRecovery { false };   // the journal holds changes not written back.
+    quint32 usedInodes { 0 };
+    quint32 firstInode { 0 };   // the first non-reserved inode, lost+found.
+    QByteArray label;
+};
 
+static bool readFsState(const QString &device, FsState *state)
+{
+    int fd = open(device.toStdString().c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    unsigned char sb[1024];
+    bool ok = pread(fd, sb, sizeof(sb), 1024) == sizeof(sb);
+    close(fd);
+    // s_magic at 0x38, all fields are little endian.
+    if (!ok || sb[0x38] != 0x53 || sb[0x39] != 0xEF)
+        return false;
+
+    auto u16 = [&sb](int off) { return quint16(sb[off] | (sb[off + 1] << 8)); };
+    auto u32 = [&sb, &u16](int off) { return quint32(u16(off)) | (quint32(u16(off + 2)) << 16); };
+    state->uuid = QByteArray(reinterpret_cast<const char *>(sb + 0x68), 16);   // s_uuid
+    state->mountTime = u32(0x2C);   // s_mtime
+    state->mountCount = u16(0x34);   // s_mnt_count
+    state->fsState = u16(0x3A);   // s_state: 1 valid, 2 has errors
+    state->clean = (state->fsState & 0x1) && !(state->fsState & 0x2);
+    state->needsRecovery = u32(0x60) & 0x4;   // s_feature_incompat: needs_recovery
+    state->usedInodes = u32(0x00) - u32(0x10);   // s_inodes_count - s_free_inodes_count
+    quint32 revLevel = u32(0x4C);
+    state->firstInode = revLevel == 0 ? 11 : u32(0x54);   // s_first_ino
+    state->label = QByteArray(reinterpret_cast<const char *>(sb + 0x78), 16);   // s_volume_name
+    state->label.truncate(int(qstrnlen(state->label.constData(), 16)));
     return true;
 }
 
-bool fs_resize::expandFileSystem_ext(const QString &device)
+static QMutex gVerifiedMtx;
+static QMap<QByteArray, FsState> gVerifiedFs;
+
+static void markVerified(const QString &device)
 {
-    // TODO(xust): not find the API of resize2fs, use BIN program temp
-    QString cmd = QString("e2fsck -f -y %1").arg(device);
-    int ret = ::system(cmd.toStdString().c_str());
+    FsState state;
+    if (!readFsState(device, &state))
+        return;
+    QMutexLocker locker(&gVerifiedMtx);
+    gVerifiedFs.insert(state.uuid, state);
+}
+
+static void forgetVerified(const QString &device)
+{
+    FsState state;
+    if (!readFsState(device, &state))
+        return;
+    QMutexLocker locker(&gVerifiedMtx);
+    gVerifiedFs.remove(state.uuid);
+}
+
+static bool isVerified(const QString &device)
+{
+    FsState state;
+    if (!readFsState(device, &state) || !state.clean)
+        return false;
+    QMutexLocker locker(&gVerifiedMtx);
+    if (!gVerifiedFs.contains(state.uuid))
+        return false;
+    const FsState &verified = gVerifiedFs.value(state.uuid);
+    return verified.mountTime == state.mountTime
+            && verified.mountCount == state.mountCount;
+}
+
+static bool checkFileSystem(const QString &device, const fs_resize::ProgressCallback &onProgress)
+{
+    if (isVerified(device)) {
+        qInfo() << "filesystem is verified and not mounted since, skip fsck" << device;
+        return true;
+    }
+
+    // the end percent of each pass of e2fsck, same as e2fsck's own progress bar.
+    static const double kPassTable[] { 0, 70, 90, 92, 95, 100 };
+    static const QRegularExpression kProgressLine(R"(^(\d+) (\d+) (\d+) )");
+
+    int ret = runTool("e2fsck", { "-f", "-y", "-C", "1", device }, lineReader([&](const QString &line) {
+        auto match = kProgressLine.match(line);
+        if (!match.hasMatch() || !onProgress)
+            return;
+        int pass = match.captured(1).toInt();
+        double cur = match.captured(2).toDouble();
+        double max = match.captured(3).toDouble();
+        if (pass < 1 || pass > 5 || max <= 0)
+            return;
+        double percent = kPassTable[pass - 1] + (kPassTable[pass] - kPassTable[pass - 1]) * cur / max;
+        onProgress("fsck", percent / 100);
+    }));
     if (ret != 0) {
         qWarning() << "e2fsck failed!"
                    << ret;
         return false;
     }
+    markVerified(device);
+    return true;
+}
 
-    cmd = QString("resize2fs %1").arg(device);
-    ret = ::system(cmd.toStdString().c_str());
+static bool resizeFileSystem(const QString &device, const QString &phase, bool shrink,
+                             const fs_resize::ProgressCallback &onProgress)
+{
+    // resize2fs -p prints "Begin pass N (max = M)" and then 40 'X' for each pass.
+    static constexpr int kMaxPasses { 4 };
+    static constexpr int kBarWidth { 40 };
+    static const QRegularExpression kBeginPass(R"(Begin pass (\d+))");
+
+    // the marks are printed one by one without line end, so parse the raw output.
+    QByteArray output;
+    QStringList args { "-p", device };
+    if (shrink)
+        args.prepend("-M");
+    int ret = runTool("resize2fs", args, [&](const QByteArray &data) {
+        output.append(data);
+        int begin = output.lastIndexOf("Begin pass ");
+        if (begin < 0 || !onProgress)
+            return;
+
+        // only keep the output of the current pass.
+        output = output.mid(begin);
+        auto match = kBeginPass.match(QString::fromLatin1(output));
+        int pass = qBound(1, match.captured(1).toInt(), kMaxPasses);
+        int marks = qMin(kBarWidth, int(output.count('X')));
+        onProgress(phase, (pass - 1 + double(marks) / kBarWidth) / kMaxPasses);
+    });
     if (ret != 0) {
         qWarning() << "resize2fs failed"
                    << ret;
         return false;
     }
-
+    // resize2fs keeps the filesystem consistent.
+    markVerified(device);
+    if (onProgress)
+        onProgress(phase, 1);
     return true;
 }
 
+// logs the time cost of each stage, used to tell where the time goes.
+static bool timedStage(const QString &stage, const QString &device, const std::function<bool()> &func)
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool ret = func();
+    qInfo() << "stage" << stage << "of" << device
+            << (ret ? "finished" : "failed")
+            << "in" << timer.elapsed() << "ms";
+    return ret;
+}
+
+bool fs_resize::shrinkFileSystem_ext(const QString &device, const ProgressCallback &onProgress)
+{
+    // libext2fs doesn't provide resize or fsck, these live in e2fsprogs' programs.
+    // run them without shell and parse their progress output instead.
+    if (!timedStage("fsck", device, [&] { return checkFileSystem(device, onProgress); }))
+        return false;
+    return timedStage("shrink", device, [&] { return resizeFileSystem(device, "shrink", true, onProgress); });
+}
+
+bool fs_resize::expandFileSystem_ext(const QString &device, const ProgressCallback &onProgress)
+{
+    if (!timedStage("fsck", device, [&] { return checkFileSystem(device, onProgress); }))
+        return false;
+    if (timedStage("expand", device, [&] { return resizeFileSystem(device, "expand", false, onProgress); }))
+        return true;
+
+    // resize2fs may still ask for a forced check, do it once and retry.
+    forgetVerified(device);
+    qInfo() << "retry expanding with a forced check" << device;
+    if (!timedStage("fsck", device, [&] { return checkFileSystem(device, onProgress); }))
+        return false;
+    return timedStage("expand", device, [&] { return resizeFileSystem(device, "expand", false, onProgress); });
+}
+
 bool fs_resize::recoverySuperblock_ext(const QString &device,
-                                       const QString &cryptHeaderPath)
+                                       const QString &cryptHeaderPath,
+                                       const ProgressCallback &onProgress)
 {
     struct stat st;
     int ret = stat(cryptHeaderPath.toStdString().c_str(),
@@ -64,10 +268,18 @@ bool fs_resize::recoverySuperblock_ext(const QString &device,
         return false;
     }
 
-    QString cmd = QString("e2image -aro %1 %2 %2")
-                          .arg(st.st_size)
-                          .arg(device);
-    ret = ::system(cmd.toStdString().c_str());
+    // e2image -p prints "Copying x / y blocks (z%)".
+    static const QRegularExpression kPercent(R"(\((\d+)%\))");
+    QElapsedTimer timer;
+    timer.start();
+    ret = runTool("e2image",
+                  { "-aro", QString::number(st.st_size), "-p", device, device },
+                  lineReader([&](const QString &line) {
+                      auto match = kPercent.match(line);
+                      if (match.hasMatch() && onProgress)
+                          onProgress("recovery", match.captured(1).toDouble() / 100);
+                  }));
+    qInfo() << "stage recovery of" << device << "finished in" << timer.elapsed() << "ms" << ret;
     if (ret != 0) {
         qWarning() << "cannot recovery superblock of"
                    << device;
@@ -75,3 +287,329 @@ bool fs_resize::recoverySuperblock_ext(const QString &device,
     }
     return true;
 }
+
+// the inodes in use counted by a read only full check, -1 if the check fails.
+static qint64 countUsedInodes(const QString &device)
+{
+    // e2fsck prints "device: 11/65536 files (...)" at last.
+    static const QRegularExpression kSummary(R"((\d+)/(\d+) files)");
+    qint64 used = -1;
+    int ret = runTool("e2fsck", { "-f", "-n", device }, lineReader([&](const QString &line) {
+        auto match = kSummary.match(line);
+        if (match.hasMatch())
+            used = match.captured(1).toLongLong();
+    }));
+    if (ret != 0) {
+        qWarning() << "read only e2fsck of" << device << "failed" << ret;
+        return -1;
+    }
+    return used;
+}
+
+bool fs_resize::isEmptyFileSystem_ext(const QString &device, QString *uuid, QString *label)
+{
+    // files are being created on a mounted fs, an exclusive open of block
+    // device fails while it's mounted.
+    int fd = open(device.toStdString().c_str(), O_RDONLY | O_EXCL);
+    if (fd < 0) {
+        qInfo() << "device is in use, it's not taken as empty" << device << strerror(errno);
+        return false;
+    }
+    close(fd);
+
+    FsState state;
+    if (!readFsState(device, &state))
+        return false;
+
+    // only the reserved inodes and lost+found are in use, nothing was ever
+    // created by user. the counters of superblock are only written back at
+    // unmount, after a crash they are stale and the unreplayed journal may
+    // hold the inodes which are allocated since.
+    if (state.fsState != 0x1 || state.needsRecovery || state.usedInodes > state.firstInode)
+        return false;
+
+    // the device is formatted on this answer, so the counters are confirmed
+    // by a walk of the inode tables and directories.
+    const qint64 used = countUsedInodes(device);
+    if (used < 0 || used > qint64(state.firstInode)) {
+        qWarning() << "filesystem is not empty as its superblock says" << device << used;
+        return false;
+    }
+
+    if (uuid)
+        *uuid = QUuid::fromRfc4122(state.uuid).toString(QUuid::WithoutBraces);
+    if (label)
+        *label = QString::fromUtf8(state.label);
+    return true;
+}
+
+bool fs_resize::formatFileSystem_ext(const QString &device, const QString &uuid, const QString &label)
+{
+    QStringList args { "-q", "-F" };
+    if (!uuid.isEmpty())
+        args << "-U" << uuid;
+    if (!label.isEmpty())
+        args << "-L" << label;
+    args << device;
+
+    QElapsedTimer timer;
+    timer.start();
+    int ret = runTool("mkfs.ext4", args, nullptr);
+    qInfo() << "stage mkfs of" << device << "finished in" << timer.elapsed() << "ms" << ret;
+    return ret == 0;
+}
+
+// crc32c without the final inversion, which is how ext4 chains checksums.
+static quint32 crc32c(quint32 crc, const unsigned char *data, size_t len)
+{
+    static const auto kTable = [] {
+        std::array<quint32, 256> table;
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+            table[i] = c;
+        }
+        return table;
+    }();
+    for (size_t i = 0; i < len; ++i)
+        crc = kTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static quint16 le16(const unsigned char *p)
+{
+    return quint16(p[0] | (p[1] << 8));
+}
+
+static quint32 le32(const unsigned char *p)
+{
+    return quint32(le16(p)) | (quint32(le16(p + 2)) << 16);
+}
+
+struct ExtLayout
+{
+    quint64 blockSize { 0 };
+    quint64 blocksCount { 0 };
+    quint32 firstDataBlock { 0 };
+    quint32 blocksPerGroup { 0 };
+    quint32 clustersPerGroup { 0 };
+    quint32 groups { 0 };
+    quint32 descSize { 32 };
+    quint32 csumSeed { 0 };
+    bool metadataCsum { false };
+    bool metaBg { false };
+};
+
+static bool readLayout(int fd, ExtLayout *layout, int *errors)
+{
+    static constexpr quint32 kIncompatMetaBg { 0x10 };
+    static constexpr quint32 kIncompat64Bit { 0x80 };
+    static constexpr quint32 kIncompatCsumSeed { 0x2000 };
+    static constexpr quint32 kRoCompatMetadataCsum { 0x400 };
+
+    unsigned char sb[1024];
+    if (pread(fd, sb, sizeof(sb), 1024) != sizeof(sb) || le16(sb + 0x38) != 0xEF53)
+        return false;
+
+    const quint32 incompat = le32(sb + 0x60);
+    layout->blockSize = 1024ULL << le32(sb + 0x18);
+    layout->blocksCount = le32(sb + 0x04);
+    if (incompat & kIncompat64Bit) {
+        layout->blocksCount |= quint64(le32(sb + 0x150)) << 32;
+        layout->descSize = qMax(quint32(le16(sb + 0xFE)), 32u);
+    }
+    layout->firstDataBlock = le32(sb + 0x14);
+    layout->blocksPerGroup = le32(sb + 0x20);
+    layout->clustersPerGroup = le32(sb + 0x24);
+    if (layout->blocksPerGroup == 0 || layout->blockSize > 65536)
+        return false;
+    layout->groups = quint32((layout->blocksCount - layout->firstDataBlock + layout->blocksPerGroup - 1)
+                             / layout->blocksPerGroup);
+    layout->metaBg = incompat & kIncompatMetaBg;
+    layout->metadataCsum = le32(sb + 0x64) & kRoCompatMetadataCsum;
+    if (!layout->metadataCsum)
+        return true;
+
+    // s_checksum covers the superblock up to itself.
+    if (crc32c(~0U, sb, 0x3FC) != le32(sb + 0x3FC)) {
+        qWarning() << "superblock checksum mismatch";
+        *errors += 1;
+    }
+    layout->csumSeed = (incompat & kIncompatCsumSeed)
+            ? le32(sb + 0x270)   // s_checksum_seed
+            : crc32c(~0U, sb + 0x68, 16);   // s_uuid
+    return true;
+}
+
+// checks the descriptor checksum and that the metadata it points to is inside
+// the filesystem.
+static void verifyDescriptor(const ExtLayout &layout, quint32 group, const unsigned char *desc, int *errors)
+{
+    const bool hasHi = layout.descSize >= 64;
+    auto location = [&](int lo, int hi) {
+        return quint64(le32(desc + lo)) | (hasHi ? quint64(le32(desc + hi)) << 32 : 0);
+    };
+    const quint64 blockBitmap = location(0x00, 0x20);
+    const quint64 inodeBitmap = location(0x04, 0x24);
+    const quint64 inodeTable = location(0x08, 0x28);
+    if (blockBitmap >= layout.blocksCount || inodeBitmap >= layout.blocksCount || inodeTable >= layout.blocksCount) {
+        qWarning() << "metadata of block group" << group << "is out of filesystem";
+        *errors += 1;
+    }
+
+    if (!layout.metadataCsum)
+        return;
+    unsigned char copy[1024];
+    const size_t size = qMin(size_t(layout.descSize), sizeof(copy));
+    memcpy(copy, desc, size);
+    copy[0x1E] = copy[0x1F] = 0;   // bg_checksum
+    unsigned char leGroup[4] { quint8(group), quint8(group >> 8), quint8(group >> 16), quint8(group >> 24) };
+    quint32 crc = crc32c(layout.csumSeed, leGroup, sizeof(leGroup));
+    crc = crc32c(crc, copy, size);
+    if (quint16(crc & 0xFFFF) != le16(desc + 0x1E)) {
+        qWarning() << "descriptor checksum mismatch of block group" << group;
+        *errors += 1;
+    }
+}
+
+static void verifyBlockBitmap(int fd, const ExtLayout &layout, quint32 group, const unsigned char *desc,
+                              unsigned char *buf, int *errors)
+{
+    static constexpr quint16 kBlockUninit { 0x2 };
+    if (!layout.metadataCsum || (le16(desc + 0x12) & kBlockUninit))   // bg_flags
+        return;
+
+    const bool hasHi = layout.descSize >= 64;
+    const quint64 block = quint64(le32(desc)) | (hasHi ? quint64(le32(desc + 0x20)) << 32 : 0);
+    const size_t size = layout.clustersPerGroup / 8;
+    if (size > layout.blockSize
+        || pread(fd, buf, layout.blockSize, off_t(block * layout.blockSize)) != ssize_t(layout.blockSize)) {
+        qWarning() << "cannot read block bitmap of block group" << group;
+        *errors += 1;
+        return;
+    }
+
+    quint32 crc = crc32c(layout.csumSeed, buf, size);
+    quint32 stored = le16(desc + 0x18);   // bg_block_bitmap_csum_lo
+    if (layout.descSize >= 0x3C)
+        stored |= quint32(le16(desc + 0x38)) << 16;
+    else
+        crc &= 0xFFFF;
+    if (crc != stored) {
+        qWarning() << "block bitmap checksum mismatch of block group" << group;
+        *errors += 1;
+    }
+}
+
+QVariantMap fs_resize::SampleResult::toVariantMap() const
+{
+    return QVariantMap {
+        { "groups", groups },
+        { "sampledGroups", sampledGroups },
+        { "errors", errors },
+        { "bytesRead", bytesRead },
+        { "msecs", msecs },
+        { "mibPerSec", msecs > 0 ? bytesRead / 1048576.0 / (msecs / 1000.0) : 0 },
+    };
+}
+
+bool fs_resize::sampleFileSystem_ext(const QString &device, SampleResult *result)
+{
+    static constexpr int kThreads { 4 };
+    static constexpr int kSampledGroups { 64 };
+    static constexpr int kSampledChunks { 256 };
+    static constexpr quint64 kChunkSize { 1024 * 1024 };
+
+    Q_ASSERT(result);
+    *result = {};
+    QElapsedTimer timer;
+    timer.start();
+
+    int fd = open(device.toStdString().c_str(), O_RDONLY);
+    if (fd < 0) {
+        qWarning() << "cannot open device to sample" << device << strerror(errno);
+        return false;
+    }
+    ExtLayout layout;
+    bool ok = readLayout(fd, &layout, &result->errors);
+    if (!ok) {
+        close(fd);
+        qWarning() << "not an ext filesystem, skip sampling" << device;
+        return false;
+    }
+
+    // with meta_bg the descriptors are spread over the device, only the
+    // superblock is verified then.
+    QByteArray descs;
+    if (!layout.metaBg) {
+        const quint64 gdtOffset = (quint64(layout.firstDataBlock) + 1) * layout.blockSize;
+        descs.resize(int(quint64(layout.groups) * layout.descSize));
+        if (pread(fd, descs.data(), size_t(descs.size()), off_t(gdtOffset)) != descs.size()) {
+            qWarning() << "cannot read group descriptors" << device;
+            result->errors += 1;
+            descs.clear();
+        }
+    }
+    const auto descOf = [&](quint32 group) {
+        return reinterpret_cast<const unsigned char *>(descs.constData()) + group * layout.descSize;
+    };
+    if (!descs.isEmpty()) {
+        for (quint32 group = 0; group < layout.groups; ++group)
+            verifyDescriptor(layout, group, descOf(group), &result->errors);
+        result->groups = int(layout.groups);
+    }
+
+    QVector<quint32> groups;
+    if (!descs.isEmpty()) {
+        for (int i = 0; i < qMin(int(layout.groups), kSampledGroups); ++i)
+            groups.append(QRandomGenerator::global()->bounded(layout.groups));
+    }
+    QVector<quint64> chunks;
+    const quint64 devChunks = layout.blocksCount * layout.blockSize / kChunkSize;
+    for (int i = 0; i < kSampledChunks && devChunks > 0; ++i)
+        chunks.append(QRandomGenerator::global()->generate64() % devChunks * kChunkSize);
+
+    // the chunks are read bypassing page cache, which measures the dm-crypt
+    // mapping rather than memory.
+    int directFd = open(device.toStdString().c_str(), O_RDONLY | O_DIRECT);
+    std::atomic_int errors { 0 };
+    std::atomic<quint64> bytesRead { 0 };
+    QList<QFuture<void>> workers;
+    for (int t = 0; t < kThreads; ++t) {
+        workers.append(QtConcurrent::run([&, t] {
+            void *buf = nullptr;
+            if (posix_memalign(&buf, 4096, kChunkSize) != 0) {
+                errors += 1;
+                return;
+            }
+            int localErrors = 0;
+            for (int i = t; i < groups.count(); i += kThreads)
+                verifyBlockBitmap(fd, layout, groups.at(i), descOf(groups.at(i)),
+                                  static_cast<unsigned char *>(buf), &localErrors);
+            for (int i = t; i < chunks.count() && directFd >= 0; i += kThreads) {
+                ssize_t n = pread(directFd, buf, kChunkSize, off_t(chunks.at(i)));
+                if (n < 0) {
+                    qWarning() << "cannot read device at" << chunks.at(i) << strerror(errno);
+                    localErrors += 1;
+                    continue;
+                }
+                bytesRead += quint64(n);
+            }
+            errors += localErrors;
+            free(buf);
+        }));
+    }
+    for (auto &worker : workers)
+        worker.waitForFinished();
+    if (directFd >= 0)
+        close(directFd);
+    close(fd);
+
+    result->sampledGroups = groups.count();
+    result->errors += errors;
+    result->bytesRead = bytesRead;
+    result->msecs = timer.elapsed();
+    qInfo() << "stage sample of" << device << "finished in" << result->msecs << "ms" << result->toVariantMap();
+    return result->errors == 0;
+}
@@ -6,15 +6,43 @@
 
 #include "daemonplugin_file_encrypt_global.h"
 
+#include <QVariantMap>
+
+#include <functional>
+
 FILE_ENCRYPT_BEGIN_NS
 
 namespace fs_resize {
+struct SampleResult
+{
+    int groups { 0 };   // the block groups whose descriptor is verified.
+    int sampledGroups { 0 };   // the block groups whose bitmap is verified.
+    int errors { 0 };
+    quint64 bytesRead { 0 };
+    qint64 msecs { 0 };
+
+    QVariantMap toVariantMap() const;
+};
+
+// phase is one of "fsck", "shrink", "expand" and "recovery", progress is in [0, 1].
+typedef std::function<void(const QString &phase, double progress)> ProgressCallback;
+
 bool shrinkFileSystem(const QString &device);
 bool expandFileSystem(const QString &device);
 
-bool shrinkFileSystem_ext(const QString &device);
-bool expandFileSystem_ext(const QString &device);
-bool recoverySuperblock_ext(const QString &device, const QString &cryptHeaderPath);
+bool shrinkFileSystem_ext(const QString &device, const ProgressCallback &onProgress = nullptr);
+bool expandFileSystem_ext(const QString &device, const ProgressCallback &onProgress = nullptr);
+bool recoverySuperblock_ext(const QString &device, const QString &cryptHeaderPath,
+                            const ProgressCallback &onProgress = nullptr);
+
+// true if the unmounted, cleanly unmounted ext filesystem holds no file,
+// which is confirmed by a read only e2fsck. uuid and label are kept for
+// recreating it.
+bool isEmptyFileSystem_ext(const QString &device, QString *uuid = nullptr, QString *label = nullptr);
+bool formatFileSystem_ext(const QString &device, const QString &uuid, const QString &label);
+// verifies the metadata checksums and reads a random sample of the device by
+// several threads, much cheaper than fsck. false if any error is found.
+bool sampleFileSystem_ext(const QString &device, SampleResult *result);
 }   // namespace fs_resize
 
 FILE_ENCRYPT_END_NS
@@ -29,6 +29,11 @@ inline constexpr char kKeyValidateWithRecKey[] { "usingRecKey" };
 inline constexpr char kKeyDeviceName[] { "deviceName" };
 inline constexpr char kKeyBackingDevUUID[] { "backingDevUUID" };
 inline constexpr char kKeyClearDevUUID[] { "clearDevUUID" };
+inline constexpr char kKeyDiscardData[] { "discardData" };
+inline constexpr char kKeyHwOpal[] { "hwOpal" };
+inline constexpr char kKeyTraceID[] { "traceID" };
+inline constexpr char kKeyOnlineDecrypt[] { "onlineDecrypt" };
+inline constexpr char kKeyDetachedHeader[] { "detachedHeader" };
 }   // namespace encrypt_param_keys
 
 inline const QStringList kDisabledEncryptPath {
@@ -72,6 +77,7 @@ enum EncryptOperationStatus {
     kErrorResizeFs,
     kErrorDisabledMountPoint,
     kErrorSetLabel,
+    kErrorJobPaused,
 
     kErrorUnknown,
 };
@@ -96,6 +102,9 @@ struct DeviceEncryptParam
     bool validateByRecKey;
     QString backingDevUUID;
     QString clearDevUUID;
+    QString cipher;
+    bool hwOpal { false };
+    bool detachedHeader { false };
 };
 
 struct EncryptConfig
@@ -110,6 +119,9 @@ struct EncryptConfig
     QString recoveryPath;
     QVariantMap tpmConfig;
     QString clearDev;
+    int sectorSize { 512 };   // the boot stage formats the device with it.
+    bool hwOpal { false };
+    QString traceID;
 
     QVariantMap keyConfig()
     {
@@ -118,6 +130,7 @@ struct EncryptConfig
             { "device-path", devicePath },
             { "device-name", deviceName },
             { "volume", clearDev },
+            { "trace-id", traceID },
         };
     };
 };
@@ -18,8 +18,10 @@ public:
     static SignalEmitter *instance();
 
 Q_SIGNALS:
-    void updateEncryptProgress(const QString &dev, double progress);
-    void updateDecryptProgress(const QString &dev, double progress);
+    void updateEncryptProgress(const QString &dev, const QString &devName, double progress);
+    void updateDecryptProgress(const QString &dev, const QString &devName, double progress);
+    void updateEncryptProgressInfo(const QString &dev, const QString &devName, const QVariantMap &info);
+    void updateDecryptProgressInfo(const QString &dev, const QString &devName, const QVariantMap &info);
 };
 
 FILE_ENCRYPT_END_NS
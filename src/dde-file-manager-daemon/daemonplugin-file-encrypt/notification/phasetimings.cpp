@@ -0,0 +1,51 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "phasetimings.h"
+
+#include <QDebug>
+
+#include <systemd/sd-journal.h>
+#include <syslog.h>
+
+FILE_ENCRYPT_USE_NS
+
+void PhaseTimings::record(const QString &jobID, const QString &device, const QString &phase, qint64 msecs)
+{
+    {
+        QMutexLocker locker(&mtx);
+        records.append({ phase, msecs });
+    }
+
+    // query by: journalctl DFM_ENCRYPT_JOB_ID=job_xxx
+    const QByteArray &msg = QString("encrypt job %1 of %2: %3 takes %4 ms")
+                                    .arg(jobID, device, phase)
+                                    .arg(msecs)
+                                    .toLocal8Bit();
+    sd_journal_send("MESSAGE=%s", msg.constData(),
+                    "PRIORITY=%i", LOG_INFO,
+                    "DFM_ENCRYPT_JOB_ID=%s", jobID.toLocal8Bit().constData(),
+                    "DFM_ENCRYPT_DEVICE=%s", device.toLocal8Bit().constData(),
+                    "DFM_ENCRYPT_PHASE=%s", phase.toLocal8Bit().constData(),
+                    "DFM_ENCRYPT_DURATION_MS=%lld", static_cast<long long>(msecs),
+                    nullptr);
+    qInfo() << msg;
+}
+
+QVariantList PhaseTimings::summary()
+{
+    QMutexLocker locker(&mtx);
+    QVariantList phases;
+    for (const auto &r : records)
+        phases.append(QVariantMap { { "phase", r.phase }, { "msecs", r.msecs } });
+    return phases;
+}
+
+qint64 PhaseTimings::totalMsecs()
+{
+    QMutexLocker locker(&mtx);
+    qint64 total = 0;
+    for (const auto &r : records)
+        total += r.msecs;
+    return total;
+}
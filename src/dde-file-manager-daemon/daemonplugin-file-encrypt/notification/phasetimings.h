@@ -0,0 +1,38 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PHASETIMINGS_H
+#define PHASETIMINGS_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QMutex>
+#include <QVector>
+#include <QVariantList>
+
+FILE_ENCRYPT_BEGIN_NS
+
+// the time spent in each stage of a job. every stage is logged to journal
+// with structured fields when it ends, so the slow stages of long jobs can
+// be found afterwards.
+class PhaseTimings
+{
+public:
+    void record(const QString &jobID, const QString &device, const QString &phase, qint64 msecs);
+    QVariantList summary();
+    qint64 totalMsecs();
+
+private:
+    struct Record
+    {
+        QString phase;
+        qint64 msecs { 0 };
+    };
+
+    QMutex mtx;
+    QVector<Record> records;
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // PHASETIMINGS_H
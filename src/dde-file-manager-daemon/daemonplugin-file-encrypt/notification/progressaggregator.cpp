@@ -0,0 +1,101 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "progressaggregator.h"
+
+#include <atomic>
+
+FILE_ENCRYPT_USE_NS
+
+static std::atomic_int gReportInterval { 500 };   // 2Hz
+static constexpr double kRateSmoothing { 0.3 };
+static constexpr quint64 kFractionScale { 10000 };
+
+void ProgressAggregator::reset(const QString &device, const QString &phase)
+{
+    QMutexLocker locker(&mtx);
+    this->device = device;
+    this->phase = phase;
+    timer.start();
+    lastSampleMs = 0;
+    lastReportMs = -1;
+    lastOffset = 0;
+    bytesPerSec = 0;
+    last = ProgressInfo();
+    last.device = device;
+    last.phase = phase;
+}
+
+bool ProgressAggregator::update(quint64 total, quint64 offset, ProgressInfo *info)
+{
+    Q_ASSERT(info);
+    QMutexLocker locker(&mtx);
+    return doUpdate(total, offset, info);
+}
+
+bool ProgressAggregator::update(const QString &phase, double progress, ProgressInfo *info)
+{
+    Q_ASSERT(info);
+    QMutexLocker locker(&mtx);
+    if (this->phase != phase) {
+        this->phase = phase;
+        lastReportMs = -1;
+        lastOffset = 0;
+        bytesPerSec = 0;
+    }
+
+    // the fs tools only report fractions, there is no throughput of bytes.
+    bool report = doUpdate(kFractionScale, quint64(qBound(0.0, progress, 1.0) * kFractionScale), info);
+    info->bytesPerSec = 0;
+    last.bytesPerSec = 0;
+    return report;
+}
+
+bool ProgressAggregator::doUpdate(quint64 total, quint64 offset, ProgressInfo *info)
+{
+    if (!timer.isValid())
+        timer.start();
+
+    qint64 now = timer.elapsed();
+    // the first callback of a resumed job starts from the middle, only take it as baseline.
+    if (lastReportMs >= 0 && now > lastSampleMs && offset > lastOffset) {
+        double sample = double(offset - lastOffset) * 1000 / (now - lastSampleMs);
+        bytesPerSec = bytesPerSec > 0
+                ? bytesPerSec * (1 - kRateSmoothing) + sample * kRateSmoothing
+                : sample;
+    }
+    lastSampleMs = now;
+    lastOffset = offset;
+
+    last.device = device;
+    last.phase = phase;
+    last.total = total;
+    last.offset = offset;
+    last.progress = total > 0 ? double(offset) / total : 0;
+    last.bytesPerSec = bytesPerSec;
+    last.eta = bytesPerSec > 0 ? qint64((total - qMin(offset, total)) / bytesPerSec) : -1;
+
+    bool finished = total > 0 && offset >= total;
+    if (lastReportMs >= 0 && !finished && now - lastReportMs < gReportInterval)
+        return false;
+    lastReportMs = now;
+
+    *info = last;
+    return true;
+}
+
+ProgressInfo ProgressAggregator::snapshot()
+{
+    QMutexLocker locker(&mtx);
+    return last;
+}
+
+void ProgressAggregator::setInterval(int msecs)
+{
+    gReportInterval = qBound(100, msecs, 10000);
+}
+
+int ProgressAggregator::interval()
+{
+    return gReportInterval;
+}
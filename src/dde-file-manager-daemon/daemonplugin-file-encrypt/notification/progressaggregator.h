@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PROGRESSAGGREGATOR_H
+#define PROGRESSAGGREGATOR_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QElapsedTimer>
+#include <QMutex>
+
+FILE_ENCRYPT_BEGIN_NS
+
+struct ProgressInfo
+{
+    QString device;
+    QString phase;
+    quint64 total { 0 };
+    quint64 offset { 0 };
+    double progress { 0 };
+    double bytesPerSec { 0 };
+    qint64 eta { -1 };   // seconds, -1 means unknown.
+
+    QVariantMap toVariantMap() const
+    {
+        return QVariantMap {
+            { "device", device },
+            { "phase", phase },
+            { "total", total },
+            { "offset", offset },
+            { "progress", progress },
+            { "bytesPerSec", bytesPerSec },
+            { "eta", eta },
+        };
+    }
+};
+
+// coalesces the per-hotzone progress callbacks of libcryptsetup into
+// rate limited reports with throughput and eta.
+class ProgressAggregator
+{
+public:
+    void reset(const QString &device, const QString &phase = "reencrypt");
+    bool update(quint64 total, quint64 offset, ProgressInfo *info);
+    bool update(const QString &phase, double progress, ProgressInfo *info);
+    // the latest state, including the updates that were not reported.
+    ProgressInfo snapshot();
+
+    static void setInterval(int msecs);
+    static int interval();
+
+private:
+    bool doUpdate(quint64 total, quint64 offset, ProgressInfo *info);
+
+private:
+    QMutex mtx;
+    QString device;
+    QString phase;
+    QElapsedTimer timer;
+    qint64 lastSampleMs { 0 };
+    qint64 lastReportMs { -1 };
+    quint64 lastOffset { 0 };
+    double bytesPerSec { 0 };
+    ProgressInfo last;
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // PROGRESSAGGREGATOR_H
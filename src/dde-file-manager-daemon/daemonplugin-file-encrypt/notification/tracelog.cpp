@@ -0,0 +1,72 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "tracelog.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QMutex>
+#include <QFile>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+
+FILE_ENCRYPT_USE_NS
+
+inline constexpr char kTraceCategory[] { "dfm-encrypt" };
+
+bool trace_log::isEnabled()
+{
+    static const bool kEnabled = QFileInfo(kTraceDir).isDir();
+    return kEnabled;
+}
+
+qint64 trace_log::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void trace_log::span(const QString &traceID, const QString &name, qint64 beginUs, qint64 endUs, const QVariantMap &args)
+{
+    if (!isEnabled() || traceID.isEmpty())
+        return;
+
+    // an async pair with a global id, the spans of all processes sharing
+    // the trace id are drawn in one track.
+    QJsonObject event {
+        { "name", name },
+        { "cat", kTraceCategory },
+        { "id2", QJsonObject { { "global", traceID } } },
+        { "pid", qint64(getpid()) },
+        { "tid", qint64(syscall(SYS_gettid)) },
+    };
+
+    QByteArray lines;
+    event.insert("ph", "b");
+    event.insert("ts", beginUs);
+    event.insert("args", QJsonObject::fromVariantMap(args));
+    lines.append(QJsonDocument(event).toJson(QJsonDocument::Compact)).append(",\n");
+    event.insert("ph", "e");
+    event.insert("ts", endUs);
+    event.remove("args");
+    lines.append(QJsonDocument(event).toJson(QJsonDocument::Compact)).append(",\n");
+
+    static QMutex mtx;
+    QMutexLocker locker(&mtx);
+    QFile f(QString("%1/encrypt-%2.json").arg(kTraceDir, QDate::currentDate().toString("yyyyMMdd")));
+    bool isNew = !f.exists();
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "cannot open trace file" << f.fileName();
+        return;
+    }
+    // the closing bracket is optional in the format, so the file is valid
+    // whenever the daemon stops.
+    if (isNew)
+        f.write("[\n");
+    f.write(lines);
+}
@@ -0,0 +1,32 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef TRACELOG_H
+#define TRACELOG_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QVariantMap>
+
+FILE_ENCRYPT_BEGIN_NS
+
+// writes the stages of jobs as chrome trace events (the json array format,
+// loaded by chrome://tracing and ui.perfetto.dev). the spans of one job
+// share the trace id the client sends with the params, which is written by
+// the client side too, so the files of both merge into one timeline:
+//     (cat daemon.json; tail -n +2 client.json) > merged.json
+// it's enabled by creating kTraceDir, nothing is written otherwise.
+namespace trace_log {
+inline constexpr char kTraceDir[] { "/var/log/dde-file-manager/trace" };
+
+bool isEnabled();
+// microseconds since epoch, which is the same in all processes and
+// survives the reboot between the stages of an encryption.
+qint64 now();
+void span(const QString &traceID, const QString &name, qint64 beginUs, qint64 endUs,
+          const QVariantMap &args = {});
+}   // namespace trace_log
+
+FILE_ENCRYPT_END_NS
+
+#endif   // TRACELOG_H
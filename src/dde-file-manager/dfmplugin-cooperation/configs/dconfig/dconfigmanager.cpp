@@ -14,6 +14,25 @@ static constexpr char kCfgAppId[] { "org.deepin.dde.cooperation" };
 
 DCORE_USE_NAMESPACE
 
+void DConfigManagerPrivate::cacheValue(const QString &config, const QString &key)
+{
+#ifdef DTKCORE_CLASS_DConfig
+    QWriteLocker locker(&lock);
+
+    auto cfg = configs.value(config);
+    if (!cfg)
+        return;
+
+    QStringList &keys = keyLists[config];
+    if (!keys.contains(key))
+        keys = cfg->keyList();
+    caches[config].insert(key, cfg->value(key));
+#else
+    Q_UNUSED(config)
+    Q_UNUSED(key)
+#endif
+}
+
 DConfigManager::DConfigManager(QObject *parent)
     : QObject(parent), d(new DConfigManagerPrivate(this))
 {
@@ -62,9 +81,20 @@ bool DConfigManager::addConfig(const QString &config, QString *err)
         return false;
     }
 
+    const QStringList &keys = cfg->keyList();
+    QVariantHash values;
+    values.reserve(keys.size());
+    for (const QString &key : keys)
+        values.insert(key, cfg->value(key));
+
     d->configs.insert(config, cfg);
+    d->keyLists.insert(config, keys);
+    d->caches.insert(config, values);
     locker.unlock();
-    connect(cfg, &DConfig::valueChanged, this, [=](const QString &key) { Q_EMIT valueChanged(config, key); });
+    connect(cfg, &DConfig::valueChanged, this, [=](const QString &key) {
+        d->cacheValue(config, key);
+        Q_EMIT valueChanged(config, key);
+    });
 #endif
     return true;
 }
@@ -79,6 +109,8 @@ bool DConfigManager::removeConfig(const QString &config, QString *err)
     if (d->configs.contains(config)) {
         delete d->configs[config];
         d->configs.remove(config);
+        d->keyLists.remove(config);
+        d->caches.remove(config);
     }
 #endif
     return true;
@@ -89,10 +121,7 @@ QStringList DConfigManager::keys(const QString &config) const
 #ifdef DTKCORE_CLASS_DConfig
     QReadLocker locker(&d->lock);
 
-    if (!d->configs.contains(config))
-        return QStringList();
-
-    return d->configs[config]->keyList();
+    return d->keyLists.value(config);
 #else
     return QStringList();
 #endif
@@ -100,7 +129,19 @@ QStringList DConfigManager::keys(const QString &config) const
 
 bool DConfigManager::contains(const QString &config, const QString &key) const
 {
-    return key.isEmpty() ? false : keys(config).contains(key);
+#ifdef DTKCORE_CLASS_DConfig
+    if (key.isEmpty())
+        return false;
+
+    QReadLocker locker(&d->lock);
+
+    const auto &cache = d->caches.constFind(config);
+    return cache != d->caches.constEnd() && cache->contains(key);
+#else
+    Q_UNUSED(config)
+    Q_UNUSED(key)
+    return false;
+#endif
 }
 
 QVariant DConfigManager::value(const QString &config, const QString &key, const QVariant &fallback) const
@@ -108,10 +149,13 @@ QVariant DConfigManager::value(const QString &config, const QString &key, const
 #ifdef DTKCORE_CLASS_DConfig
     QReadLocker locker(&d->lock);
 
-    if (d->configs.contains(config))
-        return d->configs.value(config)->value(key, fallback);
-    else
+    const auto &cache = d->caches.constFind(config);
+    if (cache != d->caches.constEnd()) {
+        const QVariant &value = cache->value(key);
+        return value.isValid() ? value : fallback;
+    } else {
         qWarning() << "Config: " << config << "is not registered!!!";
+    }
     return fallback;
 #else
     return fallback;
@@ -123,8 +167,13 @@ void DConfigManager::setValue(const QString &config, const QString &key, const Q
 #ifdef DTKCORE_CLASS_DConfig
     QReadLocker locker(&d->lock);
 
-    if (d->configs.contains(config))
-        d->configs.value(config)->setValue(key, value);
+    if (!d->configs.contains(config))
+        return;
+    d->configs.value(config)->setValue(key, value);
+    locker.unlock();
+
+    // reads after it see the value accepted by the config.
+    d->cacheValue(config, key);
 #endif
 }
 
@@ -7,6 +7,8 @@
 
 #include <dtkcore_global.h>
 #include <QMap>
+#include <QVariantHash>
+#include <QStringList>
 #include <QReadWriteLock>
 
 DCORE_BEGIN_NAMESPACE
@@ -20,8 +22,14 @@ class DConfigManagerPrivate
     DConfigManager *q { nullptr };
 
     QMap<QString, DTK_NAMESPACE::DCORE_NAMESPACE::DConfig *> configs;
+    // the values of the configs, read in one batch when a config is added
+    // and refreshed by its valueChanged, so a read never reaches the daemon.
+    QMap<QString, QVariantHash> caches;
+    QMap<QString, QStringList> keyLists;
     QReadWriteLock lock;
 
+    void cacheValue(const QString &config, const QString &key);
+
 public:
     explicit DConfigManagerPrivate(DConfigManager *qq)
         : q(qq) {}
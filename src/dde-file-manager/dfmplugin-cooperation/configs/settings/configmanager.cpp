@@ -6,6 +6,11 @@
 #include "settings.h"
 
 #include <QCoreApplication>
+#include <QStandardPaths>
+
+// the config is shared with the cooperation app, it's found by its name
+// instead of the name of the app loading this plugin.
+inline constexpr char kCooperationAppName[] { "dde-cooperation" };
 
 ConfigManager::ConfigManager(QObject *parent)
     : QObject(parent)
@@ -20,9 +25,10 @@ ConfigManager::~ConfigManager()
 void ConfigManager::init()
 {
     const auto &orgName = qApp->organizationName();
-    const auto &appName = qApp->applicationName();
+    const QString appName(kCooperationAppName);
 
     QString asCfonigPath = QString("%1/%2/%3").arg(orgName, appName, appName);
+    stateDir = QString("%1/%2/%3").arg(QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation), orgName, appName);
     appSettings = new Settings(asCfonigPath, Settings::GenericConfig, this);
     appSettings->setAutoSync(true);
     appSettings->setWatchChanges(true);
@@ -59,3 +65,8 @@ Settings *ConfigManager::appSetting()
 {
     return appSettings;
 }
+
+QString ConfigManager::stateDirPath() const
+{
+    return stateDir;
+}
@@ -7,6 +7,14 @@
 
 #include <QObject>
 
+inline constexpr char kGenericAttribute[] { "GenericAttribute" };
+// the limit of upload rate in KiB/s, 0 is unlimited
+inline constexpr char kTransferBandwidth[] { "TransferBandwidth" };
+// the count of parallel streams, 0 lets the transfer app decide
+inline constexpr char kTransferStreams[] { "TransferStreams" };
+// compresses the compressible file types on the fly
+inline constexpr char kTransferCompression[] { "TransferCompression" };
+
 class Settings;
 class ConfigManager : public QObject
 {
@@ -20,6 +28,8 @@ public:
     bool syncAppAttribute();
 
     Settings *appSetting();
+    // the directory of the app config, the caches of cooperation live here
+    QString stateDirPath() const;
 
 Q_SIGNALS:
     void appAttributeChanged(const QString &group, const QString &key, const QVariant &value);
@@ -33,6 +43,7 @@ protected:
 
 private:
     Settings *appSettings { nullptr };   // app config
+    QString stateDir;
 };
 
 #endif   // CONFIGMANAGER_H
@@ -11,9 +11,12 @@
 #include <QJsonObject>
 #include <QDebug>
 #include <QFile>
+#include <QSaveFile>
 #include <QDir>
 #include <QTimer>
 #include <QThread>
+#include <QMutex>
+#include <QCryptographicHash>
 #include <QUrl>
 
 class SettingsPrivate
@@ -69,9 +72,53 @@ public:
     Data fallbackData;
     Data writableData;
 
+    // the three layers merged into one, so a read is a single lookup. it's
+    // rebuilt when a layer is loaded and updated in place by setValue.
+    struct Merged
+    {
+        QHash<QPair<QString, QString>, QVariant> values;
+        QHash<QString, QSet<QString>> keys;
+        QHash<QString, QStringList> keyLists;
+        QSet<QString> groups;
+    };
+
+    Merged merged;
+
+    void rebuildMerged();
+    void updateMerged(const QString &group, const QString &key);
+    void updateMergedKeyList(const QString &group);
+
     void fromJsonFile(const QString &fileName, Data *data);
     void fromJson(const QByteArray &json, Data *data);
-    QByteArray toJson(const Data &data);
+
+    // the writable layer as json, only the groups changed since the last
+    // sync are converted again.
+    QJsonObject jsonCache;
+    QSet<QString> dirtyGroups;
+    bool jsonCacheValid = false;
+
+    void markGroupDirty(const QString &group) { dirtyGroups << group; }
+    void invalidateJsonCache() { jsonCacheValid = false; }
+    QJsonObject toJsonObject();
+
+    // the file is written in this thread, a sync in flight takes the latest
+    // snapshot when it starts, so the requests in between are coalesced.
+    QThread *writerThread = nullptr;
+    QObject *writer = nullptr;
+    QMutex writeMutex;
+    QJsonObject pendingJson;
+    bool writeScheduled = false;
+    // the hash of the content last written or loaded, a watcher event for
+    // the same content is our own write and is ignored.
+    QByteArray fileHash;
+
+    void scheduleWrite(const QJsonObject &json);
+    void stopWriter();
+    static bool writeFile(const QString &fileName, const QJsonObject &json, QByteArray *hash = nullptr);
+
+    // the watcher events of a burst of writes are handled once.
+    QTimer *reloadTimer = nullptr;
+    void reloadSettingFile();
 
     void makeSettingFileToDirty(bool dirty)
     {
@@ -169,65 +216,252 @@ void SettingsPrivate::fromJson(const QByteArray &json, Data *data)
     }
 }
 
-QByteArray SettingsPrivate::toJson(const Data &data)
+QJsonObject SettingsPrivate::toJsonObject()
 {
-    QJsonObject root_object;
+    if (!jsonCacheValid) {
+        jsonCache = QJsonObject();
+        for (auto begin = writableData.values.constBegin(); begin != writableData.values.constEnd(); ++begin)
+            jsonCache.insert(begin.key(), QJsonObject::fromVariantHash(begin.value()));
+        jsonCacheValid = true;
+        dirtyGroups.clear();
+        return jsonCache;
+    }
+
+    for (const QString &group : dirtyGroups) {
+        const auto &values = writableData.values.constFind(group);
+        if (values == writableData.values.constEnd())
+            jsonCache.remove(group);
+        else
+            jsonCache.insert(group, QJsonObject::fromVariantHash(values.value()));
+    }
+    dirtyGroups.clear();
+
+    return jsonCache;
+}
 
-    for (auto begin = data.values.constBegin(); begin != data.values.constEnd(); ++begin) {
-        root_object.insert(begin.key(), QJsonValue(QJsonObject::fromVariantHash(begin.value())));
+bool SettingsPrivate::writeFile(const QString &fileName, const QJsonObject &json, QByteArray *hash)
+{
+    // the content is written to a temporary file, flushed to disk and
+    // renamed over the old one, a crash never leaves a truncated file.
+    QSaveFile file(fileName);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "cannot open setting file" << fileName << file.errorString();
+        return false;
+    }
+
+    const QByteArray &bytes = QJsonDocument(json).toJson();
+    if (file.write(bytes) != bytes.size()) {
+        qWarning() << "cannot write setting file" << fileName << file.errorString();
+        file.cancelWriting();
+        return false;
+    }
+
+    if (!file.commit()) {
+        qWarning() << "cannot commit setting file" << fileName << file.errorString();
+        return false;
     }
 
-    return QJsonDocument(root_object).toJson();
+    if (hash)
+        *hash = QCryptographicHash::hash(bytes, QCryptographicHash::Sha1);
+    return true;
 }
 
-void SettingsPrivate::_q_onFileChanged(const QString &filePath)
+void SettingsPrivate::scheduleWrite(const QJsonObject &json)
 {
-    if (filePath != settingFile)
+    if (!writerThread) {
+        writerThread = new QThread;
+        writer = new QObject;
+        writer->moveToThread(writerThread);
+        QObject::connect(writerThread, &QThread::finished, writer, &QObject::deleteLater);
+        writerThread->start(QThread::LowPriority);
+    }
+
+    QMutexLocker locker(&writeMutex);
+    pendingJson = json;
+    if (writeScheduled)
         return;
+    writeScheduled = true;
 
-    const auto old_values = writableData.values;
+    const QString fileName = settingFile;
+    QMetaObject::invokeMethod(writer, [this, fileName] {
+        QJsonObject json;
+        {
+            QMutexLocker locker(&writeMutex);
+            json = pendingJson;
+            pendingJson = QJsonObject();
+            writeScheduled = false;
+        }
 
-    writableData.values.clear();
-    fromJsonFile(settingFile, &writableData);
-    makeSettingFileToDirty(false);
+        QByteArray hash;
+        bool ok = writeFile(fileName, json, &hash);
+        if (ok) {
+            QMutexLocker locker(&writeMutex);
+            fileHash = hash;
+        }
+        Settings *q = q_ptr;
+        QMetaObject::invokeMethod(q, [this, q, ok] {
+            // the changes are written by the next sync.
+            if (!ok)
+                makeSettingFileToDirty(true);
+            Q_EMIT q->syncFinished(ok);
+        }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+}
 
-    for (auto begin = writableData.values.constBegin(); begin != writableData.values.constEnd(); ++begin) {
-        for (auto i = begin.value().constBegin(); i != begin.value().constEnd(); ++i) {
-            if (old_values.value(begin.key()).contains(i.key())) {
-                if (old_values.value(begin.key()).value(i.key()) == i.value()) {
-                    continue;
-                }
-            } else {
-                if (fallbackData.values.value(begin.key()).contains(i.key())) {
-                    if (fallbackData.values.value(begin.key()).value(i.key()) == i.value()) {
-                        continue;
-                    }
-                }
+void SettingsPrivate::stopWriter()
+{
+    if (!writerThread)
+        return;
 
-                if (defaultData.values.value(begin.key()).value(i.key()) == i.value()) {
-                    continue;
-                }
+    writerThread->quit();
+    writerThread->wait();
+    delete writerThread;
+    writerThread = nullptr;
+    writer = nullptr;
+
+    // a write queued but not started is done here.
+    if (writeScheduled) {
+        writeScheduled = false;
+        writeFile(settingFile, pendingJson);
+    }
+}
+
+void SettingsPrivate::rebuildMerged()
+{
+    merged = Merged();
+
+    // the lower layer is inserted first and overwritten by the upper ones.
+    for (auto begin = defaultData.values.constBegin(); begin != defaultData.values.constEnd(); ++begin) {
+        for (auto i = begin.value().constBegin(); i != begin.value().constEnd(); ++i)
+            merged.values.insert(qMakePair(begin.key(), i.key()), i.value());
+    }
+
+    for (const Data *data : { &fallbackData, &writableData }) {
+        for (auto begin = data->values.constBegin(); begin != data->values.constEnd(); ++begin) {
+            for (auto i = begin.value().constBegin(); i != begin.value().constEnd(); ++i) {
+                if (i.value().isValid())
+                    merged.values.insert(qMakePair(begin.key(), i.key()), i.value());
             }
+        }
+    }
 
-            Q_EMIT q_ptr->valueEdited(begin.key(), i.key(), i.value());
-            Q_EMIT q_ptr->valueChanged(begin.key(), i.key(), i.value());
+    for (const Data *data : { &writableData, &fallbackData, &defaultData }) {
+        for (auto begin = data->values.constBegin(); begin != data->values.constEnd(); ++begin) {
+            merged.groups << begin.key();
+            QSet<QString> &keys = merged.keys[begin.key()];
+            for (auto i = begin.value().constBegin(); i != begin.value().constEnd(); ++i)
+                keys << i.key();
         }
     }
 
-    for (auto begin = old_values.constBegin(); begin != old_values.constEnd(); ++begin) {
-        for (auto i = begin.value().constBegin(); i != begin.value().constEnd(); ++i) {
-            if (writableData.values.value(begin.key()).contains(i.key())) {
-                continue;
-            }
+    for (auto begin = merged.keys.constBegin(); begin != merged.keys.constEnd(); ++begin)
+        updateMergedKeyList(begin.key());
+}
+
+void SettingsPrivate::updateMerged(const QString &group, const QString &key)
+{
+    const auto &index = qMakePair(group, key);
+    merged.values.remove(index);
+
+    bool found = false;
+    for (const Data *data : { &writableData, &fallbackData }) {
+        const QVariant &value = data->values.value(group).value(key);
+        if (value.isValid()) {
+            merged.values.insert(index, value);
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) {
+        const auto &dg = defaultData.values.constFind(group);
+        if (dg != defaultData.values.constEnd() && dg->contains(key))
+            merged.values.insert(index, dg->value(key));
+    }
+
+    // only called after the key is written to the writable layer.
+    merged.groups << group;
+    QSet<QString> &keys = merged.keys[group];
+    if (!keys.contains(key)) {
+        keys << key;
+        updateMergedKeyList(group);
+    }
+}
 
-            const QVariant &new_value = q_ptr->value(begin.key(), i.key());
+void SettingsPrivate::updateMergedKeyList(const QString &group)
+{
+    QStringList keyList;
+    QSet<QString> keys = merged.keys.value(group);
 
-            if (new_value != old_values.value(begin.key()).value(i.key())) {
-                Q_EMIT q_ptr->valueEdited(begin.key(), i.key(), new_value);
-                Q_EMIT q_ptr->valueChanged(begin.key(), i.key(), new_value);
+    for (const Data *data : { &defaultData, &fallbackData, &writableData }) {
+        for (const QString &ordered_key : data->groupKeyOrderedList(group)) {
+            if (keys.contains(ordered_key)) {
+                keyList << ordered_key;
+                keys.remove(ordered_key);
             }
         }
     }
+
+    keyList << keys.toList();
+    merged.keyLists.insert(group, keyList);
+}
+
+void SettingsPrivate::_q_onFileChanged(const QString &filePath)
+{
+    if (filePath != settingFile)
+        return;
+
+    // the file is replaced by rename when it's synced, which drops the watch.
+    if (settingFileWatcher && !settingFileWatcher->files().contains(settingFile))
+        settingFileWatcher->addPath(settingFile);
+
+    if (reloadTimer)
+        reloadTimer->start();
+    else
+        reloadSettingFile();
+}
+
+void SettingsPrivate::reloadSettingFile()
+{
+    QByteArray json;
+    QFile file(settingFile);
+    if (file.open(QFile::ReadOnly))
+        json = file.readAll();
+
+    const QByteArray &hash = QCryptographicHash::hash(json, QCryptographicHash::Sha1);
+    {
+        QMutexLocker locker(&writeMutex);
+        if (hash == fileHash)
+            return;
+        fileHash = hash;
+    }
+
+    const auto old_values = merged.values;
+
+    writableData.values.clear();
+    if (!json.isEmpty())
+        fromJson(json, &writableData);
+    rebuildMerged();
+    invalidateJsonCache();
+    makeSettingFileToDirty(false);
+
+    // only the values that are changed in effect are notified.
+    for (auto begin = merged.values.constBegin(); begin != merged.values.constEnd(); ++begin) {
+        const auto &old_value = old_values.constFind(begin.key());
+        if (old_value != old_values.constEnd() && old_value.value() == begin.value())
+            continue;
+
+        Q_EMIT q_ptr->valueEdited(begin.key().first, begin.key().second, begin.value());
+        Q_EMIT q_ptr->valueChanged(begin.key().first, begin.key().second, begin.value());
+    }
+
+    for (auto begin = old_values.constBegin(); begin != old_values.constEnd(); ++begin) {
+        if (merged.values.contains(begin.key()))
+            continue;
+
+        Q_EMIT q_ptr->valueEdited(begin.key().first, begin.key().second, QVariant());
+        Q_EMIT q_ptr->valueChanged(begin.key().first, begin.key().second, QVariant());
+    }
 }
 
 /*!
@@ -245,6 +479,7 @@ Settings::Settings(const QString &defaultFile, const QString &fallbackFile, cons
     d_ptr->fromJsonFile(defaultFile, &d_ptr->defaultData);
     d_ptr->fromJsonFile(fallbackFile, &d_ptr->fallbackData);
     d_ptr->fromJsonFile(settingFile, &d_ptr->writableData);
+    d_ptr->rebuildMerged();
 }
 
 static QString getConfigFilePath(QStandardPaths::StandardLocation type, const QString &fileName, bool writable)
@@ -291,83 +526,33 @@ Settings::~Settings()
     if (d->settingFileIsDirty) {
         sync();
     }
+
+    d->stopWriter();
 }
 
 bool Settings::contains(const QString &group, const QString &key) const
 {
     Q_D(const Settings);
 
-    if (key.isEmpty()) {
-        if (d->writableData.values.contains(group)) {
-            return true;
-        }
-
-        if (d->fallbackData.values.contains(group)) {
-            return true;
-        }
-
-        return d->defaultData.values.contains(group);
-    }
-
-    if (d->writableData.values.value(group).contains(key)) {
-        return true;
-    }
-
-    if (d->fallbackData.values.value(group).contains(key)) {
-        return true;
-    }
+    if (key.isEmpty())
+        return d->merged.groups.contains(group);
 
-    return d->defaultData.values.value(group).contains(key);
+    const auto &keys = d->merged.keys.constFind(group);
+    return keys != d->merged.keys.constEnd() && keys->contains(key);
 }
 
 QSet<QString> Settings::groups() const
 {
     Q_D(const Settings);
 
-    QSet<QString> groups;
-
-    groups.reserve(d->writableData.values.size() + d->fallbackData.values.size() + d->defaultData.values.size());
-
-    for (auto begin = d->writableData.values.constBegin(); begin != d->writableData.values.constEnd(); ++begin) {
-        groups << begin.key();
-    }
-
-    for (auto begin = d->fallbackData.values.constBegin(); begin != d->fallbackData.values.constEnd(); ++begin) {
-        groups << begin.key();
-    }
-
-    for (auto begin = d->defaultData.values.constBegin(); begin != d->defaultData.values.constEnd(); ++begin) {
-        groups << begin.key();
-    }
-
-    return groups;
+    return d->merged.groups;
 }
 
 QSet<QString> Settings::keys(const QString &group) const
 {
     Q_D(const Settings);
 
-    QSet<QString> keys;
-
-    const auto &&wg = d->writableData.values.value(group);
-    const auto &&fg = d->fallbackData.values.value(group);
-    const auto &&dg = d->defaultData.values.value(group);
-
-    keys.reserve(wg.size() + fg.size() + dg.size());
-
-    for (auto begin = wg.constBegin(); begin != wg.constEnd(); ++begin) {
-        keys << begin.key();
-    }
-
-    for (auto begin = fg.constBegin(); begin != fg.constEnd(); ++begin) {
-        keys << begin.key();
-    }
-
-    for (auto begin = dg.constBegin(); begin != dg.constEnd(); ++begin) {
-        keys << begin.key();
-    }
-
-    return keys;
+    return d->merged.keys.value(group);
 }
 
 /*!
@@ -379,52 +564,15 @@ QStringList Settings::keyList(const QString &group) const
 {
     Q_D(const Settings);
 
-    QStringList keyList;
-    QSet<QString> keys = this->keys(group);
-
-    for (const QString &ordered_key : d->defaultData.groupKeyOrderedList(group)) {
-        if (keys.contains(ordered_key)) {
-            keyList << ordered_key;
-            keys.remove(ordered_key);
-        }
-    }
-
-    for (const QString &ordered_key : d->fallbackData.groupKeyOrderedList(group)) {
-        if (keys.contains(ordered_key)) {
-            keyList << ordered_key;
-            keys.remove(ordered_key);
-        }
-    }
-
-    for (const QString &ordered_key : d->writableData.groupKeyOrderedList(group)) {
-        if (keys.contains(ordered_key)) {
-            keyList << ordered_key;
-            keys.remove(ordered_key);
-        }
-    }
-
-    keyList << keys.toList();
-
-    return keyList;
+    return d->merged.keyLists.value(group);
 }
 
 QVariant Settings::value(const QString &group, const QString &key, const QVariant &defaultValue) const
 {
     Q_D(const Settings);
 
-    QVariant value = d->writableData.values.value(group).value(key, QVariant::Invalid);
-
-    if (value.isValid()) {
-        return value;
-    }
-
-    value = d->fallbackData.values.value(group).value(key, QVariant::Invalid);
-
-    if (value.isValid()) {
-        return value;
-    }
-
-    return d->defaultData.values.value(group).value(key, defaultValue);
+    const auto &value = d->merged.values.constFind(qMakePair(group, key));
+    return value != d->merged.values.constEnd() ? *value : defaultValue;
 }
 
 void Settings::setValue(const QString &group, const QString &key, const QVariant &value)
@@ -451,6 +599,8 @@ bool Settings::setValueNoNotify(const QString &group, const QString &key, const
     }
 
     d->writableData.setValue(group, key, value);
+    d->updateMerged(group, key);
+    d->markGroupDirty(group);
     d->makeSettingFileToDirty(true);
 
     return changed;
@@ -466,6 +616,8 @@ void Settings::removeGroup(const QString &group)
 
     const QVariantHash &group_values = d->writableData.values.take(group);
 
+    d->rebuildMerged();
+    d->markGroupDirty(group);
     d->makeSettingFileToDirty(true);
 
     for (auto begin = group_values.constBegin(); begin != group_values.constEnd(); ++begin) {
@@ -493,6 +645,8 @@ void Settings::remove(const QString &group, const QString &key)
     }
 
     const QVariant &old_value = d->writableData.values[group].take(key);
+    d->rebuildMerged();
+    d->markGroupDirty(group);
     d->makeSettingFileToDirty(true);
 
     const QVariant &new_value = value(group, key);
@@ -515,6 +669,8 @@ void Settings::clear()
     const QHash<QString, QVariantHash> old_values = d->writableData.values;
 
     d->writableData.values.clear();
+    d->rebuildMerged();
+    d->invalidateJsonCache();
     d->makeSettingFileToDirty(true);
 
     for (auto begin = old_values.constBegin(); begin != old_values.constEnd(); ++begin) {
@@ -547,8 +703,16 @@ void Settings::reload()
     d->writableData.privateValues.clear();
     d->writableData.values.clear();
     d->fromJsonFile(d->settingFile, &d_ptr->writableData);
+    d->rebuildMerged();
+    d->invalidateJsonCache();
 }
 
+/*!
+ * \brief Writes the changes in background.
+ *
+ * The file is written in a worker thread and the result is reported by
+ * syncFinished(), the returned value is kept for compatibility.
+ */
 bool Settings::sync()
 {
     Q_D(Settings);
@@ -557,22 +721,10 @@ bool Settings::sync()
         return true;
     }
 
-    const QByteArray &json = d->toJson(d->writableData);
-
-    QFile file(d->settingFile);
-
-    if (!file.open(QFile::WriteOnly)) {
-        return false;
-    }
-
-    bool ok = file.write(json) == json.size();
+    d->scheduleWrite(d->toJsonObject());
+    d->makeSettingFileToDirty(false);
 
-    if (ok) {
-        d->makeSettingFileToDirty(false);
-    }
-    file.close();
-
-    return ok;
+    return true;
 }
 
 bool Settings::autoSync() const
@@ -652,10 +804,20 @@ void Settings::setWatchChanges(bool watchChanges)
         d->settingFileWatcher->moveToThread(thread());
 
         connect(d->settingFileWatcher, &QFileSystemWatcher::fileChanged, this, &Settings::onFileChanged);
+
+        d->reloadTimer = new QTimer(this);
+        d->reloadTimer->setSingleShot(true);
+        d->reloadTimer->setInterval(200);
+        connect(d->reloadTimer, &QTimer::timeout, this, [d] { d->reloadSettingFile(); });
     } else {
         if (d->settingFileWatcher) {
             d->settingFileWatcher->deleteLater();
             d->settingFileWatcher = nullptr;
         }
+
+        if (d->reloadTimer) {
+            d->reloadTimer->deleteLater();
+            d->reloadTimer = nullptr;
+        }
     }
 }
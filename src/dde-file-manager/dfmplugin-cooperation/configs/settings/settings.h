@@ -57,6 +57,7 @@ public Q_SLOTS:
 Q_SIGNALS:
     void valueChanged(const QString &group, const QString &key, const QVariant &value);
     void valueEdited(const QString &group, const QString &key, const QVariant &value);
+    void syncFinished(bool ok);
 
 private:
     QScopedPointer<SettingsPrivate> d_ptr;
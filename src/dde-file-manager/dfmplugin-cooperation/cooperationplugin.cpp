@@ -5,7 +5,6 @@
 #include "cooperationplugin.h"
 #include "menu/cooperationmenuscene.h"
 #include "utils/cooperationhelper.h"
-#include "configs/settings/configmanager.h"
 
 #include <dfm-base/settingdialog/settingjsongenerator.h>
 #include <dfm-base/settingdialog/customsettingitemregister.h>
@@ -34,14 +33,9 @@ void CooperationPlugin::initialize()
 
 bool CooperationPlugin::start()
 {
-    // 加载跨端配置
-    auto appName = qApp->applicationName();
-    qApp->setApplicationName("dde-cooperation");
-    ConfigManager::instance();
-    qApp->setApplicationName(appName);
-
+    // 跨端配置在首次使用时加载
     // 添加文管设置
-    if (appName == "dde-file-manager")
+    if (qApp->applicationName() == "dde-file-manager")
         addCooperationSettingItem();
 
     return true;
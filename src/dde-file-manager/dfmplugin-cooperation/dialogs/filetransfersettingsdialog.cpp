@@ -18,6 +18,10 @@
 using namespace dfmplugin_cooperation;
 DWIDGET_USE_NAMESPACE
 
+// KiB/s
+static const QList<int> kBandwidthLimits { 0, 1024, 5 * 1024, 10 * 1024, 50 * 1024, 100 * 1024 };
+static const QList<int> kStreamCounts { 0, 1, 2, 4, 8 };
+
 FileChooserEdit::FileChooserEdit(QWidget *parent)
     : QWidget(parent)
 {
@@ -167,14 +171,34 @@ void FileTransferSettingsDialog::initUI()
     comBox->addItems(items);
     comBox->setFocusPolicy(Qt::NoFocus);
 
+    bandwidthBox = new DComboBox(this);
+    for (int limit : kBandwidthLimits)
+        bandwidthBox->addItem(limit == 0 ? tr("Unlimited") : tr("%1 MB/s").arg(limit / 1024));
+    bandwidthBox->setFocusPolicy(Qt::NoFocus);
+
+    streamsBox = new DComboBox(this);
+    for (int count : kStreamCounts)
+        streamsBox->addItem(count == 0 ? tr("Automatic") : QString::number(count));
+    streamsBox->setFocusPolicy(Qt::NoFocus);
+
+    compressionBox = new DComboBox(this);
+    compressionBox->addItems({ tr("Off"), tr("Compress compressible files") });
+    compressionBox->setFocusPolicy(Qt::NoFocus);
+
     addItem(tr("Allows the following users to send files to me"), comBox, 0);
-    addItem(tr("File save location"), fileChooserEdit, 1);
+    addItem(tr("File save location"), fileChooserEdit, 2);
+    addItem(tr("Maximum upload bandwidth"), bandwidthBox, 2);
+    addItem(tr("Parallel transfer streams"), streamsBox, 2);
+    addItem(tr("Compression during transfer"), compressionBox, 1);
 }
 
 void FileTransferSettingsDialog::initConnect()
 {
     connect(comBox, qOverload<int>(&DComboBox::currentIndexChanged), this, &FileTransferSettingsDialog::onComBoxValueChanged);
     connect(fileChooserEdit, &FileChooserEdit::fileChoosed, this, &FileTransferSettingsDialog::onFileChoosered);
+    connect(bandwidthBox, qOverload<int>(&DComboBox::activated), this, &FileTransferSettingsDialog::onBandwidthChanged);
+    connect(streamsBox, qOverload<int>(&DComboBox::activated), this, &FileTransferSettingsDialog::onStreamsChanged);
+    connect(compressionBox, qOverload<int>(&DComboBox::activated), this, &FileTransferSettingsDialog::onCompressionChanged);
 }
 
 void FileTransferSettingsDialog::loadConfig()
@@ -191,6 +215,23 @@ void FileTransferSettingsDialog::loadConfig()
 
     value = ConfigManager::instance()->appAttribute("GenericAttribute", "StoragePath");
     fileChooserEdit->setText(value.isValid() ? value.toString() : QStandardPaths::writableLocation(QStandardPaths::DownloadLocation));
+
+    // a limit that isn't one of the presets shows the nearest lower one, or the lowest.
+    int bandwidth = ConfigManager::instance()->appAttribute(kGenericAttribute, kTransferBandwidth).toInt();
+    int index = 0;
+    for (int i = 1; i < kBandwidthLimits.size() && bandwidth > 0; ++i) {
+        if (kBandwidthLimits.at(i) <= bandwidth)
+            index = i;
+    }
+    if (bandwidth > 0 && index == 0)
+        index = 1;
+    bandwidthBox->setCurrentIndex(index);
+
+    int streams = ConfigManager::instance()->appAttribute(kGenericAttribute, kTransferStreams).toInt();
+    streamsBox->setCurrentIndex(qMax(0, kStreamCounts.indexOf(streams)));
+
+    bool compression = ConfigManager::instance()->appAttribute(kGenericAttribute, kTransferCompression).toBool();
+    compressionBox->setCurrentIndex(compression ? 1 : 0);
 }
 
 void FileTransferSettingsDialog::addItem(const QString &text, QWidget *widget, int indexPos)
@@ -233,6 +274,21 @@ void FileTransferSettingsDialog::onComBoxValueChanged(int index)
 #endif
 }
 
+void FileTransferSettingsDialog::onBandwidthChanged(int index)
+{
+    ConfigManager::instance()->setAppAttribute(kGenericAttribute, kTransferBandwidth, kBandwidthLimits.value(index));
+}
+
+void FileTransferSettingsDialog::onStreamsChanged(int index)
+{
+    ConfigManager::instance()->setAppAttribute(kGenericAttribute, kTransferStreams, kStreamCounts.value(index));
+}
+
+void FileTransferSettingsDialog::onCompressionChanged(int index)
+{
+    ConfigManager::instance()->setAppAttribute(kGenericAttribute, kTransferCompression, index == 1);
+}
+
 void FileTransferSettingsDialog::showEvent(QShowEvent *e)
 {
     loadConfig();
@@ -70,6 +70,9 @@ public:
 public Q_SLOTS:
     void onFileChoosered(const QString &fileName);
     void onComBoxValueChanged(int index);
+    void onBandwidthChanged(int index);
+    void onStreamsChanged(int index);
+    void onCompressionChanged(int index);
 
 protected:
     void showEvent(QShowEvent *e) override;
@@ -84,6 +87,9 @@ private:
 private:
     FileChooserEdit *fileChooserEdit { nullptr };
     DTK_WIDGET_NAMESPACE::DComboBox *comBox { nullptr };
+    DTK_WIDGET_NAMESPACE::DComboBox *bandwidthBox { nullptr };
+    DTK_WIDGET_NAMESPACE::DComboBox *streamsBox { nullptr };
+    DTK_WIDGET_NAMESPACE::DComboBox *compressionBox { nullptr };
     QVBoxLayout *mainLayout { nullptr };
 };
 
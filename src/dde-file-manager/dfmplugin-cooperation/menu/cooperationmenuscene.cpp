@@ -4,11 +4,11 @@
 
 #include "cooperationmenuscene.h"
 #include "cooperationmenuscene_p.h"
+#include "utils/transferhandoff.h"
 
 #include <dfm-base/dfm_menu_defines.h>
 
 #include <QUrl>
-#include <QProcess>
 
 inline constexpr char kFileTransfer[] { "file-transfer" };
 
@@ -118,11 +118,8 @@ bool CooperationMenuScene::triggered(QAction *action)
         for (auto &url : d->selectFiles)
             fileList << url.toLocalFile();
 
-        QStringList arguments;
-        arguments << "-s"
-                  << fileList;
-
-        return QProcess::startDetached("dde-cooperation-transfer", arguments);
+        TransferHandoff::instance()->send(fileList);
+        return true;
     }
 
     return true;
@@ -0,0 +1,246 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "fingerprintcache.h"
+
+#include <QCryptographicHash>
+#include <QtEndian>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QFile>
+#include <QDebug>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <cstring>
+
+inline constexpr int kHashBlockSize { 1024 * 1024 };
+inline constexpr char kHashPrefix[] { "xxh64:" };
+
+using namespace dfmplugin_cooperation;
+
+FingerprintCache::FingerprintCache(const QString &cacheDir, const QString &dirPath)
+    : dirPath(dirPath)
+{
+    const auto &id = QCryptographicHash::hash(dirPath.toUtf8(), QCryptographicHash::Sha1).toHex();
+    cacheFile = QString("%1/%2.json").arg(cacheDir, QString::fromLatin1(id));
+
+    QFile file(cacheFile);
+    if (!file.open(QFile::ReadOnly))
+        return;
+
+    const auto &obj = QJsonDocument::fromJson(file.readAll()).object();
+    // a hash collision of the directory path makes the cache unusable.
+    if (obj.value("dir").toString() != dirPath)
+        return;
+
+    const auto &files = obj.value("files").toObject();
+    for (auto iter = files.constBegin(); iter != files.constEnd(); ++iter) {
+        const auto &value = iter.value().toObject();
+        Item item;
+        item.size = value.value("size").toVariant().toLongLong();
+        item.mtime = value.value("mtime").toVariant().toLongLong();
+        item.hash = value.value("hash").toString().toLatin1();
+        // the hashes of an older algorithm are computed again.
+        if (!item.hash.startsWith(kHashPrefix))
+            continue;
+        items.insert(iter.key(), item);
+    }
+}
+
+static qint64 mtimeOf(const struct stat &st)
+{
+    return qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+QByteArray FingerprintCache::cached(const QString &name, const struct stat &st)
+{
+    if (!S_ISREG(st.st_mode))
+        return {};
+
+    seen << name;
+    auto iter = items.constFind(name);
+    if (iter != items.cend() && iter->size == qint64(st.st_size) && iter->mtime == mtimeOf(st))
+        return iter->hash;
+    return {};
+}
+
+QByteArray FingerprintCache::fingerprint(int dirFd, const QString &name, const struct stat &st)
+{
+    const QByteArray &hash = cached(name, st);
+    if (!hash.isEmpty() || !S_ISREG(st.st_mode))
+        return hash;
+
+    const qint64 mtime = mtimeOf(st);
+    Item item { qint64(st.st_size), mtime, hashFile(dirFd, name) };
+    if (item.hash.isEmpty())
+        return {};
+
+    items.insert(name, item);
+    dirty = true;
+    return item.hash;
+}
+
+void FingerprintCache::save(bool prune)
+{
+    if (prune) {
+        for (auto iter = items.begin(); iter != items.end();) {
+            if (seen.contains(iter.key())) {
+                ++iter;
+            } else {
+                iter = items.erase(iter);
+                dirty = true;
+            }
+        }
+    }
+
+    if (!dirty)
+        return;
+
+    QJsonObject files;
+    for (auto iter = items.constBegin(); iter != items.constEnd(); ++iter) {
+        files.insert(iter.key(), QJsonObject {
+                { "size", QString::number(iter->size) },
+                { "mtime", QString::number(iter->mtime) },
+                { "hash", QString::fromLatin1(iter->hash) } });
+    }
+
+    QSaveFile file(cacheFile);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "cannot save fingerprint cache" << cacheFile << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument(QJsonObject { { "dir", dirPath }, { "files", files } }).toJson(QJsonDocument::Compact));
+    if (file.commit())
+        dirty = false;
+}
+
+QByteArray FingerprintCache::fingerprintOf(const QString &cacheDir, const QString &path)
+{
+    const QFileInfo info(path);
+    const QString &dirPath = info.absolutePath();
+    int dirFd = open(dirPath.toLocal8Bit().constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0)
+        return {};
+
+    QByteArray hash;
+    struct stat st;
+    if (fstatat(dirFd, info.fileName().toLocal8Bit().constData(), &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        FingerprintCache cache(cacheDir, dirPath);
+        hash = cache.fingerprint(dirFd, info.fileName(), st);
+        cache.save(false);
+    }
+    close(dirFd);
+    return hash;
+}
+
+namespace {
+
+// xxh64, the hash only tells the changed files apart, it doesn't need to be
+// cryptographic but has to keep up with the disk.
+class FastHash
+{
+public:
+    void addData(const char *data, size_t len)
+    {
+        total += len;
+        if (bufLen > 0) {
+            size_t fill = qMin(len, sizeof(buf) - bufLen);
+            memcpy(buf + bufLen, data, fill);
+            bufLen += fill;
+            data += fill;
+            len -= fill;
+            if (bufLen < sizeof(buf))
+                return;
+            consume(buf);
+            bufLen = 0;
+        }
+        for (; len >= sizeof(buf); data += sizeof(buf), len -= sizeof(buf))
+            consume(data);
+        memcpy(buf, data, len);
+        bufLen = len;
+    }
+
+    quint64 result() const
+    {
+        quint64 h = total >= sizeof(buf)
+                ? merge(merge(merge(merge(rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18),
+                                          v[0]), v[1]), v[2]), v[3])
+                : kP5;
+        h += total;
+
+        const char *p = buf;
+        size_t len = bufLen;
+        for (; len >= 8; p += 8, len -= 8) {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * kP1 + kP4;
+        }
+        if (len >= 4) {
+            h ^= quint64(qFromLittleEndian<quint32>(p)) * kP1;
+            h = rotl(h, 23) * kP2 + kP3;
+            p += 4;
+            len -= 4;
+        }
+        for (; len > 0; ++p, --len) {
+            h ^= quint64(quint8(*p)) * kP5;
+            h = rotl(h, 11) * kP1;
+        }
+
+        h ^= h >> 33;
+        h *= kP2;
+        h ^= h >> 29;
+        h *= kP3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static constexpr quint64 kP1 { 11400714785074694791ULL };
+    static constexpr quint64 kP2 { 14029467366897019727ULL };
+    static constexpr quint64 kP3 { 1609587929392839161ULL };
+    static constexpr quint64 kP4 { 9650029242287828579ULL };
+    static constexpr quint64 kP5 { 2870177450012600261ULL };
+
+    static quint64 rotl(quint64 x, int r) { return (x << r) | (x >> (64 - r)); }
+    static quint64 read64(const char *p) { return qFromLittleEndian<quint64>(p); }
+    static quint64 round(quint64 acc, quint64 input) { return rotl(acc + input * kP2, 31) * kP1; }
+    static quint64 merge(quint64 acc, quint64 val) { return (acc ^ round(0, val)) * kP1 + kP4; }
+
+    void consume(const char *p)
+    {
+        for (int i = 0; i < 4; ++i)
+            v[i] = round(v[i], read64(p + i * 8));
+    }
+
+    quint64 v[4] { kP1 + kP2, kP2, 0, 0 - kP1 };
+    char buf[32];
+    size_t bufLen { 0 };
+    quint64 total { 0 };
+};
+
+}   // namespace
+
+QByteArray FingerprintCache::hashFile(int dirFd, const QString &name)
+{
+    int fd = openat(dirFd, name.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0)
+        return {};
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    FastHash hash;
+    QByteArray buf(kHashBlockSize, Qt::Uninitialized);
+    ssize_t len = 0;
+    while ((len = read(fd, buf.data(), size_t(buf.size()))) > 0)
+        hash.addData(buf.constData(), size_t(len));
+    close(fd);
+
+    if (len < 0)
+        return {};
+    // the algorithm is named, so the hashes of another one never match.
+    return kHashPrefix + QByteArray::number(hash.result(), 16).rightJustified(16, '0');
+}
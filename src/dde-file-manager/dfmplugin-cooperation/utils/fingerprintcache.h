@@ -0,0 +1,54 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef FINGERPRINTCACHE_H
+#define FINGERPRINTCACHE_H
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+
+struct stat;
+
+namespace dfmplugin_cooperation {
+
+// the content hashes of the files in one directory, kept in a cache file
+// per directory. a hash is only computed when it's asked for, and again only
+// when the size or mtime of the file differs from the cached one, so a
+// directory sent again is not read again unless it's changed.
+class FingerprintCache
+{
+public:
+    FingerprintCache(const QString &cacheDir, const QString &dirPath);
+
+    // the cached hash if the file is unchanged, the file is never read.
+    QByteArray cached(const QString &name, const struct stat &st);
+    QByteArray fingerprint(int dirFd, const QString &name, const struct stat &st);
+    // drops the files not looked up if the whole directory is scanned
+    void save(bool prune);
+
+    // computes the hash of a file with the cache of its directory, and
+    // saves it. it reads the whole file, it's never called in gui thread.
+    static QByteArray fingerprintOf(const QString &cacheDir, const QString &path);
+
+private:
+    struct Item
+    {
+        qint64 size { 0 };
+        qint64 mtime { 0 };
+        QByteArray hash;
+    };
+
+    static QByteArray hashFile(int dirFd, const QString &name);
+
+    QString cacheFile;
+    QString dirPath;
+    QHash<QString, Item> items;
+    QSet<QString> seen;
+    bool dirty { false };
+};
+
+}   // namespace dfmplugin_cooperation
+
+#endif   // FINGERPRINTCACHE_H
@@ -0,0 +1,315 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "transferhandoff.h"
+#include "transfermanifest.h"
+#include "fingerprintcache.h"
+#include "configs/settings/configmanager.h"
+
+#include <QProcess>
+#include <QStandardPaths>
+#include <QUuid>
+#include <QFile>
+#include <QDir>
+#include <QTimer>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QDebug>
+
+#include <unistd.h>
+
+#include <cstring>
+#include <algorithm>
+
+inline constexpr char kTransferApp[] { "dde-cooperation-transfer" };
+inline constexpr char kTransferServer[] { "dde-cooperation-transfer" };
+inline constexpr int kChunkPaths { 512 };
+inline constexpr int kMaxArgumentBytes { 128 * 1024 };
+inline constexpr qint64 kMaxBufferedBytes { 1024 * 1024 };
+inline constexpr int kConnectInterval { 200 };
+inline constexpr int kLaunchTimeout { 5000 };
+
+namespace dfmplugin_cooperation {
+
+class HashTask : public QRunnable
+{
+public:
+    HashTask(TransferHandoff *handoff, const QString &cacheDir, const QString &path)
+        : handoff(handoff), cacheDir(cacheDir), path(path) { }
+
+    void run() override
+    {
+        const QByteArray &hash = FingerprintCache::fingerprintOf(cacheDir, path);
+        QMetaObject::invokeMethod(handoff, [handoff = handoff, path = path, hash] {
+            handoff->reply(path, hash);
+        }, Qt::QueuedConnection);
+    }
+
+private:
+    TransferHandoff *handoff;
+    QString cacheDir;
+    QString path;
+};
+
+}   // namespace dfmplugin_cooperation
+
+using namespace dfmplugin_cooperation;
+
+TransferHandoff *TransferHandoff::instance()
+{
+    static TransferHandoff ins;
+    return &ins;
+}
+
+TransferHandoff::TransferHandoff(QObject *parent)
+    : QObject(parent),
+      socket(new QLocalSocket(this)),
+      hashPool(new QThreadPool(this))
+{
+    // the hashes read the files, one at a time keeps the disk and the
+    // cache files of directories uncontended.
+    hashPool->setMaxThreadCount(1);
+
+    connect(socket, &QLocalSocket::connected, this, [this] {
+        launchTimer.invalidate();
+        writeNext();
+    });
+    connect(socket, &QLocalSocket::bytesWritten, this, &TransferHandoff::writeNext);
+    connect(socket, &QLocalSocket::readyRead, this, &TransferHandoff::onReadyRead);
+    connect(socket, &QLocalSocket::disconnected, this, [this] {
+        // the answers belong to the instance gone.
+        received.clear();
+        hashPool->clear();
+        if (!pending.isEmpty() && pending.first().reply)
+            written = 0;
+        pending.erase(std::remove_if(pending.begin(), pending.end(), [](const Request &request) {
+                          return request.reply;
+                      }),
+                      pending.end());
+        // the written part of an interrupted request is not sent again, the
+        // rest is a new request to the next instance, with its own header.
+        if (!pending.isEmpty() && pending.first().headerSent) {
+            pending.first().paths = pending.first().paths.mid(written);
+            pending.first().headerSent = false;
+            written = 0;
+        }
+        if (!pending.isEmpty())
+            connectServer();
+    });
+    connect(socket, QOverload<QLocalSocket::LocalSocketError>::of(&QLocalSocket::error),
+            this, &TransferHandoff::onError);
+}
+
+void TransferHandoff::send(const QStringList &paths)
+{
+    if (paths.isEmpty())
+        return;
+
+    // the paths are handed over once the manifest is built, the manifest
+    // belongs to the transfer instance after that.
+    QString dirPath = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) + "/" + kTransferApp;
+    QDir().mkpath(dirPath);
+    QString fileName = QString("%1/manifest-%2.json").arg(dirPath, QUuid::createUuid().toString(QUuid::WithoutBraces));
+
+    // the settings when the files are chosen are used.
+    const QByteArray options = transferOptions();
+    auto builder = new ManifestBuilder(paths, fileName, this);
+    builder->setFingerprintDir(fingerprintDir());
+    connect(builder, &ManifestBuilder::finished, this, [this, builder, paths](const TransferManifest &manifest) {
+        qInfo() << "transfer manifest is built:" << manifest.fileCount << "files" << manifest.totalBytes << "bytes";
+        enqueue({ paths, manifest.fileName, options });
+        builder->deleteLater();
+    });
+    builder->start();
+}
+
+void TransferHandoff::enqueue(const Request &request)
+{
+    pending.append(request);
+    if (socket->state() == QLocalSocket::ConnectedState)
+        writeNext();
+    else
+        connectServer();
+}
+
+QByteArray TransferHandoff::transferOptions()
+{
+    auto cfg = ConfigManager::instance();
+    QByteArray options;
+    options.append("bandwidth=" + QByteArray::number(qMax(0, cfg->appAttribute(kGenericAttribute, kTransferBandwidth).toInt())));
+    options.append('\0');
+    options.append("streams=" + QByteArray::number(qMax(0, cfg->appAttribute(kGenericAttribute, kTransferStreams).toInt())));
+    options.append('\0');
+    options.append("compression=" + QByteArray(cfg->appAttribute(kGenericAttribute, kTransferCompression).toBool() ? "1" : "0"));
+    options.append('\0');
+    return options;
+}
+
+QString TransferHandoff::fingerprintDir()
+{
+    return ConfigManager::instance()->stateDirPath() + "/fingerprints";
+}
+
+void TransferHandoff::connectServer()
+{
+    if (socket->state() != QLocalSocket::UnconnectedState)
+        return;
+    socket->connectToServer(kTransferServer);
+}
+
+bool TransferHandoff::isLaunching() const
+{
+    return launchTimer.isValid() && launchTimer.elapsed() < kLaunchTimeout;
+}
+
+bool TransferHandoff::launchTransfer(qint64 maxBytes)
+{
+    if (pending.isEmpty())
+        return false;
+
+    // the instance gets as many paths as fit in the arguments, the rest
+    // are sent to it once it listens.
+    Request &request = pending.first();
+    QStringList &paths = request.paths;
+    QStringList arguments = optionArguments(request);
+    arguments << "-s";
+    int count = 0;
+    qint64 bytes = 0;
+    for (; count < paths.size(); ++count) {
+        bytes += paths.at(count).toLocal8Bit().size() + 1;
+        if (count > 0 && bytes > maxBytes)
+            break;
+        arguments << paths.at(count);
+    }
+
+    if (!QProcess::startDetached(kTransferApp, arguments)) {
+        qWarning() << "cannot start" << kTransferApp << ", the files are dropped";
+        for (const auto &dropped : qAsConst(pending)) {
+            if (!dropped.manifestFile.isEmpty())
+                QFile::remove(dropped.manifestFile);
+        }
+        pending.clear();
+        written = 0;
+        return false;
+    }
+    launchTimer.start();
+
+    paths = paths.mid(count);
+    request.launched = true;
+    // the manifest belongs to the started instance now.
+    if (paths.isEmpty())
+        pending.removeFirst();
+    return true;
+}
+
+QStringList TransferHandoff::optionArguments(const Request &request)
+{
+    // the same as the records of header, "key=value" is given as "--key value".
+    QStringList arguments;
+    for (const QByteArray &record : request.options.split('\0')) {
+        int pos = record.indexOf('=');
+        if (pos <= 0)
+            continue;
+        arguments << "--" + QString::fromUtf8(record.left(pos)) << QString::fromUtf8(record.mid(pos + 1));
+    }
+    if (!request.manifestFile.isEmpty())
+        arguments << "--manifest" << request.manifestFile;
+    return arguments;
+}
+
+void TransferHandoff::writeNext()
+{
+    if (socket->state() != QLocalSocket::ConnectedState)
+        return;
+
+    while (!pending.isEmpty() && socket->bytesToWrite() < kMaxBufferedBytes) {
+        Request &request = pending.first();
+        const QStringList &paths = request.paths;
+        QByteArray chunk;
+        if (!request.headerSent) {
+            chunk.append(request.options);
+            if (!request.manifestFile.isEmpty()) {
+                chunk.append("manifest=" + request.manifestFile.toUtf8());
+                chunk.append('\0');
+            }
+            request.headerSent = true;
+        }
+
+        int end = qMin(written + kChunkPaths, paths.size());
+        for (; written < end; ++written) {
+            chunk.append(paths.at(written).toUtf8());
+            chunk.append('\0');
+        }
+
+        if (written == paths.size()) {
+            chunk.append('\0');
+            pending.removeFirst();
+            written = 0;
+        }
+        socket->write(chunk);
+    }
+
+    // the socket is kept open for the queries of hashes, until the instance
+    // closes it. a later request connects again then.
+}
+
+void TransferHandoff::onReadyRead()
+{
+    received.append(socket->readAll());
+    int start = 0;
+    for (int end = received.indexOf('\0'); end >= 0; end = received.indexOf('\0', start)) {
+        const QByteArray &record = received.mid(start, end - start);
+        start = end + 1;
+        if (record.startsWith("hash="))
+            hashPool->start(new HashTask(this, fingerprintDir(), QString::fromUtf8(record.mid(int(strlen("hash="))))));
+        else
+            qWarning() << "unknown record from" << kTransferApp << record.left(64);
+    }
+    received.remove(0, start);
+}
+
+void TransferHandoff::reply(const QString &path, const QByteArray &hash)
+{
+    // the instance asked is gone.
+    if (socket->state() != QLocalSocket::ConnectedState)
+        return;
+
+    Request request;
+    request.paths = QStringList { path };
+    request.options = "hash=" + hash;
+    request.options.append('\0');
+    request.reply = true;
+    enqueue(request);
+}
+
+void TransferHandoff::onError(QLocalSocket::LocalSocketError error)
+{
+    if (error != QLocalSocket::ServerNotFoundError
+        && error != QLocalSocket::ConnectionRefusedError) {
+        if (error != QLocalSocket::PeerClosedError)
+            qWarning() << "transfer handoff failed:" << socket->errorString();
+        return;
+    }
+
+    // waits for the instance just started, whichever request started it.
+    if (!isLaunching() && !pending.isEmpty()) {
+        if (!pending.first().launched) {
+            launchTransfer(kMaxArgumentBytes);
+        } else {
+            // the instance doesn't listen, the rest goes to one more instance
+            // by arguments, what exceeds the limit of arguments is dropped.
+            qWarning() << kTransferApp << "is not listening, start it with the files as arguments";
+            const qint64 argMax = qMax(qint64(kMaxArgumentBytes), qint64(sysconf(_SC_ARG_MAX)) / 2);
+            if (launchTransfer(argMax) && !pending.isEmpty() && pending.first().launched) {
+                qWarning() << pending.first().paths.size() << "files exceed the arguments and are dropped";
+                pending.removeFirst();
+            }
+            // it's not expected to listen either, the next request doesn't wait.
+            launchTimer.invalidate();
+        }
+    }
+
+    if (!pending.isEmpty())
+        QTimer::singleShot(kConnectInterval, this, &TransferHandoff::connectServer);
+}
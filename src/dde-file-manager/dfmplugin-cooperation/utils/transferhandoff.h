@@ -0,0 +1,77 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TRANSFERHANDOFF_H
+#define TRANSFERHANDOFF_H
+
+#include <QObject>
+#include <QStringList>
+#include <QLocalSocket>
+#include <QElapsedTimer>
+
+class QThreadPool;
+
+namespace dfmplugin_cooperation {
+
+// hands the files to transfer over to dde-cooperation-transfer.
+// the paths are streamed in chunks through the local socket of a running
+// instance, an instance is started with the first chunk as arguments only
+// when none is listening, the records of header below are given to it as
+// "--key value" arguments too. if the started instance doesn't listen in time,
+// the rest of the request is given to one more instance by arguments.
+// a request is a list of paths each terminated by
+// '\0', the request itself is terminated by an empty path. before the
+// paths a request has the records "bandwidth=<KiB/s>", "streams=<count>"
+// and "compression=<0|1>" of the transfer settings, and "manifest=<file>"
+// if the manifest of the whole selection is built, see TransferManifest.
+// the instance may query the content hash of a file of the manifest by
+// writing the record "hash=<path>", it's answered by a request with the
+// record "hash=<value>" and the path only, which is not to be transferred.
+// the value is empty if the file cannot be read.
+class TransferHandoff : public QObject
+{
+    Q_OBJECT
+public:
+    static TransferHandoff *instance();
+
+    void send(const QStringList &paths);
+
+private:
+    friend class HashTask;
+    explicit TransferHandoff(QObject *parent = nullptr);
+
+    void connectServer();
+    bool launchTransfer(qint64 maxBytes);
+    bool isLaunching() const;
+    void writeNext();
+    void onError(QLocalSocket::LocalSocketError error);
+    void onReadyRead();
+    void reply(const QString &path, const QByteArray &hash);
+
+    struct Request
+    {
+        QStringList paths;
+        QString manifestFile;
+        QByteArray options;   // the records of the transfer settings
+        bool headerSent { false };
+        bool launched { false };   // an instance is started with a part of it
+        bool reply { false };   // answers a query of the connected instance
+    };
+
+    void enqueue(const Request &request);
+    static QByteArray transferOptions();
+    static QStringList optionArguments(const Request &request);
+    static QString fingerprintDir();
+
+    QLocalSocket *socket { nullptr };
+    QThreadPool *hashPool { nullptr };
+    QByteArray received;   // the incomplete record read from the instance
+    QList<Request> pending;
+    int written { 0 };   // the paths of the first pending request written
+    QElapsedTimer launchTimer;   // since the last instance was started
+};
+
+}   // namespace dfmplugin_cooperation
+
+#endif   // TRANSFERHANDOFF_H
@@ -0,0 +1,209 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "transfermanifest.h"
+#include "fingerprintcache.h"
+
+#include <QThreadPool>
+#include <QThread>
+#include <QRunnable>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QMap>
+#include <QScopedPointer>
+#include <QDebug>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+inline constexpr int kManifestVersion { 2 };
+
+namespace dfmplugin_cooperation {
+
+class ScanTask : public QRunnable
+{
+public:
+    ScanTask(ManifestBuilder *builder, const QString &dirPath, const QStringList &names)
+        : builder(builder), dirPath(dirPath), names(names) { }
+
+    void run() override { builder->scanDir(dirPath, names); }
+
+private:
+    ManifestBuilder *builder;
+    QString dirPath;
+    QStringList names;
+};
+
+}   // namespace dfmplugin_cooperation
+
+using namespace dfmplugin_cooperation;
+
+static void fillEntry(const QString &path, const struct stat &st, TransferManifest::Entry *entry)
+{
+    entry->path = path;
+    entry->device = quint64(st.st_dev);
+    entry->inode = quint64(st.st_ino);
+    entry->isDir = S_ISDIR(st.st_mode);
+    entry->size = entry->isDir ? 0 : qint64(st.st_size);
+    entry->mtime = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+bool TransferManifest::save(const QString &fileName) const
+{
+    QJsonArray items;
+    for (const auto &entry : entries) {
+        items.append(QJsonObject {
+                { "path", entry.path },
+                { "size", entry.size },
+                { "mtime", QString::number(entry.mtime) },
+                { "hash", QString::fromLatin1(entry.hash) },
+                { "dev", QString::number(entry.device) },
+                { "ino", QString::number(entry.inode) },
+                { "dir", entry.isDir } });
+    }
+
+    QJsonObject obj {
+        { "version", kManifestVersion },
+        { "roots", QJsonArray::fromStringList(roots) },
+        { "files", fileCount },
+        { "bytes", totalBytes },
+        { "entries", items }
+    };
+
+    QSaveFile file(fileName);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "cannot open manifest file" << fileName << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+ManifestBuilder::ManifestBuilder(const QStringList &roots, const QString &fileName, QObject *parent)
+    : QObject(parent),
+      pool(new QThreadPool(this)),
+      fileName(fileName)
+{
+    manifest.roots = roots;
+    // the walk is bound by the disk, more threads don't help.
+    pool->setMaxThreadCount(qBound(2, QThread::idealThreadCount(), 8));
+}
+
+ManifestBuilder::~ManifestBuilder()
+{
+    pool->clear();
+    pool->waitForDone();
+}
+
+void ManifestBuilder::setFingerprintDir(const QString &dirPath)
+{
+    fingerprintDir = dirPath;
+    if (!fingerprintDir.isEmpty())
+        QDir().mkpath(fingerprintDir);
+}
+
+void ManifestBuilder::start()
+{
+    // the walk is done when this task and all the scans it started end.
+    runningTasks = 1;
+
+    // the selected files are scanned with the others of their directory,
+    // so they share the fingerprint cache of it.
+    QMap<QString, QStringList> parents;
+    for (const QString &root : manifest.roots) {
+        const QFileInfo info(root);
+        parents[info.absolutePath()] << info.fileName();
+    }
+    for (auto iter = parents.constBegin(); iter != parents.constEnd(); ++iter)
+        startScan(iter.key(), iter.value());
+
+    taskDone();
+}
+
+void ManifestBuilder::startScan(const QString &dirPath, const QStringList &names)
+{
+    ++runningTasks;
+    pool->start(new ScanTask(this, dirPath, names));
+}
+
+void ManifestBuilder::scanDir(const QString &dirPath, const QStringList &names)
+{
+    DIR *dir = opendir(dirPath.toLocal8Bit().constData());
+    if (!dir) {
+        qWarning() << "cannot open the transfer directory" << dirPath;
+        taskDone();
+        return;
+    }
+
+    QScopedPointer<FingerprintCache> cache;
+    if (!fingerprintDir.isEmpty())
+        cache.reset(new FingerprintCache(fingerprintDir, dirPath));
+
+    QVector<TransferManifest::Entry> entries;
+    const int fd = dirfd(dir);
+    const QString prefix = dirPath.endsWith('/') ? dirPath : dirPath + "/";
+    auto addEntry = [&](const QString &name) {
+        // the links are not followed, the walk never loops.
+        struct stat st;
+        if (fstatat(fd, name.toLocal8Bit().constData(), &st, AT_SYMLINK_NOFOLLOW) != 0)
+            return;
+
+        TransferManifest::Entry entry;
+        fillEntry(prefix + name, st, &entry);
+        if (entry.isDir)
+            startScan(entry.path);
+        else if (cache)
+            entry.hash = cache->cached(name, st);
+        entries.append(entry);
+    };
+
+    if (names.isEmpty()) {
+        while (struct dirent *ent = readdir(dir)) {
+            if (qstrcmp(ent->d_name, ".") == 0 || qstrcmp(ent->d_name, "..") == 0)
+                continue;
+            addEntry(QString::fromLocal8Bit(ent->d_name));
+        }
+    } else {
+        for (const QString &name : names)
+            addEntry(name);
+    }
+
+    if (cache)
+        cache->save(names.isEmpty());
+    closedir(dir);
+
+    addEntries(entries);
+    taskDone();
+}
+
+void ManifestBuilder::addEntries(const QVector<TransferManifest::Entry> &entries)
+{
+    QMutexLocker locker(&mutex);
+    for (const auto &entry : entries) {
+        if (!entry.isDir && !counted.contains({ entry.device, entry.inode })) {
+            counted.insert({ entry.device, entry.inode });
+            manifest.fileCount++;
+            manifest.totalBytes += entry.size;
+        }
+    }
+    manifest.entries += entries;
+}
+
+void ManifestBuilder::taskDone()
+{
+    if (--runningTasks > 0)
+        return;
+
+    if (manifest.save(fileName))
+        manifest.fileName = fileName;
+
+    QMetaObject::invokeMethod(this, [this] {
+        Q_EMIT finished(manifest);
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,85 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TRANSFERMANIFEST_H
+#define TRANSFERMANIFEST_H
+
+#include <QObject>
+#include <QStringList>
+#include <QVector>
+#include <QMutex>
+#include <QSet>
+
+#include <atomic>
+
+class QThreadPool;
+
+namespace dfmplugin_cooperation {
+
+// what is going to be transferred: every file and directory under the
+// selection with its size, mtime, inode identity and the cached hash of its
+// content, and the totals of them. peers compare size and mtime first, and
+// ask for the hash of a file only when they differ and it's not cached, see
+// TransferHandoff. a file linked several times is counted once in the totals.
+struct TransferManifest
+{
+    struct Entry
+    {
+        QString path;
+        qint64 size { 0 };
+        qint64 mtime { 0 };   // in nanoseconds
+        QByteArray hash;   // of the content of a regular file, empty if not cached
+        quint64 device { 0 };
+        quint64 inode { 0 };
+        bool isDir { false };
+    };
+
+    QStringList roots;
+    QVector<Entry> entries;
+    qint64 fileCount { 0 };
+    qint64 totalBytes { 0 };
+    QString fileName;   // where it's saved, empty if it's not
+
+    bool save(const QString &fileName) const;
+};
+
+// walks the selection with a pool of threads, the directories are scanned
+// as separate tasks. the manifest is saved to fileName by the last task and
+// finished() is emitted in the thread of the builder.
+class ManifestBuilder : public QObject
+{
+    Q_OBJECT
+public:
+    ManifestBuilder(const QStringList &roots, const QString &fileName, QObject *parent = nullptr);
+    ~ManifestBuilder() override;
+
+    // the content hashes are looked up in this directory, they're never
+    // computed while scanning.
+    void setFingerprintDir(const QString &dirPath);
+    void start();
+
+Q_SIGNALS:
+    void finished(const TransferManifest &manifest);
+
+private:
+    friend class ScanTask;
+    void scanDir(const QString &dirPath, const QStringList &names);
+    void startScan(const QString &dirPath, const QStringList &names = {});
+    void addEntries(const QVector<TransferManifest::Entry> &entries);
+    void taskDone();
+
+    QThreadPool *pool { nullptr };
+    QMutex mutex;
+    QSet<QPair<quint64, quint64>> counted;
+    TransferManifest manifest;
+    QString fileName;
+    QString fingerprintDir;
+    std::atomic<int> runningTasks { 0 };
+};
+
+}   // namespace dfmplugin_cooperation
+
+Q_DECLARE_METATYPE(dfmplugin_cooperation::TransferManifest)
+
+#endif   // TRANSFERMANIFEST_H
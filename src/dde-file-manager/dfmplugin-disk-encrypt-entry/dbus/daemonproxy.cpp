@@ -0,0 +1,19 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "daemonproxy.h"
+#include "dfmplugin_disk_encrypt_global.h"
+
+using namespace dfmplugin_diskenc;
+
+DiskEncryptInterface *daemon_proxy::instance()
+{
+    static DiskEncryptInterface *ins = [] {
+        auto iface = new DiskEncryptInterface(kDaemonBusName, kDaemonBusPath,
+                                              QDBusConnection::systemBus());
+        iface->setTimeout(30 * 1000);   // the first cipher benchmark may take seconds.
+        return iface;
+    }();
+    return ins;
+}
@@ -0,0 +1,35 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef DAEMONPROXY_H
+#define DAEMONPROXY_H
+
+#include "diskencryptinterface.h"
+
+#include <QDBusPendingCallWatcher>
+
+namespace dfmplugin_diskenc {
+namespace daemon_proxy {
+
+// the proxy generated from the interface of daemon, shared by the plugin.
+// unlike QDBusInterface it doesn't introspect the service when created.
+// it must be created in gui thread first, see DiskEncryptEntry::start.
+DiskEncryptInterface *instance();
+
+// calls func in gui thread with the finished call.
+template<typename Func>
+void watch(const QDBusPendingCall &call, Func &&func)
+{
+    auto watcher = new QDBusPendingCallWatcher(call, instance());
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, instance(),
+                     [func = std::forward<Func>(func)](QDBusPendingCallWatcher *self) {
+                         func(*self);
+                         self->deleteLater();
+                     });
+}
+
+}   // namespace daemon_proxy
+}   // namespace dfmplugin_diskenc
+
+#endif   // DAEMONPROXY_H
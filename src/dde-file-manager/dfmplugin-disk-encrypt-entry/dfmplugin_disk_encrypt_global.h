@@ -32,6 +32,9 @@ inline constexpr char kMenuPluginName[] { "dfmplugin_menu" };
 inline constexpr char kComputerMenuSceneName[] { "ComputerMenu" };
 
 inline constexpr int kPasswordSize { 14 };
+inline constexpr int kTPMIVSize { 16 };
+// returned by slot_DecryptTokenByTPMPro when the token cannot be decrypted in memory.
+inline constexpr int kTPMNoTokenBackend { -2 };
 inline const QString kGlobalTPMConfigPath("/tmp/dfm-encrypt");
 inline constexpr char kTPMSessionHashAlgo[] { "sha256" };
 inline constexpr char kTPMSessionKeyAlgo[] { "aes" };
@@ -7,20 +7,27 @@
 #include "gui/unlockpartitiondialog.h"
 #include "gui/encryptparamsinputdialog.h"
 #include "utils/encryptutils.h"
+#include "utils/devicestatecache.h"
 #include "menu/diskencryptmenuscene.h"
+#include "dbus/daemonproxy.h"
 
 #include <dfm-framework/dpf.h>
 #include <dfm-base/utils/finallyutil.h>
 
+#include <dfm-mount/dmount.h>
+
 #include <QApplication>
 #include <QtConcurrent/QtConcurrent>
 #include <QSettings>
 #include <QDBusConnection>
 #include <QDBusInterface>
 #include <QDBusPendingCall>
+#include <QTimer>
 
 #include <DDialog>
 
+#include <memory>
+
 Q_DECLARE_METATYPE(QString *)
 Q_DECLARE_METATYPE(bool *)
 
@@ -28,6 +35,9 @@ using namespace dfmplugin_diskenc;
 using namespace disk_encrypt;
 DWIDGET_USE_NAMESPACE;
 
+// udisks derives the key of the given passphrase in seconds.
+static constexpr int kPendingUnlockKeyTimeout { 60 * 1000 };
+
 EventsHandler *EventsHandler::instance()
 {
     static EventsHandler ins;
@@ -58,37 +68,205 @@ void EventsHandler::bindDaemonSignals()
     conn("EncryptProgress", SLOT(onEncryptProgress(const QString &, const QString &, double)));
     conn("DecryptDiskResult", SLOT(onDecryptResult(const QString &, const QString &, const QString &, int)));
     conn("DecryptProgress", SLOT(onDecryptProgress(const QString &, const QString &, double)));
+    conn("EncryptProgressDetail", SLOT(onEncryptProgressDetail(const QString &, const QString &, const QVariantMap &)));
+    conn("DecryptProgressDetail", SLOT(onDecryptProgressDetail(const QString &, const QString &, const QVariantMap &)));
     conn("ChangePassphressResult", SLOT(onChgPassphraseResult(const QString &, const QString &, const QString &, int)));
     conn("RequestEncryptParams", SLOT(onRequestEncryptParams(const QVariantMap &)));
+    conn("RequestResumeJob", SLOT(onRequestResumeJob(const QVariantMap &)));
+    conn("EncryptDisksProgress", SLOT(onEncryptDisksProgress(const QString &, const QVariantMap &)));
+    conn("EncryptDisksResult", SLOT(onEncryptDisksResult(const QString &, const QVariantMap &)));
+
+    watchSessionIdle();
+}
+
+void EventsHandler::watchSessionIdle()
+{
+    // the screensaver is active when user leaves, the session is locked
+    // when user locks screen or by the screensaver.
+    QDBusConnection::sessionBus().connect("org.freedesktop.ScreenSaver",
+                                          "/org/freedesktop/ScreenSaver",
+                                          "org.freedesktop.ScreenSaver",
+                                          "ActiveChanged",
+                                          this,
+                                          SLOT(onScreenSaverActiveChanged(bool)));
+    QDBusConnection::sessionBus().connect("com.deepin.SessionManager",
+                                          "/com/deepin/SessionManager",
+                                          "org.freedesktop.DBus.Properties",
+                                          "PropertiesChanged",
+                                          this,
+                                          SLOT(onSessionPropertiesChanged(const QString &, const QVariantMap &, const QStringList &)));
+}
+
+void EventsHandler::onScreenSaverActiveChanged(bool active)
+{
+    screenSaverActive = active;
+    reportSessionIdle();
+}
+
+void EventsHandler::onSessionPropertiesChanged(const QString &, const QVariantMap &changes, const QStringList &)
+{
+    if (!changes.contains("Locked"))
+        return;
+    sessionLocked = changes.value("Locked").toBool();
+    reportSessionIdle();
+}
+
+void EventsHandler::watchUnlockKeyCache()
+{
+    // purged when the session is locked, by hand or by the screensaver.
+    QDBusConnection::sessionBus().connect("com.deepin.SessionManager",
+                                          "/com/deepin/SessionManager",
+                                          "org.freedesktop.DBus.Properties",
+                                          "PropertiesChanged",
+                                          this,
+                                          SLOT(onSessionLockChanged(const QString &, const QVariantMap &, const QStringList &)));
+
+    using namespace dfmmount;
+    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+    if (!monitor)
+        return;
+    connect(monitor.data(), &DBlockMonitor::propertyChanged,
+            this, [this](const QString &objPath, const QMap<Property, QVariant> &changes) {
+                auto iter = changes.constFind(Property::kEncryptedCleartextDevice);
+                if (iter == changes.cend() || iter.value().toString().length() <= 1)
+                    return;
+                onDeviceUnlocked("/dev/" + objPath.section('/', -1));
+            });
+}
+
+void EventsHandler::onSessionLockChanged(const QString &, const QVariantMap &changes, const QStringList &)
+{
+    if (!changes.value("Locked").toBool())
+        return;
+    pendingUnlockKeys.clear();
+    cachedKeyServed.clear();
+    keyring_utils::dropUnlockKeys();
+}
+
+void EventsHandler::onDeviceUnlocked(const QString &dev)
+{
+    cachedKeyServed.remove(dev);
+    if (!pendingUnlockKeys.contains(dev))
+        return;
+
+    const PendingUnlockKey &pending = pendingUnlockKeys.take(dev);
+    if (config_utils::unlockKeyCacheEnabled())
+        keyring_utils::cacheUnlockKey(pending.uuid, pending.key, config_utils::unlockKeyCacheTimeout());
+}
+
+void EventsHandler::reportSessionIdle()
+{
+    bool idle = screenSaverActive || sessionLocked;
+    qInfo() << "session idle state changed:" << idle;
+    daemon_proxy::instance()->SetSessionIdle(idle);
 }
 
 void EventsHandler::hookEvents()
 {
+    watchUnlockKeyCache();
     dpfHookSequence->follow("dfmplugin_computer", "hook_Device_AcquireDevPwd",
                             this, &EventsHandler::onAcquireDevicePwd);
+    dpfSignalDispatcher->subscribe("dfmplugin_computer", "signal_View_Refreshed",
+                                   this, &EventsHandler::onComputerViewRefreshed);
+}
+
+void EventsHandler::onComputerViewRefreshed()
+{
+    prefetchUnlockMaterial();
+}
+
+void EventsHandler::prefetchUnlockMaterial()
+{
+    if (prefetching)
+        return;
+
+    // only the locked luks devices need to be unlocked.
+    const QStringList &devices = device_utils::lockedLuksDevices().keys();
+    if (devices.isEmpty())
+        return;
+
+    // the key types are queried in gui thread, the tokens are cached by them.
+    prefetching = true;
+    auto types = std::make_shared<QMap<QString, int>>();
+    for (const auto &dev : devices) {
+        device_utils::queryEncKeyType(dev, this, [this, dev, types, count = devices.count()](int type) {
+            types->insert(dev, type);
+            if (types->count() == count)
+                prewarmTPM(*types);
+        });
+    }
 }
 
-bool EventsHandler::hasEnDecryptJob()
+void EventsHandler::prewarmTPM(const QMap<QString, int> &keyTypes)
 {
-    return !(encryptDialogs.isEmpty() && decryptDialogs.isEmpty());
+    QStringList primaryAlgos;
+    for (auto iter = keyTypes.cbegin(); iter != keyTypes.cend(); ++iter) {
+        if (iter.value() != kTPMAndPIN && iter.value() != kTPMOnly)
+            continue;
+        const QVariantMap &token = device_utils::cachedToken(iter.key());
+        const QString &algo = token.value("primary-hash-alg").toString()
+                + "/" + token.value("primary-key-alg").toString();
+        if (!primaryAlgos.contains(algo))
+            primaryAlgos << algo;
+    }
+    if (primaryAlgos.isEmpty()) {
+        prefetching = false;
+        return;
+    }
+
+    auto watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher] {
+        prefetching = false;
+        tpmReady = watcher->result();
+        watcher->deleteLater();
+    });
+    watcher->setFuture(QtConcurrent::run([keyTypes, primaryAlgos] {
+        bool ready = tpm_utils::checkTPM() == 0
+                && !tpm_passphrase_utils::supportedAlgorithms().isEmpty();
+        // the primary keys are made ready, the tpm sessions are bound to a
+        // tpm context and cannot be kept until the unlocking.
+        for (const auto &algo : primaryAlgos) {
+            if (ready)
+                tpm_utils::prewarmTPM(algo.section('/', 0, 0), algo.section('/', 1, 1));
+        }
+        qInfo() << "prefetched unlock material of" << keyTypes << "tpm ready:" << ready;
+        return ready;
+    }));
+}
+
+bool EventsHandler::hasEnDecryptJob(const QString &dev)
+{
+    return encryptDialogs.contains(dev) || decryptDialogs.contains(dev) || batchedDevices.contains(dev);
 }
 
 void EventsHandler::onPreencryptResult(const QString &dev, const QString &devName, const QString &, int code)
 {
     QApplication::restoreOverrideCursor();
+    trace_utils::end(dev, "preencrypt", { { "code", code } });
+    // reported once the batch is finished.
+    if (batchedDevices.contains(dev))
+        return;
 
     if (code != kSuccess) {
+        trace_utils::finish(dev);
         showPreEncryptError(dev, devName, code);
         return;
     }
 
     qInfo() << "reboot is required..." << dev;
+    // the daemon continues the trace after reboot with the saved id.
+    trace_utils::finish(dev);
     showRebootOnPreencrypted(dev, devName);
 }
 
 void EventsHandler::onEncryptResult(const QString &dev, const QString &devName, int code)
 {
+    DeviceStateCache::instance()->invalidate(dev);
     QApplication::restoreOverrideCursor();
+    trace_utils::end(dev, "reencrypt", { { "code", code } });
+    trace_utils::finish(dev);
+    if (batchedDevices.contains(dev))
+        return;
     if (encryptDialogs.contains(dev)) {
         delete encryptDialogs.value(dev);
         encryptDialogs.remove(dev);
@@ -98,6 +276,12 @@ void EventsHandler::onEncryptResult(const QString &dev, const QString &devName,
 
     QString title = tr("Encrypt done");
     QString msg = tr("Device %1 has been encrypted").arg(device);
+    if (code == -kErrorJobPaused) {
+        dialog_utils::showDialog(tr("Encrypt paused"),
+                                 tr("Encryption of device %1 is paused.").arg(device),
+                                 dialog_utils::kInfo);
+        return;
+    }
     if (code != 0) {
         title = tr("Encrypt failed");
         msg = tr("Device %1 encrypt failed, please see log for more information.(%2)")
@@ -110,7 +294,10 @@ void EventsHandler::onEncryptResult(const QString &dev, const QString &devName,
 
 void EventsHandler::onDecryptResult(const QString &dev, const QString &devName, const QString &, int code)
 {
+    DeviceStateCache::instance()->invalidate(dev);
     QApplication::restoreOverrideCursor();
+    trace_utils::end(dev, "decrypt", { { "code", code } });
+    trace_utils::finish(dev);
     if (decryptDialogs.contains(dev)) {
         decryptDialogs.value(dev)->deleteLater();
         decryptDialogs.remove(dev);
@@ -124,6 +311,9 @@ void EventsHandler::onDecryptResult(const QString &dev, const QString &devName,
 
 void EventsHandler::onChgPassphraseResult(const QString &dev, const QString &devName, const QString &, int code)
 {
+    DeviceStateCache::instance()->invalidate(dev);
+    if (code == kSuccess)
+        keyring_utils::dropUnlockKey(device_utils::luksUUID(dev));
     QApplication::restoreOverrideCursor();
     showChgPwdError(dev, devName, code);
 }
@@ -147,10 +337,13 @@ void EventsHandler::onRequestEncryptParams(const QVariantMap &encConfig)
     auto blkDev = device_utils::createBlockDevice(objPath);
     param.backingDevUUID = blkDev ? blkDev->getProperty(dfmmount::Property::kBlockIDUUID).toString() : "";
     param.deviceDisplayName = encConfig.value("device-name").toString();
+    trace_utils::adoptTrace(devPath, encConfig.value("trace-id").toString());
     auto dlg = new EncryptParamsInputDialog(param, qApp->activeWindow());
     encryptInputs.insert(devPath, dlg);
 
+    trace_utils::begin(devPath, "input_params");
     int ret = dlg->exec();
+    trace_utils::end(devPath, "input_params", { { "accepted", ret == QDialog::Accepted } });
     if (ret != QDialog::Accepted) {
         delete encryptInputs.take(devPath);
         return;
@@ -159,41 +352,178 @@ void EventsHandler::onRequestEncryptParams(const QVariantMap &encConfig)
     DiskEncryptMenuScene::doReencryptDevice(param);
 }
 
+void EventsHandler::onRequestResumeJob(const QVariantMap &job)
+{
+    const QString &dev = job.value("device-path").toString();
+    if (dev.isEmpty() || resumeRequests.contains(dev) || declinedResumes.contains(dev))
+        return;
+
+    resumeRequests.insert(dev);
+    dfmbase::FinallyUtil release([this, dev] { resumeRequests.remove(dev); });
+
+    const QString &device = QString("%1(%2)").arg(job.value("device-name").toString()).arg(dev.mid(5));
+    dialog_utils::showDialog(tr("Encrypt interrupted"),
+                             tr("Encryption of device %1 was interrupted, please enter the passphrase to continue.").arg(device),
+                             dialog_utils::kInfo);
+
+    // the tpm token is set after the encryption, the key type comes from the job.
+    bool cancelled = false;
+    QString passphrase;
+    switch (job.value("mode").toInt()) {
+    case kTPMAndPIN:
+        passphrase = acquirePassphraseByPIN(dev, cancelled);
+        break;
+    case kTPMOnly:
+        passphrase = acquirePassphraseByTPM(dev, cancelled);
+        break;
+    default:
+        passphrase = acquirePassphrase(dev, cancelled);
+        break;
+    }
+    if (cancelled) {
+        qInfo() << "user declined to resume the encryption of" << dev;
+        declinedResumes.insert(dev);
+        return;
+    }
+    if (passphrase.isEmpty()) {
+        dialog_utils::showDialog(tr("Error"), tr("Cannot resolve passphrase from TPM"), dialog_utils::kError);
+        return;
+    }
+
+    trace_utils::adoptTrace(dev, job.value("trace-id").toString());
+    QVariantMap params {
+        { encrypt_param_keys::kKeyDevice, dev },
+        { encrypt_param_keys::kKeyPassphrase, passphrase },
+    };
+    daemon_proxy::watch(daemon_proxy::instance()->ResumeInterruptedJob(params),
+                        [dev, device](QDBusPendingReply<int> reply) {
+                            if (reply.isError()) {
+                                qWarning() << "cannot resume encryption:" << reply.error().message();
+                                return;
+                            }
+                            int code = reply.value();
+                            qInfo() << "resume interrupted encryption of" << dev << code;
+                            if (code == -kErrorWrongPassphrase)
+                                dialog_utils::showDialog(tr("Error"), tr("Wrong passphrase"), dialog_utils::kError);
+                            else if (code != 0)
+                                dialog_utils::showDialog(tr("Encrypt failed"),
+                                                         tr("Cannot resume the encryption of device %1.(%2)").arg(device).arg(code),
+                                                         dialog_utils::kError);
+                            else
+                                trace_utils::begin(dev, "reencrypt");
+                        });
+}
+
 void EventsHandler::onEncryptProgress(const QString &dev, const QString &devName, double progress)
 {
-    if (!encryptDialogs.contains(dev)) {
+    if (batchedDevices.contains(dev))
+        return;
+    encryptProgressDialog(dev, devName)->updateProgress(progress);
+}
+
+void EventsHandler::onDecryptProgress(const QString &dev, const QString &devName, double progress)
+{
+    decryptProgressDialog(dev, devName)->updateProgress(progress);
+}
+
+void EventsHandler::onEncryptProgressDetail(const QString &dev, const QString &devName, const QVariantMap &info)
+{
+    if (batchedDevices.contains(dev))
+        return;
+    encryptProgressDialog(dev, devName)->updateDetail(info);
+}
+
+void EventsHandler::onDecryptProgressDetail(const QString &dev, const QString &devName, const QVariantMap &info)
+{
+    decryptProgressDialog(dev, devName)->updateDetail(info);
+}
+
+void EventsHandler::onEncryptDisksProgress(const QString &batchID, const QVariantMap &info)
+{
+    const QVariantList &devices = info.value("devices").toList();
+    auto dlg = batchDialogs.value(batchID);
+    if (!dlg) {
+        QApplication::restoreOverrideCursor();
+        dlg = new EncryptProgressDialog(qApp->activeWindow());
+        dlg->setText(tr("%1 partitions are under encrypting...").arg(devices.count()),
+                     tr("The encrypting process may have system lag, please minimize the system operation"));
+        batchDialogs.insert(batchID, dlg);
+    }
+    for (const auto &dev : devices)
+        batchedDevices.insert(dev.toMap().value("device").toString());
+
+    dlg->updateDetail(info);
+    if (!dlg->isVisible())
+        dlg->show();
+}
+
+void EventsHandler::onEncryptDisksResult(const QString &batchID, const QVariantMap &results)
+{
+    QApplication::restoreOverrideCursor();
+    delete batchDialogs.take(batchID);
+
+    QStringList failed;
+    const QVariantList &devices = results.value("devices").toList();
+    int batchCode = results.value("code", kSuccess).toInt();
+    for (const auto &dev : devices) {
+        const QVariantMap &info = dev.toMap();
+        const QString &device = info.value("device").toString();
+        batchedDevices.remove(device);
+        int code = batchCode != kSuccess ? batchCode : info.value("code").toInt();
+        if (code != kSuccess)
+            failed << QString("%1(%2): %3").arg(info.value("deviceName").toString()).arg(device.mid(5)).arg(code);
+    }
+    if (batchCode == -kUserCancelled)
+        return;
+
+    if (failed.isEmpty()) {
+        dialog_utils::showDialog(tr("Encrypt done"),
+                                 tr("%1 partitions have been encrypted").arg(devices.count()),
+                                 dialog_utils::kInfo);
+        return;
+    }
+    dialog_utils::showDialog(tr("Encrypt failed"),
+                             tr("Some partitions encrypt failed, please see log for more information.\n%1")
+                                     .arg(failed.join("\n")),
+                             dialog_utils::kError);
+}
+
+EncryptProgressDialog *EventsHandler::encryptProgressDialog(const QString &dev, const QString &devName)
+{
+    auto dlg = encryptDialogs.value(dev);
+    if (!dlg) {
         QString device = QString("%1(%2)").arg(devName).arg(dev.mid(5));
 
         QApplication::restoreOverrideCursor();
-        auto dlg = new EncryptProgressDialog(qApp->activeWindow());
+        dlg = new EncryptProgressDialog(qApp->activeWindow());
         dlg->setText(tr("%1 is under encrypting...").arg(device),
                      tr("The encrypting process may have system lag, please minimize the system operation"));
         encryptDialogs.insert(dev, dlg);
-    }
-    auto dlg = encryptDialogs.value(dev);
-    dlg->updateProgress(progress);
-    dlg->show();
 
-    // when start encrypt, delete the inputs widget.
-    if (encryptInputs.contains(dev))
-        delete encryptInputs.take(dev);
+        // when start encrypt, delete the inputs widget.
+        if (encryptInputs.contains(dev))
+            delete encryptInputs.take(dev);
+    }
+    if (!dlg->isVisible())
+        dlg->show();
+    return dlg;
 }
 
-void EventsHandler::onDecryptProgress(const QString &dev, const QString &devName, double progress)
+EncryptProgressDialog *EventsHandler::decryptProgressDialog(const QString &dev, const QString &devName)
 {
-    if (!decryptDialogs.contains(dev)) {
+    auto dlg = decryptDialogs.value(dev);
+    if (!dlg) {
         QString device = QString("%1(%2)").arg(devName).arg(dev.mid(5));
 
         QApplication::restoreOverrideCursor();
-        auto dlg = new EncryptProgressDialog(qApp->activeWindow());
+        dlg = new EncryptProgressDialog(qApp->activeWindow());
         dlg->setText(tr("%1 is under decrypting...").arg(device),
                      tr("The decrypting process may have system lag, please minimize the system operation"));
         decryptDialogs.insert(dev, dlg);
     }
-
-    auto dlg = decryptDialogs.value(dev);
-    dlg->updateProgress(progress);
-    dlg->show();
+    if (!dlg->isVisible())
+        dlg->show();
+    return dlg;
 }
 
 bool EventsHandler::onAcquireDevicePwd(const QString &dev, QString *pwd, bool *cancelled)
@@ -201,11 +531,26 @@ bool EventsHandler::onAcquireDevicePwd(const QString &dev, QString *pwd, bool *c
     if (!pwd || !cancelled)
         return false;
 
-    int type = device_utils::encKeyType(dev);
+    // the key which unlocked the device in this session, it's dropped if
+    // the device is asked again before being unlocked by it.
+    const QString &uuid = config_utils::unlockKeyCacheEnabled() ? device_utils::luksUUID(dev) : QString();
+    if (!uuid.isEmpty()) {
+        if (cachedKeyServed.remove(dev)) {
+            qWarning() << "cached unlock key of" << dev << "doesn't work, ask for another one";
+            keyring_utils::dropUnlockKey(uuid);
+        } else if (!(*pwd = keyring_utils::cachedUnlockKey(uuid)).isEmpty()) {
+            qInfo() << "unlock" << dev << "with the cached key";
+            cachedKeyServed.insert(dev);
+            return true;
+        }
+    }
+    recKeyUsed = false;
+
+    int type = DeviceStateCache::instance()->resolveKeyType(dev);
 
     // test tpm
     bool testTPM = (type == kTPMAndPIN || type == kTPMOnly);
-    if (testTPM && tpm_utils::checkTPM() != 0) {
+    if (testTPM && !tpmReady && tpm_utils::checkTPM() != 0) {
         qWarning() << "TPM service is not available.";
         int ret = dialog_utils::showDialog(tr("Error"), tr("TPM status is abnormal, please use the recovery key to unlock it"),
                                            dialog_utils::DialogType::kError);
@@ -244,6 +589,13 @@ bool EventsHandler::onAcquireDevicePwd(const QString &dev, QString *pwd, bool *c
         *cancelled = true;
     }
 
+    // kept until the device is unlocked, the wrong ones are never cached.
+    if (!uuid.isEmpty() && !pwd->isEmpty() && !recKeyUsed) {
+        pendingUnlockKeys.insert(dev, { uuid, *pwd });
+        QTimer::singleShot(kPendingUnlockKeyTimeout, this, [this, dev] {
+            pendingUnlockKeys.remove(dev);
+        });
+    }
     return true;
 }
 
@@ -269,8 +621,8 @@ QString EventsHandler::acquirePassphraseByPIN(const QString &dev, bool &cancelle
     auto keys = dlg.getUnlockKey();
     if (keys.first == UnlockPartitionDialog::kPin)
         return tpm_passphrase_utils::getPassphraseFromTPM(dev, keys.second);
-    else
-        return keys.second;
+    recKeyUsed = true;
+    return keys.second;
 }
 
 QString EventsHandler::acquirePassphraseByTPM(const QString &dev, bool &)
@@ -286,6 +638,7 @@ QString EventsHandler::acquirePassphraseByRec(const QString &dev, bool &cancelle
         cancelled = true;
         return "";
     }
+    recKeyUsed = true;
     auto keys = dlg.getUnlockKey();
     return keys.second;
 }
@@ -307,6 +660,11 @@ void EventsHandler::showPreEncryptError(const QString &dev, const QString &devNa
         title = tr("Encrypt disk");
         msg = tr("User cancelled operation");
         break;
+    case kErrorEncryptBusy:
+        title = tr("Encrypt disk");
+        msg = tr("Another partition on the same disk is being encrypted or decrypted, please try again later.");
+        showError = true;
+        break;
     default:
         title = tr("Preencrypt failed");
         msg = tr("Device %1 preencrypt failed, please see log for more information.(%2)")
@@ -342,6 +700,15 @@ void EventsHandler::showDecryptError(const QString &dev, const QString &devName,
         title = tr("Decrypt disk");
         msg = tr("Wrong passpharse or PIN");
         break;
+    case kErrorEncryptBusy:
+        title = tr("Decrypt disk");
+        msg = tr("Another partition on the same disk is being encrypted or decrypted, please try again later.");
+        break;
+    case kErrorJobPaused:
+        title = tr("Decrypt paused");
+        msg = tr("Decryption of device %1 is paused.").arg(device);
+        showFailed = false;
+        break;
     default:
         title = tr("Decrypt failed");
         msg = tr("Device %1 Decrypt failed, please see log for more information.(%2)")
@@ -360,7 +727,7 @@ void EventsHandler::showChgPwdError(const QString &dev, const QString &devName,
     QString msg;
     QString device = QString("%1(%2)").arg(devName).arg(dev.mid(5));
 
-    int encType = device_utils::encKeyType(dev);
+    int encType = DeviceStateCache::instance()->resolveKeyType(dev);
     QString codeType;
     switch (encType) {
     case SecKeyType::kPasswordOnly:
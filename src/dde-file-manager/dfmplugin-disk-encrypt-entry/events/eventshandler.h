@@ -6,6 +6,7 @@
 
 #include <QObject>
 #include <QMap>
+#include <QSet>
 
 namespace dfmplugin_diskenc {
 class EncryptProgressDialog;
@@ -17,8 +18,9 @@ public:
     static EventsHandler *instance();
     void bindDaemonSignals();
     void hookEvents();
-    bool hasEnDecryptJob();
+    bool hasEnDecryptJob(const QString &dev);
     bool onAcquireDevicePwd(const QString &dev, QString *pwd, bool *giveup);
+    void prefetchUnlockMaterial();
 
 private Q_SLOTS:
     void onPreencryptResult(const QString &, const QString &, const QString &, int);
@@ -26,8 +28,18 @@ private Q_SLOTS:
     void onEncryptProgress(const QString &, const QString &, double);
     void onDecryptResult(const QString &, const QString &, const QString &, int);
     void onDecryptProgress(const QString &, const QString &, double);
+    void onEncryptProgressDetail(const QString &, const QString &, const QVariantMap &);
+    void onDecryptProgressDetail(const QString &, const QString &, const QVariantMap &);
+    void onEncryptDisksProgress(const QString &batchID, const QVariantMap &info);
+    void onEncryptDisksResult(const QString &batchID, const QVariantMap &results);
     void onChgPassphraseResult(const QString &, const QString &, const QString &, int);
     void onRequestEncryptParams(const QVariantMap &encConfig);
+    void onRequestResumeJob(const QVariantMap &job);
+    void onScreenSaverActiveChanged(bool active);
+    void onSessionPropertiesChanged(const QString &iface, const QVariantMap &changes, const QStringList &invalidated);
+    void onSessionLockChanged(const QString &iface, const QVariantMap &changes, const QStringList &invalidated);
+    void onComputerViewRefreshed();
+    void prewarmTPM(const QMap<QString, int> &keyTypes);
 
     QString acquirePassphrase(const QString &dev, bool &cancelled);
     QString acquirePassphraseByPIN(const QString &dev, bool &cancelled);
@@ -40,7 +52,14 @@ private Q_SLOTS:
     void showRebootOnPreencrypted(const QString &device, const QString &devName);
     void showRebootOnDecrypted(const QString &device, const QString &devName);
 
+    EncryptProgressDialog *encryptProgressDialog(const QString &dev, const QString &devName);
+    EncryptProgressDialog *decryptProgressDialog(const QString &dev, const QString &devName);
+
     void requestReboot();
+    void watchSessionIdle();
+    void reportSessionIdle();
+    void watchUnlockKeyCache();
+    void onDeviceUnlocked(const QString &dev);
 
 private:
     explicit EventsHandler(QObject *parent = nullptr);
@@ -48,6 +67,31 @@ private:
     QMap<QString, EncryptProgressDialog *> encryptDialogs;
     QMap<QString, EncryptProgressDialog *> decryptDialogs;
     QMap<QString, EncryptParamsInputDialog *> encryptInputs;
+    // the partitions in batches are shown in one dialog per batch.
+    QMap<QString, EncryptProgressDialog *> batchDialogs;
+    QSet<QString> batchedDevices;
+    // the interrupted jobs being asked for passphrase, or declined by user.
+    QSet<QString> resumeRequests;
+    QSet<QString> declinedResumes;
+    bool screenSaverActive { false };
+    bool sessionLocked { false };
+
+    // the keys given to unlock devices, they are cached once the devices
+    // are unlocked by them, keyed by device.
+    struct PendingUnlockKey
+    {
+        QString uuid;
+        QString key;
+    };
+    QMap<QString, PendingUnlockKey> pendingUnlockKeys;
+    // the devices given a cached key which are not unlocked by it yet.
+    QSet<QString> cachedKeyServed;
+    // the last key is a recovery key, which is never cached.
+    bool recKeyUsed { false };
+
+    // prefetched when computer view is shown, the key types are kept by DeviceStateCache.
+    bool prefetching { false };
+    bool tpmReady { false };
 signals:
 };
 }
@@ -3,6 +3,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "chgpassphrasedialog.h"
 #include "utils/encryptutils.h"
+#include "utils/devicestatecache.h"
 
 #include <QFormLayout>
 #include <QLabel>
@@ -14,7 +15,7 @@ ChgPassphraseDialog::ChgPassphraseDialog(const QString &device, QWidget *parent)
     : Dtk::Widget::DDialog(parent),
       device(device)
 {
-    int keyType = device_utils::encKeyType(device);
+    int keyType = DeviceStateCache::instance()->resolveKeyType(device);
     encType = tr("passphrase");
     if (keyType == 1)   // PIN
         encType = tr("PIN");
@@ -46,7 +47,7 @@ void ChgPassphraseDialog::initUI()
 {
     setIcon(QIcon::fromTheme("drive-harddisk-root"));
 
-    int keyType = device_utils::encKeyType(device);
+    int keyType = DeviceStateCache::instance()->resolveKeyType(device);
     QString keyTypeStr = tr("passphrase");
     if (keyType == 1)   // PIN
         keyTypeStr = tr("PIN");
@@ -85,7 +86,7 @@ void ChgPassphraseDialog::initUI()
 
 bool ChgPassphraseDialog::validatePasswd()
 {
-    int keyType = device_utils::encKeyType(device);
+    int keyType = DeviceStateCache::instance()->resolveKeyType(device);
     QString keyTypeStr = tr("passphrase");
     if (keyType == 1)   // PIN
         keyTypeStr = tr("PIN");
@@ -18,6 +18,7 @@
 #include <QEventLoop>
 #include <QtConcurrent/QtConcurrent>
 #include <QAbstractButton>
+#include <QCheckBox>
 
 #include <DDialog>
 #include <DPasswordEdit>
@@ -42,6 +43,9 @@ EncryptParamsInputDialog::EncryptParamsInputDialog(const disk_encrypt::DeviceEnc
 {
     initUi();
     initConn();
+
+    // fetch the cipher benchmark of daemon while user is typing.
+    config_utils::queryCipherBenchmark();
 }
 
 DeviceEncryptParam EncryptParamsInputDialog::getInputs()
@@ -57,6 +61,8 @@ DeviceEncryptParam EncryptParamsInputDialog::getInputs()
     params.type = static_cast<SecKeyType>(encType->currentIndex());
     params.key = password;
     params.exportPath = keyExportInput->text();
+    params.cipher = config_utils::cipherType();
+    params.hwOpal = !hwOpalCheck->isHidden() && hwOpalCheck->isChecked();
     return params;
 }
 
@@ -131,7 +137,11 @@ QWidget *EncryptParamsInputDialog::createPasswordPage()
                         tr("Use TPM+PIN to unlock on this computer (recommended)"),
                         tr("Automatic unlocking on this computer by TPM") });
 
-    if (tpm_utils::checkTPM() != 0) {
+    // the algorithms are probed once and cached for generating the passphrase.
+    QString sessionHashAlgo, sessionKeyAlgo, primaryHashAlgo, primaryKeyAlgo, minorHashAlgo, minorKeyAlgo;
+    if (tpm_utils::checkTPM() != 0
+        || !tpm_passphrase_utils::getAlgorithm(&sessionHashAlgo, &sessionKeyAlgo, &primaryHashAlgo,
+                                               &primaryKeyAlgo, &minorHashAlgo, &minorKeyAlgo)) {
         encType->setItemData(kTPMAndPIN, QVariant(0), Qt::UserRole - 1);
         encType->setItemData(kTPMOnly, QVariant(0), Qt::UserRole - 1);
 
@@ -142,6 +152,17 @@ QWidget *EncryptParamsInputDialog::createPasswordPage()
         onEncTypeChanged(kTPMAndPIN);
     }
 
+    // the drive encrypts data itself, only for partitions that are formatted
+    // while encrypting, others are encrypted by software still.
+    hwOpalCheck = new QCheckBox(tr("Use the hardware encryption of drive if the partition is empty"), this);
+    hwOpalCheck->setVisible(false);
+    lay->addRow("", hwOpalCheck);
+    if (!params.initOnly) {
+        device_utils::queryHwOpalSupported(params.devDesc, hwOpalCheck, [this](bool supported) {
+            hwOpalCheck->setVisible(supported);
+        });
+    }
+
     return wid;
 }
 
@@ -18,6 +18,7 @@ class DLineEdit;
 DWIDGET_END_NAMESPACE
 
 class QLabel;
+class QCheckBox;
 class QStackedLayout;
 class QLayout;
 
@@ -54,6 +55,7 @@ private:
     DTK_WIDGET_NAMESPACE::DPasswordEdit *encKeyEdit1 { nullptr };
     DTK_WIDGET_NAMESPACE::DPasswordEdit *encKeyEdit2 { nullptr };
     DTK_WIDGET_NAMESPACE::DFileChooserEdit *keyExportInput { nullptr };
+    QCheckBox *hwOpalCheck { nullptr };
 
     QLabel *keyHint1 { nullptr };
     QLabel *keyHint2 { nullptr };
@@ -7,7 +7,9 @@
 #include <QCoreApplication>
 #include <QVBoxLayout>
 #include <QLabel>
-#include <QTimer>
+#include <QLocale>
+#include <QScreen>
+#include <QGuiApplication>
 
 using namespace dfmplugin_diskenc;
 
@@ -15,6 +17,12 @@ EncryptProgressDialog::EncryptProgressDialog(QWidget *parent)
     : DDialog(parent)
 {
     initUI();
+
+    QScreen *screen = QGuiApplication::primaryScreen();
+    qreal rate = screen ? screen->refreshRate() : 60;
+    refreshTimer.setSingleShot(true);
+    refreshTimer.setInterval(qMax(1, int(1000 / (rate > 0 ? rate : 60))));
+    connect(&refreshTimer, &QTimer::timeout, this, &EncryptProgressDialog::refresh);
 }
 
 void EncryptProgressDialog::setText(const QString &title, const QString &message)
@@ -25,9 +33,62 @@ void EncryptProgressDialog::setText(const QString &title, const QString &message
 
 void EncryptProgressDialog::updateProgress(double progress)
 {
-    this->progress->setValue(progress * 100);
-    if (int(progress) == 1)
+    pendingProgress = progress;
+    requestRefresh();
+}
+
+void EncryptProgressDialog::updateDetail(const QVariantMap &info)
+{
+    // the progress of other phases like fs resizing restarts from 0.
+    const QString &phase = info.value("phase").toString();
+    if (info.contains("progress") && (phase.isEmpty() || phase == "reencrypt"))
+        pendingProgress = info.value("progress").toDouble();
+    bytesPerSec = info.value("bytesPerSec", 0).toDouble();
+    eta = info.value("eta", -1).toLongLong();
+    requestRefresh();
+}
+
+void EncryptProgressDialog::requestRefresh()
+{
+    if (!refreshTimer.isActive())
+        refreshTimer.start();
+}
+
+void EncryptProgressDialog::refresh()
+{
+    if (finished)
+        return;
+
+    int percent = qBound(0, int(pendingProgress * 100), 100);
+    if (percent != shownPercent) {
+        shownPercent = percent;
+        progress->setValue(percent);
+    }
+
+    QString text;
+    if (bytesPerSec > 0) {
+        text = tr("%1/s").arg(QLocale().formattedDataSize(qint64(bytesPerSec)));
+        if (eta >= 0)
+            text += "  " + tr("about %1 remaining").arg(formatEta(eta));
+    }
+    if (text != detail->text()) {
+        detail->setText(text);
+        detail->setVisible(!text.isEmpty());
+    }
+
+    if (int(pendingProgress) == 1) {
+        finished = true;
         QTimer::singleShot(500, this, [this] { this->close(); });
+    }
+}
+
+QString EncryptProgressDialog::formatEta(qint64 secs)
+{
+    if (secs < 60)
+        return tr("%1 s").arg(secs);
+    if (secs < 3600)
+        return tr("%1 min").arg((secs + 59) / 60);
+    return tr("%1 h %2 min").arg(secs / 3600).arg((secs % 3600) / 60);
 }
 
 void EncryptProgressDialog::initUI()
@@ -52,5 +113,9 @@ void EncryptProgressDialog::initUI()
     message = new QLabel(this);
     lay->addWidget(message, 0, Qt::AlignCenter);
 
+    detail = new QLabel(this);
+    detail->setVisible(false);
+    lay->addWidget(detail, 0, Qt::AlignCenter);
+
     setCloseButtonVisible(false);
 }
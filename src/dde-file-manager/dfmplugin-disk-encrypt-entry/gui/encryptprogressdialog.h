@@ -8,6 +8,8 @@
 #include <DDialog>
 #include <DWaterProgress>
 
+#include <QTimer>
+
 DWIDGET_USE_NAMESPACE
 
 namespace dfmplugin_diskenc {
@@ -19,13 +21,29 @@ public:
     explicit EncryptProgressDialog(QWidget *parent = nullptr);
     void setText(const QString &title, const QString &message);
     void updateProgress(double progress);
+    void updateDetail(const QVariantMap &info);
 
 protected:
     void initUI();
 
+private:
+    void requestRefresh();
+    void refresh();
+    static QString formatEta(qint64 secs);
+
 private:
     DWaterProgress *progress { nullptr };
     QLabel *message { nullptr };
+    QLabel *detail { nullptr };
+
+    // the daemon may report much faster than the screen refreshes, updates
+    // are kept here and applied at most once a frame.
+    QTimer refreshTimer;
+    double pendingProgress { 0 };
+    double bytesPerSec { 0 };
+    qint64 eta { -1 };
+    int shownPercent { -1 };
+    bool finished { false };
 };
 }
 
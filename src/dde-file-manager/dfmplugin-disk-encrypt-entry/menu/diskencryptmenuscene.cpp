@@ -9,6 +9,8 @@
 #include "gui/chgpassphrasedialog.h"
 #include "events/eventshandler.h"
 #include "utils/encryptutils.h"
+#include "utils/devicestatecache.h"
+#include "dbus/daemonproxy.h"
 
 #include <dfm-base/dfm_menu_defines.h>
 #include <dfm-base/base/schemefactory.h>
@@ -21,8 +23,6 @@
 #include <QProcess>
 #include <QFile>
 #include <QStringList>
-#include <QDBusInterface>
-#include <QDBusReply>
 #include <QApplication>
 
 #include <ddialog.h>
@@ -30,12 +30,16 @@
 
 #include <fstab.h>
 
+#include <memory>
+
 DFMBASE_USE_NAMESPACE
 using namespace dfmplugin_diskenc;
 using namespace disk_encrypt;
 
 static constexpr char kActIDEncrypt[] { "de_0_encrypt" };
+static constexpr char kActIDEncryptBatch[] { "de_0_encryptBatch" };
 static constexpr char kActIDUnlock[] { "de_0_unlock" };
+static constexpr char kActIDUnlockAll[] { "de_0_unlockAll" };
 static constexpr char kActIDDecrypt[] { "de_1_decrypt" };
 static constexpr char kActIDChangePwd[] { "de_2_changePwd" };
 
@@ -59,6 +63,8 @@ bool DiskEncryptMenuScene::initialize(const QVariantHash &params)
     QList<QUrl> selectedItems = params.value(MenuParamKey::kSelectFiles).value<QList<QUrl>>();
     if (selectedItems.isEmpty())
         return false;
+    if (selectedItems.count() > 1)
+        return initializeBatch(selectedItems);
 
     auto selectedItem = selectedItems.first();
     if (!selectedItem.path().endsWith("blockdev"))
@@ -67,7 +73,14 @@ bool DiskEncryptMenuScene::initialize(const QVariantHash &params)
     QSharedPointer<FileInfo> info = InfoFactory::create<FileInfo>(selectedItem);
     if (!info)
         return false;
-    info->refresh();
+
+    // the url of block entry is named by the udisks object, like sda1.blockdev.
+    QString cacheKey = selectedItem.path().section('/', -1);
+    cacheKey = "/dev/" + cacheKey.left(cacheKey.lastIndexOf('.'));
+    if (!DeviceStateCache::instance()->isFresh(cacheKey)) {
+        info->refresh();
+        DeviceStateCache::instance()->setFresh(cacheKey);
+    }
 
     selectedItemInfo = info->extraProperties();
     auto device = selectedItemInfo.value("Device", "").toString();
@@ -109,15 +122,88 @@ bool DiskEncryptMenuScene::initialize(const QVariantHash &params)
     param.backingDevUUID = param.uuid;
     param.clearDevUUID = selectedItemInfo.value("ClearBlockDeviceInfo").toHash().value("IdUUID", "").toString();
 
-    if (itemEncrypted)
-        param.type = static_cast<SecKeyType>(device_utils::encKeyType(device));
+    // an in-use fstab partition is encrypted online instead of at next boot.
+    if (!itemEncrypted && param.initOnly && selectionMounted && config_utils::detachedHeaderEnabled()) {
+        param.initOnly = false;
+        param.detachedHeader = true;
+    }
+
+    // the cipher is chosen by the benchmark if the device is encrypted then.
+    if (!itemEncrypted)
+        config_utils::queryCipherBenchmark();
+
+    // the key type is resolved by prefetching or later, the actions are
+    // updated when it's resolved after the menu is shown.
+    if (itemEncrypted) {
+        int type = DeviceStateCache::instance()->keyType(device);
+        keyTypeResolved = type >= 0;
+        if (keyTypeResolved) {
+            param.type = static_cast<SecKeyType>(type);
+        } else {
+            connect(DeviceStateCache::instance(), &DeviceStateCache::keyTypeChanged,
+                    this, &DiskEncryptMenuScene::onKeyTypeResolved);
+            DeviceStateCache::instance()->queryKeyType(device);
+        }
+    }
 
     return true;
 }
 
+bool DiskEncryptMenuScene::initializeBatch(const QList<QUrl> &selectedItems)
+{
+    const QStringList &supportedFS { "ext4", "ext3", "ext2" };
+    for (const auto &item : selectedItems) {
+        if (!item.path().endsWith("blockdev"))
+            continue;
+        QSharedPointer<FileInfo> info = InfoFactory::create<FileInfo>(item);
+        if (!info)
+            continue;
+
+        QString cacheKey = item.path().section('/', -1);
+        cacheKey = "/dev/" + cacheKey.left(cacheKey.lastIndexOf('.'));
+        if (!DeviceStateCache::instance()->isFresh(cacheKey)) {
+            info->refresh();
+            DeviceStateCache::instance()->setFresh(cacheKey);
+        }
+
+        // encrypted partitions, mapper devices and the ones in fstab are
+        // handled one by one.
+        const QVariantHash &props = info->extraProperties();
+        const QString &device = props.value("Device").toString();
+        const QString &devMpt = props.value("MountPoint").toString();
+        if (device.isEmpty() || device.startsWith("/dev/dm-")
+            || props.value("PreferredDevice").toString().startsWith("/dev/mapper/")
+            || !supportedFS.contains(props.value("IdType").toString())
+            || kDisabledEncryptPath.contains(devMpt, Qt::CaseInsensitive)
+            || fstab_utils::isFstabItem(devMpt)
+            || EventsHandler::instance()->hasEnDecryptJob(device))
+            continue;
+
+        DeviceEncryptParam p;
+        p.devDesc = device;
+        p.initOnly = false;
+        p.validateByRecKey = false;
+        p.mountPoint = devMpt;
+        p.uuid = props.value("IdUUID").toString();
+        p.deviceDisplayName = info->displayOf(dfmbase::FileInfo::kFileDisplayName);
+        p.type = SecKeyType::kPasswordOnly;
+        p.backingDevUUID = p.uuid;
+        batchParams.append(p);
+        batchObjPaths.append(props.value("Id").toString());
+    }
+    return batchParams.count() > 1;
+}
+
 bool DiskEncryptMenuScene::create(QMenu *)
 {
-    bool hasJob = EventsHandler::instance()->hasEnDecryptJob();
+    if (!batchParams.isEmpty()) {
+        QAction *act = new QAction(tr("Enable encryption of %1 partitions").arg(batchParams.count()));
+        act->setProperty(ActionPropertyKey::kActionID, kActIDEncryptBatch);
+        actions.insert(kActIDEncryptBatch, act);
+        return true;
+    }
+
+    bool hasJob = EventsHandler::instance()->hasEnDecryptJob(param.devDesc);
     if (itemEncrypted) {
         QAction *act = nullptr;
 
@@ -125,19 +211,22 @@ bool DiskEncryptMenuScene::create(QMenu *)
         act->setProperty(ActionPropertyKey::kActionID, kActIDUnlock);
         actions.insert(kActIDUnlock, act);
 
+        lockedDevices = device_utils::lockedLuksDevices();
+        if (lockedDevices.contains(param.devDesc) && lockedDevices.count() > 1) {
+            act = new QAction(tr("Unlock all encrypted partitions"));
+            act->setProperty(ActionPropertyKey::kActionID, kActIDUnlockAll);
+            actions.insert(kActIDUnlockAll, act);
+        }
+
         act = new QAction(tr("Cancel partition encryption"));
         act->setProperty(ActionPropertyKey::kActionID, kActIDDecrypt);
         actions.insert(kActIDDecrypt, act);
         act->setEnabled(!hasJob);
 
-        if (param.type == kTPMOnly)
+        if (keyTypeResolved && param.type == kTPMOnly)
             return true;
 
-        QString keyType = tr("passphrase");
-        if (param.type == kTPMAndPIN)
-            keyType = "PIN";
-
-        act = new QAction(tr("Changing the encryption %1").arg(keyType));
+        act = new QAction(changePwdText(param.type));
         act->setProperty(ActionPropertyKey::kActionID, kActIDChangePwd);
         actions.insert(kActIDChangePwd, act);
     } else {
@@ -153,15 +242,51 @@ bool DiskEncryptMenuScene::create(QMenu *)
 bool DiskEncryptMenuScene::triggered(QAction *action)
 {
     QString actID = action->property(ActionPropertyKey::kActionID).toString();
+    if (actID == kActIDEncryptBatch) {
+        // unmount them one by one, then ask for the key shared by all of them.
+        auto params = batchParams;
+        auto objPaths = batchObjPaths;
+        auto next = std::make_shared<std::function<void(int)>>();
+        std::weak_ptr<std::function<void(int)>> weakNext = next;
+        *next = [params, objPaths, weakNext](int i) {
+            auto self = weakNext.lock();
+            if (!self)
+                return;
+            if (i == params.count()) {
+                encryptDevices(params, objPaths);
+                return;
+            }
+            unmountDevice(objPaths.at(i), params.at(i),
+                          [self, i](const DeviceEncryptParam &) { (*self)(i + 1); });
+        };
+        (*next)(0);
+        return true;
+    }
+
+    // the query is not finished, it's acceptable to wait after user clicked.
+    if (itemEncrypted && !keyTypeResolved) {
+        int type = DeviceStateCache::instance()->resolveKeyType(param.devDesc);
+        param.type = static_cast<SecKeyType>(type);
+        keyTypeResolved = true;
+        if (actID == kActIDChangePwd && param.type == kTPMOnly)
+            return true;
+    }
 
-    if (actID == kActIDEncrypt)
-        param.initOnly ? doEncryptDevice(param) : unmountBefore(encryptDevice);
+    if (actID == kActIDEncrypt) {
+        trace_utils::begin(param.devDesc, "unmount");
+        if (param.initOnly)
+            doEncryptDevice(param);
+        else
+            param.detachedHeader ? encryptDevice(param) : unmountBefore(encryptDevice);
+    }
     else if (actID == kActIDDecrypt)
-        param.initOnly ? doDecryptDevice(param) : unmountBefore(deencryptDevice);
+        param.initOnly ? deencryptDevice(param) : unmountBefore(deencryptDevice);
     else if (actID == kActIDChangePwd)
         changePassphrase(param);
     else if (actID == kActIDUnlock)
         unlockDevice(selectedItemInfo.value("Id").toString());
+    else if (actID == kActIDUnlockAll)
+        unlockDevices(param.devDesc, lockedDevices);
     else
         return false;
     return true;
@@ -195,16 +320,64 @@ void DiskEncryptMenuScene::updateState(QMenu *parent)
     });
 }
 
+QString DiskEncryptMenuScene::changePwdText(int type)
+{
+    QString keyType = tr("passphrase");
+    if (type == kTPMAndPIN)
+        keyType = "PIN";
+    return tr("Changing the encryption %1").arg(keyType);
+}
+
+void DiskEncryptMenuScene::onKeyTypeResolved(const QString &dev, int type)
+{
+    if (dev != param.devDesc || keyTypeResolved)
+        return;
+
+    keyTypeResolved = true;
+    param.type = static_cast<SecKeyType>(type);
+    QAction *act = actions.value(kActIDChangePwd);
+    if (!act)
+        return;
+    act->setText(changePwdText(type));
+    act->setVisible(type != kTPMOnly);
+}
+
 void DiskEncryptMenuScene::encryptDevice(const DeviceEncryptParam &param)
 {
+    trace_utils::end(param.devDesc, "unmount");
+    trace_utils::begin(param.devDesc, "input_params");
     EncryptParamsInputDialog dlg(param, qApp->activeWindow());
     int ret = dlg.exec();
+    trace_utils::end(param.devDesc, "input_params", { { "accepted", ret == QDialog::Accepted } });
     if (ret == QDialog::Accepted) {
         auto inputs = dlg.getInputs();
         doEncryptDevice(inputs);
+    } else {
+        trace_utils::finish(param.devDesc);
     }
 }
 
+void DiskEncryptMenuScene::encryptDevices(const QList<DeviceEncryptParam> &params, const QStringList &objPaths)
+{
+    Q_ASSERT(!params.isEmpty() && params.count() == objPaths.count());
+    EncryptParamsInputDialog dlg(params.first(), qApp->activeWindow());
+    if (dlg.exec() != QDialog::Accepted)
+        return;
+
+    // the key and the options of dialog apply to all of the partitions.
+    const auto &inputs = dlg.getInputs();
+    QList<DeviceEncryptParam> batch;
+    for (auto p : params) {
+        p.type = inputs.type;
+        p.key = inputs.key;
+        p.exportPath = inputs.exportPath;
+        p.cipher = inputs.cipher;
+        p.hwOpal = false;
+        batch.append(p);
+    }
+    doEncryptDevices(batch);
+}
+
 void DiskEncryptMenuScene::deencryptDevice(const DeviceEncryptParam &param)
 {
     auto inputs = param;
@@ -301,29 +474,70 @@ void DiskEncryptMenuScene::doEncryptDevice(const DeviceEncryptParam &param)
         tpmToken = generateTPMToken(param.devDesc, param.type == kTPMAndPIN);
     }
 
-    QDBusInterface iface(kDaemonBusName,
-                         kDaemonBusPath,
-                         kDaemonBusIface,
-                         QDBusConnection::systemBus());
-    if (iface.isValid()) {
-        QVariantMap params {
-            { encrypt_param_keys::kKeyDevice, param.devDesc },
-            { encrypt_param_keys::kKeyUUID, param.uuid },
-            { encrypt_param_keys::kKeyCipher, config_utils::cipherType() },
-            { encrypt_param_keys::kKeyPassphrase, param.key },
-            { encrypt_param_keys::kKeyInitParamsOnly, param.initOnly },
-            { encrypt_param_keys::kKeyRecoveryExportPath, param.exportPath },
-            { encrypt_param_keys::kKeyEncMode, static_cast<int>(param.type) },
-            { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName },
-            { encrypt_param_keys::kKeyMountPoint, param.mountPoint }
-        };
-        if (!tpmConfig.isEmpty()) params.insert(encrypt_param_keys::kKeyTPMConfig, tpmConfig);
-        if (!tpmToken.isEmpty()) params.insert(encrypt_param_keys::kKeyTPMToken, tpmToken);
+    const QVariantMap &params = encryptParamsOf(param, tpmConfig, tpmToken);
+    const QString dev = param.devDesc;
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    trace_utils::begin(dev, "PrepareEncryptDisk");
+    daemon_proxy::watch(daemon_proxy::instance()->PrepareEncryptDisk(params),
+                        [dev](QDBusPendingReply<QString> reply) {
+                            trace_utils::end(dev, "PrepareEncryptDisk", { { "job", reply.isError() ? QString() : reply.value() } });
+                            if (reply.isError()) {
+                                qWarning() << "cannot preencrypt device:" << reply.error().message();
+                                QApplication::restoreOverrideCursor();
+                                trace_utils::finish(dev);
+                                return;
+                            }
+                            trace_utils::begin(dev, "preencrypt");
+                            qDebug() << "preencrypt device jobid:" << reply.value();
+                        });
+}
 
-        QDBusReply<QString> reply = iface.call("PrepareEncryptDisk", params);
-        qDebug() << "preencrypt device jobid:" << reply.value();
-        QApplication::setOverrideCursor(Qt::WaitCursor);
+void DiskEncryptMenuScene::doEncryptDevices(const QList<DeviceEncryptParam> &params)
+{
+    // the partitions share one key, so they share the tpm token of it too.
+    const auto &first = params.first();
+    QString tpmConfig, tpmToken;
+    if (first.type != kPasswordOnly) {
+        tpmConfig = generateTPMConfig();
+        tpmToken = generateTPMToken(first.devDesc, first.type == kTPMAndPIN);
     }
+
+    QVariantList paramsList;
+    for (const auto &p : params)
+        paramsList.append(encryptParamsOf(p, tpmConfig, tpmToken));
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    daemon_proxy::watch(daemon_proxy::instance()->EncryptDisks(paramsList),
+                        [](QDBusPendingReply<QString> reply) {
+                            if (reply.isError()) {
+                                qWarning() << "cannot encrypt devices:" << reply.error().message();
+                                QApplication::restoreOverrideCursor();
+                                return;
+                            }
+                            qDebug() << "encrypt devices batch:" << reply.value();
+                        });
+}
+
+QVariantMap DiskEncryptMenuScene::encryptParamsOf(const DeviceEncryptParam &param,
+                                                  const QString &tpmConfig, const QString &tpmToken)
+{
+    QVariantMap params {
+        { encrypt_param_keys::kKeyDevice, param.devDesc },
+        { encrypt_param_keys::kKeyUUID, param.uuid },
+        { encrypt_param_keys::kKeyCipher, param.cipher.isEmpty() ? config_utils::cipherType() : param.cipher },
+        { encrypt_param_keys::kKeyPassphrase, param.key },
+        { encrypt_param_keys::kKeyInitParamsOnly, param.initOnly },
+        { encrypt_param_keys::kKeyRecoveryExportPath, param.exportPath },
+        { encrypt_param_keys::kKeyEncMode, static_cast<int>(param.type) },
+        { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName },
+        { encrypt_param_keys::kKeyMountPoint, param.mountPoint },
+        { encrypt_param_keys::kKeyHwOpal, param.hwOpal },
+        { encrypt_param_keys::kKeyDetachedHeader, param.detachedHeader },
+        { encrypt_param_keys::kKeyTraceID, trace_utils::traceID(param.devDesc) }
+    };
+    if (!tpmConfig.isEmpty()) params.insert(encrypt_param_keys::kKeyTPMConfig, tpmConfig);
+    if (!tpmToken.isEmpty()) params.insert(encrypt_param_keys::kKeyTPMToken, tpmToken);
+    return params;
 }
 
 void DiskEncryptMenuScene::doReencryptDevice(const DeviceEncryptParam &param)
@@ -335,52 +549,68 @@ void DiskEncryptMenuScene::doReencryptDevice(const DeviceEncryptParam &param)
         tpmToken = generateTPMToken(param.devDesc, param.type == kTPMAndPIN);
     }
 
-    QDBusInterface iface(kDaemonBusName,
-                         kDaemonBusPath,
-                         kDaemonBusIface,
-                         QDBusConnection::systemBus());
-    if (iface.isValid()) {
-        QVariantMap params {
-            { encrypt_param_keys::kKeyDevice, param.devDesc },
-            { encrypt_param_keys::kKeyUUID, param.uuid },
-            { encrypt_param_keys::kKeyCipher, config_utils::cipherType() },
-            { encrypt_param_keys::kKeyPassphrase, param.key },
-            { encrypt_param_keys::kKeyInitParamsOnly, param.initOnly },
-            { encrypt_param_keys::kKeyRecoveryExportPath, param.exportPath },
-            { encrypt_param_keys::kKeyEncMode, static_cast<int>(param.type) },
-            { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName },
-            { encrypt_param_keys::kKeyMountPoint, param.mountPoint },
-            { encrypt_param_keys::kKeyBackingDevUUID, param.backingDevUUID },
-            { encrypt_param_keys::kKeyClearDevUUID, param.clearDevUUID }
-        };
-        if (!tpmConfig.isEmpty()) params.insert(encrypt_param_keys::kKeyTPMConfig, tpmConfig);
-        if (!tpmToken.isEmpty()) params.insert(encrypt_param_keys::kKeyTPMToken, tpmToken);
-
-        QDBusReply<void> reply = iface.call("SetEncryptParams", params);
-        qDebug() << "start reencrypt device";
-        QApplication::setOverrideCursor(Qt::WaitCursor);
-    }
+    QVariantMap params {
+        { encrypt_param_keys::kKeyDevice, param.devDesc },
+        { encrypt_param_keys::kKeyUUID, param.uuid },
+        { encrypt_param_keys::kKeyCipher, param.cipher.isEmpty() ? config_utils::cipherType() : param.cipher },
+        { encrypt_param_keys::kKeyPassphrase, param.key },
+        { encrypt_param_keys::kKeyInitParamsOnly, param.initOnly },
+        { encrypt_param_keys::kKeyRecoveryExportPath, param.exportPath },
+        { encrypt_param_keys::kKeyEncMode, static_cast<int>(param.type) },
+        { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName },
+        { encrypt_param_keys::kKeyMountPoint, param.mountPoint },
+        { encrypt_param_keys::kKeyBackingDevUUID, param.backingDevUUID },
+        { encrypt_param_keys::kKeyClearDevUUID, param.clearDevUUID },
+        { encrypt_param_keys::kKeyTraceID, trace_utils::traceID(param.devDesc) }
+    };
+    if (!tpmConfig.isEmpty()) params.insert(encrypt_param_keys::kKeyTPMConfig, tpmConfig);
+    if (!tpmToken.isEmpty()) params.insert(encrypt_param_keys::kKeyTPMToken, tpmToken);
+
+    const QString dev = param.devDesc;
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    daemon_proxy::watch(daemon_proxy::instance()->SetEncryptParams(params),
+                        [dev](QDBusPendingReply<> reply) {
+                            if (reply.isError()) {
+                                qWarning() << "cannot reencrypt device:" << reply.error().message();
+                                QApplication::restoreOverrideCursor();
+                                trace_utils::finish(dev);
+                                return;
+                            }
+                            trace_utils::begin(dev, "reencrypt");
+                            qDebug() << "start reencrypt device";
+                        });
 }
 
 void DiskEncryptMenuScene::doDecryptDevice(const DeviceEncryptParam &param)
 {
     // if tpm selected, use tpm to generate the key
-    QDBusInterface iface(kDaemonBusName,
-                         kDaemonBusPath,
-                         kDaemonBusIface,
-                         QDBusConnection::systemBus());
-    if (iface.isValid()) {
-        QVariantMap params {
-            { encrypt_param_keys::kKeyDevice, param.devDesc },
-            { encrypt_param_keys::kKeyPassphrase, param.key },
-            { encrypt_param_keys::kKeyInitParamsOnly, param.initOnly },
-            { encrypt_param_keys::kKeyUUID, param.uuid },
-            { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName }
-        };
-        QDBusReply<QString> reply = iface.call("DecryptDisk", params);
-        qDebug() << "preencrypt device jobid:" << reply.value();
-        QApplication::setOverrideCursor(Qt::WaitCursor);
-    }
+    QVariantMap params {
+        { encrypt_param_keys::kKeyDevice, param.devDesc },
+        { encrypt_param_keys::kKeyPassphrase, param.key },
+        { encrypt_param_keys::kKeyInitParamsOnly, param.initOnly },
+        // the daemon unmounts the fstab device and decrypts it in place,
+        // it asks for a reboot only if the device is busy.
+        { encrypt_param_keys::kKeyOnlineDecrypt, param.initOnly && !param.key.isEmpty() },
+        { encrypt_param_keys::kKeyMountPoint, param.mountPoint },
+        { encrypt_param_keys::kKeyUUID, param.uuid },
+        { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName },
+        { encrypt_param_keys::kKeyTraceID, trace_utils::traceID(param.devDesc) }
+    };
+    const QString dev = param.devDesc;
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    trace_utils::begin(dev, "DecryptDisk");
+    daemon_proxy::watch(daemon_proxy::instance()->DecryptDisk(params),
+                        [dev](QDBusPendingReply<QString> reply) {
+                            trace_utils::end(dev, "DecryptDisk", { { "job", reply.isError() ? QString() : reply.value() } });
+                            if (reply.isError()) {
+                                qWarning() << "cannot decrypt device:" << reply.error().message();
+                                QApplication::restoreOverrideCursor();
+                                trace_utils::finish(dev);
+                                return;
+                            }
+                            trace_utils::begin(dev, "decrypt");
+                            qDebug() << "decrypt device jobid:" << reply.value();
+                        });
 }
 
 void DiskEncryptMenuScene::doChangePassphrase(const DeviceEncryptParam &param)
@@ -388,14 +618,16 @@ void DiskEncryptMenuScene::doChangePassphrase(const DeviceEncryptParam &param)
     QString token;
     if (param.type != SecKeyType::kPasswordOnly) {
         // new tpm token should be setted.
-        QFile f(kGlobalTPMConfigPath + param.devDesc + "/token.json");
-        if (!f.open(QIODevice::ReadOnly)) {
-            qWarning() << "cannot read old tpm token!!!";
-            return;
+        QJsonObject oldTokenObj = QJsonObject::fromVariantMap(device_utils::cachedToken(param.devDesc));
+        if (oldTokenObj.isEmpty()) {
+            QFile f(kGlobalTPMConfigPath + param.devDesc + "/token.json");
+            if (!f.open(QIODevice::ReadOnly)) {
+                qWarning() << "cannot read old tpm token!!!";
+                return;
+            }
+            oldTokenObj = QJsonDocument::fromJson(f.readAll()).object();
+            f.close();
         }
-        QJsonDocument oldTokenDoc = QJsonDocument::fromJson(f.readAll());
-        f.close();
-        QJsonObject oldTokenObj = oldTokenDoc.object();
 
         QString newToken = generateTPMToken(param.devDesc, param.type == SecKeyType::kTPMAndPIN);
         QJsonDocument newTokenDoc = QJsonDocument::fromJson(newToken.toLocal8Bit());
@@ -409,23 +641,24 @@ void DiskEncryptMenuScene::doChangePassphrase(const DeviceEncryptParam &param)
         token = newTokenDoc.toJson(QJsonDocument::Compact);
     }
 
-    QDBusInterface iface(kDaemonBusName,
-                         kDaemonBusPath,
-                         kDaemonBusIface,
-                         QDBusConnection::systemBus());
-    if (iface.isValid()) {
-        QVariantMap params {
-            { encrypt_param_keys::kKeyDevice, param.devDesc },
-            { encrypt_param_keys::kKeyPassphrase, param.newKey },
-            { encrypt_param_keys::kKeyOldPassphrase, param.key },
-            { encrypt_param_keys::kKeyValidateWithRecKey, param.validateByRecKey },
-            { encrypt_param_keys::kKeyTPMToken, token },
-            { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName }
-        };
-        QDBusReply<QString> reply = iface.call("ChangeEncryptPassphress", params);
-        qDebug() << "modify device passphrase jobid:" << reply.value();
-        QApplication::setOverrideCursor(Qt::WaitCursor);
-    }
+    QVariantMap params {
+        { encrypt_param_keys::kKeyDevice, param.devDesc },
+        { encrypt_param_keys::kKeyPassphrase, param.newKey },
+        { encrypt_param_keys::kKeyOldPassphrase, param.key },
+        { encrypt_param_keys::kKeyValidateWithRecKey, param.validateByRecKey },
+        { encrypt_param_keys::kKeyTPMToken, token },
+        { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName }
+    };
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    daemon_proxy::watch(daemon_proxy::instance()->ChangeEncryptPassphress(params),
+                        [](QDBusPendingReply<QString> reply) {
+                            if (reply.isError()) {
+                                qWarning() << "cannot modify device passphrase:" << reply.error().message();
+                                QApplication::restoreOverrideCursor();
+                                return;
+                            }
+                            qDebug() << "modify device passphrase jobid:" << reply.value();
+                        });
 }
 
 QString DiskEncryptMenuScene::generateTPMConfig()
@@ -493,6 +726,97 @@ QString DiskEncryptMenuScene::getBase64Of(const QString &fileName)
     return QString(contents.toBase64());
 }
 
+void DiskEncryptMenuScene::unlockDevices(const QString &dev, const QMap<QString, QString> &lockedDevices)
+{
+    // the credential is asked once for the selected device.
+    QString pwd;
+    bool cancel { false };
+    bool ok = EventsHandler::instance()->onAcquireDevicePwd(dev, &pwd, &cancel);
+    if (cancel || (pwd.isEmpty() && ok)) {
+        qWarning() << "acquire pwd faield!!!";
+        return;
+    }
+
+    // the devices with the same kind of key are tried with it, the ones
+    // protected by tpm must have the same sealed passphrase.
+    int type = DeviceStateCache::instance()->keyType(dev);
+    QMap<QString, QString> targets;
+    for (auto iter = lockedDevices.cbegin(); iter != lockedDevices.cend(); ++iter) {
+        if (iter.key() == dev) {
+            targets.insert(iter.key(), iter.value());
+            continue;
+        }
+        int otherType = DeviceStateCache::instance()->resolveKeyType(iter.key());
+        if (otherType != type)
+            continue;
+        if (type != kPasswordOnly && !device_utils::isSameTPMToken(dev, iter.key()))
+            continue;
+        targets.insert(iter.key(), iter.value());
+    }
+
+    // udisks derives the keys of the requests in its own job threads, so
+    // all of them are sent at once and the devices are mounted as soon as
+    // each one is unlocked.
+    struct Summary
+    {
+        int pending { 0 };
+        QStringList failed;
+        QStringList mounted;
+    };
+    auto summary = std::make_shared<Summary>();
+    summary->pending = targets.count();
+    auto finish = [summary](const QString &device, const QString &error) {
+        if (error.isEmpty())
+            summary->mounted << device;
+        else
+            summary->failed << QString("%1: %2").arg(device, error);
+        if (--summary->pending > 0)
+            return;
+
+        QApplication::restoreOverrideCursor();
+        qInfo() << "unlock all finished, mounted:" << summary->mounted << "failed:" << summary->failed;
+        if (summary->failed.isEmpty()) {
+            dialog_utils::showDialog(tr("Unlock done"),
+                                     tr("%1 partitions have been unlocked").arg(summary->mounted.count()),
+                                     dialog_utils::kInfo);
+            return;
+        }
+        dialog_utils::showDialog(tr("Unlock device failed"),
+                                 tr("%1 partitions have been unlocked, failed ones:\n%2")
+                                         .arg(summary->mounted.count())
+                                         .arg(summary->failed.join("\n")),
+                                 dialog_utils::kError);
+    };
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    for (auto iter = targets.cbegin(); iter != targets.cend(); ++iter) {
+        const QString device = iter.key();
+        auto blkDev = device_utils::createBlockDevice(iter.value());
+        if (!blkDev) {
+            finish(device, tr("device is not found"));
+            continue;
+        }
+
+        blkDev->unlockAsync(pwd, {}, [device, finish](bool ok, dfmmount::OperationErrorInfo info, QString clearDev) {
+            if (!ok) {
+                qWarning() << "unlock device failed!" << device << info.message;
+                finish(device, tr("Wrong passphrase"));
+                return;
+            }
+            auto clearBlk = device_utils::createBlockDevice(clearDev);
+            if (!clearBlk) {
+                finish(device, "");
+                return;
+            }
+            clearBlk->mountAsync({}, [device, finish](bool ok, dfmmount::OperationErrorInfo info, QString) {
+                if (!ok)
+                    qWarning() << "mount device failed!" << device << info.message;
+                finish(device, ok ? "" : tr("Mount device failed"));
+            });
+        });
+    }
+}
+
 void DiskEncryptMenuScene::onUnlocked(bool ok, dfmmount::OperationErrorInfo info, QString clearDev)
 {
     QApplication::restoreOverrideCursor();
@@ -523,9 +847,15 @@ void DiskEncryptMenuScene::onMounted(bool ok, dfmmount::OperationErrorInfo info,
 }
 
 void DiskEncryptMenuScene::unmountBefore(const std::function<void(const DeviceEncryptParam &)> &after)
+{
+    unmountDevice(selectedItemInfo.value("Id").toString(), param, after);
+}
+
+void DiskEncryptMenuScene::unmountDevice(const QString &objPath, const DeviceEncryptParam &param,
+                                         const std::function<void(const DeviceEncryptParam &)> &after)
 {
     using namespace dfmmount;
-    auto blk = device_utils::createBlockDevice(selectedItemInfo.value("Id").toString());
+    auto blk = device_utils::createBlockDevice(objPath);
     if (!blk)
         return;
 
@@ -48,11 +48,16 @@ public:
 
 protected:
     static void encryptDevice(const disk_encrypt::DeviceEncryptParam &param);
+    static void encryptDevices(const QList<disk_encrypt::DeviceEncryptParam> &params, const QStringList &objPaths);
     static void deencryptDevice(const disk_encrypt::DeviceEncryptParam &param);
     static void changePassphrase(disk_encrypt::DeviceEncryptParam param);
     static void unlockDevice(const QString &dev);
+    static void unlockDevices(const QString &dev, const QMap<QString, QString> &lockedDevices);
 
     static void doEncryptDevice(const disk_encrypt::DeviceEncryptParam &param);
+    static void doEncryptDevices(const QList<disk_encrypt::DeviceEncryptParam> &params);
+    static QVariantMap encryptParamsOf(const disk_encrypt::DeviceEncryptParam &param,
+                                       const QString &tpmConfig, const QString &tpmToken);
     static void doDecryptDevice(const disk_encrypt::DeviceEncryptParam &param);
     static void doChangePassphrase(const disk_encrypt::DeviceEncryptParam &param);
 
@@ -60,10 +65,16 @@ protected:
     static QString generateTPMToken(const QString &device, bool pin);
     static QString getBase64Of(const QString &fileName);
 
+    static QString changePwdText(int type);
+    void onKeyTypeResolved(const QString &dev, int type);
+
     static void onUnlocked(bool ok, dfmmount::OperationErrorInfo, QString);
     static void onMounted(bool ok, dfmmount::OperationErrorInfo, QString);
 
+    bool initializeBatch(const QList<QUrl> &selectedItems);
     void unmountBefore(const std::function<void(const disk_encrypt::DeviceEncryptParam &)> &after);
+    static void unmountDevice(const QString &objPath, const disk_encrypt::DeviceEncryptParam &param,
+                              const std::function<void(const disk_encrypt::DeviceEncryptParam &)> &after);
     enum OpType { kUnmount,
                   kLock };
     static void onUnmountError(OpType t, const QString &dev, const dfmmount::OperationErrorInfo &err);
@@ -72,10 +83,16 @@ private:
     QMap<QString, QAction *> actions;
 
     bool itemEncrypted { false };
+    bool keyTypeResolved { true };
     bool selectionMounted { false };
     QVariantHash selectedItemInfo;
+    QMap<QString, QString> lockedDevices;
 
     disk_encrypt::DeviceEncryptParam param;
+
+    // the partitions that can be encrypted in one batch when multi selected.
+    QList<disk_encrypt::DeviceEncryptParam> batchParams;
+    QStringList batchObjPaths;
 };
 
 }
@@ -5,6 +5,8 @@
 #include "plugin_diskencryptentry.h"
 #include "menu/diskencryptmenuscene.h"
 #include "events/eventshandler.h"
+#include "utils/devicestatecache.h"
+#include "dbus/daemonproxy.h"
 
 #include <QTranslator>
 
@@ -35,6 +37,8 @@ bool DiskEncryptEntry::start()
                                        this, &DiskEncryptEntry::onComputerMenuSceneAdded);
     }
 
+    daemon_proxy::instance();   // workers use it as well, create it in gui thread.
+    DeviceStateCache::instance()->watchDevices();
     EventsHandler::instance()->bindDaemonSignals();
     EventsHandler::instance()->hookEvents();
 
@@ -0,0 +1,121 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "devicestatecache.h"
+#include "encryptutils.h"
+#include "dfmplugin_disk_encrypt_global.h"
+#include "dbus/daemonproxy.h"
+
+#include <dfm-mount/dmount.h>
+
+#include <QEventLoop>
+#include <QTimer>
+#include <QDebug>
+
+using namespace dfmplugin_diskenc;
+
+inline constexpr char kBlockObjPathPrefix[] { "/org/freedesktop/UDisks2/block_devices/" };
+
+DeviceStateCache *DeviceStateCache::instance()
+{
+    static DeviceStateCache ins;
+    return &ins;
+}
+
+DeviceStateCache::DeviceStateCache(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void DeviceStateCache::watchDevices()
+{
+    using namespace dfmmount;
+    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+    if (!monitor) {
+        qWarning() << "no block monitor, device states are not cached.";
+        return;
+    }
+
+    // the state of a luks device changes with its cleartext device too, so
+    // any change makes all the devices refreshed again.
+    connect(monitor.data(), &DBlockMonitor::deviceAdded, this, &DeviceStateCache::onBlockDeviceChanged);
+    connect(monitor.data(), &DBlockMonitor::propertyChanged, this, &DeviceStateCache::onBlockDeviceChanged);
+    connect(monitor.data(), &DBlockMonitor::deviceRemoved, this, &DeviceStateCache::onBlockDeviceRemoved);
+}
+
+bool DeviceStateCache::isFresh(const QString &dev) const
+{
+    return freshDevices.contains(dev);
+}
+
+void DeviceStateCache::setFresh(const QString &dev)
+{
+    freshDevices.insert(dev);
+}
+
+int DeviceStateCache::keyType(const QString &dev) const
+{
+    return keyTypes.value(dev, -1);
+}
+
+void DeviceStateCache::setKeyType(const QString &dev, int type)
+{
+    if (keyTypes.contains(dev) && keyTypes.value(dev) == type)
+        return;
+    keyTypes.insert(dev, type);
+    Q_EMIT keyTypeChanged(dev, type);
+}
+
+void DeviceStateCache::queryKeyType(const QString &dev)
+{
+    if (querying.contains(dev))
+        return;
+    querying.insert(dev);
+
+    device_utils::queryEncKeyType(dev, this, [this, dev](int) {
+        querying.remove(dev);
+    });
+}
+
+int DeviceStateCache::resolveKeyType(const QString &dev)
+{
+    static constexpr int kQueryTimeout { 5000 };
+    int type = keyType(dev);
+    if (type >= 0)
+        return type;
+
+    QEventLoop loop;
+    device_utils::queryEncKeyType(dev, &loop, [&loop, &type](int queried) {
+        type = queried;
+        loop.quit();
+    });
+    QTimer::singleShot(kQueryTimeout, &loop, &QEventLoop::quit);
+    loop.exec();
+
+    if (type < 0) {
+        qWarning() << "key type of" << dev << "is unknown, take it as passphrase";
+        return disk_encrypt::kPasswordOnly;
+    }
+    return type;
+}
+
+void DeviceStateCache::invalidate(const QString &dev)
+{
+    freshDevices.remove(dev);
+    keyTypes.remove(dev);
+    queryKeyType(dev);
+}
+
+void DeviceStateCache::onBlockDeviceChanged()
+{
+    freshDevices.clear();
+}
+
+void DeviceStateCache::onBlockDeviceRemoved(const QString &objPath)
+{
+    freshDevices.clear();
+    const QString &dev = "/dev/" + objPath.mid(int(strlen(kBlockObjPathPrefix)));
+    keyTypes.remove(dev);
+    querying.remove(dev);
+}
@@ -0,0 +1,54 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef DEVICESTATECACHE_H
+#define DEVICESTATECACHE_H
+
+#include <QObject>
+#include <QMap>
+#include <QSet>
+
+namespace dfmplugin_diskenc {
+
+// the encryption state of devices used by menu, which is updated by block
+// device events and daemon signals, so showing menu never waits for them.
+class DeviceStateCache : public QObject
+{
+    Q_OBJECT
+public:
+    static DeviceStateCache *instance();
+    void watchDevices();
+
+    // the properties of device have not been changed since last refresh.
+    bool isFresh(const QString &dev) const;
+    void setFresh(const QString &dev);
+
+    // -1 if unknown, query it by queryKeyType.
+    int keyType(const QString &dev) const;
+    void setKeyType(const QString &dev, int type);
+    void queryKeyType(const QString &dev);
+    // for the actions started by user, the cached type, or the queried one
+    // waited in a local event loop so the gui keeps responding. the type of
+    // passphrase if the query fails.
+    int resolveKeyType(const QString &dev);
+    void invalidate(const QString &dev);
+
+Q_SIGNALS:
+    void keyTypeChanged(const QString &dev, int type);
+
+private Q_SLOTS:
+    void onBlockDeviceChanged();
+    void onBlockDeviceRemoved(const QString &objPath);
+
+private:
+    explicit DeviceStateCache(QObject *parent = nullptr);
+
+    QSet<QString> freshDevices;
+    QMap<QString, int> keyTypes;
+    QSet<QString> querying;
+};
+
+}
+
+#endif   // DEVICESTATECACHE_H
@@ -4,25 +4,39 @@
 
 #include "encryptutils.h"
 #include "dfmplugin_disk_encrypt_global.h"
+#include "dbus/daemonproxy.h"
+#include "devicestatecache.h"
 
 #include <dfm-framework/event/event.h>
 
 #include <dfm-mount/dmount.h>
 
 #include <QSettings>
-#include <QDBusInterface>
-#include <QDBusReply>
+#include <QPointer>
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QDateTime>
+#include <QStandardPaths>
+#include <QVector>
+#include <QCoreApplication>
 
 #include <dconfig.h>
 #include <DDialog>
 
 #include <fstab.h>
+#include <linux/keyctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
 
 Q_DECLARE_METATYPE(bool *)
 Q_DECLARE_METATYPE(QString *)
+Q_DECLARE_METATYPE(QVariantMap *)
 
 using namespace dfmplugin_diskenc;
 
@@ -39,13 +53,77 @@ QString config_utils::cipherType()
     auto cfg = Dtk::Core::DConfig::create("org.deepin.dde.file-manager",
                                           "org.deepin.dde.file-manager.diskencrypt");
     cfg->deleteLater();
-    auto cipher = cfg->value("encryptAlgorithm", "sm4").toString();
+    auto cipher = cfg->value("encryptAlgorithm", "auto").toString();
     QStringList supportedCipher { "sm4", "aes" };
+    if (cipher == "auto")
+        return fastestCipher(supportedCipher);
     if (!supportedCipher.contains(cipher))
         return "sm4";
     return cipher;
 }
 
+bool config_utils::detachedHeaderEnabled()
+{
+    auto cfg = Dtk::Core::DConfig::create("org.deepin.dde.file-manager",
+                                          "org.deepin.dde.file-manager.diskencrypt");
+    cfg->deleteLater();
+    return cfg->value("detachedHeaderEncrypt", false).toBool();
+}
+
+bool config_utils::unlockKeyCacheEnabled()
+{
+    auto cfg = Dtk::Core::DConfig::create("org.deepin.dde.file-manager",
+                                          "org.deepin.dde.file-manager.diskencrypt");
+    cfg->deleteLater();
+    return cfg->value("cacheUnlockKey", false).toBool();
+}
+
+int config_utils::unlockKeyCacheTimeout()
+{
+    auto cfg = Dtk::Core::DConfig::create("org.deepin.dde.file-manager",
+                                          "org.deepin.dde.file-manager.diskencrypt");
+    cfg->deleteLater();
+    return qMax(0, cfg->value("unlockKeyCacheTimeout", 900).toInt());
+}
+
+// the cpu won't change during runtime, the benchmark is fetched only once.
+static QVariantMap cipherBenchmark;
+
+QString config_utils::fastestCipher(const QStringList &candidates)
+{
+    Q_ASSERT(!candidates.isEmpty());
+    if (cipherBenchmark.isEmpty()) {
+        qWarning() << "cipher benchmark is not ready, use" << candidates.first();
+        return candidates.first();
+    }
+
+    QString fastest = candidates.first();
+    double fastestMbs = -1;
+    for (const auto &cipher : candidates) {
+        double mbs = cipherBenchmark.value(cipher, -1).toDouble();
+        if (mbs > fastestMbs) {
+            fastestMbs = mbs;
+            fastest = cipher;
+        }
+    }
+    qInfo() << "cipher benchmark:" << cipherBenchmark << "use" << fastest;
+    return fastest;
+}
+
+void config_utils::queryCipherBenchmark()
+{
+    if (!cipherBenchmark.isEmpty())
+        return;
+    daemon_proxy::watch(daemon_proxy::instance()->QueryCipherBenchmark(),
+                        [](QDBusPendingReply<QVariantMap> reply) {
+                            if (!reply.isValid()) {
+                                qWarning() << "cannot query cipher benchmark:" << reply.error().message();
+                                return;
+                            }
+                            cipherBenchmark = reply.value();
+                        });
+}
+
 bool fstab_utils::isFstabItem(const QString &mpt)
 {
     if (mpt.isEmpty())
@@ -80,6 +158,11 @@ int tpm_utils::isSupportAlgoByTPM(const QString &algoName, bool *support)
     return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_IsTPMSupportAlgoPro", algoName, support).toInt();
 }
 
+int tpm_utils::getAlgoProfileByTPM(const QStringList &candidates, QVariantMap *profile)
+{
+    return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_GetTPMAlgoProfilePro", candidates, profile).toInt();
+}
+
 int tpm_utils::encryptByTPM(const QVariantMap &map)
 {
     return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_EncryptByTPMPro", map).toInt();
@@ -90,26 +173,49 @@ int tpm_utils::decryptByTPM(const QVariantMap &map, QString *psw)
     return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_DecryptByTPMPro", map, psw).toInt();
 }
 
-int device_utils::encKeyType(const QString &dev)
-{
-    QDBusInterface iface(kDaemonBusName,
-                         kDaemonBusPath,
-                         kDaemonBusIface,
-                         QDBusConnection::systemBus());
-    if (iface.isValid()) {
-        QDBusReply<QString> reply = iface.call("QueryTPMToken", dev);
-        if (!reply.isValid()) return 0;
-        QString tokenJson = reply.value();
-        if (tokenJson.isEmpty()) return 0;
-
-        QJsonDocument doc = QJsonDocument::fromJson(tokenJson.toLocal8Bit());
-        QJsonObject obj = doc.object();
-        cacheToken(dev, obj.toVariantMap());
-        QString usePin = obj.value("pin").toString("");
-        if (usePin.isEmpty()) return 0;
-        if (usePin == "1") return 1;
-        if (usePin == "0") return 2;
-    }
+int tpm_utils::decryptTokenByTPM(const QVariantMap &token, const QString &pin, QString *psw)
+{
+    return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_DecryptTokenByTPMPro", token, pin, psw).toInt();
+}
+
+int tpm_utils::prewarmTPM(const QString &primaryHashAlgo, const QString &primaryKeyAlgo)
+{
+    return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_PrewarmTPMPro", primaryHashAlgo, primaryKeyAlgo).toInt();
+}
+
+int tpm_utils::getEntropyByTPM(const QVariantMap &request, QVariantMap *slices)
+{
+    return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_GetEntropyByTPMPro", request, slices).toInt();
+}
+
+void device_utils::queryEncKeyType(const QString &dev, QObject *receiver, std::function<void(int)> callback)
+{
+    QPointer<QObject> guard(receiver);
+    daemon_proxy::watch(daemon_proxy::instance()->QueryTPMToken(dev),
+                        [dev, guard, callback](QDBusPendingReply<QString> reply) {
+                            int type = -1;
+                            if (reply.isValid()) {
+                                type = keyTypeOfToken(dev, reply.value());
+                                DeviceStateCache::instance()->setKeyType(dev, type);
+                            } else {
+                                qWarning() << "cannot query tpm token of" << dev << reply.error().message();
+                            }
+                            if (guard)
+                                callback(type);
+                        });
+}
+
+int device_utils::keyTypeOfToken(const QString &dev, const QString &tokenJson)
+{
+    if (tokenJson.isEmpty()) return 0;
+
+    QJsonDocument doc = QJsonDocument::fromJson(tokenJson.toLocal8Bit());
+    QJsonObject obj = doc.object();
+    cacheToken(dev, obj.toVariantMap());
+    QString usePin = obj.value("pin").toString("");
+    if (usePin.isEmpty()) return 0;
+    if (usePin == "1") return 1;
+    if (usePin == "0") return 2;
     return 0;
 }
 
@@ -117,8 +223,14 @@ int tpm_passphrase_utils::genPassphraseFromTPM(const QString &dev, const QString
 {
     Q_ASSERT(passphrase);
 
-    if ((tpm_utils::getRandomByTPM(kPasswordSize, passphrase) != 0)
-        || passphrase->isEmpty()) {
+    // the passphrase and the iv of token are read from tpm by one request.
+    QVariantMap entropy;
+    const QVariantMap request { { "passphrase", kPasswordSize / 2 }, { "iv", kTPMIVSize } };
+    if (tpm_utils::getEntropyByTPM(request, &entropy) == 0
+        && entropy.value("passphrase").toByteArray().size() == kPasswordSize / 2) {
+        *passphrase = QString::fromLatin1(entropy.value("passphrase").toByteArray().toHex());
+    } else if ((tpm_utils::getRandomByTPM(kPasswordSize, passphrase) != 0)
+               || passphrase->isEmpty()) {
         qCritical() << "TPM get random number failed!";
         return kTPMNoRandomNumber;
     }
@@ -144,6 +256,8 @@ int tpm_passphrase_utils::genPassphraseFromTPM(const QString &dev, const QString
         { "PropertyKey_DirPath", dirPath },
         { "PropertyKey_Plain", *passphrase },
     };
+    if (entropy.value("iv").toByteArray().size() == kTPMIVSize)
+        map.insert("PropertyKey_Iv", entropy.value("iv"));
     if (pin.isEmpty()) {
         map.insert("PropertyKey_EncryptType", kUseTpmAndPcr);
         map.insert("PropertyKey_Pcr", "7");
@@ -172,6 +286,24 @@ int tpm_passphrase_utils::genPassphraseFromTPM(const QString &dev, const QString
 
 QString tpm_passphrase_utils::getPassphraseFromTPM(const QString &dev, const QString &pin)
 {
+    const QVariantMap &token = device_utils::cachedToken(dev);
+    if (!token.isEmpty()) {
+        QString passphrase;
+        int ret = tpm_utils::decryptTokenByTPM(token, pin, &passphrase);
+        if (ret == 0 && !passphrase.isEmpty())
+            return passphrase;
+        // a wrong pin is not retried, which counts against the lockout of tpm.
+        if (ret != 0 && ret != kTPMNoTokenBackend) {
+            qWarning() << "cannot acquire passphrase from TPM for device" << dev;
+            return "";
+        }
+
+        // the tools backend reads the token from files only.
+        qInfo() << "decrypt token with token files" << dev;
+        if (!device_utils::saveTokenFiles(dev, token))
+            return "";
+    }
+
     const QString dirPath = kGlobalTPMConfigPath + dev;
     QSettings tpmSets(dirPath + QDir::separator() + "algo.ini", QSettings::IniFormat);
     const QString sessionHashAlgo = tpmSets.value(kConfigKeySessionHashAlgo).toString();
@@ -218,24 +350,54 @@ QString tpm_passphrase_utils::getPassphraseFromTPM(const QString &dev, const QSt
     return passphrase;
 }
 
+QStringList tpm_passphrase_utils::supportedAlgorithms()
+{
+    // the tpm cannot be changed while running, so it's probed only once, the
+    // profiles are kept by the identity of tpm for logging which one is used.
+    static QMutex mtx;
+    static QMap<QString, QStringList> profiles;
+    static QString current;
+    static bool probed { false };
+
+    QMutexLocker locker(&mtx);
+    if (probed)
+        return profiles.value(current);
+
+    QStringList candidates { kTPMSessionHashAlgo, kTPMSessionKeyAlgo, kTPMPrimaryHashAlgo,
+                             kTPMPrimaryKeyAlgo, kTPMMinorHashAlgo, kTPMMinorKeyAlgo,
+                             kTCMSessionHashAlgo, kTCMSessionKeyAlgo, kTCMPrimaryHashAlgo,
+                             kTCMPrimaryKeyAlgo, kTCMMinorHashAlgo, kTCMMinorKeyAlgo };
+    candidates.removeDuplicates();
+    QVariantMap profile;
+    if (tpm_utils::getAlgoProfileByTPM(candidates, &profile) != 0) {
+        // not cached, the tpm may be not ready yet.
+        qWarning() << "cannot query algorithms of TPM";
+        return {};
+    }
+
+    current = QString("%1/%2").arg(profile.value("manufacturer").toString(),
+                                   profile.value("firmware").toString());
+    profiles.insert(current, profile.value("algorithms").toStringList());
+    probed = true;
+    qInfo() << "TPM" << current << "supports" << profiles.value(current);
+    return profiles.value(current);
+}
+
 bool tpm_passphrase_utils::getAlgorithm(QString *sessionHashAlgo, QString *sessionKeyAlgo,
                                         QString *primaryHashAlgo, QString *primaryKeyAlgo,
                                         QString *minorHashAlgo, QString *minorKeyAlgo)
 {
-    bool re1 { false };
-    bool re2 { false };
-    bool re3 { false };
-    bool re4 { false };
-    bool re5 { false };
-    bool re6 { false };
-    tpm_utils::isSupportAlgoByTPM(kTPMSessionHashAlgo, &re1);
-    tpm_utils::isSupportAlgoByTPM(kTPMSessionKeyAlgo, &re2);
-    tpm_utils::isSupportAlgoByTPM(kTPMPrimaryHashAlgo, &re3);
-    tpm_utils::isSupportAlgoByTPM(kTPMPrimaryKeyAlgo, &re4);
-    tpm_utils::isSupportAlgoByTPM(kTPMMinorHashAlgo, &re5);
-    tpm_utils::isSupportAlgoByTPM(kTPMMinorKeyAlgo, &re6);
-
-    if (re1 && re2 && re3 && re4 && re5 && re6) {
+    const QStringList &algos = supportedAlgorithms();
+    auto supported = [&algos](const QStringList &required) {
+        for (const auto &algo : required) {
+            if (!algos.contains(algo))
+                return false;
+        }
+        return true;
+    };
+
+    if (supported({ kTPMSessionHashAlgo, kTPMSessionKeyAlgo, kTPMPrimaryHashAlgo,
+                    kTPMPrimaryKeyAlgo, kTPMMinorHashAlgo, kTPMMinorKeyAlgo })) {
         (*sessionHashAlgo) = kTPMSessionHashAlgo;
         (*sessionKeyAlgo) = kTPMSessionKeyAlgo;
         (*primaryHashAlgo) = kTPMPrimaryHashAlgo;
@@ -245,20 +407,8 @@ bool tpm_passphrase_utils::getAlgorithm(QString *sessionHashAlgo, QString *sessi
         return true;
     }
 
-    re1 = false;
-    re2 = false;
-    re3 = false;
-    re4 = false;
-    re5 = false;
-    re6 = false;
-    tpm_utils::isSupportAlgoByTPM(kTCMSessionHashAlgo, &re1);
-    tpm_utils::isSupportAlgoByTPM(kTCMSessionKeyAlgo, &re2);
-    tpm_utils::isSupportAlgoByTPM(kTCMPrimaryHashAlgo, &re3);
-    tpm_utils::isSupportAlgoByTPM(kTCMPrimaryKeyAlgo, &re4);
-    tpm_utils::isSupportAlgoByTPM(kTCMMinorHashAlgo, &re5);
-    tpm_utils::isSupportAlgoByTPM(kTCMMinorKeyAlgo, &re6);
-
-    if (re1 && re2 && re3 && re4 && re5 && re6) {
+    if (supported({ kTCMSessionHashAlgo, kTCMSessionKeyAlgo, kTCMPrimaryHashAlgo,
+                    kTCMPrimaryKeyAlgo, kTCMMinorHashAlgo, kTCMMinorKeyAlgo })) {
         (*sessionHashAlgo) = kTCMSessionHashAlgo;
         (*sessionKeyAlgo) = kTCMSessionKeyAlgo;
         (*primaryHashAlgo) = kTCMPrimaryHashAlgo;
@@ -297,6 +447,57 @@ BlockDev device_utils::createBlockDevice(const QString &devObjPath)
     return monitor->createDeviceById(devObjPath).objectCast<DBlockDevice>();
 }
 
+QString device_utils::luksUUID(const QString &dev)
+{
+    auto blk = createBlockDevice("/org/freedesktop/UDisks2/block_devices/" + dev.mid(5));
+    if (!blk || blk->getProperty(dfmmount::Property::kBlockIDType).toString() != "crypto_LUKS")
+        return "";
+    return blk->getProperty(dfmmount::Property::kBlockIDUUID).toString();
+}
+
+QMap<QString, QString> device_utils::lockedLuksDevices()
+{
+    using namespace dfmmount;
+    QMap<QString, QString> devices;
+    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+    if (!monitor)
+        return devices;
+
+    for (const auto &objPath : monitor->getDevices()) {
+        auto blk = monitor->createDeviceById(objPath).objectCast<DBlockDevice>();
+        if (!blk || blk->getProperty(Property::kBlockIDType).toString() != "crypto_LUKS")
+            continue;
+        if (blk->getProperty(Property::kEncryptedCleartextDevice).toString() != "/")
+            continue;
+        devices.insert(blk->getProperty(Property::kBlockDevice).toString(), objPath);
+    }
+    return devices;
+}
+
+// the devices encrypted in one batch share the sealed passphrase.
+bool device_utils::isSameTPMToken(const QString &dev, const QString &other)
+{
+    const QVariantMap &token = cachedToken(dev);
+    const QVariantMap &otherToken = cachedToken(other);
+    if (token.isEmpty() || otherToken.isEmpty())
+        return false;
+    for (const char *key : { "enc", "kek-pub", "kek-priv", "iv", "pin" }) {
+        if (token.value(key) != otherToken.value(key))
+            return false;
+    }
+    return true;
+}
+
+void device_utils::queryHwOpalSupported(const QString &dev, QObject *receiver, std::function<void(bool)> callback)
+{
+    QPointer<QObject> guard(receiver);
+    daemon_proxy::watch(daemon_proxy::instance()->IsHwOpalSupported(dev),
+                        [guard, callback](QDBusPendingReply<bool> reply) {
+                            if (guard)
+                                callback(reply.isValid() && reply.value());
+                        });
+}
+
 int dialog_utils::showDialog(const QString &title, const QString &msg, DialogType type)
 {
     QString icon;
@@ -319,14 +520,35 @@ int dialog_utils::showDialog(const QString &title, const QString &msg, DialogTyp
     return d.exec();
 }
 
+static QMutex tokenMutex;
+static QMap<QString, QVariantMap> cachedTokens;
+
 void device_utils::cacheToken(const QString &device, const QVariantMap &token)
 {
+    // the token is kept in memory, the files are written only when they are
+    // needed by the tools backend.
+    {
+        QMutexLocker locker(&tokenMutex);
+        if (token.isEmpty())
+            cachedTokens.remove(device);
+        else
+            cachedTokens.insert(device, token);
+    }
+
     if (token.isEmpty()) {
         QDir tmp("/tmp");
         tmp.rmpath(kGlobalTPMConfigPath + device);
-        return;
     }
+}
+
+QVariantMap device_utils::cachedToken(const QString &device)
+{
+    QMutexLocker locker(&tokenMutex);
+    return cachedTokens.value(device);
+}
 
+bool device_utils::saveTokenFiles(const QString &device, const QVariantMap &token)
+{
     auto makeFile = [](const QString &fileName, const QByteArray &content) {
         QFile f(fileName);
         if (!f.open(QIODevice::Truncate | QIODevice::WriteOnly)) {
@@ -371,6 +593,7 @@ void device_utils::cacheToken(const QString &device, const QVariantMap &token)
 
     if (!ret)
         tpmPath.rmpath(devTpmConfigPath);
+    return ret;
 }
 
 void dialog_utils::showTPMError(const QString &title, tpm_passphrase_utils::TPMError err)
@@ -395,3 +618,215 @@ void dialog_utils::showTPMError(const QString &title, tpm_passphrase_utils::TPME
     if (!msg.isEmpty())
         showDialog(title, msg, kError);
 }
+
+bool trace_utils::isEnabled()
+{
+    static const bool kEnabled = QFileInfo(QString("%1/%2")
+                                                   .arg(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation), kTraceDir))
+                                         .isDir();
+    return kEnabled;
+}
+
+// the permissions of keyutils.h, all of them are granted to the possessor
+// and none to the others.
+static constexpr quint32 kKeyPermPossessorAll { 0x3f000000 };
+inline constexpr char kKeyTypeUser[] { "user" };
+
+static QByteArray unlockKeyDesc(const QString &uuid)
+{
+    return QString("%1%2").arg(keyring_utils::kUnlockKeyPrefix, uuid).toUtf8();
+}
+
+static long findUnlockKey(const QString &uuid)
+{
+    return syscall(SYS_keyctl, KEYCTL_SEARCH, KEY_SPEC_SESSION_KEYRING,
+                   kKeyTypeUser, unlockKeyDesc(uuid).constData(), 0);
+}
+
+static void invalidateKey(long id)
+{
+    if (syscall(SYS_keyctl, KEYCTL_INVALIDATE, id) < 0)
+        syscall(SYS_keyctl, KEYCTL_REVOKE, id);
+}
+
+bool keyring_utils::cacheUnlockKey(const QString &uuid, const QString &key, int timeoutSecs)
+{
+    if (uuid.isEmpty() || key.isEmpty())
+        return false;
+
+    // the payload of an existing key is replaced.
+    QByteArray payload = key.toUtf8();
+    long id = syscall(SYS_add_key, kKeyTypeUser, unlockKeyDesc(uuid).constData(),
+                      payload.constData(), size_t(payload.size()), KEY_SPEC_SESSION_KEYRING);
+    payload.fill('\0');
+    if (id < 0) {
+        qWarning() << "cannot cache unlock key of" << uuid << strerror(errno);
+        return false;
+    }
+
+    // the timeout is set before the permissions are narrowed.
+    if (timeoutSecs > 0)
+        syscall(SYS_keyctl, KEYCTL_SET_TIMEOUT, id, unsigned(timeoutSecs));
+    if (syscall(SYS_keyctl, KEYCTL_SETPERM, id, kKeyPermPossessorAll) < 0) {
+        qWarning() << "cannot restrict unlock key of" << uuid << strerror(errno);
+        invalidateKey(id);
+        return false;
+    }
+    qInfo() << "unlock key of" << uuid << "is cached for" << timeoutSecs << "seconds";
+    return true;
+}
+
+QString keyring_utils::cachedUnlockKey(const QString &uuid)
+{
+    if (uuid.isEmpty())
+        return "";
+
+    long id = findUnlockKey(uuid);
+    if (id < 0)
+        return "";
+
+    QByteArray buf(256, '\0');
+    long len = syscall(SYS_keyctl, KEYCTL_READ, id, buf.data(), size_t(buf.size()));
+    if (len > buf.size()) {
+        buf.resize(int(len));
+        len = syscall(SYS_keyctl, KEYCTL_READ, id, buf.data(), size_t(buf.size()));
+    }
+    // expired or revoked since found.
+    if (len < 0 || len > buf.size())
+        return "";
+
+    const QString &key = QString::fromUtf8(buf.constData(), int(len));
+    buf.fill('\0');
+    return key;
+}
+
+void keyring_utils::dropUnlockKey(const QString &uuid)
+{
+    long id = uuid.isEmpty() ? -1 : findUnlockKey(uuid);
+    if (id >= 0) {
+        invalidateKey(id);
+        qInfo() << "cached unlock key of" << uuid << "is dropped";
+    }
+}
+
+void keyring_utils::dropUnlockKeys()
+{
+    // the keyring is read as an array of key serials.
+    QVector<qint32> ids(64);
+    long len = syscall(SYS_keyctl, KEYCTL_READ, KEY_SPEC_SESSION_KEYRING,
+                       ids.data(), size_t(ids.size()) * sizeof(qint32));
+    if (len > long(ids.size() * sizeof(qint32))) {
+        ids.resize(int(len / long(sizeof(qint32))));
+        len = syscall(SYS_keyctl, KEYCTL_READ, KEY_SPEC_SESSION_KEYRING,
+                      ids.data(), size_t(ids.size()) * sizeof(qint32));
+    }
+    if (len < 0)
+        return;
+    ids.resize(qMin(ids.size(), int(len / long(sizeof(qint32)))));
+
+    // described as "type;uid;gid;perm;description".
+    const QString &prefix = QString(kKeyTypeUser) + ";";
+    int dropped = 0;
+    for (qint32 id : ids) {
+        char desc[512] {};
+        if (syscall(SYS_keyctl, KEYCTL_DESCRIBE, id, desc, sizeof(desc) - 1) < 0)
+            continue;
+        const QString &fields = QString::fromUtf8(desc);
+        if (!fields.startsWith(prefix) || !fields.section(';', 4).startsWith(kUnlockKeyPrefix))
+            continue;
+        invalidateKey(id);
+        dropped += 1;
+    }
+    if (dropped > 0)
+        qInfo() << dropped << "cached unlock keys are dropped";
+}
+
+static QHash<QString, QString> &traceIDs()
+{
+    static QHash<QString, QString> ids;
+    return ids;
+}
+
+static QHash<QPair<QString, QString>, qint64> &spanBegins()
+{
+    static QHash<QPair<QString, QString>, qint64> begins;
+    return begins;
+}
+
+static qint64 traceNow()
+{
+    return QDateTime::currentMSecsSinceEpoch() * 1000;
+}
+
+QString trace_utils::traceID(const QString &dev)
+{
+    QString &id = traceIDs()[dev];
+    if (id.isEmpty())
+        id = QString("trace_%1_%2").arg(QDateTime::currentMSecsSinceEpoch()).arg(dev.mid(5));
+    return id;
+}
+
+void trace_utils::adoptTrace(const QString &dev, const QString &traceID)
+{
+    if (!traceID.isEmpty())
+        traceIDs().insert(dev, traceID);
+}
+
+void trace_utils::begin(const QString &dev, const QString &span)
+{
+    if (isEnabled())
+        spanBegins().insert({ dev, span }, traceNow());
+}
+
+void trace_utils::end(const QString &dev, const QString &span, const QVariantMap &args)
+{
+    if (!isEnabled())
+        return;
+
+    auto iter = spanBegins().find({ dev, span });
+    if (iter == spanBegins().end())
+        return;
+    qint64 beginUs = iter.value();
+    spanBegins().erase(iter);
+
+    QVariantMap spanArgs(args);
+    spanArgs.insert("device", dev);
+    QJsonObject event {
+        { "name", span },
+        { "cat", "dfm-encrypt" },
+        { "id2", QJsonObject { { "global", traceID(dev) } } },
+        { "pid", QCoreApplication::applicationPid() },
+        { "tid", 0 },
+    };
+
+    QByteArray lines;
+    event.insert("ph", "b");
+    event.insert("ts", beginUs);
+    event.insert("args", QJsonObject::fromVariantMap(spanArgs));
+    lines.append(QJsonDocument(event).toJson(QJsonDocument::Compact)).append(",\n");
+    event.insert("ph", "e");
+    event.insert("ts", traceNow());
+    event.remove("args");
+    lines.append(QJsonDocument(event).toJson(QJsonDocument::Compact)).append(",\n");
+
+    QFile f(QString("%1/%2/encrypt-client-%3.json")
+                    .arg(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation), kTraceDir)
+                    .arg(QCoreApplication::applicationPid()));
+    bool isNew = !f.exists();
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Append))
+        return;
+    if (isNew)
+        f.write("[\n");
+    f.write(lines);
+}
+
+void trace_utils::finish(const QString &dev)
+{
+    traceIDs().remove(dev);
+    for (auto iter = spanBegins().begin(); iter != spanBegins().end();) {
+        if (iter.key().first == dev)
+            iter = spanBegins().erase(iter);
+        else
+            ++iter;
+    }
+}
@@ -8,6 +8,10 @@
 #include <QString>
 #include <QVariantMap>
 
+#include <functional>
+
+class QObject;
+
 namespace dfmmount {
 class DBlockDevice;
 }
@@ -20,8 +24,12 @@ namespace tpm_utils {
 int checkTPM();
 int getRandomByTPM(int size, QString *output);
 int isSupportAlgoByTPM(const QString &algoName, bool *support);
+int getAlgoProfileByTPM(const QStringList &candidates, QVariantMap *profile);
 int encryptByTPM(const QVariantMap &map);
 int decryptByTPM(const QVariantMap &map, QString *psw);
+int decryptTokenByTPM(const QVariantMap &token, const QString &pin, QString *psw);
+int prewarmTPM(const QString &primaryHashAlgo, const QString &primaryKeyAlgo);
+int getEntropyByTPM(const QVariantMap &request, QVariantMap *slices);
 }   // namespace tpm_utils
 
 namespace tpm_passphrase_utils {
@@ -34,6 +42,7 @@ enum TPMError {
     kTPMMissingAlog,
 };
 
+QStringList supportedAlgorithms();
 bool getAlgorithm(QString *sessionHashAlgo, QString *sessionKeyAlgo,
                   QString *primaryHashAlgo, QString *primaryKeyAlgo,
                   QString *minorHashAlgo, QString *minorKeyAlgo);
@@ -44,8 +53,28 @@ QString getPassphraseFromTPM(const QString &dev, const QString &pin);
 namespace config_utils {
 bool exportKeyEnabled();
 QString cipherType();
+// served from the benchmark fetched by queryCipherBenchmark, the first
+// candidate if it's not fetched yet.
+QString fastestCipher(const QStringList &candidates);
+void queryCipherBenchmark();
+bool detachedHeaderEnabled();
+bool unlockKeyCacheEnabled();
+// seconds, 0 if the key is kept until the session is locked.
+int unlockKeyCacheTimeout();
 }   // namespace config_utils
 
+// the keys which unlocked devices in this session, kept as user keys in the
+// session keyring and readable by their possessor only. keyrings are
+// revoked by the kernel when the session is logged out.
+namespace keyring_utils {
+inline constexpr char kUnlockKeyPrefix[] { "dde-file-manager:unlock:" };
+bool cacheUnlockKey(const QString &uuid, const QString &key, int timeoutSecs);
+QString cachedUnlockKey(const QString &uuid);
+void dropUnlockKey(const QString &uuid);
+// all the unlock keys in the session keyring.
+void dropUnlockKeys();
+}   // namespace keyring_utils
+
 namespace recovery_key_utils {
 QString formatRecoveryKey(const QString &raw);
 }
@@ -55,9 +84,20 @@ bool isFstabItem(const QString &mpt);
 }   // namespace fstab_utils
 
 namespace device_utils {
-int encKeyType(const QString &dev);
+// callback is invoked in gui thread with -1 if the query failed, the type is
+// kept by DeviceStateCache.
+void queryEncKeyType(const QString &dev, QObject *receiver, std::function<void(int)> callback);
+int keyTypeOfToken(const QString &dev, const QString &tokenJson);
 void cacheToken(const QString &device, const QVariantMap &token);
+QVariantMap cachedToken(const QString &device);
+bool saveTokenFiles(const QString &device, const QVariantMap &token);
 BlockDev createBlockDevice(const QString &devObjPath);
+QString luksUUID(const QString &dev);
+// locked luks devices, device path to udisks object path.
+QMap<QString, QString> lockedLuksDevices();
+bool isSameTPMToken(const QString &dev, const QString &other);
+// callback is invoked in gui thread unless receiver is destroyed before the reply.
+void queryHwOpalSupported(const QString &dev, QObject *receiver, std::function<void(bool)> callback);
 }   // namespace device_utils
 
 namespace dialog_utils {
@@ -70,6 +110,22 @@ int showDialog(const QString &title, const QString &msg, DialogType type);
 void showTPMError(const QString &title, tpm_passphrase_utils::TPMError err);
 }
 
+// the client half of the job traces written by the daemon, in the same
+// chrome trace format and keyed by the same trace id, which is sent with
+// the job params. enabled by creating kTraceDir under the cache dir.
+namespace trace_utils {
+inline constexpr char kTraceDir[] { "dde-file-manager/trace" };
+bool isEnabled();
+// the trace of the job on dev, created on first use.
+QString traceID(const QString &dev);
+// continues a trace started before reboot.
+void adoptTrace(const QString &dev, const QString &traceID);
+void begin(const QString &dev, const QString &span);
+void end(const QString &dev, const QString &span, const QVariantMap &args = {});
+// ends the trace of dev, the next job starts another one.
+void finish(const QString &dev);
+}   // namespace trace_utils
+
 }   // namespace dfmplugin_diskenc
 
 #endif   // ENCRYPTUTILS_H
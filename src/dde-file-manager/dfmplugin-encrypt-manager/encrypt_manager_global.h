@@ -11,6 +11,7 @@
 #define DPENCRYPTMANAGER_USE_NAMESPACE using namespace dfmplugin_encrypt_manager;
 
 #include <QString>
+#include <QByteArray>
 
 namespace dfmplugin_encrypt_manager {
 
@@ -32,6 +33,7 @@ struct EncryptParams
     QString minorKeyAlgo;
     QString dirPath;
     QString plain;
+    QByteArray iv;   // optional, generated by tpm if empty
 
     QString pinCode;
 
@@ -54,6 +56,18 @@ struct DecryptParams
     QString pcr_bank;
 };
 
+// returned when a token cannot be decrypted without files.
+inline constexpr int kNoTokenBackend { -2 };
+
+// the binary parts of a tpm token, decoded from the base64 fields.
+struct TokenData
+{
+    QByteArray iv;
+    QByteArray keyPub;
+    QByteArray keyPriv;
+    QByteArray cipher;
+};
+
 namespace PropertyKey {
 inline constexpr char kEncryptType[] { "PropertyKey_EncryptType" };
 inline constexpr char kSessionHashAlgo[] { "PropertyKey_SessionHashAlgo" };
@@ -64,6 +78,7 @@ inline constexpr char kMinorHashAlgo[] { "PropertyKey_MinorHashAlgo" };
 inline constexpr char kMinorKeyAlgo[] { "PropertyKey_MinorKeyAlgo" };
 inline constexpr char kDirPath[] { "PropertyKey_DirPath" };
 inline constexpr char kPlain[] { "PropertyKey_Plain" };
+inline constexpr char kIv[] { "PropertyKey_Iv" };
 inline constexpr char kPinCode[] { "PropertyKey_PinCode" };
 inline constexpr char kPcr[] { "PropertyKey_Pcr" };
 inline constexpr char kPcrBank[] { "PropertyKey_PcrBank" };
@@ -4,12 +4,14 @@
 
 #include "encryptmanager.h"
 #include "events/eventreceiver.h"
+#include "tpm/tpmlibrary.h"
 
 DPENCRYPTMANAGER_USE_NAMESPACE
 
 
 void EncryptManager::initialize()
 {
+    TPMLibrary::instance();
     EventReceiver::instance();
 }
 
@@ -26,8 +26,12 @@ class EncryptManager : public dpf::Plugin
     DPF_EVENT_REG_SLOT(slot_TPMIsAvailablePro)
     DPF_EVENT_REG_SLOT(slot_GetRandomByTPMPro)
     DPF_EVENT_REG_SLOT(slot_IsTPMSupportAlgoPro)
+    DPF_EVENT_REG_SLOT(slot_GetTPMAlgoProfilePro)
     DPF_EVENT_REG_SLOT(slot_EncryptByTPMPro)
     DPF_EVENT_REG_SLOT(slot_DecryptByTPMPro)
+    DPF_EVENT_REG_SLOT(slot_DecryptTokenByTPMPro)
+    DPF_EVENT_REG_SLOT(slot_PrewarmTPMPro)
+    DPF_EVENT_REG_SLOT(slot_GetEntropyByTPMPro)
 
 public:
     void initialize() override;
@@ -9,6 +9,7 @@
 
 Q_DECLARE_METATYPE(QString *)
 Q_DECLARE_METATYPE(bool *)
+Q_DECLARE_METATYPE(QVariantMap *)
 
 DPENCRYPTMANAGER_USE_NAMESPACE
 
@@ -86,6 +87,15 @@ int EventReceiver::isTpmSupportAlgoProcess(const QString &algoName, bool *suppor
     return tpm.isSupportAlgoByTools(algoName, support);
 }
 
+int EventReceiver::tpmAlgoProfileProcess(const QStringList &candidates, QVariantMap *profile)
+{
+    if (!profile)
+        return -1;
+
+    TPMWork tpm;
+    return tpm.algoProfileByTools(candidates, profile);
+}
+
 int EventReceiver::encryptByTpmProcess(const QVariantMap &encryptParams)
 {
     if (!encryptParams.contains(PropertyKey::kEncryptType))
@@ -132,6 +142,7 @@ int EventReceiver::encryptByTpmProcess(const QVariantMap &encryptParams)
     params.minorKeyAlgo = encryptParams.value(PropertyKey::kMinorKeyAlgo).toString();
     params.dirPath = encryptParams.value(PropertyKey::kDirPath).toString();
     params.plain = encryptParams.value(PropertyKey::kPlain).toString();
+    params.iv = encryptParams.value(PropertyKey::kIv).toByteArray();
     if (type == 1) {
         params.type = kTpmAndPcr;
         params.pcr = encryptParams.value(PropertyKey::kPcr).toString();
@@ -207,6 +218,56 @@ int EventReceiver::decryptByTpmProcess(const QVariantMap &decryptParams, QString
     return tpm.decryptByTools(params, pwd);
 }
 
+int EventReceiver::decryptTokenByTpmProcess(const QVariantMap &token, const QString &pin, QString *pwd)
+{
+    if (!pwd || token.isEmpty())
+        return -1;
+
+    // the token is the one saved in luks header, see DiskEncryptMenuScene::generateTPMToken.
+    DecryptParams params;
+    params.type = pin.isEmpty() ? kTpmAndPcr : kTpmAndPcrAndPin;
+    params.sessionHashAlgo = token.value("session-hash-alg").toString();
+    params.sessionKeyAlgo = token.value("session-key-alg").toString();
+    params.primaryHashAlgo = token.value("primary-hash-alg").toString();
+    params.primaryKeyAlgo = token.value("primary-key-alg").toString();
+    params.pcr = token.value("pcr").toString();
+    params.pcr_bank = token.value("pcr-bank").toString();
+    params.pinCode = pin;
+    if (params.sessionHashAlgo.isEmpty())
+        params.sessionHashAlgo = "sha256";
+    if (params.sessionKeyAlgo.isEmpty())
+        params.sessionKeyAlgo = "aes";
+
+    TokenData data;
+    data.iv = QByteArray::fromBase64(token.value("iv").toString().toLocal8Bit());
+    data.keyPub = QByteArray::fromBase64(token.value("kek-pub").toString().toLocal8Bit());
+    data.keyPriv = QByteArray::fromBase64(token.value("kek-priv").toString().toLocal8Bit());
+    data.cipher = QByteArray::fromBase64(token.value("enc").toString().toLocal8Bit());
+    if (data.iv.isEmpty() || data.keyPub.isEmpty() || data.keyPriv.isEmpty() || data.cipher.isEmpty())
+        return -1;
+
+    TPMWork tpm;
+    return tpm.decryptToken(params, data, pwd);
+}
+
+int EventReceiver::prewarmTpmProcess(const QString &primaryHashAlgo, const QString &primaryKeyAlgo)
+{
+    if (primaryHashAlgo.isEmpty() || primaryKeyAlgo.isEmpty())
+        return -1;
+
+    TPMWork tpm;
+    return tpm.prewarm(primaryHashAlgo, primaryKeyAlgo);
+}
+
+int EventReceiver::getEntropyByTpmProcess(const QVariantMap &request, QVariantMap *slices)
+{
+    if (!slices || request.isEmpty())
+        return -1;
+
+    TPMWork tpm;
+    return tpm.getEntropy(request, slices);
+}
+
 EventReceiver::EventReceiver(QObject *parent) : QObject(parent)
 {
     initConnection();
@@ -224,6 +285,10 @@ void EventReceiver::initConnection()
     dpfSlotChannel->connect("dfmplugin_encrypt_manager", "slot_TPMIsAvailablePro", this, &EventReceiver::tpmIsAvailableProcess);
     dpfSlotChannel->connect("dfmplugin_encrypt_manager", "slot_GetRandomByTPMPro", this, &EventReceiver::getRandomByTpmProcess);
     dpfSlotChannel->connect("dfmplugin_encrypt_manager", "slot_IsTPMSupportAlgoPro", this, &EventReceiver::isTpmSupportAlgoProcess);
+    dpfSlotChannel->connect("dfmplugin_encrypt_manager", "slot_GetTPMAlgoProfilePro", this, &EventReceiver::tpmAlgoProfileProcess);
     dpfSlotChannel->connect("dfmplugin_encrypt_manager", "slot_EncryptByTPMPro", this, &EventReceiver::encryptByTpmProcess);
     dpfSlotChannel->connect("dfmplugin_encrypt_manager", "slot_DecryptByTPMPro", this, &EventReceiver::decryptByTpmProcess);
+    dpfSlotChannel->connect("dfmplugin_encrypt_manager", "slot_DecryptTokenByTPMPro", this, &EventReceiver::decryptTokenByTpmProcess);
+    dpfSlotChannel->connect("dfmplugin_encrypt_manager", "slot_PrewarmTPMPro", this, &EventReceiver::prewarmTpmProcess);
+    dpfSlotChannel->connect("dfmplugin_encrypt_manager", "slot_GetEntropyByTPMPro", this, &EventReceiver::getEntropyByTpmProcess);
 }
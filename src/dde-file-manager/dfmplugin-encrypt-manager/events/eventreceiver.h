@@ -29,8 +29,12 @@ public Q_SLOTS:
     int tpmIsAvailableProcess();
     int getRandomByTpmProcess(int size, QString *output);
     int isTpmSupportAlgoProcess(const QString &algoName, bool *support);
+    int tpmAlgoProfileProcess(const QStringList &candidates, QVariantMap *profile);
     int encryptByTpmProcess(const QVariantMap &encryptParams);
     int decryptByTpmProcess(const QVariantMap &decryptParams, QString *pwd);
+    int decryptTokenByTpmProcess(const QVariantMap &token, const QString &pin, QString *pwd);
+    int prewarmTpmProcess(const QString &primaryHashAlgo, const QString &primaryKeyAlgo);
+    int getEntropyByTpmProcess(const QVariantMap &request, QVariantMap *slices);
 
 private:
     explicit EventReceiver(QObject *parent = nullptr);
@@ -0,0 +1,701 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "tpmesys.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QDir>
+#include <QMap>
+#include <QSettings>
+#include <QScopedPointer>
+
+#include <tss2/tss2_mu.h>
+
+#include <cstring>
+
+inline constexpr int kIVSize { 16 };
+inline constexpr int kSymKeyBits { 128 };
+inline constexpr char kIVFileName[] { "iv.bin" };
+inline constexpr char kPubKeyFileName[] { "key.pub" };
+inline constexpr char kPriKeyFileName[] { "key.priv" };
+inline constexpr char kCipherFileName[] { "cipher.out" };
+inline constexpr char kAlgoFileName[] { "algo.ini" };
+inline constexpr char kPrimaryHandleKey[] { "primary_handle" };
+// the owner persistent handles used for primary keys, one per algorithm.
+inline constexpr TPM2_HANDLE kPersistentBase { 0x81000100 };
+inline constexpr TPM2_HANDLE kPersistentCount { 16 };
+
+DPENCRYPTMANAGER_USE_NAMESPACE
+
+#define CHECK_RC(rc, func, retVal)                                                    \
+    if ((rc) != TSS2_RC_SUCCESS) {                                                    \
+        qCritical() << "esys" << (func) << "failed:" << QString::number((rc), 16); \
+        return retVal;                                                                \
+    }
+
+static TPM2_ALG_ID hashAlgId(const QString &name)
+{
+    static const QMap<QString, TPM2_ALG_ID> kHashAlgs {
+        { "sha1", TPM2_ALG_SHA1 },
+        { "sha256", TPM2_ALG_SHA256 },
+        { "sha384", TPM2_ALG_SHA384 },
+        { "sha512", TPM2_ALG_SHA512 },
+        { "sm3_256", TPM2_ALG_SM3_256 },
+    };
+    return kHashAlgs.value(name, TPM2_ALG_ERROR);
+}
+
+static TPM2_ALG_ID symAlgId(const QString &name)
+{
+    static const QMap<QString, TPM2_ALG_ID> kSymAlgs {
+        { "aes", TPM2_ALG_AES },
+        { "sm4", TPM2_ALG_SM4 },
+    };
+    return kSymAlgs.value(name, TPM2_ALG_ERROR);
+}
+
+// same as "-G aes" or "-G sm4" of tpm2-tools: 128 bits in cfb mode.
+static TPMT_SYM_DEF_OBJECT symDef(TPM2_ALG_ID alg)
+{
+    TPMT_SYM_DEF_OBJECT def {};
+    def.algorithm = alg;
+    def.keyBits.sym = kSymKeyBits;
+    def.mode.sym = TPM2_ALG_CFB;
+    return def;
+}
+
+// the template of "tpm2_createprimary -C o -g <hash> -G <key>", which must stay
+// the same, otherwise the keys created under the primary cannot be loaded.
+static bool primaryTemplate(const QString &hashAlgo, const QString &keyAlgo, TPM2B_PUBLIC *pub)
+{
+    *pub = {};
+    TPMT_PUBLIC &area = pub->publicArea;
+    area.nameAlg = hashAlgId(hashAlgo);
+    area.objectAttributes = TPMA_OBJECT_RESTRICTED | TPMA_OBJECT_DECRYPT
+            | TPMA_OBJECT_FIXEDTPM | TPMA_OBJECT_FIXEDPARENT
+            | TPMA_OBJECT_SENSITIVEDATAORIGIN | TPMA_OBJECT_USERWITHAUTH;
+    if (keyAlgo == "rsa") {
+        area.type = TPM2_ALG_RSA;
+        area.parameters.rsaDetail.symmetric = symDef(TPM2_ALG_AES);
+        area.parameters.rsaDetail.scheme.scheme = TPM2_ALG_NULL;
+        area.parameters.rsaDetail.keyBits = 2048;
+        area.parameters.rsaDetail.exponent = 0;
+    } else if (keyAlgo == "ecc") {
+        area.type = TPM2_ALG_ECC;
+        area.parameters.eccDetail.symmetric = symDef(TPM2_ALG_AES);
+        area.parameters.eccDetail.scheme.scheme = TPM2_ALG_NULL;
+        area.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+        area.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+    } else if (symAlgId(keyAlgo) != TPM2_ALG_ERROR) {
+        area.type = TPM2_ALG_SYMCIPHER;
+        area.parameters.symDetail.sym = symDef(symAlgId(keyAlgo));
+    } else {
+        qCritical() << "unsupported primary key algorithm" << keyAlgo;
+        return false;
+    }
+    return area.nameAlg != TPM2_ALG_ERROR;
+}
+
+static QString algName(TPM2_ALG_ID id)
+{
+    static const QMap<TPM2_ALG_ID, QString> kNames {
+        { TPM2_ALG_SHA1, "sha1" },
+        { TPM2_ALG_SHA256, "sha256" },
+        { TPM2_ALG_SHA384, "sha384" },
+        { TPM2_ALG_SHA512, "sha512" },
+        { TPM2_ALG_SM3_256, "sm3_256" },
+        { TPM2_ALG_AES, "aes" },
+        { TPM2_ALG_SM4, "sm4" },
+        { TPM2_ALG_RSA, "rsa" },
+        { TPM2_ALG_ECC, "ecc" },
+    };
+    return kNames.value(id);
+}
+
+static QString vendorString(UINT32 value)
+{
+    QByteArray str;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        char c = char((value >> shift) & 0xff);
+        if (c != '\0')
+            str.append(c);
+    }
+    return QString::fromLatin1(str).trimmed();
+}
+
+static bool isSameTemplate(const TPMT_PUBLIC &lhs, const TPMT_PUBLIC &rhs)
+{
+    return lhs.type == rhs.type
+            && lhs.nameAlg == rhs.nameAlg
+            && lhs.objectAttributes == rhs.objectAttributes
+            && lhs.authPolicy.size == rhs.authPolicy.size
+            && memcmp(&lhs.parameters, &rhs.parameters, sizeof(lhs.parameters)) == 0;
+}
+
+static bool parsePcrSelection(const QString &pcr, const QString &pcrBank, TPML_PCR_SELECTION *sel)
+{
+    *sel = {};
+    TPM2_ALG_ID bank = hashAlgId(pcrBank);
+    if (bank == TPM2_ALG_ERROR)
+        return false;
+
+    sel->count = 1;
+    sel->pcrSelections[0].hash = bank;
+    sel->pcrSelections[0].sizeofSelect = 3;
+    for (const auto &idx : pcr.split(',', QString::SkipEmptyParts)) {
+        bool ok = false;
+        int n = idx.trimmed().toInt(&ok);
+        if (!ok || n < 0 || n >= 24)
+            return false;
+        sel->pcrSelections[0].pcrSelect[n / 8] |= quint8(1 << (n % 8));
+    }
+    return true;
+}
+
+static bool readFile(const QString &path, QByteArray *content)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) {
+        qCritical() << "cannot read tpm file" << path;
+        return false;
+    }
+    *content = f.readAll();
+    return true;
+}
+
+static bool writeFile(const QString &path, const QByteArray &content)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCritical() << "cannot write tpm file" << path;
+        return false;
+    }
+    return f.write(content) == content.size();
+}
+
+static bool hasPcrPolicy(TPMType type)
+{
+    return type == kTpmAndPcr || type == kTpmAndPcrAndPin;
+}
+
+static bool hasPinPolicy(TPMType type)
+{
+    return type == kTpmAndPin || type == kTpmAndPcrAndPin;
+}
+
+TPMEsys::TPMEsys()
+{
+    // the default tcti is picked by tctildr, tabrmd if it's running.
+    TSS2_RC rc = Esys_Initialize(&ctx, nullptr, nullptr);
+    if (rc != TSS2_RC_SUCCESS) {
+        qWarning() << "cannot initialize esys context:" << QString::number(rc, 16);
+        ctx = nullptr;
+    }
+}
+
+TPMEsys::~TPMEsys()
+{
+    if (!ctx)
+        return;
+    while (!transients.isEmpty())
+        flush(transients.last());
+    // persistent objects stay in the tpm, only the esys resources are released.
+    for (ESYS_TR handle : persistents)
+        Esys_TR_Close(ctx, &handle);
+    Esys_Finalize(&ctx);
+}
+
+int TPMEsys::encrypt(const EncryptParams &params)
+{
+    if (!ctx)
+        return -1;
+
+    QByteArray iv = params.iv;
+    if (iv.size() != kIVSize && !getRandom(kIVSize, &iv))
+        return -1;
+
+    // the policy digest of key, computed in a trial session.
+    ESYS_TR trial { ESYS_TR_NONE };
+    if (!startSession(TPM2_SE_TRIAL, params.sessionHashAlgo, params.sessionKeyAlgo, &trial)
+        || !applyPolicy(trial, params.type, params.pcr, params.pcr_bank))
+        return -1;
+    TPM2B_DIGEST *policy { nullptr };
+    TSS2_RC rc = Esys_PolicyGetDigest(ctx, trial, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &policy);
+    flush(trial);
+    CHECK_RC(rc, "PolicyGetDigest", -1);
+    TPM2B_DIGEST policyDigest = *policy;
+    Esys_Free(policy);
+
+    ESYS_TR primary { ESYS_TR_NONE };
+    if (!loadPrimary(params.dirPath, params.primaryHashAlgo, params.primaryKeyAlgo, &primary))
+        return -1;
+
+    const QString &pin = hasPinPolicy(params.type) ? params.pinCode : QString();
+    QByteArray pub, priv;
+    if (!createKey(primary, params.minorHashAlgo, params.minorKeyAlgo, policyDigest, pin, &pub, &priv))
+        return -1;
+
+    ESYS_TR key { ESYS_TR_NONE };
+    if (!loadKey(primary, pub, priv, &key))
+        return -1;
+    if (!pin.isEmpty() && !setAuth(key, pin))
+        return -1;
+
+    ESYS_TR session { ESYS_TR_NONE };
+    if (!startSession(TPM2_SE_POLICY, params.sessionHashAlgo, params.sessionKeyAlgo, &session)
+        || !applyPolicy(session, params.type, params.pcr, params.pcr_bank))
+        return -1;
+
+    // the tools encrypt the plain written by echo, with the line end.
+    QByteArray plain = params.plain.toUtf8() + '\n';
+    QByteArray cipher;
+    bool ok = encryptDecrypt(key, session, false, iv, plain, &cipher);
+    plain.fill('\0');
+    if (!ok)
+        return -1;
+
+    const QString &dir = params.dirPath + QDir::separator();
+    ok = writeFile(dir + kIVFileName, iv)
+            && writeFile(dir + kPubKeyFileName, pub)
+            && writeFile(dir + kPriKeyFileName, priv)
+            && writeFile(dir + kCipherFileName, cipher);
+    return ok ? 0 : -1;
+}
+
+int TPMEsys::decrypt(const DecryptParams &params, QString *pwd)
+{
+    Q_ASSERT(pwd);
+    if (!ctx)
+        return -1;
+
+    const QString &dir = params.dirPath + QDir::separator();
+    TokenData data;
+    if (!readFile(dir + kIVFileName, &data.iv)
+        || !readFile(dir + kPubKeyFileName, &data.keyPub)
+        || !readFile(dir + kPriKeyFileName, &data.keyPriv)
+        || !readFile(dir + kCipherFileName, &data.cipher))
+        return -1;
+
+    return decrypt(params, data, pwd);
+}
+
+int TPMEsys::decrypt(const DecryptParams &params, const TokenData &data, QString *pwd)
+{
+    Q_ASSERT(pwd);
+    if (!ctx)
+        return -1;
+
+    ESYS_TR primary { ESYS_TR_NONE };
+    if (!loadPrimary(params.dirPath, params.primaryHashAlgo, params.primaryKeyAlgo, &primary))
+        return -1;
+
+    ESYS_TR key { ESYS_TR_NONE };
+    if (!loadKey(primary, data.keyPub, data.keyPriv, &key))
+        return -1;
+
+    if (hasPinPolicy(params.type) && !setAuth(key, params.pinCode))
+        return -1;
+
+    ESYS_TR session { ESYS_TR_NONE };
+    if (!startSession(TPM2_SE_POLICY, params.sessionHashAlgo, params.sessionKeyAlgo, &session)
+        || !applyPolicy(session, params.type, params.pcr, params.pcr_bank))
+        return -1;
+
+    QByteArray plain;
+    if (!encryptDecrypt(key, session, true, data.iv, data.cipher, &plain))
+        return -1;
+
+    // same as reading the clear file by stream of the tools flow.
+    *pwd = QString::fromLatin1(plain).trimmed();
+    plain.fill('\0');
+    return 0;
+}
+
+int TPMEsys::prewarm(const QString &primaryHashAlgo, const QString &primaryKeyAlgo)
+{
+    if (!ctx)
+        return -1;
+
+    // makes sure the primary is persisted, so unlocking needn't create it.
+    ESYS_TR primary { ESYS_TR_NONE };
+    return loadPrimary(QString(), primaryHashAlgo, primaryKeyAlgo, &primary) ? 0 : -1;
+}
+
+int TPMEsys::algoProfile(QVariantMap *profile)
+{
+    Q_ASSERT(profile);
+    if (!ctx)
+        return -1;
+
+    // the identity of the tpm, which the profile is cached by.
+    TPMI_YES_NO more { TPM2_NO };
+    TPMS_CAPABILITY_DATA *cap { nullptr };
+    TSS2_RC rc = Esys_GetCapability(ctx, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+                                    TPM2_CAP_TPM_PROPERTIES, TPM2_PT_MANUFACTURER,
+                                    TPM2_PT_FIRMWARE_VERSION_2 - TPM2_PT_MANUFACTURER + 1,
+                                    &more, &cap);
+    CHECK_RC(rc, "GetCapability", -1);
+    UINT32 fw1 = 0, fw2 = 0;
+    for (UINT32 i = 0; i < cap->data.tpmProperties.count; ++i) {
+        const TPMS_TAGGED_PROPERTY &prop = cap->data.tpmProperties.tpmProperty[i];
+        if (prop.property == TPM2_PT_MANUFACTURER)
+            profile->insert("manufacturer", vendorString(prop.value));
+        else if (prop.property == TPM2_PT_FIRMWARE_VERSION_1)
+            fw1 = prop.value;
+        else if (prop.property == TPM2_PT_FIRMWARE_VERSION_2)
+            fw2 = prop.value;
+    }
+    Esys_Free(cap);
+    profile->insert("firmware", QString("%1.%2.%3.%4")
+                                        .arg(fw1 >> 16).arg(fw1 & 0xffff)
+                                        .arg(fw2 >> 16).arg(fw2 & 0xffff));
+
+    // all the algorithms in one sweep, continued only if the tpm has more.
+    QStringList algos;
+    TPM2_ALG_ID next = TPM2_ALG_FIRST;
+    do {
+        rc = Esys_GetCapability(ctx, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+                                TPM2_CAP_ALGS, next, TPM2_MAX_CAP_ALGS, &more, &cap);
+        CHECK_RC(rc, "GetCapability", -1);
+        const TPML_ALG_PROPERTY &list = cap->data.algorithms;
+        for (UINT32 i = 0; i < list.count; ++i) {
+            const QString &name = algName(list.algProperties[i].alg);
+            if (!name.isEmpty())
+                algos.append(name);
+        }
+        if (list.count > 0)
+            next = TPM2_ALG_ID(list.algProperties[list.count - 1].alg + 1);
+        else
+            more = TPM2_NO;
+        Esys_Free(cap);
+    } while (more == TPM2_YES);
+
+    profile->insert("algorithms", algos);
+    return 0;
+}
+
+bool TPMEsys::startSession(TPM2_SE type, const QString &hashAlgo, const QString &keyAlgo, ESYS_TR *session)
+{
+    TPMT_SYM_DEF sym {};
+    sym.algorithm = symAlgId(keyAlgo);
+    sym.keyBits.sym = kSymKeyBits;
+    sym.mode.sym = TPM2_ALG_CFB;
+    TPM2_ALG_ID hash = hashAlgId(hashAlgo);
+    if (sym.algorithm == TPM2_ALG_ERROR || hash == TPM2_ALG_ERROR) {
+        qCritical() << "unsupported session algorithm" << hashAlgo << keyAlgo;
+        return false;
+    }
+
+    TSS2_RC rc = Esys_StartAuthSession(ctx, ESYS_TR_NONE, ESYS_TR_NONE,
+                                       ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+                                       nullptr, type, &sym, hash, session);
+    CHECK_RC(rc, "StartAuthSession", false);
+    transients.append(*session);
+
+    // the session is flushed by us, not by the tpm after its first use.
+    rc = Esys_TRSess_SetAttributes(ctx, *session, TPMA_SESSION_CONTINUESESSION, 0xff);
+    CHECK_RC(rc, "TRSess_SetAttributes", false);
+    return true;
+}
+
+bool TPMEsys::setAuth(ESYS_TR handle, const QString &pin)
+{
+    TPM2B_AUTH auth {};
+    const QByteArray &value = pin.toUtf8();
+    auth.size = quint16(qMin(size_t(value.size()), sizeof(auth.buffer)));
+    memcpy(auth.buffer, value.constData(), auth.size);
+    TSS2_RC rc = Esys_TR_SetAuth(ctx, handle, &auth);
+    memset(&auth, 0, sizeof(auth));
+    CHECK_RC(rc, "TR_SetAuth", false);
+    return true;
+}
+
+bool TPMEsys::applyPolicy(ESYS_TR session, TPMType type, const QString &pcr, const QString &pcrBank)
+{
+    if (hasPcrPolicy(type)) {
+        TPML_PCR_SELECTION sel;
+        if (!parsePcrSelection(pcr, pcrBank, &sel)) {
+            qCritical() << "invalid pcr selection" << pcrBank << pcr;
+            return false;
+        }
+        // an empty digest makes the tpm take the current pcr values.
+        TPM2B_DIGEST pcrDigest {};
+        TSS2_RC rc = Esys_PolicyPCR(ctx, session, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+                                    &pcrDigest, &sel);
+        CHECK_RC(rc, "PolicyPCR", false);
+    }
+
+    if (hasPinPolicy(type)) {
+        TSS2_RC rc = Esys_PolicyPassword(ctx, session, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE);
+        CHECK_RC(rc, "PolicyPassword", false);
+    }
+    return hasPcrPolicy(type) || hasPinPolicy(type);
+}
+
+bool TPMEsys::loadPrimary(const QString &dirPath, const QString &hashAlgo, const QString &keyAlgo, ESYS_TR *primary)
+{
+    TPM2B_PUBLIC expected;
+    if (!primaryTemplate(hashAlgo, keyAlgo, &expected))
+        return false;
+
+    // tokens handled in memory have no metadata, the handles are searched then.
+    QScopedPointer<QSettings> meta;
+    if (!dirPath.isEmpty()) {
+        meta.reset(new QSettings(dirPath + QDir::separator() + kAlgoFileName, QSettings::IniFormat));
+        bool ok = false;
+        TPM2_HANDLE handle = meta->value(kPrimaryHandleKey).toString().toUInt(&ok, 16);
+        if (ok && openPersistent(handle, expected.publicArea, primary))
+            return true;
+    }
+
+    // the primary of the same template is derived from the same seed, so it
+    // may have been persisted already for another device.
+    const QVector<TPM2_HANDLE> &used = persistentHandles();
+    for (TPM2_HANDLE handle : used) {
+        if (openPersistent(handle, expected.publicArea, primary)) {
+            if (meta)
+                meta->setValue(kPrimaryHandleKey, QString::number(handle, 16));
+            return true;
+        }
+    }
+
+    // the handle is missing, evicted by a tpm clear or holds another algorithm.
+    qInfo() << "regenerate tpm primary key of" << hashAlgo << keyAlgo;
+    if (!createPrimary(hashAlgo, keyAlgo, primary))
+        return false;
+
+    TPM2_HANDLE handle = persistPrimary(*primary, used);
+    if (handle != 0 && meta)
+        meta->setValue(kPrimaryHandleKey, QString::number(handle, 16));
+    return true;
+}
+
+bool TPMEsys::openPersistent(TPM2_HANDLE handle, const TPMT_PUBLIC &expected, ESYS_TR *primary)
+{
+    if (handle < kPersistentBase || handle >= kPersistentBase + kPersistentCount)
+        return false;
+
+    ESYS_TR obj { ESYS_TR_NONE };
+    TSS2_RC rc = Esys_TR_FromTPMPublic(ctx, handle, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &obj);
+    if (rc != TSS2_RC_SUCCESS)
+        return false;
+
+    TPM2B_PUBLIC *outPublic { nullptr };
+    TPM2B_NAME *name { nullptr };
+    TPM2B_NAME *qualifiedName { nullptr };
+    rc = Esys_ReadPublic(ctx, obj, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+                         &outPublic, &name, &qualifiedName);
+    const bool match = rc == TSS2_RC_SUCCESS && isSameTemplate(outPublic->publicArea, expected);
+    Esys_Free(outPublic);
+    Esys_Free(name);
+    Esys_Free(qualifiedName);
+    if (!match) {
+        Esys_TR_Close(ctx, &obj);
+        return false;
+    }
+
+    persistents.append(obj);
+    *primary = obj;
+    return true;
+}
+
+QVector<TPM2_HANDLE> TPMEsys::persistentHandles()
+{
+    TPMI_YES_NO more { TPM2_NO };
+    TPMS_CAPABILITY_DATA *cap { nullptr };
+    TSS2_RC rc = Esys_GetCapability(ctx, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+                                    TPM2_CAP_HANDLES, kPersistentBase, kPersistentCount,
+                                    &more, &cap);
+    CHECK_RC(rc, "GetCapability", {});
+    QVector<TPM2_HANDLE> handles;
+    for (UINT32 i = 0; i < cap->data.handles.count; ++i) {
+        if (cap->data.handles.handle[i] < kPersistentBase + kPersistentCount)
+            handles.append(cap->data.handles.handle[i]);
+    }
+    Esys_Free(cap);
+    return handles;
+}
+
+TPM2_HANDLE TPMEsys::persistPrimary(ESYS_TR primary, const QVector<TPM2_HANDLE> &used)
+{
+    TPM2_HANDLE handle = kPersistentBase;
+    while (used.contains(handle) && handle < kPersistentBase + kPersistentCount)
+        ++handle;
+    if (handle >= kPersistentBase + kPersistentCount) {
+        qWarning() << "no free persistent handle for tpm primary key";
+        return 0;
+    }
+
+    ESYS_TR obj { ESYS_TR_NONE };
+    TSS2_RC rc = Esys_EvictControl(ctx, ESYS_TR_RH_OWNER, primary, ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
+                                   handle, &obj);
+    if (rc != TSS2_RC_SUCCESS) {
+        // the key still works as a transient object for this time.
+        qWarning() << "esys EvictControl failed:" << QString::number(rc, 16);
+        return 0;
+    }
+    Esys_TR_Close(ctx, &obj);
+    return handle;
+}
+
+bool TPMEsys::createPrimary(const QString &hashAlgo, const QString &keyAlgo, ESYS_TR *primary)
+{
+    TPM2B_PUBLIC inPublic;
+    if (!primaryTemplate(hashAlgo, keyAlgo, &inPublic))
+        return false;
+
+    TPM2B_SENSITIVE_CREATE inSensitive {};
+    TPM2B_DATA outsideInfo {};
+    TPML_PCR_SELECTION creationPcr {};
+    TPM2B_PUBLIC *outPublic { nullptr };
+    TPM2B_CREATION_DATA *creationData { nullptr };
+    TPM2B_DIGEST *creationHash { nullptr };
+    TPMT_TK_CREATION *creationTicket { nullptr };
+    TSS2_RC rc = Esys_CreatePrimary(ctx, ESYS_TR_RH_OWNER, ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
+                                    &inSensitive, &inPublic, &outsideInfo, &creationPcr,
+                                    primary, &outPublic, &creationData, &creationHash, &creationTicket);
+    Esys_Free(outPublic);
+    Esys_Free(creationData);
+    Esys_Free(creationHash);
+    Esys_Free(creationTicket);
+    CHECK_RC(rc, "CreatePrimary", false);
+    transients.append(*primary);
+    return true;
+}
+
+bool TPMEsys::createKey(ESYS_TR primary, const QString &hashAlgo, const QString &keyAlgo,
+                        const TPM2B_DIGEST &policy, const QString &pin,
+                        QByteArray *pub, QByteArray *priv)
+{
+    TPM2B_PUBLIC inPublic {};
+    TPMT_PUBLIC &area = inPublic.publicArea;
+    area.type = TPM2_ALG_SYMCIPHER;
+    area.nameAlg = hashAlgId(hashAlgo);
+    area.parameters.symDetail.sym = symDef(symAlgId(keyAlgo));
+    area.authPolicy = policy;
+    // the key is usable only by satisfying the policy.
+    area.objectAttributes = TPMA_OBJECT_FIXEDTPM | TPMA_OBJECT_FIXEDPARENT
+            | TPMA_OBJECT_SENSITIVEDATAORIGIN | TPMA_OBJECT_DECRYPT | TPMA_OBJECT_SIGN_ENCRYPT;
+    if (area.nameAlg == TPM2_ALG_ERROR || area.parameters.symDetail.sym.algorithm == TPM2_ALG_ERROR) {
+        qCritical() << "unsupported key algorithm" << hashAlgo << keyAlgo;
+        return false;
+    }
+
+    TPM2B_SENSITIVE_CREATE inSensitive {};
+    const QByteArray &auth = pin.toUtf8();
+    inSensitive.sensitive.userAuth.size = quint16(qMin(size_t(auth.size()), sizeof(inSensitive.sensitive.userAuth.buffer)));
+    memcpy(inSensitive.sensitive.userAuth.buffer, auth.constData(), inSensitive.sensitive.userAuth.size);
+
+    TPM2B_DATA outsideInfo {};
+    TPML_PCR_SELECTION creationPcr {};
+    TPM2B_PRIVATE *outPrivate { nullptr };
+    TPM2B_PUBLIC *outPublic { nullptr };
+    TPM2B_CREATION_DATA *creationData { nullptr };
+    TPM2B_DIGEST *creationHash { nullptr };
+    TPMT_TK_CREATION *creationTicket { nullptr };
+    TSS2_RC rc = Esys_Create(ctx, primary, ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
+                             &inSensitive, &inPublic, &outsideInfo, &creationPcr,
+                             &outPrivate, &outPublic, &creationData, &creationHash, &creationTicket);
+    memset(&inSensitive, 0, sizeof(inSensitive));
+    Esys_Free(creationData);
+    Esys_Free(creationHash);
+    Esys_Free(creationTicket);
+    if (rc != TSS2_RC_SUCCESS) {
+        Esys_Free(outPrivate);
+        Esys_Free(outPublic);
+    }
+    CHECK_RC(rc, "Create", false);
+
+    // the marshalled form, same as the default output of tpm2_create.
+    uint8_t buf[sizeof(TPM2B_PUBLIC) + sizeof(TPM2B_PRIVATE)];
+    size_t pubSize = 0, privSize = 0;
+    TSS2_RC pubRc = Tss2_MU_TPM2B_PUBLIC_Marshal(outPublic, buf, sizeof(buf), &pubSize);
+    if (pubRc == TSS2_RC_SUCCESS)
+        *pub = QByteArray(reinterpret_cast<const char *>(buf), int(pubSize));
+    TSS2_RC privRc = Tss2_MU_TPM2B_PRIVATE_Marshal(outPrivate, buf, sizeof(buf), &privSize);
+    if (privRc == TSS2_RC_SUCCESS)
+        *priv = QByteArray(reinterpret_cast<const char *>(buf), int(privSize));
+    Esys_Free(outPrivate);
+    Esys_Free(outPublic);
+    CHECK_RC(pubRc, "marshal public", false);
+    CHECK_RC(privRc, "marshal private", false);
+    return true;
+}
+
+bool TPMEsys::loadKey(ESYS_TR primary, const QByteArray &pub, const QByteArray &priv, ESYS_TR *key)
+{
+    TPM2B_PUBLIC inPublic {};
+    TPM2B_PRIVATE inPrivate {};
+    size_t offset = 0;
+    TSS2_RC rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(reinterpret_cast<const uint8_t *>(pub.constData()),
+                                                size_t(pub.size()), &offset, &inPublic);
+    CHECK_RC(rc, "unmarshal public", false);
+    offset = 0;
+    rc = Tss2_MU_TPM2B_PRIVATE_Unmarshal(reinterpret_cast<const uint8_t *>(priv.constData()),
+                                         size_t(priv.size()), &offset, &inPrivate);
+    CHECK_RC(rc, "unmarshal private", false);
+
+    rc = Esys_Load(ctx, primary, ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE,
+                   &inPrivate, &inPublic, key);
+    CHECK_RC(rc, "Load", false);
+    transients.append(*key);
+    return true;
+}
+
+bool TPMEsys::encryptDecrypt(ESYS_TR key, ESYS_TR session, bool decrypt, const QByteArray &iv,
+                             const QByteArray &in, QByteArray *out)
+{
+    TPM2B_MAX_BUFFER inData {};
+    TPM2B_IV ivIn {};
+    if (size_t(in.size()) > sizeof(inData.buffer) || size_t(iv.size()) > sizeof(ivIn.buffer)) {
+        qCritical() << "data is too large for tpm" << in.size() << iv.size();
+        return false;
+    }
+    inData.size = quint16(in.size());
+    memcpy(inData.buffer, in.constData(), inData.size);
+    ivIn.size = quint16(iv.size());
+    memcpy(ivIn.buffer, iv.constData(), ivIn.size);
+
+    TPM2B_MAX_BUFFER *outData { nullptr };
+    TPM2B_IV *ivOut { nullptr };
+    TSS2_RC rc = Esys_EncryptDecrypt2(ctx, key, session, ESYS_TR_NONE, ESYS_TR_NONE,
+                                      &inData, decrypt ? TPM2_YES : TPM2_NO, TPM2_ALG_NULL, &ivIn,
+                                      &outData, &ivOut);
+    memset(&inData, 0, sizeof(inData));
+    Esys_Free(ivOut);
+    CHECK_RC(rc, "EncryptDecrypt2", false);
+    *out = QByteArray(reinterpret_cast<const char *>(outData->buffer), outData->size);
+    memset(outData->buffer, 0, outData->size);
+    Esys_Free(outData);
+    return true;
+}
+
+bool TPMEsys::getRandom(int size, QByteArray *out)
+{
+    out->clear();
+    while (out->size() < size) {
+        TPM2B_DIGEST *bytes { nullptr };
+        TSS2_RC rc = Esys_GetRandom(ctx, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+                                    UINT16(size - out->size()), &bytes);
+        CHECK_RC(rc, "GetRandom", false);
+        // the tpm returns at most a digest size each time.
+        const bool empty = bytes->size == 0;
+        out->append(reinterpret_cast<const char *>(bytes->buffer), bytes->size);
+        Esys_Free(bytes);
+        if (empty)
+            return false;
+    }
+    return true;
+}
+
+void TPMEsys::flush(ESYS_TR handle)
+{
+    if (handle == ESYS_TR_NONE)
+        return;
+    transients.removeAll(handle);
+    TSS2_RC rc = Esys_FlushContext(ctx, handle);
+    if (rc != TSS2_RC_SUCCESS)
+        qWarning() << "esys FlushContext failed:" << QString::number(rc, 16);
+}
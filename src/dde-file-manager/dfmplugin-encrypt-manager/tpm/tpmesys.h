@@ -0,0 +1,65 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TPMESYS_H
+#define TPMESYS_H
+
+#include "encrypt_manager_global.h"
+
+#include <QByteArray>
+#include <QVariantMap>
+#include <QVector>
+
+#include <tss2/tss2_esys.h>
+
+namespace dfmplugin_encrypt_manager {
+
+// runs the tpm2-tools workflow of the *ByTools api in process with the tss2
+// enhanced system api. the tpm is opened once per instance, sessions and
+// objects are kept as handles in memory and flushed when it's destroyed.
+// the files in dirPath are the same as the tools produce, so keys sealed by
+// either backend can be unsealed by the other one.
+// the primary key is kept under a persistent handle of the owner hierarchy,
+// which is recorded in algo.ini, so it's created only once for an algorithm.
+class TPMEsys
+{
+public:
+    TPMEsys();
+    ~TPMEsys();
+    Q_DISABLE_COPY(TPMEsys)
+
+    inline bool isValid() const { return ctx != nullptr; }
+
+    int encrypt(const EncryptParams &params);
+    int decrypt(const DecryptParams &params, QString *pwd);
+    int decrypt(const DecryptParams &params, const TokenData &data, QString *pwd);
+    int algoProfile(QVariantMap *profile);
+    int prewarm(const QString &primaryHashAlgo, const QString &primaryKeyAlgo);
+    bool getRandom(int size, QByteArray *out);
+
+private:
+    bool startSession(TPM2_SE type, const QString &hashAlgo, const QString &keyAlgo, ESYS_TR *session);
+    bool setAuth(ESYS_TR handle, const QString &pin);
+    bool applyPolicy(ESYS_TR session, TPMType type, const QString &pcr, const QString &pcrBank);
+    bool loadPrimary(const QString &dirPath, const QString &hashAlgo, const QString &keyAlgo, ESYS_TR *primary);
+    bool openPersistent(TPM2_HANDLE handle, const TPMT_PUBLIC &expected, ESYS_TR *primary);
+    QVector<TPM2_HANDLE> persistentHandles();
+    TPM2_HANDLE persistPrimary(ESYS_TR primary, const QVector<TPM2_HANDLE> &used);
+    bool createPrimary(const QString &hashAlgo, const QString &keyAlgo, ESYS_TR *primary);
+    bool createKey(ESYS_TR primary, const QString &hashAlgo, const QString &keyAlgo,
+                   const TPM2B_DIGEST &policy, const QString &pin,
+                   QByteArray *pub, QByteArray *priv);
+    bool loadKey(ESYS_TR primary, const QByteArray &pub, const QByteArray &priv, ESYS_TR *key);
+    bool encryptDecrypt(ESYS_TR key, ESYS_TR session, bool decrypt, const QByteArray &iv,
+                        const QByteArray &in, QByteArray *out);
+    void flush(ESYS_TR handle);
+
+    ESYS_CONTEXT *ctx { nullptr };
+    QVector<ESYS_TR> transients;
+    QVector<ESYS_TR> persistents;
+};
+
+}
+
+#endif   // TPMESYS_H
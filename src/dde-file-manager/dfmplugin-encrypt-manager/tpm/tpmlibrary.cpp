@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "tpmlibrary.h"
+
+#include <QLibrary>
+#include <QDebug>
+
+#include <type_traits>
+
+inline constexpr char kTpmLibName[] { "libutpm2.so" };
+
+DPENCRYPTMANAGER_USE_NAMESPACE
+
+const TPMLibrary *TPMLibrary::instance()
+{
+    static TPMLibrary ins;
+    return &ins;
+}
+
+TPMLibrary::TPMLibrary()
+    : lib(new QLibrary(kTpmLibName))
+{
+    loaded = lib->load();
+    if (!loaded) {
+        qWarning() << "Vault: load utpm2 failed, the error is " << lib->errorString();
+        return;
+    }
+
+    auto resolve = [this](auto *fn, const char *name) {
+        *fn = reinterpret_cast<std::remove_pointer_t<decltype(fn)>>(lib->resolve(name));
+        if (!*fn)
+            qWarning() << "resolve" << name << "failed!";
+    };
+    resolve(&getRandom, "utpm2_get_random");
+    resolve(&checkAlgo, "utpm2_check_alg");
+    resolve(&init, "utpm2_init");
+    resolve(&encryptDecrypt, "utpm2_encrypt_decrypt");
+    resolve(&checkTpmByTools, "utpm2_check_tpm_by_tools");
+    resolve(&getRandomByTools, "utpm2_get_random_by_tools");
+    resolve(&checkAlgoByTools, "utpm2_check_alg_by_tools");
+    resolve(&encryptByTools, "utpm2_encrypt_by_tools");
+    resolve(&decryptByTools, "utpm2_decrypt_by_tools");
+}
+
+TPMLibrary::~TPMLibrary()
+{
+    // the library stays loaded until the process exits, the resolved entries
+    // may be in use by other plugin threads.
+    delete lib;
+    lib = nullptr;
+}
@@ -0,0 +1,104 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TPMLIBRARY_H
+#define TPMLIBRARY_H
+
+#include "encrypt_manager_global.h"
+
+#include <cstdint>
+
+QT_BEGIN_NAMESPACE
+class QLibrary;
+QT_END_NAMESPACE
+
+namespace dfmplugin_encrypt_manager {
+
+typedef enum {
+    kCTpmAndPcr,
+    kCTpmAndPin,
+    kCTpmAndPcrAndPin
+} TpmProType;
+
+typedef struct
+{
+    TpmProType type;
+    char *sessionHashAlgo;
+    char *sessionKeyAlgo;
+    char *primaryHashAlgo;
+    char *primaryKeyAlgo;
+    char *minorHashAlgo;
+    char *minorKeyAlgo;
+    char *dirPath;
+    char *plain;
+
+    char *pinCode;
+
+    char *pcr;
+    char *pcr_bank;
+} Utpm2EncryptParamsByTools;
+
+typedef struct
+{
+    TpmProType type;
+    char *sessionHashAlgo;
+    char *sessionKeyAlgo;
+    char *primaryHashAlgo;
+    char *primaryKeyAlgo;
+    char *dirPath;
+
+    char *pinCode;
+
+    char *pcr;
+    char *pcr_bank;
+} Utpm2DecryptParamsByTools;
+
+// the entry points of libutpm2, they are resolved once when the plugin is
+// loaded, a null entry means the library or the symbol is missing.
+class TPMLibrary
+{
+public:
+    static const TPMLibrary *instance();
+
+    typedef bool (*FnGetRandom)(uint16_t *size, uint8_t ranbytes[]);
+    typedef bool (*FnCheckAlgo)(const char *alg);
+    typedef bool (*FnInit)(char *algdetail, char *galg, const char *auth, const char *dir);
+    typedef int (*FnEncryptDecrypt)(const char *dir, bool isdecrypt, const char *auth,
+                                    uint8_t inbytes[], uint8_t outbytes[], uint16_t *size);
+    typedef int (*FnCheckTpmByTools)(void);
+    typedef int (*FnGetRandomByTools)(int size, char *buf);
+    typedef int (*FnCheckAlgoByTools)(const char *algo_name, bool *support);
+    typedef int (*FnEncryptByTools)(const Utpm2EncryptParamsByTools *par);
+    typedef int (*FnDecryptByTools)(const Utpm2DecryptParamsByTools *par, char *pwd, int *len);
+
+    FnGetRandom getRandom { nullptr };
+    FnCheckAlgo checkAlgo { nullptr };
+    FnInit init { nullptr };
+    FnEncryptDecrypt encryptDecrypt { nullptr };
+    FnCheckTpmByTools checkTpmByTools { nullptr };
+    FnGetRandomByTools getRandomByTools { nullptr };
+    FnCheckAlgoByTools checkAlgoByTools { nullptr };
+    FnEncryptByTools encryptByTools { nullptr };
+    FnDecryptByTools decryptByTools { nullptr };
+
+    inline bool isLoaded() const { return loaded; }
+    inline bool hasLibApi() const { return getRandom && checkAlgo && init && encryptDecrypt; }
+    inline bool hasToolsApi() const
+    {
+        return checkTpmByTools && getRandomByTools && checkAlgoByTools
+                && encryptByTools && decryptByTools;
+    }
+
+private:
+    TPMLibrary();
+    ~TPMLibrary();
+    Q_DISABLE_COPY(TPMLibrary)
+
+    QLibrary *lib { nullptr };
+    bool loaded { false };
+};
+
+}
+
+#endif   // TPMLIBRARY_H
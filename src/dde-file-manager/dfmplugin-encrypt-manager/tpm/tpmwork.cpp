@@ -3,75 +3,31 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "tpmwork.h"
+#include "tpmlibrary.h"
+#include "tpmesys.h"
 
-#include <QLibrary>
 #include <QDebug>
 #include <QFile>
 #include <QDir>
 
-typedef enum {
-  kCTpmAndPcr,
-  kCTpmAndPin,
-  kCTpmAndPcrAndPin
-} TpmProType;
-
-typedef struct {
-    TpmProType type;
-    char *sessionHashAlgo;
-    char *sessionKeyAlgo;
-    char *primaryHashAlgo;
-    char *primaryKeyAlgo;
-    char *minorHashAlgo;
-    char *minorKeyAlgo;
-    char *dirPath;
-    char *plain;
-
-    char *pinCode;
-
-    char *pcr;
-    char *pcr_bank;
-} Utpm2EncryptParamsByTools;
-
-typedef struct {
-    TpmProType type;
-    char *sessionHashAlgo;
-    char *sessionKeyAlgo;
-    char *primaryHashAlgo;
-    char *primaryKeyAlgo;
-    char *dirPath;
-
-    char *pinCode;
-
-    char *pcr;
-    char *pcr_bank;
-} Utpm2DecryptParamsByTools;
-
 inline constexpr int kTpmOutTextMaxSize { 3000 };
-inline constexpr char kTpmLibName[] { "libutpm2.so" };
 inline constexpr char kTpmEncryptFileName[] { "tpm_encrypt.txt" };
 
 DPENCRYPTMANAGER_USE_NAMESPACE
 
 TPMWork::TPMWork(QObject *parent)
-    : QObject(parent)
-    , tpmLib(new QLibrary(kTpmLibName))
+    : QObject(parent),
+      lib(TPMLibrary::instance())
 {
-    if (!tpmLib->load())
-        qWarning() << "Vault: load utpm2 failed, the error is " << tpmLib->errorString();
 }
 
 TPMWork::~TPMWork()
 {
-    if (tpmLib) {
-        tpmLib->unload();
-        delete tpmLib;
-        tpmLib = nullptr;
-    }
 }
 
 bool TPMWork::checkTPMAvailable()
 {
-    if (!tpmLib->isLoaded())
+    if (!lib->hasLibApi())
         return false;
 
     QString output;
@@ -80,7 +36,7 @@ bool TPMWork::checkTPMAvailable()
 
 bool TPMWork::getRandom(int size, QString *output)
 {
-    if (!tpmLib->isLoaded())
+    if (!lib->isLoaded())
         return false;
 
     if (size % 2 != 0 || size < 2 || size > 64) {
@@ -88,13 +44,11 @@ bool TPMWork::getRandom(int size, QString *output)
         return false;
     }
 
-    typedef bool (*p_get_random)(uint16_t *size, uint8_t ranbytes[]);
-    p_get_random utpm2_get_random = (p_get_random) tpmLib->resolve("utpm2_get_random");
-    if (utpm2_get_random) {
+    if (lib->getRandom) {
         uint16_t len = size / 2;
         uint8_t *random = (uint8_t *)malloc(sizeof(uint8_t) * len);
         memset(random, 0, sizeof(uint8_t) * len);
-        if (utpm2_get_random(&len, random)) {
+        if (lib->getRandom(&len, random)) {
             char *out = (char *)malloc(sizeof(uint8_t) * size + 1);
             memset(out, 0, sizeof(uint8_t) * size + 1);
             for (size_t i = 0; i < len; ++i) {
@@ -111,14 +65,12 @@ bool TPMWork::getRandom(int size, QString *output)
 
 bool TPMWork::isSupportAlgo(const QString &algoName, bool *support)
 {
-    if (!tpmLib->isLoaded())
+    if (!lib->isLoaded())
         return false;
 
-    typedef bool (*p_check_algo)(const char *alg);
-    p_check_algo utpm2_check_algo = (p_check_algo) tpmLib->resolve("utpm2_check_alg");
-    if (utpm2_check_algo) {
+    if (lib->checkAlgo) {
         QByteArray arAlgoName = algoName.toUtf8();
-        if (utpm2_check_algo(arAlgoName.data())) {
+        if (lib->checkAlgo(arAlgoName.data())) {
             *support = true;
         } else {
             *support = false;
@@ -131,17 +83,15 @@ bool TPMWork::isSupportAlgo(const QString &algoName, bool *support)
 
 bool TPMWork::initTpm2(const QString &hashAlgo, const QString &keyAlgo, const QString &keyPin, const QString &dirPath)
 {
-    if (!tpmLib->isLoaded())
+    if (!lib->isLoaded())
         return false;
 
-    typedef bool (*p_init)(char *algdetail, char *galg, const char *auth, const char *dir);
-    p_init utpm2_init = (p_init)tpmLib->resolve("utpm2_init");
-    if (utpm2_init) {
+    if (lib->init) {
         QByteArray arKeyAlgo = keyAlgo.toUtf8();
         QByteArray arHashAlgo = hashAlgo.toUtf8();
         QByteArray arKeyPin = keyPin.toUtf8();
         QByteArray arDir = dirPath.toUtf8();
-        if (utpm2_init(arKeyAlgo.data(), arHashAlgo.data(), arKeyPin.data(), arDir.data())) {
+        if (lib->init(arKeyAlgo.data(), arHashAlgo.data(), arKeyPin.data(), arDir.data())) {
             return true;
         } else {
             qCritical() << "Vault: utpm2_init return false!";
@@ -158,16 +108,14 @@ bool TPMWork::encrypt(const QString &hashAlgo, const QString &keyAlgo, const QSt
         return false;
     }
 
-    typedef int (*p_encrypt_decrypt)(const char *dir, bool isdecrypt, const char *auth, uint8_t inbytes[], uint8_t outbytes[], uint16_t *size);
-    p_encrypt_decrypt utpm2_encrypt_decrypt = (p_encrypt_decrypt) tpmLib->resolve("utpm2_encrypt_decrypt");
-    if (utpm2_encrypt_decrypt) {
+    if (lib->encryptDecrypt) {
         QByteArray arDir = dirPath.toUtf8();
         QByteArray arKeyPin = keyPin.toUtf8();
         QByteArray arrPassword = password.toUtf8();
         uint16_t len = static_cast<uint16_t>(arrPassword.size());
         uint8_t *inbuffer = reinterpret_cast<uint8_t*>(arrPassword.data());
         uint8_t out_text[kTpmOutTextMaxSize] = { 0 };
-        if (utpm2_encrypt_decrypt(arDir.data(), false, arKeyPin.data(), inbuffer, out_text, &len)) {
+        if (lib->encryptDecrypt(arDir.data(), false, arKeyPin.data(), inbuffer, out_text, &len)) {
             QFile file(dirPath + QDir::separator() + kTpmEncryptFileName);
             if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
                 file.write(reinterpret_cast<const char*>(out_text), len);
@@ -187,12 +135,10 @@ bool TPMWork::encrypt(const QString &hashAlgo, const QString &keyAlgo, const QSt
 
 bool TPMWork::decrypt(const QString &keyPin, const QString &dirPath, QString *psw)
 {
-    if (!tpmLib->isLoaded())
+    if (!lib->isLoaded())
         return false;
 
-    typedef int (*p_encrypt_decrypt)(const char *dir, bool isdecrypt, const char *auth, uint8_t inbytes[], uint8_t outbytes[], uint16_t *size);
-    p_encrypt_decrypt utpm2_encrypt_decrypt = (p_encrypt_decrypt) tpmLib->resolve("utpm2_encrypt_decrypt");
-    if (utpm2_encrypt_decrypt) {
+    if (lib->encryptDecrypt) {
         QByteArray arDir = QString(dirPath).toUtf8();
         QByteArray arKeyPin = keyPin.toUtf8();
         QFile file(dirPath + QDir::separator() + kTpmEncryptFileName);
@@ -202,7 +148,7 @@ bool TPMWork::decrypt(const QString &keyPin, const QString &dirPath, QString *ps
             uint16_t len = static_cast<uint16_t>(ciphertext.size());
             uint8_t out_text[kTpmOutTextMaxSize] = { 0 };
             uint8_t *inbuffer = reinterpret_cast<uint8_t*>(ciphertext.data());
-            if (utpm2_encrypt_decrypt(arDir.data(), true, arKeyPin.data(), inbuffer, out_text, &len)) {
+            if (lib->encryptDecrypt(arDir.data(), true, arKeyPin.data(), inbuffer, out_text, &len)) {
                 *psw = QString::fromUtf8(reinterpret_cast<const char*>(out_text), len);
                 return true;
             } else {
@@ -219,65 +165,68 @@ bool TPMWork::decrypt(const QString &keyPin, const QString &dirPath, QString *ps
 
 int TPMWork::checkTPMAvailbableByTools()
 {
-    if (!tpmLib->isLoaded())
-        return -1;
-
-    typedef int (*p_utpm2_check_tpm_by_tools)(void);
-    p_utpm2_check_tpm_by_tools utpm2_check_tpm_by_tools = (p_utpm2_check_tpm_by_tools) tpmLib->resolve("utpm2_check_tpm_by_tools");
-    if (!utpm2_check_tpm_by_tools) {
-        qCritical() << "resolve utpm2_check_tpm_by_tools failed!";
+    if (!lib->checkTpmByTools)
         return -1;
-    }
 
-    return utpm2_check_tpm_by_tools();
+    return lib->checkTpmByTools();
 }
 
 int TPMWork::getRandomByTools(int size, QString *output)
 {
-    if (!tpmLib->isLoaded())
+    if (!lib->getRandomByTools)
         return -1;
 
-    typedef int (*p_utpm2_get_random_by_tools)(int size, char *buf);
-    p_utpm2_get_random_by_tools utpm2_get_random_by_tools = (p_utpm2_get_random_by_tools) tpmLib->resolve("utpm2_get_random_by_tools");
-    if (!utpm2_get_random_by_tools) {
-        qCritical() << "resolve utpm2_get_random_by_tools failed!";
-        return -1;
-    }
-
     char buf[129] = { 0 };
-    int re = utpm2_get_random_by_tools(size, buf);
+    int re = lib->getRandomByTools(size, buf);
     *output = QString::fromLatin1(buf);
     return re;
 }
 
 int TPMWork::isSupportAlgoByTools(const QString &algoName, bool *support)
 {
-    if (!tpmLib->isLoaded())
+    if (!lib->checkAlgoByTools)
         return -1;
 
-    typedef int (*p_utpm2_check_alg_by_tools)(const char *algo_name,  bool *support);
-    p_utpm2_check_alg_by_tools utpm2_check_alg_by_tools = (p_utpm2_check_alg_by_tools) tpmLib->resolve("utpm2_check_alg_by_tools");
-    if (!utpm2_check_alg_by_tools) {
-        qCritical() << "resolve utpm2_check_alg_by_tools failed!";
-        return -1;
-    }
-
     QByteArray algo = algoName.toUtf8();
-    int re = utpm2_check_alg_by_tools(algo.data(), support);
+    int re = lib->checkAlgoByTools(algo.data(), support);
     return re;
 }
 
+int TPMWork::algoProfileByTools(const QStringList &candidates, QVariantMap *profile)
+{
+    {
+        TPMEsys esys;
+        if (esys.isValid() && esys.algoProfile(profile) == 0)
+            return 0;
+        qWarning() << "esys capability query failed, fall back to tpm2-tools";
+    }
+
+    // the tools check algorithms one by one, so only the candidates are checked.
+    QStringList algos;
+    for (const auto &algo : candidates) {
+        bool support = false;
+        int re = isSupportAlgoByTools(algo, &support);
+        if (re != 0)
+            return re;
+        if (support)
+            algos.append(algo);
+    }
+    profile->insert("algorithms", algos);
+    return 0;
+}
+
 int TPMWork::encryptByTools(const EncryptParams &params)
 {
-    if (!tpmLib->isLoaded())
-        return -1;
+    // the in process backend saves the process and file round trips of tools.
+    {
+        TPMEsys esys;
+        if (esys.isValid() && esys.encrypt(params) == 0)
+            return 0;
+        qWarning() << "esys encrypt failed, fall back to tpm2-tools";
+    }
 
-    typedef int (*utpm2_encrypt_by_tools)(const Utpm2EncryptParamsByTools *par);
-    utpm2_encrypt_by_tools func = (utpm2_encrypt_by_tools)tpmLib->resolve("utpm2_encrypt_by_tools");
-    if (!func) {
-        qCritical() << "resolve utpm2_encrypt_by_tools failed!";
+    if (!lib->encryptByTools)
         return -1;
-    }
 
     Utpm2EncryptParamsByTools pa;
     if (params.type == kTpmAndPcr) {
@@ -315,7 +264,7 @@ int TPMWork::encryptByTools(const EncryptParams &params)
     QByteArray arrPcrBank = params.pcr_bank.toUtf8();
     pa.pcr_bank = arrPcrBank.data();
 
-    int re = func(&pa);
+    int re = lib->encryptByTools(&pa);
     if (re != 0) {
         qCritical() << "utpm2_encrypt_by_tools return false!";
     }
@@ -325,15 +274,15 @@ int TPMWork::encryptByTools(const EncryptParams &params)
 
 int TPMWork::decryptByTools(const DecryptParams &params, QString *pwd)
 {
-    if (!tpmLib->isLoaded())
-        return -1;
+    {
+        TPMEsys esys;
+        if (esys.isValid() && esys.decrypt(params, pwd) == 0)
+            return 0;
+        qWarning() << "esys decrypt failed, fall back to tpm2-tools";
+    }
 
-    typedef int (*utpm2_decrypt_by_tools)(const Utpm2DecryptParamsByTools *par, char *pwd, int *len);
-    utpm2_decrypt_by_tools fun = (utpm2_decrypt_by_tools) tpmLib->resolve("utpm2_decrypt_by_tools");
-    if (!fun) {
-        qCritical() << "resolve utpm2_encry_decrypt failed!";
+    if (!lib->decryptByTools)
         return -1;
-    }
 
     Utpm2DecryptParamsByTools pa;
     if (params.type == kTpmAndPcr) {
@@ -366,7 +315,7 @@ int TPMWork::decryptByTools(const DecryptParams &params, QString *pwd)
 
     char password[128] = { 0 };
     int length = sizeof(password) - 1;
-    int re = fun(&pa, password, &length);
+    int re = lib->decryptByTools(&pa, password, &length);
     if (re != 0) {
         qCritical() << "utpm2_encry_decrypt return failed!";
     }
@@ -374,3 +323,60 @@ int TPMWork::decryptByTools(const DecryptParams &params, QString *pwd)
 
     return re;
 }
+
+int TPMWork::decryptToken(const DecryptParams &params, const TokenData &data, QString *pwd)
+{
+    // the tools only work with files, the callers fall back to them.
+    TPMEsys esys;
+    if (!esys.isValid())
+        return kNoTokenBackend;
+
+    return esys.decrypt(params, data, pwd);
+}
+
+int TPMWork::prewarm(const QString &primaryHashAlgo, const QString &primaryKeyAlgo)
+{
+    TPMEsys esys;
+    if (!esys.isValid())
+        return kNoTokenBackend;
+
+    return esys.prewarm(primaryHashAlgo, primaryKeyAlgo);
+}
+
+int TPMWork::getEntropy(const QVariantMap &request, QVariantMap *slices)
+{
+    int total = 0;
+    for (const auto &size : request) {
+        if (size.toInt() <= 0)
+            return -1;
+        total += size.toInt();
+    }
+
+    // all the material is read in one context, then cut in the key order.
+    QByteArray random;
+    {
+        TPMEsys esys;
+        if (!esys.isValid() || !esys.getRandom(total, &random)) {
+            qWarning() << "esys getrandom failed, fall back to tpm2-tools";
+            random.clear();
+        }
+    }
+
+    // the tools return hex string of at most 64 chars each time.
+    while (random.size() < total) {
+        QString hex;
+        int len = qMin(32, total - random.size());
+        if (getRandomByTools(len * 2, &hex) != 0 || hex.size() != len * 2)
+            return -1;
+        random.append(QByteArray::fromHex(hex.toLatin1()));
+    }
+
+    int offset = 0;
+    for (auto iter = request.cbegin(); iter != request.cend(); ++iter) {
+        int len = iter.value().toInt();
+        slices->insert(iter.key(), random.mid(offset, len));
+        offset += len;
+    }
+    random.fill('\0');
+    return 0;
+}
@@ -8,12 +8,10 @@
 #include "encrypt_manager_global.h"
 
 #include <QObject>
-
-QT_BEGIN_NAMESPACE
-class QLibrary;
-QT_END_NAMESPACE
+#include <QVariantMap>
 
 namespace dfmplugin_encrypt_manager {
+class TPMLibrary;
 
 class TPMWork : public QObject
 {
@@ -32,14 +30,18 @@ public:
     int checkTPMAvailbableByTools();
     int getRandomByTools(int size, QString *output);
     int isSupportAlgoByTools(const QString &algoName, bool *support);
+    int algoProfileByTools(const QStringList &candidates, QVariantMap *profile);
     int encryptByTools(const EncryptParams &params);
     int decryptByTools(const DecryptParams &params, QString *pwd);
+    int decryptToken(const DecryptParams &params, const TokenData &data, QString *pwd);
+    int prewarm(const QString &primaryHashAlgo, const QString &primaryKeyAlgo);
+    int getEntropy(const QVariantMap &request, QVariantMap *slices);
 
 private:
     bool initTpm2(const QString &hashAlgo, const QString &keyAlgo,
                   const QString &keyPin, const QString &dirPath);
 
-    QLibrary *tpmLib { nullptr };
+    const TPMLibrary *lib { nullptr };
 
 };
 
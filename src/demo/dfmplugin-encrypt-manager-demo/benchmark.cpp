@@ -0,0 +1,217 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "benchmark.h"
+
+#include <QDir>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QDebug>
+
+#include <dfm-framework/event/event.h>
+
+#include <algorithm>
+#include <cmath>
+
+Q_DECLARE_METATYPE(QString *)
+Q_DECLARE_METATYPE(bool *)
+
+inline constexpr char kPluginName[] { "dfmplugin_encrypt_manager" };
+inline constexpr char kBenchPin[] { "pin123456" };
+inline constexpr char kBenchPassword[] { "Qwer@1234" };
+inline constexpr int kRandomSize { 14 };
+
+Benchmark::Benchmark(int iterations, const QString &workDir)
+    : iterations(iterations),
+      workDir(workDir)
+{
+}
+
+int Benchmark::exec()
+{
+    if (iterations <= 0) {
+        qCritical() << "Benchmark: invalid iteration count" << iterations;
+        return -1;
+    }
+
+    // the keys are sealed into a scratch dir, which is removed afterwards.
+    QTemporaryDir tmp(QDir(workDir.isEmpty() ? QDir::tempPath() : workDir).filePath("tpm-benchmark-XXXXXX"));
+    if (!tmp.isValid()) {
+        qCritical() << "Benchmark: cannot create work dir:" << tmp.errorString();
+        return -1;
+    }
+
+    const QString &libDir = tmp.filePath("library");
+    const QString &proDir = tmp.filePath("pro");
+    QDir().mkpath(libDir);
+    QDir().mkpath(proDir);
+
+    runLibrary(libDir);
+    runPro(proDir);
+    report();
+
+    for (const auto &result : results) {
+        if (result.failed > 0)
+            return 1;
+    }
+    return 0;
+}
+
+void Benchmark::measure(const QString &backend, const QString &operation, const std::function<bool()> &func)
+{
+    Result result;
+    result.backend = backend;
+    result.operation = operation;
+    result.samples.reserve(iterations);
+
+    QElapsedTimer timer;
+    for (int i = 0; i < iterations; ++i) {
+        timer.start();
+        bool ok = func();
+        qint64 ns = timer.nsecsElapsed();
+        if (!ok) {
+            ++result.failed;
+            continue;
+        }
+        result.samples.append(ns / 1000000.0);
+    }
+
+    if (result.failed > 0)
+        qWarning() << "Benchmark:" << backend << operation << "failed" << result.failed << "times";
+    results.append(result);
+}
+
+void Benchmark::runLibrary(const QString &dirPath)
+{
+    const QString backend("library");
+    measure(backend, "check", [] {
+        return dpfSlotChannel->push(kPluginName, "slot_TPMIsAvailable").toBool();
+    });
+    measure(backend, "random", [] {
+        QString out;
+        return dpfSlotChannel->push(kPluginName, "slot_GetRandomByTPM", kRandomSize, &out).toBool();
+    });
+    measure(backend, "algo", [] {
+        bool support { false };
+        return dpfSlotChannel->push(kPluginName, "slot_IsTPMSupportAlgo", QString("sm4"), &support).toBool();
+    });
+    measure(backend, "encrypt", [dirPath] {
+        return dpfSlotChannel->push(kPluginName, "slot_EncryptByTPM", QString("sha256"), QString("aes"),
+                                    QString(kBenchPin), QString(kBenchPassword), dirPath)
+                .toBool();
+    });
+    measure(backend, "decrypt", [dirPath] {
+        QString pwd;
+        bool ok = dpfSlotChannel->push(kPluginName, "slot_DecryptByTPM", QString(kBenchPin), dirPath, &pwd).toBool();
+        return ok && pwd == kBenchPassword;
+    });
+}
+
+void Benchmark::runPro(const QString &dirPath)
+{
+    const QString backend("pro");
+    measure(backend, "check", [] {
+        return dpfSlotChannel->push(kPluginName, "slot_TPMIsAvailablePro").toInt() == 0;
+    });
+    measure(backend, "random", [] {
+        QString out;
+        return dpfSlotChannel->push(kPluginName, "slot_GetRandomByTPMPro", kRandomSize, &out).toInt() == 0;
+    });
+    measure(backend, "algo", [] {
+        bool support { false };
+        return dpfSlotChannel->push(kPluginName, "slot_IsTPMSupportAlgoPro", QString("sm4"), &support).toInt() == 0;
+    });
+
+    // pin only policy, so the numbers don't depend on the pcr values.
+    const QVariantMap encryptMap {
+        { "PropertyKey_EncryptType", 2 },
+        { "PropertyKey_SessionHashAlgo", "sha256" },
+        { "PropertyKey_SessionKeyAlgo", "aes" },
+        { "PropertyKey_PrimaryHashAlgo", "sha256" },
+        { "PropertyKey_PrimaryKeyAlgo", "rsa" },
+        { "PropertyKey_MinorHashAlgo", "sha256" },
+        { "PropertyKey_MinorKeyAlgo", "aes" },
+        { "PropertyKey_DirPath", dirPath },
+        { "PropertyKey_Plain", kBenchPassword },
+        { "PropertyKey_PinCode", kBenchPin }
+    };
+    const QVariantMap decryptMap {
+        { "PropertyKey_EncryptType", 2 },
+        { "PropertyKey_SessionHashAlgo", "sha256" },
+        { "PropertyKey_SessionKeyAlgo", "aes" },
+        { "PropertyKey_PrimaryHashAlgo", "sha256" },
+        { "PropertyKey_PrimaryKeyAlgo", "rsa" },
+        { "PropertyKey_DirPath", dirPath },
+        { "PropertyKey_PinCode", kBenchPin }
+    };
+    measure(backend, "encrypt", [encryptMap] {
+        return dpfSlotChannel->push(kPluginName, "slot_EncryptByTPMPro", encryptMap).toInt() == 0;
+    });
+    measure(backend, "decrypt", [decryptMap] {
+        QString pwd;
+        int re = dpfSlotChannel->push(kPluginName, "slot_DecryptByTPMPro", decryptMap, &pwd).toInt();
+        return re == 0 && pwd == kBenchPassword;
+    });
+}
+
+void Benchmark::report() const
+{
+    QTextStream out(stdout);
+    out << "TPM vendor: " << vendor() << "\n";
+    out << "iterations: " << iterations << "\n\n";
+    out << QString("%1 %2 %3 %4 %5 %6 %7\n")
+                    .arg("backend", -8)
+                    .arg("operation", -10)
+                    .arg("ok", 6)
+                    .arg("failed", 7)
+                    .arg("p50(ms)", 10)
+                    .arg("p95(ms)", 10)
+                    .arg("p99(ms)", 10);
+
+    for (auto result : results) {
+        std::sort(result.samples.begin(), result.samples.end());
+        out << QString("%1 %2 %3 %4 %5 %6 %7\n")
+                        .arg(result.backend, -8)
+                        .arg(result.operation, -10)
+                        .arg(result.samples.size(), 6)
+                        .arg(result.failed, 7)
+                        .arg(percentile(result.samples, 50), 10, 'f', 2)
+                        .arg(percentile(result.samples, 95), 10, 'f', 2)
+                        .arg(percentile(result.samples, 99), 10, 'f', 2);
+    }
+    out.flush();
+}
+
+double Benchmark::percentile(const QVector<double> &sorted, double p)
+{
+    if (sorted.isEmpty())
+        return 0;
+
+    // nearest rank
+    int rank = static_cast<int>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted.at(qBound(1, rank, sorted.size()) - 1);
+}
+
+QString Benchmark::vendor()
+{
+    // the acpi/device-tree description names the chip, the hid names the vendor.
+    static const QStringList kFiles {
+        "/sys/class/tpm/tpm0/device/description",
+        "/sys/class/tpm/tpm0/device/firmware_node/description",
+        "/sys/class/tpm/tpm0/device/firmware_node/hid",
+        "/sys/class/tpm/tpm0/device/modalias"
+    };
+
+    for (const auto &fileName : kFiles) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        const QString &value = QString::fromUtf8(file.readAll()).trimmed();
+        if (!value.isEmpty())
+            return value;
+    }
+    return "unknown";
+}
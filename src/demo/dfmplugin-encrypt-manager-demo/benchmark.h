@@ -0,0 +1,44 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QString>
+#include <QVector>
+#include <functional>
+
+// runs every tpm operation of the encrypt manager some times against both
+// backends (the tpm library and the tools/esys "Pro" path), then prints the
+// p50/p95/p99 latency of each one.
+class Benchmark
+{
+public:
+    Benchmark(int iterations, const QString &workDir);
+
+    int exec();
+
+private:
+    struct Result
+    {
+        QString backend;
+        QString operation;
+        int failed { 0 };
+        QVector<double> samples;   // ms
+    };
+
+    void measure(const QString &backend, const QString &operation, const std::function<bool()> &func);
+    void runLibrary(const QString &dirPath);
+    void runPro(const QString &dirPath);
+    void report() const;
+
+    static double percentile(const QVector<double> &sorted, double p);
+    static QString vendor();
+
+    int iterations { 0 };
+    QString workDir;
+    QVector<Result> results;
+};
+
+#endif   // BENCHMARK_H
@@ -3,9 +3,11 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "mainwindow.h"
+#include "benchmark.h"
 
 #include <QApplication>
 #include <QDebug>
+#include <QCommandLineParser>
 
 #include <dfm-framework/dpf.h>
 
@@ -35,13 +37,35 @@ int main(int argc, char *argv[])
 {
     qputenv("QT_LOGGING_RULES", "*.info=true");
 
+    // the benchmark runs headless, no display is needed for it.
+    bool headless = false;
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--benchmark") == 0 || qstrncmp(argv[i], "--benchmark=", 12) == 0)
+            headless = true;
+    }
+    if (headless && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
     QApplication a(argc, argv);
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption benchOpt("benchmark", "Run every TPM operation <count> times on both backends and print the latency.", "count");
+    QCommandLineOption dirOpt("dir", "Directory the benchmark keys are sealed into (default: temp dir).", "path");
+    parser.addOption(benchOpt);
+    parser.addOption(dirOpt);
+    parser.process(a);
+
     if (!pluginsLoad()) {
         qCritical() << "Load plugin failed!";
         abort();
     }
 
+    if (parser.isSet(benchOpt)) {
+        Benchmark bench(parser.value(benchOpt).toInt(), parser.value(dirOpt));
+        return bench.exec();
+    }
+
     MainWindow window;
     window.show();
 
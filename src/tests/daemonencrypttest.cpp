@@ -0,0 +1,210 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// tests of the daemon encryption helpers. the luks headers and data devices
+// are plain files, so no root privilege or block device is required.
+
+#include "daemonplugin_file_encrypt_global.h"
+#include "encrypt/diskencrypt.h"
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include <libcryptsetup.h>
+
+#include <cstring>
+
+using namespace daemonplugin_file_encrypt;
+
+static constexpr quint64 kHeaderSize { 16 * 1024 * 1024 };
+static constexpr quint64 kDataSize { 8 * 1024 * 1024 };
+
+class DaemonEncryptTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void emptySecret();
+    void resumeWithEmptyPassphrase();
+    void headerTransactionCommit();
+    void headerTransactionRevert();
+
+private:
+    bool createFile(const QString &path, quint64 size);
+    bool formatHeader(const QString &path);
+    bool unlocks(const QString &path, const char *passphrase);
+
+    QTemporaryDir dir;
+};
+
+bool DaemonEncryptTest::createFile(const QString &path, quint64 size)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly | QIODevice::Truncate) && file.resize(qint64(size));
+}
+
+// a header of the boot stage encryption, with an empty keyslot.
+bool DaemonEncryptTest::formatHeader(const QString &path)
+{
+    if (!createFile(path, kHeaderSize * 2))
+        return false;
+
+    struct crypt_device *cdev { nullptr };
+    if (crypt_init(&cdev, path.toStdString().c_str()) < 0)
+        return false;
+    auto finalClear = qScopeGuard([&] { crypt_free(cdev); });
+
+    struct crypt_pbkdf_type pbkdf = {};
+    pbkdf.type = CRYPT_KDF_PBKDF2;
+    pbkdf.hash = "sha256";
+    pbkdf.iterations = 1000;
+    pbkdf.flags = CRYPT_PBKDF_NO_BENCHMARK;
+    struct crypt_params_luks2 luks2 = {};
+    luks2.pbkdf = &pbkdf;
+    luks2.sector_size = 512;
+    return crypt_format(cdev, CRYPT_LUKS2, "aes", "xts-plain64", nullptr, nullptr, 64, &luks2) == 0
+            && crypt_keyslot_add_by_volume_key(cdev, 0, nullptr, 64, "", 0) == 0
+            && crypt_set_label(cdev, "before", nullptr) == 0;
+}
+
+bool DaemonEncryptTest::unlocks(const QString &path, const char *passphrase)
+{
+    struct crypt_device *cdev { nullptr };
+    if (crypt_init(&cdev, path.toStdString().c_str()) < 0)
+        return false;
+    auto finalClear = qScopeGuard([&] { crypt_free(cdev); });
+    return crypt_load(cdev, CRYPT_LUKS2, nullptr) == 0
+            && crypt_activate_by_passphrase(cdev, nullptr, CRYPT_ANY_SLOT, passphrase, strlen(passphrase), 0) >= 0;
+}
+
+void DaemonEncryptTest::initTestCase()
+{
+    QVERIFY(dir.isValid());
+}
+
+void DaemonEncryptTest::emptySecret()
+{
+    // never null, libcryptsetup takes null as an invalid passphrase.
+    QVERIFY(SecretBuffer().data() != nullptr);
+    QCOMPARE(SecretBuffer().size(), size_t(0));
+    QVERIFY(SecretBuffer(QString()).data() != nullptr);
+    QVERIFY(SecretBuffer(nullptr, 0).data() != nullptr);
+}
+
+void DaemonEncryptTest::resumeWithEmptyPassphrase()
+{
+    // the boot stage encryption leaves a reencryption with an empty keyslot,
+    // which is resumed by the daemon with an empty passphrase.
+    const QString &header = dir.filePath("header.bin");
+    const QString &data = dir.filePath("data.bin");
+    QVERIFY(createFile(header, kHeaderSize));
+    QVERIFY(createFile(data, kDataSize));
+
+    struct crypt_device *cdev { nullptr };
+    QCOMPARE(crypt_init_data_device(&cdev, header.toStdString().c_str(), data.toStdString().c_str()), 0);
+    auto finalClear = qScopeGuard([&] { crypt_free(cdev); });
+
+    struct crypt_pbkdf_type pbkdf = {};
+    pbkdf.type = CRYPT_KDF_PBKDF2;
+    pbkdf.hash = "sha256";
+    pbkdf.iterations = 1000;
+    pbkdf.flags = CRYPT_PBKDF_NO_BENCHMARK;
+    QCOMPARE(crypt_set_pbkdf_type(cdev, &pbkdf), 0);
+
+    struct crypt_params_luks2 luks2 = {};
+    luks2.sector_size = 512;
+    QCOMPARE(crypt_format(cdev, CRYPT_LUKS2, "aes", "xts-plain64", nullptr, nullptr, 64, &luks2), 0);
+    QCOMPARE(crypt_keyslot_add_by_volume_key(cdev, 0, nullptr, 64, "", 0), 0);
+
+    struct crypt_params_luks2 reencLuks2 = {};
+    reencLuks2.sector_size = 512;
+    reencLuks2.pbkdf = &pbkdf;
+    struct crypt_params_reencrypt params = {};
+    params.mode = CRYPT_REENCRYPT_REENCRYPT;
+    params.direction = CRYPT_REENCRYPT_FORWARD;
+    params.resilience = "checksum";
+    params.hash = "sha256";
+    params.luks2 = &reencLuks2;
+    params.flags = CRYPT_REENCRYPT_INITIALIZE_ONLY;
+    if (crypt_reencrypt_init_by_passphrase(cdev, nullptr, "", 0, 0, CRYPT_ANY_SLOT,
+                                           "aes", "xts-plain64", &params) < 0)
+        QSKIP("reencryption cannot be initialized on files here");
+
+    crypt_free(cdev);
+    cdev = nullptr;
+    QCOMPARE(crypt_init_data_device(&cdev, header.toStdString().c_str(), data.toStdString().c_str()), 0);
+    QCOMPARE(crypt_load(cdev, CRYPT_LUKS2, nullptr), 0);
+
+    // the same arguments that bcResumeReencrypt passes for an empty passphrase.
+    const SecretBuffer secret;
+    params = {};
+    params.resilience = "checksum";
+    params.hash = "sha256";
+    params.flags = CRYPT_REENCRYPT_RESUME_ONLY;
+    int ret = crypt_reencrypt_init_by_passphrase(cdev, nullptr, secret.data(), secret.size(),
+                                                 CRYPT_ANY_SLOT, CRYPT_ANY_SLOT, nullptr, nullptr, &params);
+    QVERIFY2(ret >= 0, qPrintable(QString("resume failed: %1").arg(ret)));
+}
+
+void DaemonEncryptTest::headerTransactionCommit()
+{
+    const QString &header = dir.filePath("commit.bin");
+    QVERIFY(formatHeader(header));
+
+    HeaderTransaction trans(header);
+    QCOMPARE(trans.begin(), 0);
+    int keyslot = -1;
+    QCOMPARE(trans.changePassphrase(SecretBuffer(), SecretBuffer(QString("new")), &keyslot), 0);
+    QVERIFY(keyslot > 0);
+    // unlocked by the staged passphrase, as the recovery key is added.
+    int recKeyslot = -1;
+    QCOMPARE(trans.addPassphrase(SecretBuffer(QString("new")), SecretBuffer(QString("recovery")), &recKeyslot), 0);
+    QVERIFY(recKeyslot > keyslot);
+    QCOMPARE(trans.setToken(QString("{ 'type': 'usec-recoverykey', 'keyslots': ['%1'] }").arg(recKeyslot)), 0);
+    QCOMPARE(trans.setLabel("after"), 0);
+    QCOMPARE(trans.commit(), 0);
+
+    QVERIFY(unlocks(header, "new"));
+    QVERIFY(unlocks(header, "recovery"));
+    QVERIFY(!unlocks(header, ""));
+
+    struct crypt_device *cdev { nullptr };
+    QCOMPARE(crypt_init(&cdev, header.toStdString().c_str()), 0);
+    auto finalClear = qScopeGuard([&] { crypt_free(cdev); });
+    QCOMPARE(crypt_load(cdev, CRYPT_LUKS2, nullptr), 0);
+    QCOMPARE(QString(crypt_get_label(cdev)), QString("after"));
+    const char *type { nullptr };
+    QCOMPARE(crypt_token_status(cdev, 0, &type), CRYPT_TOKEN_EXTERNAL_UNKNOWN);
+    QCOMPARE(QString(type), QString("usec-recoverykey"));
+}
+
+void DaemonEncryptTest::headerTransactionRevert()
+{
+    const QString &header = dir.filePath("revert.bin");
+    QVERIFY(formatHeader(header));
+
+    HeaderTransaction trans(header);
+    QCOMPARE(trans.begin(), 0);
+    int keyslot = -1;
+    QCOMPARE(trans.changePassphrase(SecretBuffer(), SecretBuffer(QString("new")), &keyslot), 0);
+    QCOMPARE(trans.setLabel("after"), 0);
+    // out of the token range, fails after the keyslot and label are written.
+    QCOMPARE(trans.setToken(R"({"type":"usec-tpm2","keyslots":[],"token_index":64})"), 0);
+    QVERIFY(trans.commit() < 0);
+
+    QVERIFY(unlocks(header, ""));
+    QVERIFY(!unlocks(header, "new"));
+
+    struct crypt_device *cdev { nullptr };
+    QCOMPARE(crypt_init(&cdev, header.toStdString().c_str()), 0);
+    auto finalClear = qScopeGuard([&] { crypt_free(cdev); });
+    QCOMPARE(crypt_load(cdev, CRYPT_LUKS2, nullptr), 0);
+    QCOMPARE(QString(crypt_get_label(cdev)), QString("before"));
+}
+
+QTEST_GUILESS_MAIN(DaemonEncryptTest)
+
+#include "daemonencrypttest.moc"